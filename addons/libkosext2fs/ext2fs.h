@@ -52,19 +52,23 @@ __BEGIN_DECLS
 
 /* End tunable filesystem parameters. */
 
-/* Convenience stuff, for in case you want to use this outside of KOS. */
+/* Convenience stuff, for in case you want to use this outside of KOS. This has
+   to match the real thing, since the block cache from KOS is used either way
+   (see Makefile.nonkos). */
 #ifdef EXT2_NOT_IN_KOS
+#define __KOS_BLOCKDEV_H
 
 typedef struct kos_blockdev {
     void *dev_data;
     uint32_t l_block_size;
     int (*init)(struct kos_blockdev *d);
     int (*shutdown)(struct kos_blockdev *d);
-    int (*read_blocks)(struct kos_blockdev *d, uint32_t block, size_t count,
+    int (*read_blocks)(struct kos_blockdev *d, uint64_t block, size_t count,
                        void *buf);
-    int (*write_blocks)(struct kos_blockdev *d, uint32_t block, size_t count,
+    int (*write_blocks)(struct kos_blockdev *d, uint64_t block, size_t count,
                         const void *buf);
-    uint32_t (*count_blocks)(struct kos_blockdev *d);
+    uint64_t (*count_blocks)(struct kos_blockdev *d);
+    int (*flush)(struct kos_blockdev *d);
 } kos_blockdev_t;
 
 #ifndef SYMLOOP_MAX
@@ -7,24 +7,15 @@
 #include "block.h"
 #include "superblock.h"
 
-#ifndef EXT2_NOT_IN_KOS
-#include <kos/blockdev.h>
-#else
+#ifdef EXT2_NOT_IN_KOS
 #include "ext2fs.h"
 #endif
 
+#include <kos/blockcache.h>
+
 #ifndef __EXT2_EXT2INTERNAL_H
 #define __EXT2_EXT2INTERNAL_H
 
-#define EXT2_CACHE_FLAG_VALID   1
-#define EXT2_CACHE_FLAG_DIRTY   2
-
-typedef struct ext2_cache {
-    uint32_t flags;
-    uint32_t block;
-    uint8_t *data;
-} ext2_cache_t;
-
 struct ext2fs_struct {
     kos_blockdev_t *dev;
     ext2_superblock_t sb;
@@ -33,8 +24,7 @@ struct ext2fs_struct {
     uint32_t bg_count;
     ext2_bg_desc_t *bg;
 
-    ext2_cache_t **bcache;
-    int cache_size;
+    blockcache_t *bcache;
 
     uint32_t flags;
     uint32_t mnt_flags;
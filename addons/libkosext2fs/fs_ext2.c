@@ -241,7 +241,9 @@ static int fs_ext2_close(void *h) {
     return 0;
 }
 
-static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
+/* Read from the file position, which moves along. Called with ext2_mutex held,
+   as is int_write(). */
+static ssize_t int_read(void *h, void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
     ext2_fs_t *fs;
     uint32_t bs, lbs, bo;
@@ -251,11 +253,8 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     uint64_t sz;
     int mode;
 
-    mutex_lock(&ext2_mutex);
-
     /* Check that the fd is valid */
     if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
-        mutex_unlock(&ext2_mutex);
         errno = EBADF;
         return -1;
     }
@@ -263,20 +262,21 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     /* Make sure the fd is open for reading */
     mode = fh[fd].mode & O_MODE_MASK;
     if(mode != O_RDONLY && mode != O_RDWR) {
-        mutex_unlock(&ext2_mutex);
         errno = EBADF;
         return -1;
     }
 
     /* Make sure we're not trying to read a directory with read */
     if(fh[fd].mode & O_DIR) {
-        mutex_unlock(&ext2_mutex);
         errno = EISDIR;
         return -1;
     }
 
-    /* Do we have enough left? */
+    /* Did we hit the end of the file? Do we have enough left? */
     sz = ext2_inode_size(fh[fd].inode);
+    if(fh[fd].ptr >= sz)
+        return 0;
+
     if((fh[fd].ptr + cnt) > sz)
         cnt = sz - fh[fd].ptr;
 
@@ -290,7 +290,6 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     if(bo) {
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                            NULL, &errno))) {
-            mutex_unlock(&ext2_mutex);
             return -1;
         }
 
@@ -311,7 +310,6 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     while(cnt) {
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                            NULL, &errno))) {
-            mutex_unlock(&ext2_mutex);
             return -1;
         }
 
@@ -329,11 +327,10 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     }
 
     /* We're done, clean up and return. */
-    mutex_unlock(&ext2_mutex);
     return rv;
 }
 
-static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
+static ssize_t int_write(void *h, const void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
     ext2_fs_t *fs;
     uint32_t bs, lbs, bo, bn;
@@ -343,11 +340,8 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     uint64_t sz;
     int err, mode;
 
-    mutex_lock(&ext2_mutex);
-
     /* Check that the fd is valid */
     if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
-        mutex_unlock(&ext2_mutex);
         errno = EBADF;
         return -1;
     }
@@ -355,7 +349,6 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     /* Make sure the fd is open for writing */
     mode = fh[fd].mode & O_MODE_MASK;
     if(mode != O_WRONLY && mode != O_RDWR) {
-        mutex_unlock(&ext2_mutex);
         errno = EBADF;
         return -1;
     }
@@ -379,7 +372,6 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
             if(!(block = ext2_inode_read_block(fs, fh[fd].inode,
                                                (fh[fd].ptr - 1) >> lbs, &bn,
                                                &errno))) {
-                mutex_unlock(&ext2_mutex);
                 return -1;
             }
 
@@ -393,7 +385,6 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
                 if(!(block = ext2_inode_read_block(fs, fh[fd].inode,
                                                    (sz - 1) >> lbs,
                                                    &bn, &errno))) {
-                    mutex_unlock(&ext2_mutex);
                     return -1;
                 }
 
@@ -407,7 +398,6 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
             while(sz < fh[fd].ptr) {
                 if(!(block = ext2_inode_alloc_block(fs, fh[fd].inode,
                                                     sz >> lbs, &errno))) {
-                    mutex_unlock(&ext2_mutex);
                     return -1;
                 }
 
@@ -423,7 +413,6 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     if((bo = fh[fd].ptr & ((1 << lbs) - 1))) {
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                            &bn, &errno))) {
-            mutex_unlock(&ext2_mutex);
             return -1;
         }
 
@@ -447,20 +436,20 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                            &bn, &err))) {
             if(err != EINVAL) {
-                mutex_unlock(&ext2_mutex);
                 errno = err;
                 return -1;
             }
 
-            if(!(block = ext2_inode_alloc_block(fs, fh[fd].inode,
-                                                fh[fd].ptr >> lbs, &errno))) {
-                mutex_unlock(&ext2_mutex);
+            /* Allocate the block, and then look it up again to find out
+               where it ended up. */
+            if(!ext2_inode_alloc_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
+                                       &errno) ||
+               !(block = ext2_inode_read_block(fs, fh[fd].inode,
+                                               fh[fd].ptr >> lbs, &bn,
+                                               &errno))) {
                 return -1;
             }
         }
-        else {
-            ext2_block_mark_dirty(fs, bn);
-        }
 
         if(cnt > bs) {
             memcpy(block, bbuf, bs);
@@ -473,6 +462,10 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
             fh[fd].ptr += cnt;
             cnt = 0;
         }
+
+        /* Only mark it dirty once it's been written to, so that a write-back
+           in the middle can't leave it clean. */
+        ext2_block_mark_dirty(fs, bn);
     }
 
     /* Update the file's size and modification time. */
@@ -482,6 +475,70 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
     fh[fd].inode->i_mtime = time(NULL);
     ext2_inode_mark_dirty(fh[fd].inode);
 
+    return rv;
+}
+
+static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
+    ssize_t rv;
+
+    mutex_lock(&ext2_mutex);
+    rv = int_read(h, buf, cnt);
+    mutex_unlock(&ext2_mutex);
+    return rv;
+}
+
+static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
+    ssize_t rv;
+
+    mutex_lock(&ext2_mutex);
+    rv = int_write(h, buf, cnt);
+    mutex_unlock(&ext2_mutex);
+    return rv;
+}
+
+/* Read or write at an offset, leaving the file position where it was. This all
+   happens under the lock, so nobody else sees the position move. */
+static ssize_t fs_ext2_pread(void *h, void *buf, size_t cnt, _off64_t offset) {
+    file_t fd = ((file_t)h) - 1;
+    uint64_t ptr;
+    ssize_t rv;
+
+    mutex_lock(&ext2_mutex);
+
+    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
+        mutex_unlock(&ext2_mutex);
+        errno = EBADF;
+        return -1;
+    }
+
+    ptr = fh[fd].ptr;
+    fh[fd].ptr = offset;
+    rv = int_read(h, buf, cnt);
+    fh[fd].ptr = ptr;
+
+    mutex_unlock(&ext2_mutex);
+    return rv;
+}
+
+static ssize_t fs_ext2_pwrite(void *h, const void *buf, size_t cnt,
+                              _off64_t offset) {
+    file_t fd = ((file_t)h) - 1;
+    uint64_t ptr;
+    ssize_t rv;
+
+    mutex_lock(&ext2_mutex);
+
+    if(fd >= MAX_EXT2_FILES || !fh[fd].inode_num) {
+        mutex_unlock(&ext2_mutex);
+        errno = EBADF;
+        return -1;
+    }
+
+    ptr = fh[fd].ptr;
+    fh[fd].ptr = offset;
+    rv = int_write(h, buf, cnt);
+    fh[fd].ptr = ptr;
+
     mutex_unlock(&ext2_mutex);
     return rv;
 }
@@ -1921,7 +1978,9 @@ static vfs_handler_t vh = {
     fs_ext2_total64,            /* total64 */
     fs_ext2_readlink,           /* readlink */
     fs_ext2_rewinddir,          /* rewinddir */
-    fs_ext2_fstat               /* fstat */
+    fs_ext2_fstat,              /* fstat */
+    fs_ext2_pread,              /* pread */
+    fs_ext2_pwrite              /* pwrite */
 };
 
 static int initted = 0;
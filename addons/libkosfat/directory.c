@@ -624,7 +624,7 @@ int fat_erase_dentry(fat_fs_t *fs, uint32_t cl, uint32_t off, uint32_t lcl,
     fat_dentry_t *ent;
     uint8_t *buf;
     uint32_t max, max2, i;
-    int done = 0, err;
+    int done = 0, err, rv = 0;
 
     /* Read the cluster/block where the short name lives. */
     if(!(buf = fat_cluster_read(fs, cl, &err))) {
@@ -667,9 +667,6 @@ int fat_erase_dentry(fat_fs_t *fs, uint32_t cl, uint32_t off, uint32_t lcl,
                 return -EIO;
             }
 
-            /* Just go ahead and do this now to save us the trouble later... */
-            fat_cluster_mark_dirty(fs, lcl);
-
             for(; i < max; ++i) {
                 ent = (fat_dentry_t *)(buf + (i << 5));
 
@@ -679,7 +676,8 @@ int fat_erase_dentry(fat_fs_t *fs, uint32_t cl, uint32_t off, uint32_t lcl,
                     dbglog(DBG_ERROR, "End of directory hit while reading long "
                            "name entry for deletion at cluster %" PRIu32
                            ", offset %" PRIu32 "\n", lcl, i << 5);
-                    return -EIO;
+                    rv = -EIO;
+                    break;
                 }
                 /* If name[0] == 0xE5, then this entry is empty. We previously
                    marked the short name entry (which should be right after the
@@ -695,13 +693,21 @@ int fat_erase_dentry(fat_fs_t *fs, uint32_t cl, uint32_t off, uint32_t lcl,
                     dbglog(DBG_ERROR, "Invalid dentry hit while reading long "
                            "name entry for deletion at cluster %" PRIu32
                            ", offset %" PRIu32 "\n", lcl, i << 5);
-                    return -EIO;
+                    rv = -EIO;
+                    break;
                 }
 
                 /* Mark the entry as empty and move on... */
                 ent->name[0] = FAT_ENTRY_FREE;
             }
 
+            /* Only mark the block dirty once it's been changed, so that a
+               write-back can't catch it half done and leave it clean. */
+            fat_cluster_mark_dirty(fs, lcl);
+
+            if(rv)
+                return rv;
+
 	    if(!done) {
                 /* Move onto the next cluster. */
                 if(!(lcl & 0x80000000)) {
@@ -1217,9 +1223,6 @@ int fat_add_long_entry(fat_fs_t *fs, char sn[11], uint32_t dents,
             return -EIO;
         }
 
-        /* Save some trouble later... */
-        fat_cluster_mark_dirty(fs, rlcl);
-
         /* Start building the long name directory entries from the end of the
            name to the start... */
         for(i = rloff; i < max && j; i += 32, --j, pos -= 13) {
@@ -1252,6 +1255,9 @@ int fat_add_long_entry(fat_fs_t *fs, char sn[11], uint32_t dents,
             *roff = i;
         }
 
+        /* Now that this block/cluster is filled in, it can be written. */
+        fat_cluster_mark_dirty(fs, rlcl);
+
         if(!done && !(rlcl & 0x80000000)) {
             old = rlcl;
             rlcl = fat_read_fat(fs, old, &err);
@@ -16,111 +16,52 @@
 #include "bpb.h"
 #include "fatinternal.h"
 
-/* This is basically the same as bgrad_cache from fs_iso9660 */
-static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
-    int i;
-    fat_cache_t *tmp;
-
-    /* Don't try it with the end block */
-    if(block < 0 || block >= fs->cache_size - 1)
-        return;
-
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
-
-    for(i = block; i < fs->cache_size - 1; ++i) {
-        cache[i] = cache[i + 1];
+/* Figure out which cache a cluster goes in, and the first block of the device
+   that it's on. Raw blocks of the FAT12/FAT16 root directory have the top bit
+   set, and go in a cache of their own, since they're smaller than clusters. */
+static blockcache_t *cluster_cache(fat_fs_t *fs, uint32_t cl, uint64_t *bn) {
+    if(cl & 0x80000000 && fs->sb.fs_type != FAT_FS_FAT32) {
+        *bn = cl & 0x7FFFFFFF;
+        return fs->rcache;
     }
 
-    cache[fs->cache_size - 1] = tmp;
+    if(fs->sb.num_clusters + 2 <= cl || cl < 2)
+        return NULL;
+
+    *bn = (uint64_t)(cl - 2) * fs->sb.sectors_per_cluster +
+        fs->sb.first_data_block;
+    return fs->bcache;
 }
 
-/* XXXX: This needs locking! */
 uint8_t *fat_cluster_read(fat_fs_t *fs, uint32_t cl, int *err) {
-    int i;
-    uint8_t *rv;
-    fat_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == cl && cache[i]->flags) {
-            rv = cache[i]->data;
-            make_mru(fs, cache, i);
-            goto out;
-        }
-    }
+    blockcache_t *cache;
+    uint64_t bn;
 
-    /* If we didn't get anything, did we end up with an invalid entry or do we
-       need to boot someone out? */
-    if(i < 0) {
-        i = 0;
-
-        /* Make sure that if the block is dirty, we write it back out. */
-        if(cache[0]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if(fat_cluster_write_nc(fs, cache[0]->block, cache[0]->data)) {
-                /* XXXX: Uh oh... */
-                *err = EIO;
-                return NULL;
-            }
-        }
-    }
-
-    /* Try to read the block in question. */
-    if(fat_cluster_read_nc(fs, cl, cache[i]->data)) {
+    if(!(cache = cluster_cache(fs, cl, &bn))) {
         *err = EIO;
-        cache[i]->flags = 0;            /* Mark it as invalid... */
         return NULL;
     }
 
-    cache[i]->block = cl;
-    cache[i]->flags = FAT_CACHE_FLAG_VALID;
-    rv = cache[i]->data;
-    make_mru(fs, cache, i);
-
-out:
-    return rv;
+    return blockcache_get(cache, bn, 0, err);
 }
 
 uint8_t *fat_cluster_clear(fat_fs_t *fs, uint32_t cl, int *err) {
-    int i;
+    blockcache_t *cache;
+    uint64_t bn;
     uint8_t *rv;
-    fat_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == cl && cache[i]->flags) {
-            rv = cache[i]->data;
-            make_mru(fs, cache, i);
-            goto out;
-        }
-    }
 
-    /* If we didn't get anything, did we end up with an invalid entry or do we
-       need to boot someone out? */
-    if(i < 0) {
-        i = 0;
-
-        /* Make sure that if the block is dirty, we write it back out. */
-        if(cache[0]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if(fat_cluster_write_nc(fs, cache[0]->block, cache[0]->data)) {
-                /* XXXX: Uh oh... */
-                *err = EIO;
-                return NULL;
-            }
-        }
+    if(!(cache = cluster_cache(fs, cl, &bn))) {
+        *err = EIO;
+        return NULL;
     }
 
     /* Don't bother reading the cluster from disk, since we're erasing it
        anyway... */
-    cache[i]->block = cl;
-    cache[i]->flags = FAT_CACHE_FLAG_VALID | FAT_CACHE_FLAG_DIRTY;
-    rv = cache[i]->data;
-    make_mru(fs, cache, i);
+    if(!(rv = blockcache_get(cache, bn, BLOCKCACHE_NOREAD, err)))
+        return NULL;
 
-out:
-    memset(rv, 0, fs->sb.bytes_per_sector * fs->sb.sectors_per_cluster);
+    memset(rv, 0, blockcache_entry_size(cache));
+    blockcache_mark_dirty(cache, bn);
     return rv;
 }
 
@@ -181,39 +122,26 @@ int fat_cluster_write_nc(fat_fs_t *fs, uint32_t cluster, const uint8_t *blk) {
 }
 
 int fat_cluster_mark_dirty(fat_fs_t *fs, uint32_t cluster) {
-    int i;
-    fat_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == cluster && cache[i]->flags) {
-            cache[i]->flags |= FAT_CACHE_FLAG_DIRTY;
-            make_mru(fs, cache, i);
-            return 0;
-        }
-    }
+    blockcache_t *cache;
+    uint64_t bn;
 
-    return -EINVAL;
+    if(!(cache = cluster_cache(fs, cluster, &bn)) ||
+       blockcache_mark_dirty(cache, bn))
+        return -EINVAL;
+
+    return 0;
 }
 
 int fat_cluster_cache_wb(fat_fs_t *fs) {
-    int i, err;
-    fat_cache_t **cache = fs->bcache;
-
     /* Don't even bother if we're mounted read-only. */
     if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
         return 0;
 
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->flags & FAT_CACHE_FLAG_DIRTY) {
-            if((err = fat_cluster_write_nc(fs, cache[i]->block,
-                                           cache[i]->data)))
-                return err;
+    if(blockcache_sync(fs->bcache))
+        return -EIO;
 
-            cache[i]->flags &= ~FAT_CACHE_FLAG_DIRTY;
-        }
-    }
+    if(fs->rcache && blockcache_sync(fs->rcache))
+        return -EIO;
 
     return 0;
 }
@@ -265,14 +193,13 @@ fat_fs_t *fat_fs_init(kos_blockdev_t *bd, uint32_t flags) {
 fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
                          int fcache_sz) {
     fat_fs_t *rv;
-    int j;
-    int block_size, cluster_size;
+    uint32_t block_size, cluster_size, cflags;
 
     if(bd->init(bd)) {
         return NULL;
     }
 
-    if(!(rv = (fat_fs_t *)malloc(sizeof(fat_fs_t)))) {
+    if(!(rv = (fat_fs_t *)calloc(1, sizeof(fat_fs_t)))) {
         bd->shutdown(bd);
         return NULL;
     }
@@ -300,80 +227,31 @@ fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
 
     block_size = rv->sb.bytes_per_sector;
     cluster_size = rv->sb.bytes_per_sector * rv->sb.sectors_per_cluster;
+    cflags = (rv->mnt_flags & FAT_MNT_FLAG_RW) ? BLOCKCACHE_WRITEBACK : 0;
 
-    /* Make space for the block cache. */
-    if(!(rv->bcache = (fat_cache_t **)malloc(sizeof(fat_cache_t *) *
-                                             cache_sz))) {
-        free(rv);
-        bd->shutdown(bd);
-        return NULL;
-    }
-
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j] = (fat_cache_t *)malloc(sizeof(fat_cache_t)))) {
-            goto out_cache;
-        }
-    }
-
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j]->data = (uint8_t *)memalign(32, cluster_size))) {
-            goto out_bcache;
-        }
+    /* Make space for the block cache, and for the FAT12/FAT16 root directory,
+       which is small enough to keep all of. */
+    if(!(rv->bcache = blockcache_create(bd, rv->sb.sectors_per_cluster,
+                                        cache_sz * cluster_size, cflags)))
+        goto out_cache;
 
-        rv->bcache[j]->flags = 0;
-    }
-
-    rv->cache_size = cache_sz;
+    if(rv->sb.fs_type != FAT_FS_FAT32 &&
+       !(rv->rcache = blockcache_create(bd, 1, rv->sb.root_dir * 32, cflags)))
+        goto out_cache;
 
     /* Make space for the FAT block cache. */
-    if(!(rv->fcache = (fat_cache_t **)malloc(sizeof(fat_cache_t *) *
-                                             fcache_sz))) {
-        goto out_bcache;
-    }
+    if(!(rv->fcache = blockcache_create(bd, 1, fcache_sz * block_size, cflags)))
+        goto out_cache;
 
-    for(j = 0; j < fcache_sz; ++j) {
-        if(!(rv->fcache[j] = (fat_cache_t *)malloc(sizeof(fat_cache_t)))) {
-            goto out_fcache;
-        }
-    }
-
-    for(j = 0; j < fcache_sz; ++j) {
-        if(!(rv->fcache[j]->data = (uint8_t *)memalign(32, block_size))) {
-            goto out_fcache2;
-        }
-
-        rv->fcache[j]->flags = 0;
-    }
-
-    rv->fcache_size = fcache_sz;
     return rv;
 
-out_fcache2:
-    for(; j >= 0; --j) {
-        free(rv->fcache[j]->data);
-    }
-
-    j = fcache_sz - 1;
-
-out_fcache:
-    for(; j >= 0; --j) {
-        free(rv->fcache[j]);
-    }
-
-    free(rv->fcache);
-
-out_bcache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]->data);
-    }
-
-    j = cache_sz - 1;
 out_cache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]);
-    }
+    if(rv->rcache)
+        blockcache_destroy(rv->rcache);
+
+    if(rv->bcache)
+        blockcache_destroy(rv->bcache);
 
-    free(rv->bcache);
     free(rv);
     bd->shutdown(bd);
     return NULL;
@@ -415,22 +293,14 @@ int fat_fs_sync(fat_fs_t *fs) {
 }
 
 void fat_fs_shutdown(fat_fs_t *fs) {
-    int i;
-
     /* Sync the filesystem back to the block device, if needed. */
     fat_fs_sync(fs);
 
-    for(i = 0; i < fs->cache_size; ++i) {
-        free(fs->bcache[i]->data);
-        free(fs->bcache[i]);
-    }
-
-    free(fs->bcache);
+    blockcache_destroy(fs->bcache);
+    blockcache_destroy(fs->fcache);
 
-    for(i = 0; i < fs->fcache_size; ++i) {
-        free(fs->fcache[i]->data);
-        free(fs->fcache[i]);
-    }
+    if(fs->rcache)
+        blockcache_destroy(fs->rcache);
 
     fs->dev->shutdown(fs->dev);
     free(fs);
@@ -367,7 +367,9 @@ static int fs_fat_close(void *h) {
     return rv;
 }
 
-static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
+/* Read from the file position, which moves along. Called with fat_mutex held,
+   as is int_write(). */
+static ssize_t int_read(void *h, void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
     fat_fs_t *fs;
     uint32_t bs, bo;
@@ -377,11 +379,8 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     uint64_t sz, cl;
     int mode;
 
-    mutex_lock(&fat_mutex);
-
     /* Check that the fd is valid */
     if(fd >= MAX_FAT_FILES || !fh[fd].opened) {
-        mutex_unlock(&fat_mutex);
         errno = EBADF;
         return -1;
     }
@@ -391,14 +390,12 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     /* Make sure the fd is open for reading */
     mode = fh[fd].mode & O_MODE_MASK;
     if(mode != O_RDONLY && mode != O_RDWR) {
-        mutex_unlock(&fat_mutex);
         errno = EBADF;
         return -1;
     }
 
     /* Make sure we're not trying to read a directory with read */
     if(fh[fd].mode & O_DIR) {
-        mutex_unlock(&fat_mutex);
         errno = EISDIR;
         return -1;
     }
@@ -407,7 +404,6 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     sz = fh[fd].dentry.size;
 
     if(fat_is_eof(fs, fh[fd].cluster) || fh[fd].ptr >= sz) {
-        mutex_unlock(&fat_mutex);
         return 0;
     }
 
@@ -424,11 +420,9 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
         mode = advance_cluster(fs, fd, fh[fd].ptr / bs, 0);
 
         if(mode == -EDOM) {
-            mutex_unlock(&fat_mutex);
             return 0;
         }
         else if(mode < 0) {
-            mutex_unlock(&fat_mutex);
             errno = -mode;
             return -1;
         }
@@ -437,7 +431,6 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     /* Handle the first block specially if we are offset within it. */
     if(bo) {
         if(!(block = fat_cluster_read(fs, fh[fd].cluster, &errno))) {
-            mutex_unlock(&fat_mutex);
             return -1;
         }
 
@@ -450,11 +443,9 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
             cl = fat_read_fat(fs, fh[fd].cluster, &errno);
 
             if(cl == FAT_INVALID_CLUSTER) {
-                mutex_unlock(&fat_mutex);
                 return -1;
             }
             else if(fat_is_eof(fs, cl)) {
-                mutex_unlock(&fat_mutex);
                 errno = EIO;
                 return -1;
             }
@@ -471,7 +462,6 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
                 cl = fat_read_fat(fs, fh[fd].cluster, &errno);
 
                 if(cl == FAT_INVALID_CLUSTER) {
-                    mutex_unlock(&fat_mutex);
                     return -1;
                 }
 
@@ -486,7 +476,6 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     /* While we still have more to read, do it. */
     while(cnt) {
         if(!(block = fat_cluster_read(fs, fh[fd].cluster, &errno))) {
-            mutex_unlock(&fat_mutex);
             return -1;
         }
 
@@ -499,11 +488,9 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
             cl = fat_read_fat(fs, fh[fd].cluster, &errno);
 
             if(cl == FAT_INVALID_CLUSTER) {
-                mutex_unlock(&fat_mutex);
                 return -1;
             }
             else if(fat_is_eof(fs, cl)) {
-                mutex_unlock(&fat_mutex);
                 errno = EIO;
                 return -1;
             }
@@ -520,7 +507,6 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
                 cl = fat_read_fat(fs, fh[fd].cluster, &errno);
 
                 if(cl == FAT_INVALID_CLUSTER) {
-                    mutex_unlock(&fat_mutex);
                     return -1;
                 }
 
@@ -533,11 +519,10 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     }
 
     /* We're done, clean up and return. */
-    mutex_unlock(&fat_mutex);
     return rv;
 }
 
-static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
+static ssize_t int_write(void *h, const void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
     fat_fs_t *fs;
     uint32_t bs, bo;
@@ -546,11 +531,8 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     ssize_t rv;
     int mode, err;
 
-    mutex_lock(&fat_mutex);
-
     /* Check that the fd is valid */
     if(fd >= MAX_FAT_FILES || !fh[fd].opened) {
-        mutex_unlock(&fat_mutex);
         errno = EBADF;
         return -1;
     }
@@ -558,13 +540,11 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     /* Make sure the fd is open for reading */
     mode = fh[fd].mode & O_MODE_MASK;
     if(mode != O_WRONLY && mode != O_RDWR) {
-        mutex_unlock(&fat_mutex);
         errno = EBADF;
         return -1;
     }
 
     if(!cnt) {
-        mutex_unlock(&fat_mutex);
         return 0;
     }
 
@@ -577,7 +557,6 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
        a cluster boundary)? */
     if((fh[fd].mode & 0x80000000)) {
         if((err = advance_cluster(fs, fd, fh[fd].ptr / bs, 1)) < 0) {
-            mutex_unlock(&fat_mutex);
             errno = -err;
             return -1;
         }
@@ -586,7 +565,6 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     /* Are we starting our write in the middle of a block? */
     if(bo) {
         if(!(block = fat_cluster_read(fs, fh[fd].cluster, &err))) {
-            mutex_unlock(&fat_mutex);
             errno = err;
             return -1;
         }
@@ -602,7 +580,6 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
 
             if((err = advance_cluster(fs, fd, fh[fd].cluster_order + 1,
                                       1)) < 0) {
-                mutex_unlock(&fat_mutex);
                 errno = -err;
                 return -1;
             }
@@ -624,7 +601,6 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     /* While we still have more to write, do it. */
     while(cnt) {
         if(!(block = fat_cluster_read(fs, fh[fd].cluster, &err))) {
-            mutex_unlock(&fat_mutex);
             errno = err;
             return -1;
         }
@@ -639,7 +615,6 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
 
             if((err = advance_cluster(fs, fd, fh[fd].cluster_order + 1,
                                       1)) < 0) {
-                mutex_unlock(&fat_mutex);
                 errno = -err;
                 return -1;
             }
@@ -675,6 +650,76 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     fat_update_mtime(&fh[fd].dentry);
 
     /* We're done, clean up and return. */
+    return rv;
+}
+
+static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
+    ssize_t rv;
+
+    mutex_lock(&fat_mutex);
+    rv = int_read(h, buf, cnt);
+    mutex_unlock(&fat_mutex);
+    return rv;
+}
+
+static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
+    ssize_t rv;
+
+    mutex_lock(&fat_mutex);
+    rv = int_write(h, buf, cnt);
+    mutex_unlock(&fat_mutex);
+    return rv;
+}
+
+/* Read or write at an offset, leaving the file position where it was. This all
+   happens under the lock, so nobody else sees the position move. Both moves
+   count as a seek, so that the cluster gets looked up again from the
+   position. */
+static ssize_t fs_fat_pread(void *h, void *buf, size_t cnt, _off64_t offset) {
+    file_t fd = ((file_t)h) - 1;
+    uint32_t ptr;
+    ssize_t rv;
+
+    mutex_lock(&fat_mutex);
+
+    if(fd >= MAX_FAT_FILES || !fh[fd].opened) {
+        mutex_unlock(&fat_mutex);
+        errno = EBADF;
+        return -1;
+    }
+
+    ptr = fh[fd].ptr;
+    fh[fd].ptr = offset;
+    fh[fd].mode |= 0x80000000;
+    rv = int_read(h, buf, cnt);
+    fh[fd].ptr = ptr;
+    fh[fd].mode |= 0x80000000;
+
+    mutex_unlock(&fat_mutex);
+    return rv;
+}
+
+static ssize_t fs_fat_pwrite(void *h, const void *buf, size_t cnt,
+                             _off64_t offset) {
+    file_t fd = ((file_t)h) - 1;
+    uint32_t ptr;
+    ssize_t rv;
+
+    mutex_lock(&fat_mutex);
+
+    if(fd >= MAX_FAT_FILES || !fh[fd].opened) {
+        mutex_unlock(&fat_mutex);
+        errno = EBADF;
+        return -1;
+    }
+
+    ptr = fh[fd].ptr;
+    fh[fd].ptr = offset;
+    fh[fd].mode |= 0x80000000;
+    rv = int_write(h, buf, cnt);
+    fh[fd].ptr = ptr;
+    fh[fd].mode |= 0x80000000;
+
     mutex_unlock(&fat_mutex);
     return rv;
 }
@@ -1120,8 +1165,9 @@ static int fs_fat_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
 
 static int fs_fat_mkdir(vfs_handler_t *vfs, const char *fn) {
     fs_fat_fs_t *fs = (fs_fat_fs_t *)vfs->privdata;
+    fat_dentry_t ent;
     int err;
-    uint32_t cl, off, lcl, loff, cl2 = 0;
+    uint32_t cl, off, lcl, loff, cl2 = 0, ncl;
     uint8_t *buf = NULL;
 
     mutex_lock(&fat_mutex);
@@ -1140,11 +1186,27 @@ static int fs_fat_mkdir(vfs_handler_t *vfs, const char *fn) {
         return -1;
     }
 
-    /* Add entries for "." and ".." */
+    /* Add entries for "." and "..". Adding the new directory's dentry may have
+       thrown its cluster out of the cache, so look it up again. */
+    if((err = fat_get_dentry(fs->fs, cl, off, &ent)) < 0) {
+        mutex_unlock(&fat_mutex);
+        errno = -err;
+        return -1;
+    }
+
+    ncl = ent.cluster_low | (ent.cluster_high << 16);
+
+    if(!(buf = fat_cluster_read(fs->fs, ncl, &err))) {
+        mutex_unlock(&fat_mutex);
+        errno = err;
+        return -1;
+    }
+
     fat_add_raw_dentry((fat_dentry_t *)buf, ".          ", FAT_ATTR_DIRECTORY,
-                       cl);
+                       ncl);
     fat_add_raw_dentry((fat_dentry_t *)(buf + sizeof(fat_dentry_t)),
                        "..         ", FAT_ATTR_DIRECTORY, cl2);
+    fat_cluster_mark_dirty(fs->fs, ncl);
 
     /* And we're done... Clean up. */
     mutex_unlock(&fat_mutex);
@@ -1349,7 +1411,9 @@ static vfs_handler_t vh = {
     fs_fat_total64,             /* total64 */
     NULL,                       /* readlink */
     fs_fat_rewinddir,           /* rewinddir */
-    fs_fat_fstat                /* fstat */
+    fs_fat_fstat,               /* fstat */
+    fs_fat_pread,               /* pread */
+    fs_fat_pwrite               /* pwrite */
 };
 
 static int initted = 0;
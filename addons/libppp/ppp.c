@@ -640,7 +640,8 @@ static netif_t ppp_if = {
     &ppp_if_dummy,              /* tx_commit */
     &ppp_if_dummy,              /* rx_poll */
     &ppp_if_set_flags,          /* set_flags */
-    &ppp_if_set_mc              /* set_mc */
+    &ppp_if_set_mc,             /* set_mc */
+    NULL                        /* tx_pbuf */
 };
 
 int ppp_init(void) {
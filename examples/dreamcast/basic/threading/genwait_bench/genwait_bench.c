@@ -0,0 +1,181 @@
+/* KallistiOS ##version##
+
+   genwait_bench.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* This program measures the cost of the genwait timeout queue, which backs
+   every timed wait in KOS (thd_sleep(), sem_wait_timed(), cond_wait_timed(),
+   mutex_lock_timed(), etc). For 10, 100 and 1000 threads parked in timed waits
+   it measures:
+
+     - insert: a timed semaphore ping-pong between two threads, minus the same
+       ping-pong done with untimed waits. Each round trip inserts two threads
+       into the timeout queue ahead of all of the parked waiters and then
+       cancels them again.
+     - expire: the time it takes to time out a batch of waiters which all share
+       the same deadline, per waiter (this includes switching to each one).
+     - cancel: the time it takes to wake the parked waiters early, per waiter.
+       The woken threads don't get to run until the measurement is done.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <kos/thread.h>
+#include <kos/sem.h>
+
+#include <arch/timer.h>
+
+#define ITERATIONS      1000
+#define EXPIRE_TIMEOUT  100
+#define PARK_TIMEOUT    60000
+#define STACK_SIZE      4096
+
+static semaphore_t park = SEM_INITIALIZER(0);
+static semaphore_t never = SEM_INITIALIZER(0);
+static semaphore_t ping = SEM_INITIALIZER(0);
+static semaphore_t pong = SEM_INITIALIZER(0);
+
+static volatile uint64_t first_wake, last_wake;
+static volatile int timed;
+
+static kthread_t *spawn(void *(*routine)(void *), void *param) {
+    const kthread_attr_t attr = {
+        .stack_size = STACK_SIZE,
+        .label = "bench"
+    };
+
+    return thd_create_ex(&attr, routine, param);
+}
+
+/* Parked in a timed wait until cancelled by the main thread. Deadlines are
+   staggered and all later than anything the measurements insert. */
+static void *parked_thd(void *param) {
+    sem_wait_timed(&park, PARK_TIMEOUT + (int)param);
+    return NULL;
+}
+
+/* Times out with a deadline shared by the whole batch. */
+static void *expire_thd(void *param) {
+    uint64_t now;
+
+    (void)param;
+
+    sem_wait_timed(&never, EXPIRE_TIMEOUT);
+    now = timer_ns_gettime64();
+
+    if(!first_wake || now < first_wake)
+        first_wake = now;
+
+    if(now > last_wake)
+        last_wake = now;
+
+    return NULL;
+}
+
+static void *pong_thd(void *param) {
+    int i;
+
+    (void)param;
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        if(timed)
+            sem_wait_timed(&ping, PARK_TIMEOUT / 2);
+        else
+            sem_wait(&ping);
+
+        sem_signal(&pong);
+    }
+
+    return NULL;
+}
+
+static uint64_t ping_pong(int use_timeout) {
+    kthread_t *partner;
+    uint64_t start;
+    int i;
+
+    timed = use_timeout;
+    partner = spawn(pong_thd, NULL);
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        sem_signal(&ping);
+
+        if(use_timeout)
+            sem_wait_timed(&pong, PARK_TIMEOUT / 2);
+        else
+            sem_wait(&pong);
+    }
+
+    start = timer_ns_gettime64() - start;
+    thd_join(partner, NULL);
+
+    return start / ITERATIONS;
+}
+
+static void run(int waiters) {
+    kthread_t **thds;
+    uint64_t untimed, timed_ns, start, cancel;
+    int i;
+
+    if(!(thds = calloc(waiters, sizeof(kthread_t *)))) {
+        printf("Out of memory for %d waiters\n", waiters);
+        return;
+    }
+
+    /* Measure expiry of a batch that all share one deadline. */
+    first_wake = last_wake = 0;
+
+    for(i = 0; i < waiters; ++i)
+        thds[i] = spawn(expire_thd, NULL);
+
+    for(i = 0; i < waiters; ++i)
+        thd_join(thds[i], NULL);
+
+    /* Now park everyone and measure insertion with them in the queue. */
+    for(i = 0; i < waiters; ++i)
+        thds[i] = spawn(parked_thd, (void *)i);
+
+    /* Give all of them a chance to block. */
+    thd_sleep(50);
+
+    untimed = ping_pong(0);
+    timed_ns = ping_pong(1);
+
+    /* Finally, wake them all up early. */
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < waiters; ++i)
+        sem_signal(&park);
+
+    cancel = timer_ns_gettime64() - start;
+
+    for(i = 0; i < waiters; ++i)
+        thd_join(thds[i], NULL);
+
+    printf("%5d waiters: insert %6llu ns, expire %6llu ns, cancel %6llu ns\n",
+           waiters,
+           timed_ns > untimed ? (timed_ns - untimed) / 2 : 0,
+           (last_wake - first_wake) / waiters,
+           cancel / waiters);
+
+    free(thds);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    printf("genwait timeout queue benchmark\n");
+
+    run(10);
+    run(100);
+    run(1000);
+
+    printf("Done\n");
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+/* KallistiOS ##version##
+
+   prio_inherit.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* This program demonstrates priority inversion, and how priority inheritance
+   mutexes avoid it. A low priority thread repeatedly takes a lock that a high
+   priority thread also needs, while two medium priority threads keep the CPU
+   busy. Since the low priority thread holds a second, nested lock for part of
+   its critical section, this also shows that the inherited priority is kept
+   until the outer lock is released.
+
+   With a plain mutex, the holder only gets a one-off boost when the high
+   priority thread blocks and loses it as soon as it releases the inner lock,
+   after which the medium priority threads can starve it for as long as they
+   keep the CPU busy. With MUTEX_PRIO_INHERIT, the worst case time the high priority
+   thread spends waiting for the lock stays close to the length of the critical
+   section. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <kos/thread.h>
+#include <kos/mutex.h>
+
+#include <arch/timer.h>
+
+#define PRIO_LOW        20
+#define PRIO_MEDIUM     15
+#define PRIO_HIGH       5
+
+#define ITERATIONS      50
+#define SPINNERS        2
+
+static mutex_t outer, inner;
+static volatile bool done;
+
+static void spin_us(uint64_t us) {
+    const uint64_t end = timer_ns_gettime64() + us * 1000;
+
+    while(timer_ns_gettime64() < end)
+        ;
+}
+
+static void *low_thd(void *param) {
+    (void)param;
+
+    while(!done) {
+        mutex_lock(&outer);
+        mutex_lock(&inner);
+        spin_us(200);
+        mutex_unlock(&inner);
+        spin_us(200);
+        mutex_unlock(&outer);
+
+        thd_pass();
+    }
+
+    return NULL;
+}
+
+static void *medium_thd(void *param) {
+    (void)param;
+
+    /* Hog the CPU in bursts, leaving only small gaps for lower priority
+       threads to run in. */
+    while(!done) {
+        spin_us(5000);
+        thd_sleep(1);
+    }
+
+    return NULL;
+}
+
+static void *high_thd(void *param) {
+    uint64_t start, wait, max = 0, total = 0;
+    int i;
+
+    (void)param;
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        /* Give the low priority thread time to get into its critical
+           section. */
+        thd_sleep(2);
+
+        start = timer_ns_gettime64();
+        mutex_lock(&outer);
+        wait = timer_ns_gettime64() - start;
+        mutex_unlock(&outer);
+
+        total += wait;
+
+        if(wait > max)
+            max = wait;
+    }
+
+    done = true;
+
+    printf("  average wait %6llu us, worst wait %6llu us\n",
+           total / ITERATIONS / 1000, max / 1000);
+
+    return NULL;
+}
+
+static kthread_t *spawn(void *(*routine)(void *), prio_t prio,
+                        const char *label) {
+    const kthread_attr_t attr = {
+        .prio = prio,
+        .label = label
+    };
+
+    return thd_create_ex(&attr, routine, NULL);
+}
+
+static void run(const char *name, int flags) {
+    kthread_t *low, *high, *medium[SPINNERS];
+    int i;
+
+    printf("%s:\n", name);
+
+    mutex_init(&outer, MUTEX_TYPE_NORMAL | flags);
+    mutex_init(&inner, MUTEX_TYPE_NORMAL | flags);
+    done = false;
+
+    low = spawn(low_thd, PRIO_LOW, "low");
+    thd_sleep(1);
+
+    for(i = 0; i < SPINNERS; ++i)
+        medium[i] = spawn(medium_thd, PRIO_MEDIUM, "medium");
+
+    high = spawn(high_thd, PRIO_HIGH, "high");
+    thd_join(high, NULL);
+
+    for(i = 0; i < SPINNERS; ++i)
+        thd_join(medium[i], NULL);
+
+    thd_join(low, NULL);
+
+    mutex_destroy(&inner);
+    mutex_destroy(&outer);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    /* Run at a lower priority than everything we create, so that we don't
+       compete with the spinners. */
+    thd_set_prio(thd_current, PRIO_LOW + 1);
+
+    printf("Priority inversion test\n");
+
+    run("Plain mutex", 0);
+    run("Priority inheritance mutex", MUTEX_PRIO_INHERIT);
+
+    printf("Done\n");
+
+    return 0;
+}
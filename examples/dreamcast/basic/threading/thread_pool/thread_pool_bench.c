@@ -0,0 +1,154 @@
+/* KallistiOS ##version##
+
+   thread_pool_bench.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* This program compares the throughput of running a batch of small jobs on a
+   thread pool (kos/thread_pool.h) against the ad-hoc approach of creating and
+   joining one thread per job. It also exercises parent/child jobs, where each
+   job of the batch splits its work into a number of child jobs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <kos/thread.h>
+#include <kos/thread_pool.h>
+
+#include <arch/timer.h>
+
+#define POOL_THREADS    4
+#define JOB_COUNT       512
+#define JOB_CHILDREN    4
+#define JOB_WORDS       1024
+
+typedef struct {
+    kthread_pool_job_t job;
+    kthread_pool_job_t children[JOB_CHILDREN];
+    kthread_pool_t *pool;
+    const uint32_t *data;
+    unsigned int words;
+    uint32_t sum;
+} work_t;
+
+static uint32_t buffer[JOB_WORDS];
+static work_t work[JOB_COUNT];
+static work_t child_work[JOB_COUNT][JOB_CHILDREN];
+
+/* Stand-in for a small decode job. */
+static void do_work(void *d) {
+    work_t *w = d;
+    uint32_t sum = 0;
+    unsigned int i;
+
+    for(i = 0; i < w->words; ++i)
+        sum = (sum << 1 | sum >> 31) ^ w->data[i];
+
+    w->sum = sum;
+}
+
+/* Splits its range into children and lets the pool run them. */
+static void do_split_work(void *d) {
+    work_t *w = d;
+    work_t *c = child_work[w - work];
+    const unsigned int words = w->words / JOB_CHILDREN;
+    unsigned int i;
+
+    for(i = 0; i < JOB_CHILDREN; ++i) {
+        c[i].data = w->data + i * words;
+        c[i].words = words;
+        w->children[i].routine = do_work;
+        w->children[i].job.data = &c[i];
+        thd_pool_submit(w->pool, &w->children[i], NULL);
+    }
+}
+
+static void *thd_work(void *d) {
+    do_work(d);
+    return NULL;
+}
+
+static void setup(void) {
+    unsigned int i;
+
+    for(i = 0; i < JOB_WORDS; ++i)
+        buffer[i] = i * 2654435761u;
+
+    for(i = 0; i < JOB_COUNT; ++i) {
+        work[i].data = buffer;
+        work[i].words = JOB_WORDS;
+    }
+}
+
+static void report(const char *name, uint64_t ns) {
+    printf("%-28s %8llu us, %7llu jobs/s\n", name, ns / 1000,
+           JOB_COUNT * 1000000000ull / (ns ? ns : 1));
+}
+
+static void bench_threads(void) {
+    kthread_t *thds[POOL_THREADS];
+    uint64_t start;
+    unsigned int i, j;
+
+    start = timer_ns_gettime64();
+
+    /* Keep at most POOL_THREADS jobs in flight, as the pool does. */
+    for(i = 0; i < JOB_COUNT; i += POOL_THREADS) {
+        for(j = 0; j < POOL_THREADS; ++j)
+            thds[j] = thd_create(false, thd_work, &work[i + j]);
+
+        for(j = 0; j < POOL_THREADS; ++j)
+            thd_join(thds[j], NULL);
+    }
+
+    report("thd_create per job", timer_ns_gettime64() - start);
+}
+
+static void bench_pool(kthread_pool_t *pool, bool split) {
+    kthread_wait_group_t group = KTHREAD_WAIT_GROUP_INIT;
+    uint64_t start;
+    unsigned int i;
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < JOB_COUNT; ++i) {
+        work[i].pool = pool;
+        work[i].job.routine = split ? do_split_work : do_work;
+        work[i].job.job.data = &work[i];
+        thd_pool_submit(pool, &work[i].job, &group);
+    }
+
+    thd_pool_wait_group(pool, &group);
+
+    report(split ? "thd_pool (parent/child)" : "thd_pool",
+           timer_ns_gettime64() - start);
+}
+
+int main(int argc, char **argv) {
+    kthread_pool_t *pool;
+
+    (void)argc;
+    (void)argv;
+
+    printf("Thread pool benchmark: %d jobs, %d threads\n", JOB_COUNT,
+           POOL_THREADS);
+
+    setup();
+
+    if(!(pool = thd_pool_create(POOL_THREADS))) {
+        printf("Cannot create thread pool\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_threads();
+    bench_pool(pool, false);
+    bench_pool(pool, true);
+
+    thd_pool_destroy(pool);
+
+    printf("Done\n");
+
+    return EXIT_SUCCESS;
+}
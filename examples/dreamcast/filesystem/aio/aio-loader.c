@@ -0,0 +1,185 @@
+/* KallistiOS ##version##
+
+   aio-loader.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+   This example loads a file the way a game might load a compressed asset:
+   a piece at a time, doing some work on each piece as it comes in. It does it
+   twice, once with plain read() calls and once with aio_read(), where the
+   next piece is already being read while the last one is worked on, and shows
+   how long each way took. The work here is a CRC-32 of the data, standing in
+   for decompression.
+
+   Pass the file to load as the first argument, or put one at /cd/data.bin.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <aio.h>
+
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+
+#include <kos/init.h>
+#include <kos/dbgio.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+#define CHUNK   (64 * 1024)
+
+static uint8_t bufs[2][CHUNK] __attribute__((aligned(32)));
+static uint32_t crc_table[256];
+
+static void __attribute__((__noreturn__)) wait_exit(void) {
+    maple_device_t *dev;
+    cont_state_t *state;
+
+    printf("Press any button to exit.\n");
+
+    for(;;) {
+        dev = maple_enum_type(0, MAPLE_FUNC_CONTROLLER);
+
+        if(dev) {
+            state = (cont_state_t *)maple_dev_status(dev);
+
+            if(state)   {
+                if(state->buttons)
+                    arch_exit();
+            }
+        }
+    }
+}
+
+static void crc_init(void) {
+    uint32_t c;
+    int i, j;
+
+    for(i = 0; i < 256; i++) {
+        for(c = i, j = 0; j < 8; j++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len) {
+    crc = ~crc;
+
+    while(len--)
+        crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+static int load_sync(const char *fn, uint32_t *crc) {
+    ssize_t rv;
+    int fd;
+
+    if((fd = open(fn, O_RDONLY)) < 0)
+        return -1;
+
+    *crc = 0;
+
+    while((rv = read(fd, bufs[0], CHUNK)) > 0)
+        *crc = crc32(*crc, bufs[0], rv);
+
+    close(fd);
+    return rv < 0 ? -1 : 0;
+}
+
+static int load_async(const char *fn, uint32_t *crc) {
+    struct aiocb cb[2];
+    const struct aiocb *list[1];
+    off_t pos = 0;
+    ssize_t rv;
+    int fd, cur = 0;
+
+    if((fd = open(fn, O_RDONLY)) < 0)
+        return -1;
+
+    memset(cb, 0, sizeof(cb));
+    *crc = 0;
+
+    cb[0].aio_fildes = fd;
+    cb[0].aio_buf = bufs[0];
+    cb[0].aio_nbytes = CHUNK;
+    cb[0].aio_offset = 0;
+    cb[1] = cb[0];
+    cb[1].aio_buf = bufs[1];
+
+    if(aio_read(&cb[0]))
+        goto fail;
+
+    for(;;) {
+        list[0] = &cb[cur];
+
+        while(aio_error(&cb[cur]) == EINPROGRESS)
+            aio_suspend(list, 1, NULL);
+
+        if((rv = aio_return(&cb[cur])) <= 0)
+            break;
+
+        /* Get the next piece coming in before working on this one. */
+        pos += rv;
+        cb[cur ^ 1].aio_offset = pos;
+
+        if(aio_read(&cb[cur ^ 1]))
+            goto fail;
+
+        *crc = crc32(*crc, bufs[cur], rv);
+        cur ^= 1;
+    }
+
+    close(fd);
+    return rv < 0 ? -1 : 0;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *fn = argc > 1 ? argv[1] : "/cd/data.bin";
+    uint32_t crc_sync, crc_async;
+    uint64_t begin, t_sync, t_async;
+
+    dbgio_dev_select("fb");
+    crc_init();
+
+    printf("Loading %s\n", fn);
+
+    /* Once to get it into any caches, so both runs start out the same. */
+    if(load_sync(fn, &crc_sync)) {
+        printf("Can't load %s: %s\n", fn, strerror(errno));
+        wait_exit();
+    }
+
+    begin = timer_us_gettime64();
+    load_sync(fn, &crc_sync);
+    t_sync = timer_us_gettime64() - begin;
+
+    begin = timer_us_gettime64();
+
+    if(load_async(fn, &crc_async)) {
+        printf("Asynchronous load failed: %s\n", strerror(errno));
+        wait_exit();
+    }
+
+    t_async = timer_us_gettime64() - begin;
+
+    printf("read():      %8" PRIu64 " us, CRC %08" PRIx32 "\n", t_sync,
+           crc_sync);
+    printf("aio_read():  %8" PRIu64 " us, CRC %08" PRIx32 "%s\n", t_async,
+           crc_async, crc_async == crc_sync ? "" : " (MISMATCH!)");
+
+    wait_exit();
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* KallistiOS ##version##
+
+   cdspeed.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+   This example reads a file from the disc over and over, with reads of
+   different sizes into buffers of different alignments, and shows how fast
+   each way went, along with how the iso9660 driver got the data. Put a big
+   file on the disc (a few megabytes is good) and pass its name as the first
+   argument, or call it /cd/data.bin.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <dc/fs_iso9660.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+
+#include <kos/init.h>
+#include <kos/dbgio.h>
+#include <kos/fs.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+#define MAX_READ    (256 * 1024)
+
+/* One extra byte so reads can go to an odd address. */
+static uint8_t tbuf[MAX_READ + 32] __attribute__((aligned(32)));
+
+static const size_t sizes[] = { 512, 2048, 16384, 65536, MAX_READ };
+static const size_t offsets[] = { 0, 2, 1 };
+
+static void __attribute__((__noreturn__)) wait_exit(void) {
+    maple_device_t *dev;
+    cont_state_t *state;
+
+    printf("Press any button to exit.\n");
+
+    for(;;) {
+        dev = maple_enum_type(0, MAPLE_FUNC_CONTROLLER);
+
+        if(dev) {
+            state = (cont_state_t *)maple_dev_status(dev);
+
+            if(state)   {
+                if(state->buttons)
+                    arch_exit();
+            }
+        }
+    }
+}
+
+static int run(const char *fn, size_t size, size_t offset) {
+    iso_read_stats_t st;
+    ssize_t rv;
+    file_t f;
+
+    if((f = fs_open(fn, O_RDONLY)) < 0) {
+        printf("Can't open %s\n", fn);
+        return -1;
+    }
+
+    do {
+        rv = fs_read(f, tbuf + offset, size);
+    } while(rv > 0);
+
+    if(rv < 0 || fs_ioctl(f, ISO_IOCTL_READ_STATS, &st)) {
+        printf("Reading %s failed\n", fn);
+        fs_close(f);
+        return -1;
+    }
+
+    fs_close(f);
+
+    printf("%6u bytes at +%u: %5" PRIu64 " KB/s, %3" PRIu64 "%% direct, "
+           "%3" PRIu64 "%% read ahead, %4" PRIu32 " reads, %3" PRIu32
+           " waits\n", (unsigned)size, (unsigned)offset,
+           st.read_us ? st.bytes * 1000000 / 1024 / st.read_us : 0,
+           st.bytes ? st.direct_bytes * 100 / st.bytes : 0,
+           st.bytes ? st.ra_bytes * 100 / st.bytes : 0,
+           st.commands, st.ra_waits);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *fn = argc > 1 ? argv[1] : "/cd/data.bin";
+    size_t i, j;
+
+    dbgio_dev_select("fb");
+    printf("Reading %s\n", fn);
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for(j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+            if(run(fn, sizes[i], offsets[j]))
+                wait_exit();
+        }
+    }
+
+    wait_exit();
+    return 0;
+}
@@ -0,0 +1,144 @@
+/* KallistiOS ##version##
+
+   demux_bench.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* This program measures how the cost of matching incoming UDP packets to
+   sockets grows with the number of open sockets. For 1, 16, 64 and 256 other
+   bound sockets it measures:
+
+     - bind: the time it takes to bind each of the other sockets to a port
+       picked by the stack, per socket.
+     - packet: a round trip of one small datagram over the IPv6 loopback, from
+       sendto() on one socket to recv() on another. The receiving socket is
+       created before all of the others, so that a linear search over the
+       sockets would have to look at all of them before finding it.
+
+   Nothing leaves the Dreamcast, but the stack still needs a network device to
+   be present to send anything at all.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <kos/net.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
+
+#define ITERATIONS      1000
+#define MAX_SOCKETS     256
+#define BENCH_PORT      4242
+
+static int others[MAX_SOCKETS];
+
+static int udp_socket(uint16_t port) {
+    struct sockaddr_in6 addr;
+    int s;
+
+    if((s = socket(PF_INET6, SOCK_DGRAM, 0)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+
+    if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+static void run(int count) {
+    struct sockaddr_in6 to;
+    uint64_t start, bind_ns, pkt_ns;
+    char buf[32] = "demux";
+    int rx, tx, i;
+
+    /* The receiving socket goes first, then everything else. */
+    if((rx = udp_socket(BENCH_PORT)) < 0) {
+        printf("Cannot create receiving socket\n");
+        return;
+    }
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < count; ++i) {
+        if((others[i] = udp_socket(0)) < 0) {
+            printf("Cannot create socket %d\n", i);
+            count = i;
+            break;
+        }
+    }
+
+    bind_ns = timer_ns_gettime64() - start;
+
+    if((tx = udp_socket(0)) < 0) {
+        printf("Cannot create sending socket\n");
+        goto out;
+    }
+
+    memset(&to, 0, sizeof(to));
+    to.sin6_family = AF_INET6;
+    to.sin6_addr = in6addr_loopback;
+    to.sin6_port = htons(BENCH_PORT);
+
+    start = timer_ns_gettime64();
+
+    /* Loopback delivery happens inside sendto(), so the packet is already
+       queued on the receiving socket by the time we get to recv(). */
+    for(i = 0; i < ITERATIONS; ++i) {
+        if(sendto(tx, buf, sizeof(buf), 0, (struct sockaddr *)&to,
+                  sizeof(to)) < 0 ||
+           recv(rx, buf, sizeof(buf), MSG_DONTWAIT) < 0) {
+            printf("Packet %d was lost\n", i);
+            break;
+        }
+    }
+
+    pkt_ns = timer_ns_gettime64() - start;
+
+    printf("%4d sockets: bind %7llu ns, packet %7llu ns\n", count,
+           count ? bind_ns / count : 0, pkt_ns / ITERATIONS);
+
+    close(tx);
+
+out:
+    for(i = 0; i < count; ++i)
+        close(others[i]);
+
+    close(rx);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    if(!net_default_dev) {
+        printf("No network device, can't run the benchmark\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Socket demultiplexing benchmark\n");
+
+    run(1);
+    run(16);
+    run(64);
+    run(MAX_SOCKETS);
+
+    printf("Done\n");
+
+    return EXIT_SUCCESS;
+}
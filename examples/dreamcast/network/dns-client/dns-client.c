@@ -7,12 +7,14 @@
    address for a given hostname.
 
    This example also shows how to display things on the framebuffer with the
-   "fb" device for dbgio.
+   "fb" device for dbgio, and how to look up several hosts at once with
+   getaddrinfo_start().
 
 */
 
 #include <stdio.h>
 #include <string.h>
+#include <poll.h>
 
 #include <netdb.h>
 #include <sys/socket.h>
@@ -22,6 +24,7 @@
 #include <kos/net.h>
 #include <kos/dbgio.h>
 #include <arch/arch.h>
+#include <arch/timer.h>
 
 KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
 
@@ -55,6 +58,71 @@ static void print_addrinfo(struct addrinfo *ai) {
     }
 }
 
+#define HOST_COUNT  4
+
+static const char *hosts[HOST_COUNT] = {
+    "sylverant.net", "dreamcast.wiki", "github.com", "example.com"
+};
+
+/* Look up all of the hosts at the same time, waiting on all of them with one
+   call to poll(). */
+static void lookup_all(void) {
+    struct gai_request *reqs[HOST_COUNT];
+    struct pollfd pfds[HOST_COUNT];
+    struct addrinfo *ai;
+    uint64_t start = timer_ms_gettime64();
+    int i, err, left = 0, timeout;
+
+    for(i = 0; i < HOST_COUNT; ++i) {
+        if((err = getaddrinfo_start(hosts[i], NULL, NULL, &reqs[i]))) {
+            printf("%s: error %d\n", hosts[i], err);
+            reqs[i] = NULL;
+        }
+        else {
+            ++left;
+        }
+    }
+
+    while(left) {
+        timeout = -1;
+
+        for(i = 0; i < HOST_COUNT; ++i) {
+            pfds[i].fd = -1;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+
+            if(!reqs[i])
+                continue;
+
+            err = getaddrinfo_finish(reqs[i], &ai);
+
+            if(err == EAI_INPROGRESS) {
+                pfds[i].fd = getaddrinfo_fd(reqs[i]);
+
+                if(timeout < 0 || getaddrinfo_timeout(reqs[i]) < timeout)
+                    timeout = getaddrinfo_timeout(reqs[i]);
+
+                continue;
+            }
+
+            printf("%s (%d ms):\n", hosts[i],
+                   (int)(timer_ms_gettime64() - start));
+
+            if(err)
+                printf("Error %d\n", err);
+
+            print_addrinfo(ai);
+            freeaddrinfo(ai);
+            reqs[i] = NULL;
+            --left;
+        }
+
+        if(left)
+            poll(pfds, HOST_COUNT, timeout);
+    }
+
+    printf("All done in %d ms\n", (int)(timer_ms_gettime64() - start));
+}
 
 int main(int argc, char *argv[]) {
     struct addrinfo *ai;
@@ -106,6 +174,11 @@ int main(int argc, char *argv[]) {
        parts of the hints structure) pass NULL instead of a pointer to the hints
        structure. */
 
+    /* Look up a few hosts at once. The second time around, the answers all
+       come from the cache. */
+    lookup_all();
+    lookup_all();
+
     /* Wait 10 seconds for the user to see what's on the screen before we clear
        it during the exit back to the loader */
     thd_sleep(10 * 1000);
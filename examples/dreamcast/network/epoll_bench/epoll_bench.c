@@ -0,0 +1,235 @@
+/* KallistiOS ##version##
+
+   epoll_bench.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* This program compares poll() with epoll_wait() for a server that watches
+   a lot of sockets, only one of which has anything to read at a time. A
+   datagram is sent over the IPv6 loopback to one of the sockets, picked at
+   random, and then whichever call is being measured has to find it.
+
+   Before that, it checks that level-triggered watches keep reporting a socket
+   with data left in it, while edge-triggered and one-shot watches don't.
+
+   Nothing leaves the Dreamcast, but the stack still needs a network device to
+   be present to send anything at all.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <kos/net.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
+
+#define ITERATIONS      1000
+#define NUM_SOCKETS     100
+#define BASE_PORT       4300
+
+static int socks[NUM_SOCKETS];
+static struct pollfd pfds[NUM_SOCKETS];
+static int tx = -1;
+
+static int udp_socket(uint16_t port) {
+    struct sockaddr_in6 addr;
+    int s;
+
+    if((s = socket(PF_INET6, SOCK_DGRAM, 0)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+
+    if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+static int send_to(int idx) {
+    struct sockaddr_in6 to;
+    char buf[16] = "epoll";
+
+    memset(&to, 0, sizeof(to));
+    to.sin6_family = AF_INET6;
+    to.sin6_addr = in6addr_loopback;
+    to.sin6_port = htons(BASE_PORT + idx);
+
+    return sendto(tx, buf, sizeof(buf), 0, (struct sockaddr *)&to,
+                  sizeof(to)) < 0 ? -1 : 0;
+}
+
+static void drain(int s) {
+    char buf[16];
+
+    while(recv(s, buf, sizeof(buf), MSG_DONTWAIT) > 0) ;
+}
+
+/* Count how many times in a row a socket with two datagrams waiting gets
+   reported, reading one datagram each time. */
+static int reports(uint32_t flags) {
+    struct epoll_event ev;
+    char buf[16];
+    int ep, n = 0;
+
+    if((ep = epoll_create1(0)) < 0)
+        return -1;
+
+    ev.events = EPOLLIN | flags;
+    ev.data.fd = socks[0];
+
+    if(epoll_ctl(ep, EPOLL_CTL_ADD, socks[0], &ev) < 0 ||
+       send_to(0) < 0 || send_to(0) < 0) {
+        close(ep);
+        return -1;
+    }
+
+    while(n < 4 && epoll_wait(ep, &ev, 1, 0) == 1) {
+        ++n;
+
+        if(ev.data.fd != socks[0])
+            break;
+
+        recv(socks[0], buf, sizeof(buf), MSG_DONTWAIT);
+    }
+
+    drain(socks[0]);
+    close(ep);
+
+    return n;
+}
+
+static int check(void) {
+    int lt, et, os;
+
+    lt = reports(0);
+    et = reports(EPOLLET);
+    os = reports(EPOLLONESHOT);
+
+    printf("Reports of a socket with two datagrams: level %d, edge %d, "
+           "one-shot %d\n", lt, et, os);
+
+    return lt == 2 && et == 1 && os == 1 ? 0 : -1;
+}
+
+static uint64_t bench_poll(void) {
+    uint64_t start;
+    int i, j, idx;
+
+    for(i = 0; i < NUM_SOCKETS; ++i) {
+        pfds[i].fd = socks[i];
+        pfds[i].events = POLLIN;
+    }
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        idx = rand() % NUM_SOCKETS;
+
+        if(send_to(idx) < 0 || poll(pfds, NUM_SOCKETS, 1000) != 1)
+            return 0;
+
+        for(j = 0; j < NUM_SOCKETS; ++j) {
+            if(pfds[j].revents & POLLIN)
+                drain(pfds[j].fd);
+        }
+    }
+
+    return (timer_ns_gettime64() - start) / ITERATIONS;
+}
+
+static uint64_t bench_epoll(void) {
+    struct epoll_event ev;
+    uint64_t start, rv = 0;
+    int i, ep, idx;
+
+    if((ep = epoll_create1(0)) < 0)
+        return 0;
+
+    for(i = 0; i < NUM_SOCKETS; ++i) {
+        ev.events = EPOLLIN;
+        ev.data.fd = socks[i];
+
+        if(epoll_ctl(ep, EPOLL_CTL_ADD, socks[i], &ev) < 0)
+            goto out;
+    }
+
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        idx = rand() % NUM_SOCKETS;
+
+        if(send_to(idx) < 0 || epoll_wait(ep, &ev, 1, 1000) != 1)
+            goto out;
+
+        drain(ev.data.fd);
+    }
+
+    rv = (timer_ns_gettime64() - start) / ITERATIONS;
+
+out:
+    close(ep);
+    return rv;
+}
+
+int main(int argc, char **argv) {
+    int i, rv = EXIT_FAILURE;
+
+    (void)argc;
+    (void)argv;
+
+    if(!net_default_dev) {
+        printf("No network device, can't run the benchmark\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("poll()/epoll_wait() benchmark, %d sockets\n", NUM_SOCKETS);
+
+    for(i = 0; i < NUM_SOCKETS; ++i) {
+        if((socks[i] = udp_socket(BASE_PORT + i)) < 0) {
+            printf("Cannot create socket %d\n", i);
+            goto out;
+        }
+    }
+
+    if((tx = udp_socket(0)) < 0) {
+        printf("Cannot create sending socket\n");
+        goto out;
+    }
+
+    if(check()) {
+        printf("Triggering modes don't work as they should\n");
+        goto out;
+    }
+
+    printf("poll():       %7llu ns per event\n", bench_poll());
+    printf("epoll_wait(): %7llu ns per event\n", bench_epoll());
+    rv = EXIT_SUCCESS;
+
+out:
+    if(tx >= 0)
+        close(tx);
+
+    while(i--)
+        close(socks[i]);
+
+    printf("Done\n");
+
+    return rv;
+}
@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <sys/select.h>
 #include <netinet/in.h>
 
@@ -242,7 +243,6 @@ void *client_thread(void *p) {
     char * buf, * ext;
     const char * ct;
     file_t f = -1;
-    int r, o, cnt;
 
     printf("httpd: client thread started, sock %d\n", hs->socket);
 
@@ -293,19 +293,8 @@ void *client_thread(void *p) {
 
         send_ok(hs, ct);
 
-        while((cnt = fs_read(f, buf, BUFSIZE)) != 0) {
-            o = 0;
-
-            while(cnt > 0) {
-                r = write(hs->socket, buf + o, cnt);
-
-                if(r <= 0)
-                    goto out;
-
-                cnt -= r;
-                o += r;
-            }
-        }
+        if(sendfile(hs->socket, f, NULL, fs_total(f)) < 0)
+            goto out;
     }
 
     fs_close(f);
@@ -0,0 +1,220 @@
+/* KallistiOS ##version##
+
+   sendfile_bench.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* This program serves a 4 MiB file from the romdisk over TCP, two ways: on
+   port 8000 by reading it into a buffer and sending that, and on port 8001
+   with sendfile(). Connect to either port from a PC and it sends the whole
+   file and then closes the connection, like so:
+
+       nc <dreamcast ip> 8001 > big.bin && cmp big.bin romdisk/big.bin
+
+   The time each transfer took on the Dreamcast, and how much of it was
+   spent in the calls sending the data, is printed once it's done.
+
+   Before that, it copies the file to the ramdisk with sendfile() and checks
+   that the copy matches, and that the file position is handled right.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+
+#include <kos/fs.h>
+#include <kos/thread.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
+
+#define FILENAME        "/rd/big.bin"
+#define COPYNAME        "/ram/big.bin"
+#define READ_PORT       8000
+#define SENDFILE_PORT   8001
+#define BUFSIZE         16384
+
+static int check(void) {
+    file_t in, out;
+    off_t off;
+    size_t size;
+    const uint8_t *src, *dst;
+    ssize_t rv;
+    int ok = 0;
+
+    if((in = fs_open(FILENAME, O_RDONLY)) < 0)
+        return -1;
+
+    if((out = fs_open(COPYNAME, O_WRONLY | O_TRUNC)) < 0) {
+        fs_close(in);
+        return -1;
+    }
+
+    size = fs_total(in);
+
+    /* The first half from the file position, the rest from an offset. */
+    rv = sendfile(out, in, NULL, size / 2);
+
+    if(rv != (ssize_t)(size / 2) || fs_tell(in) != (off_t)(size / 2)) {
+        printf("sendfile from the file position: %d\n", (int)rv);
+        goto out;
+    }
+
+    fs_seek(in, 0, SEEK_SET);
+    off = size / 2;
+    rv = sendfile(out, in, &off, size);
+
+    if(rv != (ssize_t)(size - size / 2) || off != (off_t)size ||
+       fs_tell(in) != 0) {
+        printf("sendfile from an offset: %d\n", (int)rv);
+        goto out;
+    }
+
+    fs_close(out);
+
+    if((out = fs_open(COPYNAME, O_RDONLY)) < 0)
+        goto out;
+
+    src = fs_mmap(in);
+    dst = fs_mmap(out);
+
+    if(!src || !dst || fs_total(out) != size || memcmp(src, dst, size)) {
+        printf("copy doesn't match\n");
+        goto out;
+    }
+
+    ok = 1;
+
+out:
+    fs_close(in);
+
+    if(out >= 0)
+        fs_close(out);
+
+    fs_unlink(COPYNAME);
+    return ok ? 0 : -1;
+}
+
+static ssize_t serve_read(int s, file_t f, uint64_t *send_us) {
+    static uint8_t buf[BUFSIZE];
+    ssize_t cnt, rv, o, total = 0;
+    uint64_t t;
+
+    while((cnt = fs_read(f, buf, sizeof(buf))) > 0) {
+        for(o = 0; o < cnt; o += rv) {
+            t = timer_us_gettime64();
+            rv = send(s, buf + o, cnt - o, 0);
+            *send_us += timer_us_gettime64() - t;
+
+            if(rv <= 0)
+                return -1;
+        }
+
+        total += cnt;
+    }
+
+    return total;
+}
+
+static ssize_t serve_sendfile(int s, file_t f, uint64_t *send_us) {
+    uint64_t t = timer_us_gettime64();
+    ssize_t rv = sendfile(s, f, NULL, fs_total(f));
+
+    *send_us += timer_us_gettime64() - t;
+    return rv;
+}
+
+static void *server(void *p) {
+    int port = (int)p;
+    struct sockaddr_in addr;
+    uint64_t start, send_us;
+    ssize_t total;
+    file_t f;
+    int ls, s;
+
+    if((ls = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if(bind(ls, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(ls, 1) < 0) {
+        perror("bind/listen");
+        close(ls);
+        return NULL;
+    }
+
+    for(;;) {
+        if((s = accept(ls, NULL, NULL)) < 0) {
+            perror("accept");
+            break;
+        }
+
+        if((f = fs_open(FILENAME, O_RDONLY)) < 0) {
+            close(s);
+            continue;
+        }
+
+        send_us = 0;
+        start = timer_us_gettime64();
+
+        if(port == SENDFILE_PORT)
+            total = serve_sendfile(s, f, &send_us);
+        else
+            total = serve_read(s, f, &send_us);
+
+        start = timer_us_gettime64() - start;
+
+        if(total < 0) {
+            printf("%s: transfer failed\n",
+                   port == SENDFILE_PORT ? "sendfile" : "read+send");
+        }
+        else {
+            printf("%-9s  %d bytes in %llu ms (%llu KiB/s), "
+                   "%llu ms sending\n",
+                   port == SENDFILE_PORT ? "sendfile" : "read+send",
+                   (int)total, start / 1000,
+                   start ? (uint64_t)total * 1000000 / 1024 / start : 0,
+                   send_us / 1000);
+        }
+
+        fs_close(f);
+        close(s);
+    }
+
+    close(ls);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    kthread_t *thd;
+
+    (void)argc;
+    (void)argv;
+
+    if(check() < 0) {
+        printf("sendfile check failed\n");
+        return 1;
+    }
+
+    printf("sendfile check passed\n");
+
+    thd = thd_create(0, server, (void *)READ_PORT);
+    server((void *)SENDFILE_PORT);
+    thd_join(thd, NULL);
+
+    return 0;
+}
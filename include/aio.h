@@ -0,0 +1,161 @@
+/* KallistiOS ##version##
+
+   aio.h
+   Copyright (C) 2024 The KOS Team and contributors
+*/
+
+/** \file    aio.h
+    \brief   POSIX asynchronous I/O.
+    \ingroup vfs_aio
+
+    This file contains the POSIX asynchronous I/O functions, as directed by the
+    POSIX 2008 standard (aka The Open Group Base Specifications Issue 7). They
+    sit on top of the fs_aio_read() and fs_aio_write() functions.
+
+    Notification by signal isn't supported, so aio_sigevent is ignored and
+    requests always act as though its sigev_notify was SIGEV_NONE. Requests
+    can't be cancelled once they're queued either.
+
+    \author The KOS Team and contributors
+    \see    kos/fs_aio.h
+*/
+
+#ifndef __AIO_H
+#define __AIO_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <time.h>
+#include <kos/fs_aio.h>
+
+__BEGIN_DECLS
+
+/** \addtogroup vfs_aio
+    @{
+*/
+
+/** \brief  Asynchronous I/O control block.
+
+    \headerfile aio.h
+*/
+struct aiocb {
+    int aio_fildes;                 /**< \brief File descriptor */
+    off_t aio_offset;               /**< \brief File offset */
+    volatile void *aio_buf;         /**< \brief Location of buffer */
+    size_t aio_nbytes;              /**< \brief Length of transfer */
+    int aio_reqprio;                /**< \brief Request priority (ignored) */
+    struct sigevent aio_sigevent;   /**< \brief Notification (ignored) */
+    int aio_lio_opcode;             /**< \brief Operation for lio_listio() */
+
+    /** \cond */
+    fs_aio_t _aio_req;
+    int _aio_queued;
+    /** \endcond */
+};
+
+/** \defgroup aio_cancel_rv     Return values of aio_cancel()
+    @{
+*/
+#define AIO_CANCELED    0   /**< \brief All requests were cancelled */
+#define AIO_NOTCANCELED 1   /**< \brief Some requests are still going */
+#define AIO_ALLDONE     2   /**< \brief All requests were done already */
+/** @} */
+
+/** \defgroup lio_modes         Modes for lio_listio()
+    @{
+*/
+#define LIO_WAIT        0   /**< \brief Wait for the requests */
+#define LIO_NOWAIT      1   /**< \brief Don't wait for the requests */
+/** @} */
+
+/** \defgroup lio_opcodes       Operations for lio_listio()
+    @{
+*/
+#define LIO_READ        0   /**< \brief Read */
+#define LIO_WRITE       1   /**< \brief Write */
+#define LIO_NOP         2   /**< \brief Do nothing */
+/** @} */
+
+/** \brief  Queue up a read.
+
+    \param  aiocbp          The request, with aio_fildes, aio_offset, aio_buf
+                            and aio_nbytes filled in.
+    \retval 0               If the read was queued.
+    \retval -1              On failure (errno is set).
+*/
+int aio_read(struct aiocb *aiocbp);
+
+/** \brief  Queue up a write.
+
+    \param  aiocbp          The request, with aio_fildes, aio_offset, aio_buf
+                            and aio_nbytes filled in.
+    \retval 0               If the write was queued.
+    \retval -1              On failure (errno is set).
+*/
+int aio_write(struct aiocb *aiocbp);
+
+/** \brief  Get the error status of a request.
+
+    \param  aiocbp          The request to check.
+    \return                 EINPROGRESS if it isn't done yet, 0 if it
+                            succeeded, or the errno value it failed with.
+*/
+int aio_error(const struct aiocb *aiocbp);
+
+/** \brief  Get the result of a finished request.
+
+    This can only be called once for each request, after aio_error() has said
+    that it's done.
+
+    \param  aiocbp          The finished request.
+    \return                 The number of bytes read or written, or -1 on
+                            failure.
+*/
+ssize_t aio_return(struct aiocb *aiocbp);
+
+/** \brief  Wait for any of a set of requests to finish.
+
+    \param  list            The requests to wait for. NULL entries are skipped.
+    \param  nent            The number of entries in list.
+    \param  timeout         The longest to wait, or NULL to wait for as long as
+                            it takes.
+    \retval 0               If at least one of the requests is done.
+    \retval -1              If the timeout ran out (errno is EAGAIN).
+*/
+int aio_suspend(const struct aiocb *const list[], int nent,
+                const struct timespec *timeout);
+
+/** \brief  Cancel requests.
+
+    Requests can't be cancelled, so this only says whether they're done. The
+    requests of a whole file aren't kept track of, so for those the answer is
+    always \ref AIO_NOTCANCELED.
+
+    \param  fildes          The file whose requests to cancel.
+    \param  aiocbp          The request to cancel, or NULL for all of the
+                            file's requests.
+    \return                 \ref AIO_ALLDONE or \ref AIO_NOTCANCELED.
+*/
+int aio_cancel(int fildes, struct aiocb *aiocbp);
+
+/** \brief  Queue up a list of requests.
+
+    \param  mode            \ref LIO_WAIT to wait for all of the requests, or
+                            \ref LIO_NOWAIT to return once they're queued.
+    \param  list            The requests, with aio_lio_opcode filled in. NULL
+                            entries are skipped.
+    \param  nent            The number of entries in list.
+    \param  sig             Notification for \ref LIO_NOWAIT (ignored).
+    \retval 0               If all of the requests were queued (and, with
+                            \ref LIO_WAIT, succeeded).
+    \retval -1              On failure (errno is set).
+*/
+int lio_listio(int mode, struct aiocb *const list[], int nent,
+               struct sigevent *sig);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __AIO_H */
@@ -37,6 +37,7 @@ __BEGIN_DECLS
 #include <kos/fs_romdisk.h>
 #include <kos/fs_ramdisk.h>
 #include <kos/fs_dev.h>
+#include <kos/fs_proc.h>
 #include <kos/fs_pty.h>
 #include <kos/limits.h>
 #include <kos/thread.h>
@@ -53,9 +54,11 @@ __BEGIN_DECLS
 #include <kos/exports.h>
 #include <kos/dbgio.h>
 #include <kos/blockdev.h>
+#include <kos/blockcache.h>
 #include <kos/dbglog.h>
 #include <kos/elf.h>
 #include <kos/fs_socket.h>
+#include <kos/fs_aio.h>
 #include <kos/string.h>
 #include <kos/init.h>
 #include <kos/oneshot_timer.h>
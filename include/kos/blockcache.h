@@ -0,0 +1,186 @@
+/* KallistiOS ##version##
+
+   kos/blockcache.h
+   Copyright (C) 2024 The KOS Team and contributors
+*/
+
+/** \file    kos/blockcache.h
+    \brief   A cache of blocks read from a block device.
+    \ingroup vfs_blockcache
+
+    This file contains a simple cache that sits on top of a block device, for
+    use by filesystems. It keeps a fixed number of equally sized entries, each
+    holding one or more consecutive device blocks, and throws out the least
+    recently used entry when it needs room for another one. Lookups go through
+    a hash table, so the number of entries has no real bearing on how long it
+    takes to find one.
+
+    Filesystems that write can mark entries as dirty, and they'll be written
+    back when they're thrown out of the cache, when blockcache_sync() is called,
+    or after they've been dirty for a while by a thread that runs in the
+    background, if the cache was created with \ref BLOCKCACHE_WRITEBACK.
+
+    \author The KOS Team and contributors
+    \see    kos/blockdev.h
+*/
+
+#ifndef __KOS_BLOCKCACHE_H
+#define __KOS_BLOCKCACHE_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdint.h>
+#include <kos/blockdev.h>
+
+/** \defgroup vfs_blockcache    Block Cache
+    \brief                      Cache of block device data for filesystems
+    \ingroup                    vfs_blockdev
+
+    @{
+*/
+
+/** \brief  Opaque type for a block cache. */
+typedef struct blockcache blockcache_t;
+
+/** \brief  Write dirty entries back in the background.
+
+    Pass this to blockcache_create() to have entries that have been dirty for
+    longer than \ref BLOCKCACHE_WB_AGE written back by a background thread.
+    Without it, they are only written when they're thrown out or the cache is
+    synced.
+*/
+#define BLOCKCACHE_WRITEBACK    0x00000001
+
+/** \brief  How long an entry may stay dirty, in milliseconds.
+
+    This only matters to caches created with \ref BLOCKCACHE_WRITEBACK.
+*/
+#define BLOCKCACHE_WB_AGE       5000
+
+/** \defgroup blockcache_get_flags  Flags for blockcache_get()
+    \brief                          Flags for getting an entry from the cache
+
+    @{
+*/
+#define BLOCKCACHE_NOREAD   0x00000001  /**< \brief Don't read from the device */
+#define BLOCKCACHE_PIN      0x00000002  /**< \brief Pin the entry in the cache */
+/** @} */
+
+/** \brief  Statistics for a block cache.
+
+    \headerfile kos/blockcache.h
+*/
+typedef struct blockcache_stats {
+    uint32_t hits;          /**< \brief Lookups found in the cache */
+    uint32_t misses;        /**< \brief Lookups read from the device */
+    uint32_t evictions;     /**< \brief Entries thrown out for new ones */
+    uint32_t writebacks;    /**< \brief Dirty entries written to the device */
+    uint32_t entries;       /**< \brief Number of entries in the cache */
+} blockcache_stats_t;
+
+/** \brief  Create a block cache.
+
+    This function creates a cache on top of the given block device. Each entry
+    of the cache holds entry_blocks device blocks, and as many entries are
+    allocated as fit in budget bytes, but never less than two. The memory for
+    all of them is allocated up front, and is suitably aligned for DMA.
+
+    \param  dev             The block device to cache.
+    \param  entry_blocks    The number of device blocks in each entry.
+    \param  budget          The memory to use for the entries, in bytes.
+    \param  flags           0, or \ref BLOCKCACHE_WRITEBACK.
+    \return                 The new cache, or NULL on failure (errno is set).
+*/
+blockcache_t *blockcache_create(kos_blockdev_t *dev, size_t entry_blocks,
+                                size_t budget, uint32_t flags);
+
+/** \brief  Destroy a block cache.
+
+    This function writes back any dirty entries and then frees the cache. The
+    cache is freed even if writing back fails.
+
+    \param  bc              The cache to destroy.
+    \retval 0               On success.
+    \retval -1              If any dirty entry couldn't be written back.
+*/
+int blockcache_destroy(blockcache_t *bc);
+
+/** \brief  Get an entry from the cache.
+
+    This function returns the data of the entry starting at the given device
+    block, reading it from the device if it isn't in the cache already. The
+    block doesn't have to be a multiple of the entry size, but the same data
+    should always be looked up by the same block.
+
+    The data stays valid until the entry is thrown out of the cache, which can
+    happen on any later call to this function, from this thread or any other.
+    Pass \ref BLOCKCACHE_PIN to keep it in the cache until it's given back with
+    blockcache_unpin().
+
+    \param  bc              The cache to look in.
+    \param  block           The first device block of the entry.
+    \param  flags           \ref blockcache_get_flags "Flags", or 0.
+    \param  err             Set to an errno value on failure, may be NULL.
+    \return                 The entry's data, or NULL on failure.
+*/
+uint8_t *blockcache_get(blockcache_t *bc, uint64_t block, uint32_t flags,
+                        int *err);
+
+/** \brief  Unpin an entry.
+
+    \param  bc              The cache the entry is in.
+    \param  data            The data pointer returned by blockcache_get().
+*/
+void blockcache_unpin(blockcache_t *bc, const void *data);
+
+/** \brief  Mark an entry as dirty.
+
+    \param  bc              The cache the entry is in.
+    \param  block           The first device block of the entry.
+    \retval 0               On success.
+    \retval -1              If the entry isn't in the cache.
+*/
+int blockcache_mark_dirty(blockcache_t *bc, uint64_t block);
+
+/** \brief  Write back all dirty entries.
+
+    This function writes every dirty entry to the device, in order of their
+    block numbers, and then flushes the device.
+
+    \param  bc              The cache to sync.
+    \retval 0               On success.
+    \retval -1              If anything couldn't be written (errno is set).
+*/
+int blockcache_sync(blockcache_t *bc);
+
+/** \brief  Drop everything in the cache.
+
+    This function throws out every entry without writing anything back, for
+    when the device has changed under the cache (like a new disc in a drive).
+    Pinned entries can't be found any more either, but their data stays put
+    until they're unpinned.
+
+    \param  bc              The cache to empty.
+*/
+void blockcache_invalidate(blockcache_t *bc);
+
+/** \brief  Get the size of the entries of a cache, in bytes.
+
+    \param  bc              The cache to look at.
+    \return                 The size of each entry.
+*/
+size_t blockcache_entry_size(const blockcache_t *bc);
+
+/** \brief  Get the statistics of a cache.
+
+    \param  bc              The cache to look at.
+    \param  stats           Where to store the statistics.
+*/
+void blockcache_get_stats(blockcache_t *bc, blockcache_stats_t *stats);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_BLOCKCACHE_H */
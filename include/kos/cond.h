@@ -153,6 +153,29 @@ int cond_wait(condvar_t *cv, mutex_t * m);
 */
 int cond_wait_timed(condvar_t *cv, mutex_t * m, int timeout);
 
+/** \brief  Wait on a condition variable with a nanosecond timeout.
+
+    This function works exactly like cond_wait_timed(), except that the timeout
+    is specified in nanoseconds.
+
+    \param  cv              The condition to wait on
+    \param  m               The associated mutex
+    \param  timeout         The number of nanoseconds before timeout, or 0 to
+                            wait forever
+    \retval 0               On success
+    \retval -1              On error, sets errno as appropriate
+
+    \par    Error Conditions:
+    \em     EPERM - called inside an interrupt \n
+    \em     ETIMEDOUT - timed out \n
+    \em     EINVAL - the condvar was not initialized \n
+    \em     EINVAL - the mutex is not initialized or not locked \n
+    \em     ENOTRECOVERABLE - the condvar was destroyed while waiting
+
+    \sa cond_wait_timed()
+*/
+int cond_wait_timed_ns(condvar_t *cv, mutex_t *m, uint64_t timeout);
+
 /** \brief  Signal a single thread waiting on the condition variable.
 
     This function will wake up a single thread that is waiting on the condition.
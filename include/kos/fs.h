@@ -204,6 +204,15 @@ typedef struct vfs_handler {
 
     /** \brief Get status information on an already opened file. */
     int (*fstat)(void *hnd, struct stat *st);
+
+    /** \brief Read from an offset in an opened file, without moving the file
+               position (optional) */
+    ssize_t (*pread)(void *hnd, void *buffer, size_t cnt, _off64_t offset);
+
+    /** \brief Write to an offset in an opened file, without moving the file
+               position (optional) */
+    ssize_t (*pwrite)(void *hnd, const void *buffer, size_t cnt,
+                      _off64_t offset);
 } vfs_handler_t;
 
 /** \cond */
@@ -464,10 +473,11 @@ void *fs_mmap(file_t hnd);
     This function is used with asynchronous I/O to perform an I/O completion on
     the given file descriptor.
 
-    \note                   Most of the filesystems in KallistiOS do not support
-                            this operation. If you attempt to use this function
-                            on a filesystem that does not support it, the
-                            function will return -1 and set errno to EINVAL.
+    For filesystems that don't do their own completions, which is most of them,
+    this waits for the requests queued on the file with fs_aio_read() and
+    fs_aio_write(), and stores the result of the last one. If nothing was
+    queued on the file since it was opened, the function will return -1 and set
+    errno to EINVAL.
 
     \param  fd              The descriptor to complete I/O on.
     \param  rv              A buffer to store the size of the I/O in.
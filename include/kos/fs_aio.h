@@ -0,0 +1,182 @@
+/* KallistiOS ##version##
+
+   kos/fs_aio.h
+   Copyright (C) 2024 The KOS Team and contributors
+*/
+
+/** \file    kos/fs_aio.h
+    \brief   Asynchronous reads and writes on files.
+    \ingroup vfs_aio
+
+    This file contains an interface for reading and writing files without
+    waiting for the data. Requests are queued up and done by a thread that
+    belongs to the filesystem the file is on, one at a time and in the order
+    they were queued, so the caller can get on with something else in the
+    meantime (like decompressing the data of the last read). Requests on files
+    of different filesystems go on at the same time.
+
+    The POSIX asynchronous I/O functions in <aio.h> are built on top of this.
+
+    \author The KOS Team and contributors
+    \see    kos/fs.h
+*/
+
+#ifndef __KOS_FS_AIO_H
+#define __KOS_FS_AIO_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <sys/types.h>
+#include <kos/fs.h>
+#include <kos/worker_thread.h>
+
+/** \defgroup vfs_aio   Asynchronous I/O
+    \brief              Queued reads and writes on files
+    \ingroup            vfs
+
+    @{
+*/
+
+struct fs_aio;
+
+/** \brief  Completion callback for an asynchronous request.
+
+    This is called in the filesystem's I/O thread, once the result of the
+    request is known but before anyone waiting on it is woken up. It must not
+    wait on another request.
+
+    \param  req             The request that finished.
+*/
+typedef void (*fs_aio_cb_t)(struct fs_aio *req);
+
+/** \brief  An asynchronous read or write.
+
+    This holds a request queued with fs_aio_read() or fs_aio_write(). It
+    belongs to the caller, who has to keep it around until the request is done.
+    Only the data field may be touched directly.
+
+    \headerfile kos/fs_aio.h
+*/
+typedef struct fs_aio {
+    void *data;                 /**< \brief Free for the caller to use */
+
+    /** \cond */
+    kthread_job_t job;
+    file_t fd;
+    file_t dupfd;
+    void *buf;
+    size_t cnt;
+    _off64_t offset;
+    fs_aio_cb_t cb;
+    int write;
+    uint32_t gen;
+    volatile int done;
+    ssize_t result;
+    int error;
+    /** \endcond */
+} fs_aio_t;
+
+/** \brief  Queue up a read from a file.
+
+    This function queues up a read of cnt bytes from the file into buf, and
+    returns straight away. The file may be closed before the read is done, but
+    the buffer has to stay put until it is.
+
+    \param  req             The request to fill in and queue.
+    \param  fd              The file to read from.
+    \param  buf             The buffer to read into.
+    \param  cnt             The number of bytes to read.
+    \param  offset          Where in the file to read from, or -1 to read from
+                            wherever the file position is when the read starts.
+                            With an offset, the file position isn't changed if
+                            the filesystem has a pread handler (iso9660, FAT,
+                            ext2 and romdisk all do). On any other, it moves
+                            while the read is going on, so the file shouldn't
+                            be used until it's done.
+    \param  cb              The function to call when the read is done, or
+                            NULL.
+    \retval 0               If the read was queued.
+    \retval -1              On failure (errno is set).
+
+    \par    Error Conditions:
+    \em     EBADF - fd isn't an open file \n
+    \em     EMFILE - too many files are open \n
+    \em     ENOMEM - out of memory for the filesystem's I/O thread
+*/
+int fs_aio_read(fs_aio_t *req, file_t fd, void *buf, size_t cnt,
+                _off64_t offset, fs_aio_cb_t cb);
+
+/** \brief  Queue up a write to a file.
+
+    This function works just like fs_aio_read(), but writes cnt bytes from buf
+    to the file instead.
+
+    \param  req             The request to fill in and queue.
+    \param  fd              The file to write to.
+    \param  buf             The data to write.
+    \param  cnt             The number of bytes to write.
+    \param  offset          Where in the file to write to, or -1 to write
+                            wherever the file position is when the write starts.
+                            With an offset, the file position isn't changed if
+                            the filesystem has a pwrite handler (FAT and ext2
+                            do). On any other, it moves while the write is
+                            going on, so the file shouldn't be used until it's
+                            done.
+    \param  cb              The function to call when the write is done, or
+                            NULL.
+    \retval 0               If the write was queued.
+    \retval -1              On failure (errno is set).
+*/
+int fs_aio_write(fs_aio_t *req, file_t fd, const void *buf, size_t cnt,
+                 _off64_t offset, fs_aio_cb_t cb);
+
+/** \brief  Check whether a request is done.
+
+    \param  req             The request to check.
+    \return                 Non-zero if the request is done.
+*/
+int fs_aio_done(const fs_aio_t *req);
+
+/** \brief  Wait for a request to finish.
+
+    \param  req             The request to wait for.
+    \return                 The number of bytes read or written, or -1 on
+                            failure (errno is set to the request's error).
+*/
+ssize_t fs_aio_wait(fs_aio_t *req);
+
+/** \brief  Wait for any of a set of requests to finish.
+
+    \param  reqs            The requests to wait for. NULL entries are skipped.
+    \param  n               The number of entries in reqs.
+    \param  timeout         The longest to wait in milliseconds, or 0 to wait
+                            for as long as it takes.
+    \retval 0               If at least one of the requests is done.
+    \retval -1              If the timeout ran out (errno is ETIMEDOUT).
+*/
+int fs_aio_suspend(fs_aio_t *const reqs[], int n, int timeout);
+
+/** \brief  Complete the asynchronous I/O on a file.
+
+    This function waits until every request that was queued on the file is
+    done, and gives back the result of the last one. It is what fs_complete()
+    does for filesystems that don't do their own completions.
+
+    \param  fd              The file to complete I/O on.
+    \param  rv              Where to store the result of the last request.
+    \retval 0               On success.
+    \retval -1              If nothing was queued on fd since it was opened
+                            (errno is EINVAL).
+*/
+int fs_aio_complete(file_t fd, ssize_t *rv);
+
+/** \cond */
+void fs_aio_shutdown(void);
+/** \endcond */
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_FS_AIO_H */
@@ -0,0 +1,50 @@
+/* KallistiOS ##version##
+
+   kos/fs_proc.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/** \file    kos/fs_proc.h
+    \brief   Kernel status files under /proc.
+    \ingroup vfs_proc
+
+    This is a small read-only filesystem that exposes kernel state as text
+    files, in the spirit of /proc on other systems. The contents of a file are
+    generated when it is opened, so each open gives a consistent snapshot.
+
+    The following files are available:
+     - /proc/threads: one line per thread with its priority, state and CPU
+       time, followed by its scheduler statistics (context switches, run queue
+       latency and time blocked per genwait message) when KOS was built with
+       THD_STATS defined in kos/opts.h.
+
+    \author The KOS Team and contributors
+*/
+
+#ifndef __KOS_FS_PROC_H
+#define __KOS_FS_PROC_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <kos/fs.h>
+
+/** \defgroup vfs_proc  Proc
+    \brief              VFS driver for /proc
+    \ingroup            vfs
+
+    @{
+*/
+
+/* \cond */
+/* Initialization */
+int fs_proc_init(void);
+int fs_proc_shutdown(void);
+/* \endcond */
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __KOS_FS_PROC_H */
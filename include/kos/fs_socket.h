@@ -378,6 +378,39 @@ typedef struct fs_socket_proto {
                             currently true in the socket. 0 if none are true.
     */
     short (*poll)(net_socket_t *s, short events);
+
+    /** \brief  Receive several messages on a socket.
+
+        This function should implement the ::recvmmsg() system call for the
+        protocol. It is optional: if it is NULL, ::recvmmsg() and ::recvmsg()
+        call recvfrom for each message instead.
+
+        \param  s           The socket to receive on.
+        \param  msgs        The messages to fill in.
+        \param  vlen        The number of entries in msgs.
+        \param  flags       Flags for the reception.
+        \param  timeout     How long to block for, or NULL for no limit.
+        \return             The number of messages received, or -1 on error
+                            (with errno set appropriately).
+    */
+    int (*recvmmsg)(net_socket_t *s, struct mmsghdr *msgs, unsigned int vlen,
+                    int flags, struct timespec *timeout);
+
+    /** \brief  Send several messages on a socket.
+
+        This function should implement the ::sendmmsg() system call for the
+        protocol. It is optional: if it is NULL, ::sendmmsg() and ::sendmsg()
+        call sendto for each message instead.
+
+        \param  s           The socket to send on.
+        \param  msgs        The messages to send.
+        \param  vlen        The number of entries in msgs.
+        \param  flags       Flags for the transmission.
+        \return             The number of messages sent, or -1 on error (with
+                            errno set appropriately).
+    */
+    int (*sendmmsg)(net_socket_t *s, struct mmsghdr *msgs, unsigned int vlen,
+                    int flags);
 } fs_socket_proto_t;
 
 /** \brief   Initializer for the entry field in the fs_socket_proto_t struct. 
@@ -48,6 +48,29 @@ __BEGIN_DECLS
 */
 int genwait_wait(void * obj, const char * mesg, int timeout, void (*callback)(void *));
 
+/** \brief  Sleep on an object, with a nanosecond timeout.
+
+    This function works exactly like genwait_wait(), except that the timeout is
+    specified in nanoseconds, allowing for sub-millisecond timed waits.
+
+    \param  obj             The object to sleep on
+    \param  mesg            A message to show in the status
+    \param  timeout         If not woken before this many nanoseconds have
+                            passed, wake up anyway (0 to wait forever)
+    \param  callback        If non-NULL, call this function with obj as its
+                            argument if the wait times out (but before the
+                            calling thread has been woken back up)
+    \retval 0               On successfully being woken up (not by timeout)
+    \retval -1              On error or being woken by timeout
+
+    \par    Error Conditions:
+    \em     EAGAIN - on timeout
+
+    \sa genwait_wait()
+*/
+int genwait_wait_ns(void *obj, const char *mesg, uint64_t timeout,
+                    void (*callback)(void *));
+
 /* Wake up N threads waiting on the given object. If cnt is <=0, then we
    wake all threads. Returns the number of threads actually woken. */
 /** \brief  Wake up a number of threads sleeping on an object.
@@ -125,12 +148,26 @@ void genwait_wake_one_err(void *obj, int err);
 */
 int genwait_wake_thd(void *obj, kthread_t *thd, int err);
 
+/** \brief  Find the highest priority thread sleeping on an object.
+
+    This function looks through the threads sleeping on the given object and
+    returns the one with the highest priority (the one that has been sleeping
+    the longest, if more than one share that priority). This is mainly useful
+    for sync primitives that hand ownership over by priority, combined with
+    genwait_wake_thd().
+
+    \param  obj             The object to look for sleeping threads on
+    \return                 The highest priority thread sleeping on the object,
+                            or NULL if there is none.
+*/
+kthread_t *genwait_top_waiter(void *obj);
+
 /** \brief  Look for timed out genwait_wait() calls.
 
     There should be no reason you need to call this function, it is called
     internally by the scheduler for you.
 
-    \param  now             The current system time, in milliseconds since boot
+    \param  now             The current system time, in nanoseconds since boot
 */
 void genwait_check_timeouts(uint64 now);
 
@@ -140,7 +177,7 @@ void genwait_check_timeouts(uint64 now);
     function is for the internal use of the scheduler, and should not be called
     from user code.
 
-    \return                 The next timeout time in milliseconds since boot, or
+    \return                 The next timeout time in nanoseconds since boot, or
                             0 if there are no pending genwait_wait() calls
 */
 uint64 genwait_next_timeout(void);
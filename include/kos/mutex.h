@@ -45,6 +45,16 @@
     There is a fourth type of mutex defined (MUTEX_TYPE_DEFAULT), which maps to
     the MUTEX_TYPE_NORMAL type. This is simply for alignment with POSIX.
 
+    Any of these types may be combined with the MUTEX_PRIO_INHERIT flag to get
+    a priority inheritance mutex. While a thread holds such a mutex, it runs at
+    (at least) the priority of the highest priority thread blocked on it. This
+    is transitive, so if the holder is itself blocked on another priority
+    inheritance mutex, that mutex's holder is boosted as well. On unlock, the
+    priority drops back to what is still required by any other priority
+    inheritance mutexes the thread holds, and ownership is handed to the
+    highest priority waiter. Mutexes without the flag only get a simpler
+    best-effort boost of the holder, which is undone entirely on unlock.
+
     \author Lawrence Sebald
     \see    kos/sem.h
 */
@@ -70,6 +80,8 @@ typedef struct kos_mutex {
     int dynamic;
     kthread_t *holder;
     int count;
+    int flags;
+    struct kos_mutex *pi_next;
 } mutex_t;
 
 /** \name  Mutex types
@@ -89,14 +101,28 @@ typedef struct kos_mutex {
 #define MUTEX_TYPE_DEFAULT      MUTEX_TYPE_NORMAL
 /** @} */
 
+/** \brief  Priority inheritance flag.
+
+    OR this into the type passed to mutex_init() to enable priority
+    inheritance on the mutex.
+*/
+#define MUTEX_PRIO_INHERIT      0x100
+
 /** \brief  Initializer for a transient mutex. */
-#define MUTEX_INITIALIZER               { MUTEX_TYPE_NORMAL, 0, NULL, 0 }
+#define MUTEX_INITIALIZER               \
+    { MUTEX_TYPE_NORMAL, 0, NULL, 0, 0, NULL }
 
 /** \brief  Initializer for a transient error-checking mutex. */
-#define ERRORCHECK_MUTEX_INITIALIZER    { MUTEX_TYPE_ERRORCHECK, 0, NULL, 0 }
+#define ERRORCHECK_MUTEX_INITIALIZER    \
+    { MUTEX_TYPE_ERRORCHECK, 0, NULL, 0, 0, NULL }
 
 /** \brief  Initializer for a transient recursive mutex. */
-#define RECURSIVE_MUTEX_INITIALIZER     { MUTEX_TYPE_RECURSIVE, 0, NULL, 0 }
+#define RECURSIVE_MUTEX_INITIALIZER     \
+    { MUTEX_TYPE_RECURSIVE, 0, NULL, 0, 0, NULL }
+
+/** \brief  Initializer for a transient priority inheritance mutex. */
+#define PRIO_INHERIT_MUTEX_INITIALIZER  \
+    { MUTEX_TYPE_NORMAL, 0, NULL, 0, MUTEX_PRIO_INHERIT, NULL }
 
 /** \brief  Allocate a new mutex.
 
@@ -118,7 +144,8 @@ mutex_t *mutex_create(void) __depr("Use mutex_init or an initializer.");
     This function initializes a new mutex for use.
 
     \param  m               The mutex to initialize
-    \param  mtype           The type of the mutex to initialize it to
+    \param  mtype           The type of the mutex to initialize it to,
+                            optionally ORed with MUTEX_PRIO_INHERIT
 
     \retval 0               On success
     \retval -1              On error, errno will be set as appropriate
@@ -213,6 +240,28 @@ int mutex_lock_irqsafe(mutex_t *m);
 */
 int mutex_lock_timed(mutex_t *m, int timeout);
 
+/** \brief  Lock a mutex (with a nanosecond timeout).
+
+    This function works exactly like mutex_lock_timed(), except that the
+    timeout is specified in nanoseconds.
+
+    \param  m               The mutex to acquire
+    \param  timeout         The number of nanoseconds to wait for the lock, or
+                            0 to wait forever
+    \retval 0               On success
+    \retval -1              On error, errno will be set as appropriate
+
+    \par    Error Conditions:
+    \em     EPERM - called inside an interrupt \n
+    \em     EINVAL - the mutex has not been initialized properly \n
+    \em     ETIMEDOUT - the timeout expired \n
+    \em     EAGAIN - lock has been acquired too many times (recursive) \n
+    \em     EDEADLK - would deadlock (error-checking)
+
+    \sa mutex_lock_timed()
+*/
+int mutex_lock_timed_ns(mutex_t *m, uint64_t timeout);
+
 /** \brief  Check if a mutex is locked.
 
     This function will check whether or not a mutex is currently locked. This is
@@ -42,6 +42,53 @@ __BEGIN_DECLS
     \ingroup                        networking
 */
 
+/** \brief   Structure describing one packet buffer.
+    \ingroup networking_pbuf
+
+    A packet buffer holds one piece of a packet to be sent. Buffers can be
+    linked into chains through the next member, in which case the packet is
+    the concatenation of the data of each buffer of the chain. This allows the
+    payload of a packet to be referenced where it already lives (a socket's
+    send buffer, for instance) rather than copied next to its headers.
+
+    A buffer may have some space before its data (the headroom), which the
+    lower layers of the stack can use to prepend their headers in place with
+    net_pbuf_push().
+
+    \headerfile kos/net.h
+*/
+typedef struct net_pbuf {
+    /** \brief  The next buffer of the chain, or NULL */
+    struct net_pbuf     *next;
+
+    /** \brief  Start of the data held in this buffer */
+    uint8               *data;
+
+    /** \brief  Length of the data held in this buffer, in bytes */
+    size_t              len;
+
+    /** \brief  Start of the storage of this buffer (including headroom) */
+    uint8               *buf;
+
+    /** \brief  Size of the storage of this buffer, in bytes */
+    size_t              size;
+
+    /** \brief  Reference count, see net_pbuf_hold() */
+    int                 ref;
+
+    /** \brief  Flags, see \ref networking_pbuf_flags */
+    int                 flags;
+} net_pbuf_t;
+
+/** \defgroup networking_pbuf_flags    Packet Buffer Flags
+    \brief                             Flags for the net_pbuf_t structure
+    \ingroup                           networking_pbuf
+    @{
+*/
+#define NET_PBUF_HEAP   0x01    /**< \brief Allocated by net_pbuf_alloc() */
+#define NET_PBUF_REF    0x02    /**< \brief Data is borrowed, not owned */
+/** @} */
+
 /** \brief   Structure describing one usable network device.
     \ingroup networking_drivers
 
@@ -181,6 +228,22 @@ typedef struct knetif {
         \param  count       The number of addresses in list.
     */
     int (*if_set_mc)(struct knetif *self, const uint8 *list, int count);
+
+    /** \brief  Queue a chain of packet buffers for transmission.
+
+        This is optional. Devices which leave it NULL only get packets through
+        if_tx(), after the stack has copied the chain into one contiguous
+        buffer. Devices which have to copy the packet to their own memory
+        anyway should implement this to gather the chain directly.
+
+        \param  self        The network device in question.
+        \param  p           The chain of buffers making up the packet.
+        \param  blocking    1 if we should block if needed, 0 otherwise.
+        \retval NETIF_TX_OK     On success.
+        \retval NETIF_TX_ERROR  On general failure.
+        \retval NETIF_TX_AGAIN  If non-blocking and we must block to send.
+    */
+    int (*if_tx_pbuf)(struct knetif *self, const net_pbuf_t *p, int blocking);
 } netif_t;
 
 /** \defgroup net_drivers_flags netif_t Flags
@@ -801,6 +864,8 @@ typedef struct net_udp_stats {
     uint32  pkt_recv_bad_size;      /**< \brief Packets of a bad size */
     uint32  pkt_recv_bad_chksum;    /**< \brief Packets with a bad checksum */
     uint32  pkt_recv_no_sock;       /**< \brief Packets with to a closed port */
+    uint32  pkt_recv_no_space;      /**< \brief Packets dropped for lack of
+                                         room in the socket's buffer */
 } net_udp_stats_t;
 
 /** \brief  Retrieve statistics from the UDP layer.
@@ -838,6 +903,141 @@ void net_tcp_shutdown(void);
 
 /** @} */
 
+/***** net_pbuf.c *********************************************************/
+
+/** \defgroup networking_pbuf   Packet Buffers
+    \brief                      Reference-counted buffers for outgoing packets
+    \ingroup                    networking
+    @{
+*/
+
+/** \brief  Packet buffer statistics structure.
+
+    This structure counts how much data was handed to network devices, and how
+    much of it had to be copied to put chains of buffers back together for
+    devices without if_tx_pbuf() (not counting any copy done by the device
+    itself). Dividing the latter by the former gives the number of copies per
+    byte the stack made on the way down.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_pbuf_stats {
+    uint64  tx_bytes;               /**< \brief Bytes handed to devices */
+    uint64  tx_copied;              /**< \brief Bytes copied to flatten chains */
+} net_pbuf_stats_t;
+
+/** \brief  Set up a packet buffer over caller-owned storage.
+
+    The buffer starts out holding everything after the headroom, and is never
+    freed by net_pbuf_free(). This is meant for buffers living on the stack, or
+    for wrapping data which is already in memory without copying it.
+
+    \param  p               The buffer to set up.
+    \param  buf             The storage to use.
+    \param  size            The size of the storage, in bytes.
+    \param  headroom        How much of the storage to keep for headers.
+*/
+void net_pbuf_init(net_pbuf_t *p, void *buf, size_t size, size_t headroom);
+
+/** \brief  Allocate a packet buffer along with its storage.
+
+    \param  headroom        How much space to keep for headers.
+    \param  len             The length of the data, in bytes.
+
+    \return                 The new buffer, or NULL if out of memory.
+*/
+net_pbuf_t *net_pbuf_alloc(size_t headroom, size_t len);
+
+/** \brief  Allocate a packet buffer referencing existing data.
+
+    The data is not copied, and so must stay valid (and unchanged) for as long
+    as the buffer is alive.
+
+    \param  data            The data to reference.
+    \param  len             The length of the data, in bytes.
+
+    \return                 The new buffer, or NULL if out of memory.
+*/
+net_pbuf_t *net_pbuf_ref(const void *data, size_t len);
+
+/** \brief  Take a reference to a packet buffer.
+
+    The buffer (along with the rest of its chain) stays alive until
+    net_pbuf_free() has been called once more than this function. Reference
+    counts are not atomic, the caller must provide its own locking.
+
+    \param  p               The buffer to take a reference to.
+*/
+void net_pbuf_hold(net_pbuf_t *p);
+
+/** \brief  Release a reference to a chain of packet buffers.
+
+    Each buffer of the chain whose last reference goes away is freed (if it
+    was allocated by the stack), stopping at the first one which is still
+    referenced elsewhere.
+
+    \param  p               The first buffer of the chain.
+*/
+void net_pbuf_free(net_pbuf_t *p);
+
+/** \brief  Append a chain of packet buffers to another.
+
+    The head chain takes over the caller's reference to the tail chain.
+
+    \param  head            The chain to append to.
+    \param  tail            The chain to append.
+*/
+void net_pbuf_cat(net_pbuf_t *head, net_pbuf_t *tail);
+
+/** \brief  Prepend space for a header to a packet buffer.
+
+    \param  p               The buffer to grow.
+    \param  len             The size of the header, in bytes.
+
+    \return                 The start of the header, or NULL if there is not
+                            enough headroom (or the data is borrowed).
+*/
+void *net_pbuf_push(net_pbuf_t *p, size_t len);
+
+/** \brief  Compute the length of a chain of packet buffers.
+
+    \param  p               The first buffer of the chain.
+
+    \return                 The total length of the data, in bytes.
+*/
+size_t net_pbuf_chain_len(const net_pbuf_t *p);
+
+/** \brief  Copy the data of a chain of packet buffers to a flat buffer.
+
+    \param  p               The first buffer of the chain.
+    \param  out             The buffer to copy to.
+    \param  size            The size of the output buffer, in bytes.
+
+    \return                 The number of bytes copied.
+*/
+size_t net_pbuf_copy(const net_pbuf_t *p, void *out, size_t size);
+
+/** \brief  Send a complete frame held in a chain of packet buffers.
+
+    The chain is handed to the device's if_tx_pbuf() if it has one, otherwise
+    it is copied into one contiguous buffer for if_tx().
+
+    \param  net             The device to send on.
+    \param  p               The first buffer of the chain.
+    \param  blocking        1 if we should block if needed, 0 otherwise.
+
+    \return                 The return value of the device's function.
+*/
+int net_pbuf_tx(netif_t *net, const net_pbuf_t *p, int blocking);
+
+/** \brief  Retrieve statistics from the packet buffer layer.
+
+    \return                 The global packet buffer stats struct.
+*/
+net_pbuf_stats_t net_pbuf_get_stats(void);
+
+/** @} */
+
 /***** net_crc.c **********************************************************/
 
 /** \defgroup networking_crc    CRC
@@ -67,6 +67,12 @@ __BEGIN_DECLS
 /* #define PVR_KM_DBG 1 */
 /* #define PVR_KM_DBG_VERBOSE 1 */
 
+/* Enable this define to collect per-thread scheduler statistics (context
+   switches, run queue latency and time spent blocked per genwait message).
+   These can be read with thd_get_stats() or from /proc/threads. When this is
+   left disabled, the scheduler does no extra work at all. */
+/* #define THD_STATS 1 */
+
 /* Enable this define to enable PVR error interrupts and to have the interrupt
    handler print them when they occur.  */
 /* #define PVR_RENDER_DBG */
@@ -124,6 +130,18 @@ __BEGIN_DECLS
 #define FS_ROMDISK_MAX_FILES 16
 #endif
 
+/** \brief  The most memory the path index of a romdisk may use, in bytes.
+
+    The first lookup on a mounted romdisk builds a hash table of every file and
+    directory in it, so that later lookups don't have to search through the
+    directories one entry at a time. Each entry takes 8 bytes, and the table is
+    kept no more than three quarters full. Images with more entries than fit in
+    this much memory are searched the old way, as is every image if this is 0.
+*/
+#ifndef FS_ROMDISK_INDEX_MAX
+#define FS_ROMDISK_INDEX_MAX (64 * 1024)
+#endif
+
 /** \brief  The maximum number of ramdisk files that can be open at a time. */
 #ifndef FS_RAMDISK_MAX_FILES
 #define FS_RAMDISK_MAX_FILES 8
@@ -136,6 +154,12 @@ __BEGIN_DECLS
 #define FD_SETSIZE 1024
 #endif
 
+/** \brief  The number of distinct genwait messages that blocked time is
+            tracked for per thread when THD_STATS is enabled. */
+#ifndef THD_STATS_WAITS
+#define THD_STATS_WAITS 8
+#endif
+
 /** @} */
 
 __END_DECLS
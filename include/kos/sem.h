@@ -24,6 +24,7 @@
 #define __KOS_SEM_H
 
 #include <kos/cdefs.h>
+#include <stdint.h>
 
 __BEGIN_DECLS
 
@@ -133,6 +134,26 @@ int sem_wait(semaphore_t *sem);
  */
 int sem_wait_timed(semaphore_t *sem, int timeout);
 
+/** \brief  Wait on a semaphore (with a nanosecond timeout).
+
+    This function works exactly like sem_wait_timed(), except that the timeout
+    is specified in nanoseconds.
+
+    \param  sem             The semaphore to wait on
+    \param  timeout         The maximum number of nanoseconds to block (a value
+                            of 0 here will block indefinitely)
+    \retval 0               On success
+    \retval -1              On error, sets errno as appropriate
+
+    \par    Error Conditions:
+    \em     EPERM - called inside an interrupt \n
+    \em     EINVAL - the semaphore was not initialized \n
+    \em     ETIMEDOUT - timed out while blocking
+
+    \sa sem_wait_timed()
+*/
+int sem_wait_timed_ns(semaphore_t *sem, uint64_t timeout);
+
 /** \brief  "Wait" on a semaphore without blocking.
 
     This function will decrement the semaphore's count and return, if resources
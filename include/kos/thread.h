@@ -40,6 +40,7 @@
 __BEGIN_DECLS
 
 #include <kos/cdefs.h>
+#include <kos/opts.h>
 #include <kos/tls.h>
 #include <arch/irq.h>
 #include <sys/queue.h>
@@ -113,6 +114,7 @@ __BEGIN_DECLS
 
 /* Pre-define list/queue types */
 struct kthread;
+struct kos_mutex;
 
 /* \cond */
 TAILQ_HEAD(ktqueue, kthread);
@@ -160,6 +162,55 @@ typedef struct tcbhead {
     uintptr_t pointer_guard; /**< \brief Pointer guard (unused) */
 } tcbhead_t;
 
+/** \brief   Time spent blocked on one kind of genwait object.
+
+    \see    kthread_stats_t
+*/
+typedef struct kthread_wait_stats {
+    /** \brief  The genwait message of the waits, or NULL for an unused slot.
+
+        Once all THD_STATS_WAITS slots are in use, any further messages are
+        lumped together in the last slot, under the name "other".
+    */
+    const char *mesg;
+
+    /** \brief  Number of waits that have completed. */
+    uint32_t count;
+
+    /** \brief  Total time spent in those waits, in nanoseconds. */
+    uint64_t time;
+} kthread_wait_stats_t;
+
+/** \brief   Scheduler statistics for one thread.
+
+    These are only collected when KOS is built with THD_STATS defined (see
+    kos/opts.h). All times are in nanoseconds.
+
+    \see    thd_get_stats()
+*/
+typedef struct kthread_stats {
+    /** \brief  Times the thread gave up the CPU by blocking or yielding. */
+    uint32_t voluntary_switches;
+
+    /** \brief  Times the thread was preempted while it could still run. */
+    uint32_t involuntary_switches;
+
+    /** \brief  Times the thread was switched to from the run queue. */
+    uint32_t dispatches;
+
+    /** \brief  Total time spent ready to run in the run queue.
+
+        Dividing this by dispatches gives the average run queue latency.
+    */
+    uint64_t ready_time;
+
+    /** \brief  Longest time spent in the run queue before being switched to. */
+    uint64_t ready_max;
+
+    /** \brief  Time spent blocked, per genwait message. */
+    kthread_wait_stats_t waits[THD_STATS_WAITS];
+} kthread_stats_t;
+
 /** \brief   Structure describing one running thread.
 
     Each thread has one of these structures assigned to it, which holds all the
@@ -176,13 +227,24 @@ typedef __attribute__((aligned(32))) struct kthread {
     /** \brief  Run/Wait queue handle. Once again, not a function. */
     TAILQ_ENTRY(kthread) thdq;
 
-    /** \brief  Timer queue handle (if applicable). Also not a function. */
-    TAILQ_ENTRY(kthread) timerq;
+    /** \brief  Timer queue handle (if applicable). Also not a function.
+
+        Links the thread into the genwait timeout heap.
+    */
+    struct {
+        struct kthread *child;  /**< \brief First child in the heap */
+        struct kthread *next;   /**< \brief Next sibling in the heap */
+        struct kthread *prev;   /**< \brief Previous sibling or parent */
+    } timerq;
 
     /** \brief  Kernel thread id. */
     tid_t tid;
 
-    /** \brief  Dynamic priority */
+    /** \brief  Dynamic priority
+
+        This also selects the run queue bucket of the thread, so it must not
+        be modified directly while the thread is queued. Use thd_set_prio().
+    */
     prio_t prio;
 
     /** \brief  Static priority: 0..PRIO_MAX (higher means lower priority). */
@@ -206,6 +268,20 @@ typedef __attribute__((aligned(32))) struct kthread {
     */
     const char *wait_msg;
 
+    /** \brief  Priority inheritance mutexes held by this thread.
+
+        Singly-linked through the mutexes themselves.
+
+        \see    kos/mutex.h
+    */
+    struct kos_mutex *pi_held;
+
+    /** \brief  Priority inheritance mutex this thread is blocked on, if any.
+
+        \see    kos/mutex.h
+    */
+    struct kos_mutex *pi_wait;
+
     /** \brief  Wait timeout callback.
 
         If the genwait times out while waiting, this function will be called.
@@ -218,8 +294,8 @@ typedef __attribute__((aligned(32))) struct kthread {
     /** \brief  Next scheduled time.
 
         This value is used for sleep and timed block operations. This value is
-        in milliseconds since the start of timer_ms_gettime(). This should be
-        enough for something like 2 million years of wait time. ;)
+        in nanoseconds since the start of timer_ns_gettime64(). This should be
+        enough for something like 580 years of wait time. ;)
     */
     uint64_t wait_timeout;
 
@@ -229,6 +305,18 @@ typedef __attribute__((aligned(32))) struct kthread {
         uint64_t total;     /**< \brief total running CPU time for thread */
     } cpu_time;
 
+#ifdef THD_STATS
+    /** \brief  Scheduler statistics.
+
+        \see    thd_get_stats()
+    */
+    kthread_stats_t stats;
+
+    /** \brief  When the thread last entered the run queue or started to wait,
+                for the scheduler statistics. */
+    uint64_t stats_mark;
+#endif
+
     /** \brief  Thread label.
 
         This value is used when printing out a user-readable process listing.
@@ -462,7 +550,7 @@ void thd_exit(void *rv) __noreturn;
     comments in kernel/thread/thread.c for more info, especially if you need to
     guarantee low latencies. This function just updates irq_srt_addr and
     thd_current. Set 'now' to non-zero if you want to use a particular system
-    time for checking timeouts.
+    time (in nanoseconds, as from timer_ns_gettime64()) for checking timeouts.
 
     \param  front_of_line   Set to false, unless you have a good reason not to.
     \param  now             Set to 0, unless you have a good reason not to.
@@ -504,6 +592,24 @@ void thd_pass(void);
 */
 void thd_sleep(unsigned ms);
 
+/** \brief   Sleep for a given number of nanoseconds.
+
+    This function works like thd_sleep(), except that the duration is given in
+    nanoseconds, so sub-millisecond sleeps are possible without busy-waiting.
+    The scheduler's timer is programmed for the wakeup itself rather than
+    rounding it up to the next timeslice, in both periodic and tickless mode.
+    The wakeup is still subject to the scheduler, so the thread may sleep
+    longer if a higher priority thread is running.
+
+    \note
+    When \p ns is given a value of `0`, this is equivalent to thd_pass().
+
+    \param  ns              The number of nanoseconds to sleep.
+
+    \sa thd_sleep()
+*/
+void thd_sleep_ns(uint64_t ns);
+
 /** \brief       Set a thread's priority value.
     \relatesalso kthread_t
 
@@ -628,6 +734,42 @@ struct _reent *thd_get_reent(kthread_t *thd);
 */
 uint64_t thd_get_cpu_time(kthread_t *thd);
 
+/** \brief   Retrieve the scheduler statistics of a thread.
+
+    This copies out the context switch counts, run queue latency and time spent
+    blocked per genwait message of the given thread. These are only collected
+    if KOS was built with THD_STATS defined in kos/opts.h, which adds a small
+    amount of bookkeeping to every context switch and wakeup.
+
+    \param  thd             The thread to retrieve the statistics of, or NULL
+                            for the current thread.
+    \param  stats           Where to store the statistics.
+
+    \retval 0               On success.
+    \retval -1              On failure, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     ENOSYS - KOS was built without THD_STATS
+
+    \sa thd_reset_stats
+*/
+int thd_get_stats(kthread_t *thd, kthread_stats_t *stats);
+
+/** \brief   Clear the scheduler statistics of a thread.
+
+    \param  thd             The thread to clear the statistics of, or NULL
+                            to clear the statistics of all threads.
+
+    \retval 0               On success.
+    \retval -1              On failure, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     ENOSYS - KOS was built without THD_STATS
+
+    \sa thd_get_stats
+*/
+int thd_reset_stats(kthread_t *thd);
+
 /** \brief   Change threading modes.
 
     This function changes the current threading mode of the system.
@@ -680,6 +822,31 @@ int thd_set_hz(unsigned int hertz);
 */
 unsigned thd_get_hz(void);
 
+/** \brief   Enable or disable tickless scheduling.
+
+    In the default mode, the scheduler interrupt fires at the frequency set
+    with thd_set_hz() regardless of what the system is doing. In tickless mode
+    the primary timer is instead programmed for the earlier of the next timed
+    wait expiring (thd_sleep(), sem_wait_timed(), etc) and the end of the
+    current timeslice, where the timeslice is only enforced while more than
+    one thread (not counting the idle thread) is runnable. A single busy thread
+    or an idle system therefore takes very few timer interrupts.
+
+    \param  enable          Set to true to enable tickless mode, false to
+                            return to a fixed timeslice interrupt.
+
+    \sa thd_get_tickless(), thd_set_hz()
+*/
+void thd_set_tickless(bool enable);
+
+/** \brief   Query whether tickless scheduling is enabled.
+
+    \return                 true if tickless mode is enabled.
+
+    \sa thd_set_tickless()
+*/
+bool thd_get_tickless(void);
+
 /** \brief       Wait for a thread to exit.
     \relatesalso kthread_t
 
@@ -749,6 +916,12 @@ int thd_pslist_queue(int (*pf)(const char *fmt, ...));
 
 /** \cond INTERNAL */
 
+#ifdef THD_STATS
+/* Account for the end of a genwait on the given thread. Called from genwait
+   with interrupts disabled, just before the thread is made runnable. */
+void thd_stats_wait_done(kthread_t *thd, uint64_t now);
+#endif
+
 /** \brief  Initialize the threading system.
     
     This is normally done for you by default when KOS starts. This will also
@@ -0,0 +1,165 @@
+/* KallistiOS ##version##
+
+   include/kos/thread_pool.h
+   Copyright (C) 2024 The KOS Team and contributors
+*/
+
+/** \file    kos/thread_pool.h
+    \brief   Thread pool with work stealing.
+    \ingroup kthreads
+
+    This file contains the thread pool API. A thread pool owns a fixed number
+    of worker threads, each with its own queue of jobs. Jobs submitted from
+    outside of the pool are spread across the workers, and a worker which runs
+    out of jobs steals from the others, so that a batch of small jobs (texture
+    or audio decoding, asset decompression, etc.) can be fanned out without
+    creating a thread per job.
+
+    A job submitted from inside another job running on the same pool becomes a
+    child of that job: the parent is only considered complete once all of its
+    children have completed. Completion is tracked with wait groups, which
+    count the outstanding jobs that were submitted with them.
+
+    Pool jobs embed a kthread_job_t, the same job structure used by the
+    threaded worker FIFO API.
+
+    \author The KOS Team and contributors
+
+    \see    kos/worker_thread.h
+*/
+
+#ifndef __KOS_THREAD_POOL_H
+#define __KOS_THREAD_POOL_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <kos/thread.h>
+#include <kos/worker_thread.h>
+
+struct kthread_pool;
+
+/** \struct  kthread_pool_t
+    \brief   Opaque structure describing one thread pool.
+*/
+typedef struct kthread_pool kthread_pool_t;
+
+/** \brief   Completion counter for a set of pool jobs.
+
+    Initialize with KTHREAD_WAIT_GROUP_INIT, then pass it to
+    thd_pool_submit() for each job that should be waited on together. No
+    member of this structure should be accessed directly.
+*/
+typedef struct kthread_wait_group {
+    /** \brief  Number of jobs still outstanding. */
+    volatile unsigned int count;
+} kthread_wait_group_t;
+
+/** \brief   Initializer for a kthread_wait_group_t. */
+#define KTHREAD_WAIT_GROUP_INIT { 0 }
+
+/** \brief   Structure describing one job for a thread pool.
+
+    The caller owns the memory of the job and must keep it alive until it has
+    completed (that is, until a wait group it was submitted with has been
+    waited on). Only the routine and the job's data pointer need to be set
+    before submitting, the other members are managed by the pool.
+*/
+typedef struct kthread_pool_job {
+    /** \brief  The underlying job; job.data is passed to the routine. */
+    kthread_job_t job;
+
+    /** \brief  Worker queue handle. */
+    TAILQ_ENTRY(kthread_pool_job) entry;
+
+    /** \brief  The function to run. */
+    void (*routine)(void *data);
+
+    /** \brief  Parent job, if submitted from inside another job. */
+    struct kthread_pool_job *parent;
+
+    /** \brief  Wait group to signal upon completion, if any. */
+    kthread_wait_group_t *group;
+
+    /** \brief  This job plus its children which have not completed yet. */
+    unsigned int pending;
+} kthread_pool_job_t;
+
+/** \brief       Create a new thread pool with the specified thread attributes.
+    \relatesalso kthread_pool_t
+
+    \param  attr            A set of thread attributes for each of the created
+                            threads. Passing NULL will initialize all
+                            attributes to their default values.
+    \param  threads         The number of worker threads in the pool.
+
+    \return                 The new thread pool on success, NULL on failure
+                            (with errno set as appropriate).
+
+    \par    Error Conditions:
+    \em     EINVAL - threads was zero \n
+    \em     ENOMEM - out of memory
+
+    \sa thd_pool_create, thd_pool_destroy
+*/
+kthread_pool_t *thd_pool_create_ex(const kthread_attr_t *attr,
+                                   unsigned int threads);
+
+/** \brief       Create a new thread pool.
+    \relatesalso kthread_pool_t
+
+    \param  threads         The number of worker threads in the pool.
+
+    \return                 The new thread pool on success, NULL on failure.
+
+    \sa thd_pool_create_ex, thd_pool_destroy
+*/
+static inline kthread_pool_t *thd_pool_create(unsigned int threads) {
+    return thd_pool_create_ex(NULL, threads);
+}
+
+/** \brief       Destroy a thread pool.
+    \relatesalso kthread_pool_t
+
+    Any jobs still queued are run before the worker threads exit. This must not
+    be called from one of the pool's own jobs.
+
+    \param  pool            The thread pool to destroy.
+*/
+void thd_pool_destroy(kthread_pool_t *pool);
+
+/** \brief       Submit a job to a thread pool.
+    \relatesalso kthread_pool_t
+
+    Queues the given job to be run by one of the pool's worker threads. When
+    called from a job running on the same pool, the new job becomes a child of
+    the running job and is queued on the current worker.
+
+    This function may be called from an interrupt handler.
+
+    \param  pool            The thread pool to run the job on.
+    \param  job             The job to run. Its routine must be set.
+    \param  group           A wait group to track the completion of the job
+                            (and of its children) with, or NULL.
+*/
+void thd_pool_submit(kthread_pool_t *pool, kthread_pool_job_t *job,
+                     kthread_wait_group_t *group);
+
+/** \brief       Wait until all jobs of a wait group have completed.
+    \relatesalso kthread_pool_t
+
+    Blocks until every job submitted with the given wait group (including all
+    of their children) has completed. When called from one of the pool's own
+    jobs, the calling worker keeps running queued jobs while it waits.
+
+    \param  pool            The thread pool the jobs were submitted to.
+    \param  group           The wait group to wait on.
+
+    \retval 0               On success.
+    \retval -1              If called inside an interrupt (errno = EPERM).
+*/
+int thd_pool_wait_group(kthread_pool_t *pool, kthread_wait_group_t *group);
+
+__END_DECLS
+
+#endif /* __KOS_THREAD_POOL_H */
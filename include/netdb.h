@@ -108,6 +108,7 @@ extern int h_errno;
 #define EAI_SOCKTYPE        8       /**< \brief Invalid socket type. */
 #define EAI_SYSTEM          9       /**< \brief System error, check errno. */
 #define EAI_OVERFLOW        10      /**< \brief Argument buffer overflow. */
+#define EAI_INPROGRESS      11      /**< \brief Lookup not done yet. */
 /** @} */
 
 /** \defgroup addrinfo_flags    addrinfo ai_flags
@@ -160,6 +161,80 @@ void freeaddrinfo(struct addrinfo *ai);
 int getaddrinfo(const char *nodename, const char *servname,
                 const struct addrinfo *hints, struct addrinfo **res);
 
+/** \brief   A lookup started by getaddrinfo_start().
+    \ingroup network_db
+
+    This is an opaque structure, only to be passed to the other
+    getaddrinfo_*() functions.
+*/
+struct gai_request;
+
+/** \brief   Start looking up an address, without waiting for the answer.
+    \ingroup network_db
+
+    This function starts the same lookup that getaddrinfo() does, but returns
+    as soon as any questions have been sent to the DNS server. The socket
+    returned by getaddrinfo_fd() becomes readable with the answers, so any
+    number of lookups can be waited on together with poll(), along with
+    anything else. Whenever that happens, or getaddrinfo_timeout() has passed,
+    call getaddrinfo_finish() to see if the lookup is done.
+
+    Answers from the server are cached for as long as they say they're good
+    for, so later lookups of the same name may be done without asking again.
+    This is a KOS extension.
+
+    \param  nodename        The host to look up.
+    \param  servname        The service to look up.
+    \param  hints           Hints used in aiding lookup.
+    \param  req             The lookup, to pass to the other functions.
+    \return                 0 on success, non-zero error code on failure.
+    \see    addrinfo_errors
+*/
+int getaddrinfo_start(const char *nodename, const char *servname,
+                      const struct addrinfo *hints, struct gai_request **req);
+
+/** \brief   Get the socket to wait on for a lookup.
+    \ingroup network_db
+
+    \param  req             The lookup from getaddrinfo_start().
+    \return                 A socket to poll for POLLIN, or -1 if nothing
+                            needs to be waited for.
+*/
+int getaddrinfo_fd(const struct gai_request *req);
+
+/** \brief   Get how long to wait for a lookup before checking on it.
+    \ingroup network_db
+
+    \param  req             The lookup from getaddrinfo_start().
+    \return                 The time in milliseconds until the questions
+                            should be sent again, suitable for poll().
+*/
+int getaddrinfo_timeout(const struct gai_request *req);
+
+/** \brief   Check if a lookup is done, and get its result if so.
+    \ingroup network_db
+
+    This function takes any answers that have come in for the lookup, and
+    sends the questions again if it has been too long. If the lookup is still
+    going, it returns EAI_INPROGRESS. Otherwise, the lookup is freed and the
+    result is returned just as getaddrinfo() would.
+
+    \param  req             The lookup from getaddrinfo_start().
+    \param  res             The resulting address information.
+    \return                 0 on success, EAI_INPROGRESS if the lookup isn't
+                            done yet, or another error code on failure.
+    \see    addrinfo_errors
+*/
+int getaddrinfo_finish(struct gai_request *req, struct addrinfo **res);
+
+/** \brief   Give up on a lookup.
+    \ingroup network_db
+
+    \param  req             The lookup from getaddrinfo_start(), which is
+                            freed.
+*/
+void getaddrinfo_cancel(struct gai_request *req);
+
 /** \brief   Look up a host by its name.
     \ingroup network_db
 
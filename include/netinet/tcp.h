@@ -22,6 +22,7 @@
 #define __NETINET_TCP_H
 
 #include <sys/cdefs.h>
+#include <stdint.h>
 
 __BEGIN_DECLS
 
@@ -46,9 +47,89 @@ __BEGIN_DECLS
 */
 
 #define TCP_NODELAY             1 /**< \brief Don't delay to coalesce. */
+#define TCP_INFO               11 /**< \brief Connection info (get only).
+                                       \see tcp_info */
+#define TCP_QUICKACK           12 /**< \brief Acknowledge data right away,
+                                       rather than delaying ACKs. */
 
 /** @} */
 
+/** \defgroup tcp_ca_states             Congestion Control States
+    \brief                              Values of tcp_info::tcpi_ca_state
+    \ingroup                            networking_tcp
+
+    @{
+*/
+
+#define TCP_CA_Open             0 /**< \brief Normal operation. */
+#define TCP_CA_Recovery         3 /**< \brief Fast recovery after a fast
+                                       retransmit. */
+#define TCP_CA_Loss             4 /**< \brief Recovering from a
+                                       retransmission timeout. */
+
+/** @} */
+
+/** \defgroup tcp_info_opts             Negotiated Options
+    \brief                              Flags for tcp_info::tcpi_options
+    \ingroup                            networking_tcp
+
+    @{
+*/
+
+#define TCPI_OPT_TIMESTAMPS     1 /**< \brief Timestamps are in use. */
+#define TCPI_OPT_SACK           2 /**< \brief SACK is in use. */
+#define TCPI_OPT_WSCALE         4 /**< \brief Window scaling is in use. */
+
+/** @} */
+
+/** \brief   TCP connection information.
+    \ingroup networking_tcp
+
+    This structure is filled in by getsockopt() with the TCP_INFO option. It is
+    modeled on the structure of the same name on Linux, but only contains a
+    subset of its fields, and window sizes are reported in bytes rather than in
+    segments. If the option length passed in is smaller than the structure, the
+    result is truncated.
+*/
+struct tcp_info {
+    uint8_t  tcpi_ca_state;         /**< \brief Congestion control state. */
+    uint8_t  tcpi_backoff;          /**< \brief Consecutive timeouts. */
+    uint8_t  tcpi_options;          /**< \brief Negotiated options.
+                                         \see tcp_info_opts */
+    uint8_t  tcpi_snd_wscale;       /**< \brief Peer's window scale. */
+    uint8_t  tcpi_rcv_wscale;       /**< \brief Our window scale. */
+    uint32_t tcpi_rto;              /**< \brief Retransmission timeout (us). */
+    uint32_t tcpi_rtt;              /**< \brief Smoothed round trip time (us). */
+    uint32_t tcpi_rttvar;           /**< \brief Round trip time variance (us). */
+    uint32_t tcpi_snd_mss;          /**< \brief Send MSS (bytes). */
+    uint32_t tcpi_snd_cwnd;         /**< \brief Congestion window (bytes). */
+    uint32_t tcpi_snd_ssthresh;     /**< \brief Slow start threshold (bytes). */
+    uint32_t tcpi_snd_wnd;          /**< \brief Peer's receive window (bytes). */
+    uint32_t tcpi_unacked;          /**< \brief Data in flight (bytes). */
+    uint32_t tcpi_segs_in;          /**< \brief Segments received. */
+    uint32_t tcpi_segs_out;         /**< \brief Data segments sent, including
+                                         retransmissions. */
+    uint32_t tcpi_total_retrans;    /**< \brief Segments retransmitted. */
+    uint32_t tcpi_fast_retrans;     /**< \brief Fast retransmits. */
+    uint32_t tcpi_timeouts;         /**< \brief Retransmission timeouts. */
+    uint32_t tcpi_dupacks;          /**< \brief Duplicate ACKs received. */
+    uint64_t tcpi_bytes_acked;      /**< \brief Bytes acknowledged by peer. */
+    uint64_t tcpi_bytes_received;   /**< \brief Bytes received in order. */
+    uint32_t tcpi_ooo_segs;         /**< \brief Segments received out of
+                                         order and queued. */
+    uint32_t tcpi_ooo_hits;         /**< \brief Holes filled in, releasing
+                                         queued data to the reader. */
+    uint32_t tcpi_ooo_drops;        /**< \brief Out of order segments dropped
+                                         for lack of space to track them. */
+    uint32_t tcpi_ooo_bytes;        /**< \brief Bytes currently queued out
+                                         of order. */
+    uint32_t tcpi_data_segs_in;     /**< \brief Segments received with
+                                         data in them. */
+    uint32_t tcpi_acks_out;         /**< \brief Pure ACKs sent. */
+    uint32_t tcpi_acks_delayed;     /**< \brief Data segments whose ACK was
+                                         held back. */
+};
+
 __END_DECLS
 
 #endif /* !__NETINET_TCP_H */
@@ -0,0 +1,159 @@
+/* KallistiOS ##version##
+
+   sys/epoll.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/** \file    sys/epoll.h
+    \brief   Scalable I/O event notification.
+    \ingroup threading_polling
+
+    This file contains an interface for waiting on events on a large number of
+    file descriptors, modeled on the epoll interface of Linux. Unlike poll(),
+    the set of file descriptors to watch is registered once with an epoll
+    instance, and an event on a file descriptor only ever has to look at the
+    instances that are watching it. Waiting only looks at the file descriptors
+    that have had something happen on them.
+
+    Just like poll(), this currently only really works for sockets. Other file
+    descriptors are always considered to be readable and writable.
+
+    \author The KOS Team
+*/
+
+#ifndef __SYS_EPOLL_H
+#define __SYS_EPOLL_H
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+#include <poll.h>
+
+__BEGIN_DECLS
+
+/** \defgroup epoll_events              Events for epoll
+    \brief                              Masks representing event types for epoll
+    \ingroup                            threading_polling
+
+    These are the events that can be set in the events field of struct
+    epoll_event. They have the same values as the corresponding events of
+    poll(). EPOLLERR and EPOLLHUP are always reported, whether they were asked
+    for or not.
+
+    @{
+*/
+#define EPOLLIN         POLLIN      /**< \brief Data may be read */
+#define EPOLLPRI        POLLPRI     /**< \brief High-priority data may be read */
+#define EPOLLOUT        POLLOUT     /**< \brief Data may be written */
+#define EPOLLRDNORM     POLLRDNORM  /**< \brief Normal data may be read */
+#define EPOLLRDBAND     POLLRDBAND  /**< \brief Priority data may be read */
+#define EPOLLWRNORM     POLLWRNORM  /**< \brief Normal data may be written */
+#define EPOLLWRBAND     POLLWRBAND  /**< \brief Priority data may be written */
+#define EPOLLERR        POLLERR     /**< \brief Error has occurred */
+#define EPOLLHUP        POLLHUP     /**< \brief Peer disconnected */
+
+/** \brief  Only report events once, when they happen (edge-triggered).
+
+    Without this, a file descriptor is reported by every call to epoll_wait()
+    for as long as it is ready (level-triggered).
+*/
+#define EPOLLET         (1U << 31)
+#define EPOLLONESHOT    (1U << 30)  /**< \brief Disable after one event */
+/** @} */
+
+/** \defgroup epoll_ctl_ops             Operations for epoll_ctl()
+    \brief                              Values for the op parameter of epoll_ctl()
+    \ingroup                            threading_polling
+
+    @{
+*/
+#define EPOLL_CTL_ADD   1           /**< \brief Start watching a fd */
+#define EPOLL_CTL_DEL   2           /**< \brief Stop watching a fd */
+#define EPOLL_CTL_MOD   3           /**< \brief Change what to watch for */
+/** @} */
+
+/** \brief   Flag for epoll_create1(), accepted for compatibility.
+    \ingroup threading_polling
+*/
+#define EPOLL_CLOEXEC   0x01
+
+/** \brief   User data attached to a watched file descriptor.
+    \ingroup threading_polling
+*/
+typedef union epoll_data {
+    void *ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+/** \brief   An event to watch for, or one that has occurred.
+    \ingroup threading_polling
+    \headerfile sys/epoll.h
+*/
+struct epoll_event {
+    uint32_t events;        /**< \brief Events, see \ref epoll_events */
+    epoll_data_t data;      /**< \brief User data, given back with events */
+};
+
+/** \brief   Create an epoll instance.
+    \ingroup threading_polling
+
+    \param  size        Ignored, other than having to be positive.
+    \return             A file descriptor for the instance, to be closed with
+                        close() once done, or -1 on error (errno is set).
+*/
+int epoll_create(int size);
+
+/** \brief   Create an epoll instance.
+    \ingroup threading_polling
+
+    \param  flags       0 or EPOLL_CLOEXEC (which does nothing).
+    \return             A file descriptor for the instance, or -1 on error.
+*/
+int epoll_create1(int flags);
+
+/** \brief   Add, change or remove a file descriptor to watch.
+    \ingroup threading_polling
+
+    A file descriptor that is closed is removed from every instance watching
+    it.
+
+    \param  epfd        The epoll instance.
+    \param  op          One of the \ref epoll_ctl_ops.
+    \param  fd          The file descriptor to watch.
+    \param  event       What to watch for, and the data to report it with.
+                        Ignored for EPOLL_CTL_DEL.
+    \return             0 on success, -1 on error (sets errno).
+
+    \par    Error Conditions:
+    \em     EBADF - epfd or fd is not a valid file descriptor \n
+    \em     EINVAL - epfd is not an epoll instance, op is not valid, or fd is
+                     epfd itself \n
+    \em     EEXIST - fd is already watched (EPOLL_CTL_ADD) \n
+    \em     ENOENT - fd is not watched (EPOLL_CTL_MOD, EPOLL_CTL_DEL) \n
+    \em     ENOMEM - out of memory
+*/
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+
+/** \brief   Wait for events on the watched file descriptors.
+    \ingroup threading_polling
+
+    \param  epfd        The epoll instance.
+    \param  events      Where to store the events that have occurred.
+    \param  maxevents   Size of the events array.
+    \param  timeout     Maximum amount of time to block, in milliseconds. Pass
+                        0 to return right away and -1 to block until an event
+                        occurs.
+    \return             The number of events stored, 0 on timeout, or -1 on
+                        error (sets errno).
+
+    If epfd is closed by another thread while this is waiting, it returns
+    right away, with -1 and errno set to EBADF if there were no events yet.
+*/
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout);
+
+__END_DECLS
+
+#endif /* !__SYS_EPOLL_H */
@@ -0,0 +1,62 @@
+/* KallistiOS ##version##
+
+   sys/sendfile.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/** \file    sys/sendfile.h
+    \brief   Copying data from a file to a socket.
+    \ingroup vfs_sockets
+
+    This file contains sendfile(), which sends the contents of a file over a
+    socket without the data having to be read into a buffer of the caller's
+    first.
+
+    \author The KOS Team
+*/
+
+#ifndef __SYS_SENDFILE_H
+#define __SYS_SENDFILE_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+/** \brief   Send data from a file to a socket.
+    \ingroup vfs_sockets
+
+    If the file can be mapped into memory with fs_mmap() (files on a romdisk
+    or ramdisk, for instance), the data is passed to the socket right from
+    where it lives. Otherwise it is read a piece at a time into a buffer
+    inside the kernel.
+
+    On a blocking socket, this only returns early on error. On a non-blocking
+    one, it sends as much as fits without blocking.
+
+    \param  out_fd      The file descriptor to write to. This is normally a
+                        connected socket, but can be any file descriptor.
+    \param  in_fd       The file to read from.
+    \param  offset      If not NULL, where to start reading, which is updated
+                        to just after the last byte sent. The position of
+                        in_fd is not changed in that case. If NULL, reading
+                        starts at the position of in_fd, which is moved past
+                        the data sent.
+    \param  count       The number of bytes to send.
+    \return             The number of bytes sent, which is less than count
+                        if the end of the file was reached, or -1 on error
+                        (errno is set).
+
+    \par    Error Conditions:
+    \em     EBADF - out_fd or in_fd is not a valid file descriptor \n
+    \em     EINVAL - *offset is negative \n
+    \em     EWOULDBLOCK - out_fd is non-blocking and nothing could be sent \n
+    \em     ENOMEM - out of memory \n
+    \em     Any error from reading in_fd or writing out_fd
+*/
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+
+__END_DECLS
+
+#endif /* !__SYS_SENDFILE_H */
@@ -87,6 +87,41 @@ struct sockaddr_storage {
     char _ss_pad2[_SS_PAD2SIZE];
 };
 
+/** \brief  Message structure, for sendmsg() and recvmsg().
+
+    Control data (ancillary data) is not supported: msg_control and
+    msg_controllen are ignored when sending, and msg_controllen is set to 0
+    when receiving.
+
+    \headerfile sys/socket.h
+*/
+struct msghdr {
+    /** \brief  Address to send to, or storage for the sender's address. */
+    void         *msg_name;
+    /** \brief  Size of the address (updated on receiving). */
+    socklen_t     msg_namelen;
+    /** \brief  Buffers to gather data from or scatter it to. */
+    struct iovec *msg_iov;
+    /** \brief  Number of entries in msg_iov. */
+    int           msg_iovlen;
+    /** \brief  Control data (unsupported). */
+    void         *msg_control;
+    /** \brief  Size of the control data (unsupported). */
+    socklen_t     msg_controllen;
+    /** \brief  Flags on the received message, see \ref msg_flags. */
+    int           msg_flags;
+};
+
+/** \brief  One message of several, for sendmmsg() and recvmmsg().
+    \headerfile sys/socket.h
+*/
+struct mmsghdr {
+    /** \brief  The message itself. */
+    struct msghdr msg_hdr;
+    /** \brief  Number of bytes sent or received. */
+    unsigned int  msg_len;
+};
+
 /** \brief  Datagram socket type.
 
     This socket type specifies that the socket in question transmits datagrams
@@ -171,6 +206,7 @@ struct sockaddr_storage {
 #define MSG_TRUNC       0x20    /**< \brief Normal data truncated (U) */
 #define MSG_WAITALL     0x40    /**< \brief Attempt to fill read buffer */
 #define MSG_DONTWAIT    0x80    /**< \brief Make this call non-blocking (non-standard) */
+#define MSG_WAITFORONE  0x100   /**< \brief Only block for the first message (recvmmsg) */
 /** @} */
 
 /** \addtogroup networking_sockets
@@ -339,6 +375,70 @@ ssize_t send(int socket, const void *message, size_t length, int flags);
 ssize_t sendto(int socket, const void *message, size_t length, int flags,
                const struct sockaddr *dest_addr, socklen_t dest_len);
 
+/** \brief  Receive a message on a socket, into several buffers.
+
+    This works like recvfrom(), except that the data is scattered over the
+    buffers of msg->msg_iov. If the message didn't fit, MSG_TRUNC is set in
+    msg->msg_flags.
+
+    \param  socket      The socket to receive on.
+    \param  msg         The message structure to fill in.
+    \param  flags       The type of message reception.
+
+    \return             On success, the number of bytes received. On error, -1,
+                        and sets errno as appropriate.
+*/
+ssize_t recvmsg(int socket, struct msghdr *msg, int flags);
+
+/** \brief  Send a message on a socket, from several buffers.
+
+    This works like sendto(), except that the data is gathered from the
+    buffers of msg->msg_iov, and sent to msg->msg_name (if set).
+
+    \param  socket      The socket to send on.
+    \param  msg         The message to send.
+    \param  flags       The type of message transmission.
+
+    \return             On success, the number of bytes sent. On error, -1,
+                        and sets errno as appropriate.
+*/
+ssize_t sendmsg(int socket, const struct msghdr *msg, int flags);
+
+struct timespec;
+
+/** \brief  Receive several messages on a socket in one call.
+
+    On a datagram socket, this takes up to vlen datagrams off the queue at
+    once. On a blocking socket, it waits until vlen messages have come in or
+    the timeout runs out, or only for the first one if MSG_WAITFORONE is set.
+
+    \param  socket      The socket to receive on.
+    \param  msgs        The messages to fill in. The msg_len field of each is
+                        set to the number of bytes received.
+    \param  vlen        The number of entries in msgs.
+    \param  flags       The type of message reception.
+    \param  timeout     How long to wait for, or NULL to wait forever.
+
+    \return             The number of messages received, or -1 on error (and
+                        sets errno as appropriate).
+*/
+int recvmmsg(int socket, struct mmsghdr *msgs, unsigned int vlen, int flags,
+             struct timespec *timeout);
+
+/** \brief  Send several messages on a socket in one call.
+
+    \param  socket      The socket to send on.
+    \param  msgs        The messages to send. The msg_len field of each is set
+                        to the number of bytes sent.
+    \param  vlen        The number of entries in msgs.
+    \param  flags       The type of message transmission.
+
+    \return             The number of messages sent, which is less than vlen
+                        if an error stopped it early, or -1 if the first one
+                        couldn't be sent (and sets errno as appropriate).
+*/
+int sendmmsg(int socket, struct mmsghdr *msgs, unsigned int vlen, int flags);
+
 /** \brief  Shutdown socket send and receive operations.
 
     This function closes a specific socket for the set of specified operations.
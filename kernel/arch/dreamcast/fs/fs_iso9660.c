@@ -34,8 +34,12 @@ ISO9660 systems, as these were used as references as well.
 
 #include <kos/thread.h>
 #include <kos/mutex.h>
+#include <kos/cond.h>
 #include <kos/fs.h>
 #include <kos/opts.h>
+#include <kos/blockcache.h>
+
+#include <arch/timer.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -187,129 +191,83 @@ static uint32 iso_733(const uint8 *from) {
 
 
 /********************************************************************************/
-/* Low-level block caching routines. This implements a simple queue-based
-   LRU/MRU caching system. Whenever a block is requested, it will be placed
-   on the MRU end of the queue. As more blocks are loaded than can fit in
-   the cache, blocks are deleted from the LRU end. */
-
-/* Holds the data for one cache block, and a pointer to the next one.
-   As sectors are read from the disc, they are added to the front of
-   this cache. As the cache fills up, sectors are removed from the end
-   of it. */
-typedef struct {
-    uint8   *data;          /* Sector data */
-    uint32  sector;         /* CD sector */
-} cache_block_t;
+/* Low-level block caching routines. The disc is wrapped up in a block device
+   so that it can use the shared block cache, with one cache for directory
+   sectors and another for file data, so that reading a big file doesn't push
+   the directories out. */
 
-/* List of cache blocks (ordered least recently used to most recently) */
 #define NUM_CACHE_BLOCKS 16
-static cache_block_t *icache[NUM_CACHE_BLOCKS];     /* inode cache */
-static cache_block_t *dcache[NUM_CACHE_BLOCKS];     /* data cache */
-
-static unsigned char *cache_data;
-static cache_block_t *caches;
-
-/* Cache modification mutex */
-static mutex_t cache_mutex;
-
-/* Clears all cache blocks */
-static void bclear_cache(cache_block_t **cache) {
-    int i;
+static blockcache_t *icache;        /* inode cache */
+static blockcache_t *dcache;        /* data cache */
 
-    mutex_lock(&cache_mutex);
-
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++)
-        cache[i]->sector = (uint32)-1;
-
-    mutex_unlock(&cache_mutex);
-}
-
-/* Graduate a block from its current position to the MRU end of the cache */
-static void bgrad_cache(cache_block_t **cache, int block) {
-    int     i;
-    cache_block_t   *tmp;
+/* Set when a read finds that the disc has changed. The per-disc setup is done
+   once the cache is done with the read, since it empties the caches. */
+static volatile int disc_changed;
 
-    /* Don't try it with the end block */
-    if(block < 0 || block >= (NUM_CACHE_BLOCKS - 1)) return;
+/* Read sectors from the disc, by DMA if the buffer is aligned for it. */
+static int cd_read(void *buf, uint32 sector, int count) {
+    int rv;
 
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
+    rv = cdrom_read_sectors_ex(buf, sector + 150, count,
+                               ((uintptr_t)buf & 31) ? CDROM_READ_PIO :
+                               CDROM_READ_DMA);
 
-    for(i = block; i < (NUM_CACHE_BLOCKS - 1); i++)
-        cache[i] = cache[i + 1];
+    if(rv < 0) {
+        if(rv == ERR_DISC_CHG || rv == ERR_NO_DISC)
+            disc_changed = 1;
 
-    cache[NUM_CACHE_BLOCKS - 1] = tmp;
-}
-
-/* Pulls the requested sector into a cache block and returns the cache
-   block index. Note that the sector in question may already be in the
-   cache, in which case it just returns the containing block. */
-static void iso_break_all(void);
-static int bread_cache(cache_block_t **cache, uint32 sector) {
-    int i, j, rv;
-
-    rv = -1;
-    mutex_lock(&cache_mutex);
-
-    /* Look for a pre-existing cache block */
-    for(i = NUM_CACHE_BLOCKS - 1; i >= 0; i--) {
-        if(cache[i]->sector == sector) {
-            bgrad_cache(cache, i);
-            rv = NUM_CACHE_BLOCKS - 1;
-            goto bread_exit;
-        }
+        errno = EIO;
+        return -1;
     }
 
-    /* If not, look for an open cache slot; if we find one, use it */
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        if(cache[i]->sector == (uint32)-1) break;
-    }
+    return 0;
+}
 
-    /* If we didn't find one, kick an LRU block out of cache */
-    if(i >= NUM_CACHE_BLOCKS) {
-        i = 0;
+/* Do the per-disc setup if a read found a new disc. */
+static void disc_check(void) {
+    if(disc_changed) {
+        disc_changed = 0;
+        init_percd();
     }
+}
 
-    /* Load the requested block */
-    j = cdrom_read_sectors_ex(cache[i]->data, sector + 150, 1, CDROM_READ_DMA);
-
-    if(j < 0) {
-        //dbglog(DBG_ERROR, "fs_iso9660: can't read_sectors for %d: %d\n",
-        //  sector+150, j);
-        if(j == ERR_DISC_CHG || j == ERR_NO_DISC) {
-            init_percd();
-        }
+static int cd_read_blocks(kos_blockdev_t *d, uint64_t block, size_t count,
+                          void *buf) {
+    (void)d;
+    return cd_read(buf, (uint32)block, (int)count);
+}
 
-        rv = -1;
-        goto bread_exit;
-    }
+static kos_blockdev_t cd_dev = {
+    .l_block_size = 11,
+    .read_blocks = cd_read_blocks
+};
 
-    cache[i]->sector = sector;
+/* Pulls the requested sector into the given cache and returns its data. Note
+   that the sector in question may already be in the cache, in which case it
+   doesn't need to be read. */
+static uint8 *bread_cache(blockcache_t *cache, uint32 sector, uint32 flags) {
+    uint8 *data = blockcache_get(cache, sector, flags, NULL);
 
-    /* Move it to the most-recently-used position */
-    bgrad_cache(cache, i);
-    rv = NUM_CACHE_BLOCKS - 1;
+    if(!data)
+        disc_check();
 
-    /* Return the new cache block index */
-bread_exit:
-    mutex_unlock(&cache_mutex);
-    return rv;
+    return data;
 }
 
 /* read data block */
-static int bdread(uint32 sector) {
-    return bread_cache(dcache, sector);
+static uint8 *bdread(uint32 sector, uint32 flags) {
+    return bread_cache(dcache, sector, flags);
 }
 
 /* read inode block */
-static int biread(uint32 sector) {
-    return bread_cache(icache, sector);
+static uint8 *biread(uint32 sector) {
+    return bread_cache(icache, sector, 0);
 }
 
 /* Clear both caches */
 static void bclear(void) {
-    bclear_cache(dcache);
-    bclear_cache(icache);
+    blockcache_invalidate(dcache);
+    blockcache_invalidate(icache);
 }
 
 /********************************************************************************/
@@ -328,7 +286,8 @@ static iso_dirent_t root_dirent;
 /* Per-disc initialization; this is done every time it's discovered that
    a new CD has been inserted. */
 static int init_percd(void) {
-    int     i, blk;
+    int     i;
+    uint8   *blk = NULL;
     CDROM_TOC   toc;
 
     dbglog(DBG_NOTICE, "fs_iso9660: disc change detected\n");
@@ -354,10 +313,10 @@ static int init_percd(void) {
     for(i = 1; i <= 3; i++) {
         blk = biread(session_base + i + 16 - 150);
 
-        if(blk < 0) return blk;
+        if(!blk) return -1;
 
-        if(memcmp((char *)icache[blk]->data, "\02CD001", 6) == 0) {
-            joliet = isjoliet((char *)icache[blk]->data + 88);
+        if(memcmp((char *)blk, "\02CD001", 6) == 0) {
+            joliet = isjoliet((char *)blk + 88);
             dbglog(DBG_NOTICE, "  (joliet level %d extensions detected)\n", joliet);
 
             if(joliet) break;
@@ -369,16 +328,16 @@ static int init_percd(void) {
         /* Grab and check the volume descriptor */
         blk = biread(session_base + 16 - 150);
 
-        if(blk < 0) return i;
+        if(!blk) return -1;
 
-        if(memcmp((char*)icache[blk]->data, "\01CD001", 6)) {
+        if(memcmp((char*)blk, "\01CD001", 6)) {
             dbglog(DBG_ERROR, "fs_iso9660: disc is not iso9660\r\n");
             return -1;
         }
     }
 
     /* Locate the root directory */
-    memcpy(&root_dirent, icache[blk]->data + 156, sizeof(iso_dirent_t));
+    memcpy(&root_dirent, blk + 156, sizeof(iso_dirent_t));
     root_extent = iso_733(root_dirent.extent);
     root_size = iso_733(root_dirent.size);
 
@@ -427,7 +386,8 @@ static int fncompare(const char *isofn, int isosize, const char *normalfn) {
  */
 static iso_dirent_t *find_object(const char *fn, int dir,
                                  uint32 dir_extent, uint32 dir_size) {
-    int     i, c;
+    int     i;
+    uint8       *blk;
     iso_dirent_t    *de;
 
     /* RockRidge */
@@ -448,13 +408,13 @@ static iso_dirent_t *find_object(const char *fn, int dir,
         utf2ucs(ucsname, (uint8 *)fn);
 
     while(size_left > 0) {
-        c = biread(dir_extent);
+        blk = biread(dir_extent);
 
-        if(c < 0) return NULL;
+        if(!blk) return NULL;
 
         for(i = 0; i < 2048 && i < size_left;) {
             /* Locate the current dirent */
-            de = (iso_dirent_t *)(icache[c]->data + i);
+            de = (iso_dirent_t *)(blk + i);
 
             if(!de->length) break;
 
@@ -571,6 +531,33 @@ static iso_dirent_t *find_object_path(const char *fn, int dir, iso_dirent_t *sta
 
 /* File handles.. I could probably do this with a linked list, but I'm just
    too lazy right now. =) */
+/* Read-ahead for files that are read in order. Once a file has had RA_TRIGGER
+   reads in a row that each started where the last one ended, the sectors after
+   the ones read are queued up with the drive, RA_SECTORS at a time, into a
+   pair of windows: while the file is read out of one, the other is filled. */
+#define RA_SECTORS      16
+#define RA_TRIGGER      2
+
+#define RA_EMPTY        0
+#define RA_PENDING      1
+#define RA_READY        2
+
+typedef struct iso_ra_win {
+    cdrom_read_req_t req;
+    uint8           *data;
+    uint32          start;          /* First sector in the window */
+    int             count;          /* Number of sectors in the window */
+    int             state;
+} iso_ra_win_t;
+
+typedef struct iso_ra {
+    iso_ra_win_t    win[2];
+    uint8           *buf;
+} iso_ra_t;
+
+static mutex_t ra_mutex;
+static condvar_t ra_cond;
+
 static struct {
     uint32      first_extent;   /* First sector */
     bool        dir;            /* True if a directory */
@@ -578,11 +565,151 @@ static struct {
     uint32      size;           /* Length of file in bytes */
     dirent_t    dirent;         /* A static dirent to pass back to clients */
     bool        broken;         /* True if the CD has been swapped out since open */
+    uint32      last_ptr;       /* Where the last read ended */
+    int         seq;            /* Number of reads in a row that were in order */
+    iso_ra_t    *ra;            /* Read-ahead windows, if any */
+    iso_read_stats_t stats;     /* Read statistics */
 } fh[FS_CD_MAX_FILES];
 
 /* Mutex for file handles */
 static mutex_t fh_mutex;
 
+static void ra_done(int result, void *d) {
+    iso_ra_win_t *w = (iso_ra_win_t *)d;
+
+    if(result == ERR_DISC_CHG || result == ERR_NO_DISC)
+        disc_changed = 1;
+
+    mutex_lock(&ra_mutex);
+    w->state = (result == ERR_OK) ? RA_READY : RA_EMPTY;
+    cond_broadcast(&ra_cond);
+    mutex_unlock(&ra_mutex);
+}
+
+static int ra_start(iso_ra_win_t *w, uint32 start, uint32 end) {
+    w->start = start;
+    w->count = (end - start > RA_SECTORS) ? RA_SECTORS : (int)(end - start);
+    w->state = RA_PENDING;
+
+    if(cdrom_read_sectors_async(&w->req, w->data, start + 150, w->count,
+                                CDROM_READ_DMA, ra_done, w) != ERR_OK) {
+        w->state = RA_EMPTY;
+        return -1;
+    }
+
+    return 0;
+}
+
+static iso_ra_win_t *ra_find(iso_ra_t *ra, uint32 sector) {
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        if(ra->win[i].state != RA_EMPTY && sector >= ra->win[i].start &&
+           sector < ra->win[i].start + ra->win[i].count)
+            return &ra->win[i];
+    }
+
+    return NULL;
+}
+
+/* Get a sector from the read-ahead windows, waiting for it if it's on the
+   way. The data stays put until the next ra_advance() on the file. */
+static uint8 *ra_get(file_t fd, uint32 sector) {
+    iso_ra_win_t *w;
+    uint8 *data = NULL;
+
+    if(!fh[fd].ra)
+        return NULL;
+
+    mutex_lock(&ra_mutex);
+
+    if((w = ra_find(fh[fd].ra, sector))) {
+        if(w->state == RA_PENDING)
+            ++fh[fd].stats.ra_waits;
+
+        while(w->state == RA_PENDING)
+            cond_wait(&ra_cond, &ra_mutex);
+
+        if(w->state == RA_READY)
+            data = w->data + (sector - w->start) * 2048;
+    }
+
+    mutex_unlock(&ra_mutex);
+    return data;
+}
+
+/* Make sure that the sector at the file's position and the window after it
+   are read ahead. */
+static void ra_advance(file_t fd) {
+    iso_ra_t *ra = fh[fd].ra;
+    iso_ra_win_t *w, *other;
+    uint32 next = fh[fd].first_extent + fh[fd].ptr / 2048;
+    uint32 end = fh[fd].first_extent + (fh[fd].size + 2047) / 2048;
+    uint32 after;
+
+    if(next >= end)
+        return;
+
+    if(!ra) {
+        if(!(ra = (iso_ra_t *)calloc(1, sizeof(iso_ra_t))))
+            return;
+
+        if(!(ra->buf = (uint8 *)memalign(32, 2 * RA_SECTORS * 2048))) {
+            free(ra);
+            return;
+        }
+
+        ra->win[0].data = ra->buf;
+        ra->win[1].data = ra->buf + RA_SECTORS * 2048;
+        fh[fd].ra = ra;
+    }
+
+    mutex_lock(&ra_mutex);
+
+    if(!(w = ra_find(ra, next))) {
+        w = (ra->win[0].state != RA_PENDING) ? &ra->win[0] : &ra->win[1];
+
+        if(w->state == RA_PENDING)
+            goto out;
+
+        if(ra_start(w, next, end))
+            goto out;
+
+        fh[fd].stats.commands++;
+    }
+
+    other = (w == &ra->win[0]) ? &ra->win[1] : &ra->win[0];
+    after = w->start + w->count;
+
+    if(after < end && other->state != RA_PENDING &&
+       (other->state == RA_EMPTY || other->start != after)) {
+        if(!ra_start(other, after, end))
+            fh[fd].stats.commands++;
+    }
+
+out:
+    mutex_unlock(&ra_mutex);
+}
+
+/* Wait for any read-ahead on a file to finish, and then drop it. */
+static void ra_free(file_t fd) {
+    iso_ra_t *ra = fh[fd].ra;
+
+    if(!ra)
+        return;
+
+    mutex_lock(&ra_mutex);
+
+    while(ra->win[0].state == RA_PENDING || ra->win[1].state == RA_PENDING)
+        cond_wait(&ra_cond, &ra_mutex);
+
+    mutex_unlock(&ra_mutex);
+
+    fh[fd].ra = NULL;
+    free(ra->buf);
+    free(ra);
+}
+
 /* Break all of our open file descriptor. This is necessary when the disc
    is changed so that we don't accidentally try to keep on doing stuff
    with the old info. As files are closed and re-opened, the broken flag
@@ -649,6 +776,9 @@ static void * iso_open(vfs_handler_t * vfs, const char *fn, int mode) {
     fh[fd].ptr = 0;
     fh[fd].size = iso_733(de->size);
     fh[fd].broken = false;
+    fh[fd].last_ptr = 0;
+    fh[fd].seq = 0;
+    memset(&fh[fd].stats, 0, sizeof(iso_read_stats_t));
 
     return (void *)fd;
 }
@@ -659,79 +789,77 @@ static int iso_close(void * h) {
 
     /* Check that the fd is valid */
     if(fd < FS_CD_MAX_FILES) {
+        ra_free(fd);
+
         /* No need to lock the mutex: this is an atomic op */
         fh[fd].first_extent = 0;
     }
     return 0;
 }
 
-/* Read from a file */
-static ssize_t iso_read(void * h, void *buf, size_t bytes) {
-    int rv, toread, thissect, c;
-    uint8 * outbuf;
-    file_t fd = (file_t)h;
-
-    /* Check that the fd is valid */
-    if(fd >= FS_CD_MAX_FILES || fh[fd].first_extent == 0 || fh[fd].broken) {
-        errno = EBADF;
-        return -1;
-    }
+/* Read from the given position in a file, moving the position along. On
+   failure, this returns -1 with the position just past what did get read. */
+static ssize_t iso_read_at(file_t fd, uint8 *outbuf, size_t bytes,
+                           uint32 *ptr) {
+    int rv, toread, thissect;
+    uint32 sector;
+    uint8 * data;
 
     rv = 0;
-    outbuf = (uint8 *)buf;
 
-    /* Read zero or more sectors into the buffer from the current pos */
+    /* Read zero or more sectors into the buffer from the position */
     while(bytes > 0) {
         /* Figure out how much we still need to read */
-        toread = (bytes > (fh[fd].size - fh[fd].ptr)) ?
-                 fh[fd].size - fh[fd].ptr : bytes;
+        toread = (bytes > (fh[fd].size - *ptr)) ?
+                 fh[fd].size - *ptr : bytes;
 
         if(toread == 0) break;
 
         /* How much more can we read in the current sector? */
-        thissect = 2048 - (fh[fd].ptr % 2048);
-
-        /* If we're on a sector boundary and we have more than one
-           full sector to read, then short-circuit the cache here
-           and use the multi-sector reads from the CD unit (this
-           should theoretically be a lot faster) */
-        /* XXX This code isn't actually faster, but I'm leaving it
-           here commented out in case we could find a better use
-           for it later than speed (i.e., preventing thread context
-           switches). */
-        /* if(thissect == 2048 && toread >= 2048) {
-            // Round it off to an even sector count
-            thissect = toread / 2048;
-            toread = thissect * 2048;
-
-            printf("cdrom: short-circuit read for %d sectors\n",
-                thissect);
-
-            // Do the read
-            if(cdrom_read_sectors(outbuf,
-                fh[fd].first_extent + fh[fd].ptr/2048 + 150,
-                thissect) < 0)
-            {
-                // Something went wrong...
-                return -1;
+        thissect = 2048 - (*ptr % 2048);
+        sector = fh[fd].first_extent + *ptr / 2048;
+
+        if((data = ra_get(fd, sector))) {
+            /* It's been read ahead already (or is being read now). */
+            toread = (toread > thissect) ? thissect : toread;
+            memcpy(outbuf, data + (*ptr % 2048), toread);
+            fh[fd].stats.ra_bytes += toread;
+        }
+        else if(thissect == 2048 && toread >= 2048 &&
+                !((uintptr_t)outbuf & 1)) {
+            /* Whole sectors go straight into the caller's buffer, all in one
+               go, rather than one at a time through the cache. */
+            toread &= ~2047;
+
+            if(cd_read(outbuf, sector, toread / 2048)) {
+                disc_check();
+                rv = -1;
+                break;
             }
-        } else { */
-        toread = (toread > thissect) ? thissect : toread;
 
-        /* Do the read */
-        c = bdread(fh[fd].first_extent + fh[fd].ptr / 2048);
-
-        if(c < 0) {
-            errno = EIO;
-            return -1;
+            fh[fd].stats.direct_bytes += toread;
+            fh[fd].stats.commands++;
         }
+        else {
+            toread = (toread > thissect) ? thissect : toread;
+
+            /* Do the read, keeping the sector in the cache while we copy out
+               of it, in case another thread is reading too. */
+            data = bdread(sector, BLOCKCACHE_PIN);
 
-        memcpy(outbuf, dcache[c]->data + (fh[fd].ptr % 2048), toread);
-        /* } */
+            if(!data) {
+                errno = EIO;
+                rv = -1;
+                break;
+            }
+
+            memcpy(outbuf, data + (*ptr % 2048), toread);
+            blockcache_unpin(dcache, data);
+        }
 
         /* Adjust pointers */
         outbuf += toread;
-        fh[fd].ptr += toread;
+        *ptr += toread;
         bytes -= toread;
         rv += toread;
     }
@@ -739,6 +867,73 @@ static ssize_t iso_read(void * h, void *buf, size_t bytes) {
     return rv;
 }
 
+/* Read from a file */
+static ssize_t iso_read(void * h, void *buf, size_t bytes) {
+    ssize_t rv;
+    uint64 start;
+    file_t fd = (file_t)h;
+
+    /* Check that the fd is valid */
+    if(fd >= FS_CD_MAX_FILES || fh[fd].first_extent == 0 || fh[fd].broken) {
+        errno = EBADF;
+        return -1;
+    }
+
+    start = timer_us_gettime64();
+
+    /* Keep track of whether the file is being read in order. */
+    if(fh[fd].ptr == fh[fd].last_ptr)
+        fh[fd].seq++;
+    else
+        fh[fd].seq = 0;
+
+    rv = iso_read_at(fd, (uint8 *)buf, bytes, &fh[fd].ptr);
+    fh[fd].last_ptr = fh[fd].ptr;
+
+    if(rv > 0) {
+        if(fh[fd].seq >= RA_TRIGGER)
+            ra_advance(fd);
+
+        fh[fd].stats.bytes += rv;
+    }
+
+    fh[fd].stats.read_us += timer_us_gettime64() - start;
+    return rv;
+}
+
+/* Read from an offset in a file, leaving the file position (and whether it's
+   being read in order) alone. */
+static ssize_t iso_pread(void * h, void *buf, size_t bytes, _off64_t offset) {
+    ssize_t rv;
+    uint64 start;
+    uint32 ptr;
+    file_t fd = (file_t)h;
+
+    /* Check that the fd is valid */
+    if(fd >= FS_CD_MAX_FILES || fh[fd].first_extent == 0 || fh[fd].broken) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if((uint64)offset >= fh[fd].size)
+        return 0;
+
+    start = timer_us_gettime64();
+    ptr = (uint32)offset;
+    rv = iso_read_at(fd, (uint8 *)buf, bytes, &ptr);
+
+    if(rv > 0)
+        fh[fd].stats.bytes += rv;
+
+    fh[fd].stats.read_us += timer_us_gettime64() - start;
+    return rv;
+}
+
 /* Seek elsewhere in a file */
 static off_t iso_seek(void * h, off_t offset, int whence) {
     file_t fd = (file_t)h;
@@ -833,7 +1028,7 @@ static void fn_postprocess(char *fnin) {
 
 /* Read a directory entry */
 static dirent_t *iso_readdir(void * h) {
-    int     c;
+    uint8       *blk;
     iso_dirent_t    *de;
 
     /* RockRidge */
@@ -850,16 +1045,16 @@ static dirent_t *iso_readdir(void * h) {
 
     /* Scan forwards until we find the next valid entry, an
        end-of-entry mark, or run out of dir size. */
-    c = -1;
+    blk = NULL;
     de = NULL;
 
     while(fh[fd].ptr < fh[fd].size) {
         /* Get the current dirent block */
-        c = biread(fh[fd].first_extent + fh[fd].ptr / 2048);
+        blk = biread(fh[fd].first_extent + fh[fd].ptr / 2048);
 
-        if(c < 0) return NULL;
+        if(!blk) return NULL;
 
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(blk + (fh[fd].ptr % 2048));
 
         if(de->length) break;
 
@@ -872,9 +1067,9 @@ static dirent_t *iso_readdir(void * h) {
     /* If we're at the first, skip the two blank entries */
     if(!de->name[0] && de->name_len == 1) {
         fh[fd].ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(blk + (fh[fd].ptr % 2048));
         fh[fd].ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(blk + (fh[fd].ptr % 2048));
 
         if(!de->length) return NULL;
     }
@@ -1048,6 +1243,31 @@ static int iso_fcntl(void *h, int cmd, va_list ap) {
     return rv;
 }
 
+static int iso_ioctl(void *h, int cmd, va_list ap) {
+    file_t fd = (file_t)h;
+    iso_read_stats_t *stats;
+
+    if(fd >= FS_CD_MAX_FILES || !fh[fd].first_extent || fh[fd].broken) {
+        errno = EBADF;
+        return -1;
+    }
+
+    switch(cmd) {
+        case ISO_IOCTL_READ_STATS:
+            if(!(stats = va_arg(ap, iso_read_stats_t *))) {
+                errno = EFAULT;
+                return -1;
+            }
+
+            *stats = fh[fd].stats;
+            return 0;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
 static int iso_fstat(void *h, struct stat *st) {
     file_t fd = (file_t)h;
 
@@ -1089,7 +1309,7 @@ static vfs_handler_t vh = {
     iso_tell,
     iso_total,
     iso_readdir,
-    NULL,
+    iso_ioctl,
     NULL,
     NULL,
     NULL,
@@ -1106,13 +1326,13 @@ static vfs_handler_t vh = {
     NULL,               /* total64 */
     NULL,               /* readlink */
     iso_rewinddir,
-    iso_fstat
+    iso_fstat,
+    iso_pread,
+    NULL                /* pwrite */
 };
 
 /* Initialize the file system */
 void fs_iso9660_init(void) {
-    int i;
-
     /* Reset fd's */
     memset(fh, 0, sizeof(fh));
 
@@ -1120,21 +1340,13 @@ void fs_iso9660_init(void) {
     fh[0].first_extent = -1;
 
     /* Init thread mutexes */
-    mutex_init(&cache_mutex, MUTEX_TYPE_NORMAL);
     mutex_init(&fh_mutex, MUTEX_TYPE_NORMAL);
+    mutex_init(&ra_mutex, MUTEX_TYPE_NORMAL);
+    cond_init(&ra_cond);
 
-    /* Allocate cache block space, properly aligned for DMA access */
-    cache_data = memalign(32, 2 * NUM_CACHE_BLOCKS * 2048);
-    caches = malloc(2 * NUM_CACHE_BLOCKS * sizeof(cache_block_t));
-
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        icache[i] = &caches[i * 2];
-        icache[i]->data = &cache_data[i * 2 * 2048];
-        icache[i]->sector = -1;
-        dcache[i] = &caches[i * 2 + 1];
-        dcache[i]->data = &cache_data[i * 2 * 2048 + 2048];
-        dcache[i]->sector = -1;
-    }
+    /* Set up the caches, which are properly aligned for DMA access */
+    icache = blockcache_create(&cd_dev, 1, NUM_CACHE_BLOCKS * 2048, 0);
+    dcache = blockcache_create(&cd_dev, 1, NUM_CACHE_BLOCKS * 2048, 0);
 
     percd_done = 0;
     iso_last_status = -1;
@@ -1152,12 +1364,13 @@ void fs_iso9660_shutdown(void) {
     vblank_handler_remove(iso_vblank_hnd);
 
     /* Dealloc cache block space */
-    free(cache_data);
-    free(caches);
+    blockcache_destroy(icache);
+    blockcache_destroy(dcache);
 
     /* Free muteces */
-    mutex_destroy(&cache_mutex);
     mutex_destroy(&fh_mutex);
+    mutex_destroy(&ra_mutex);
+    cond_destroy(&ra_cond);
 
     nmmgr_handler_remove(&vh.nmmgr);
 }
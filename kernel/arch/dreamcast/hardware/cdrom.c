@@ -14,13 +14,17 @@
 #include <arch/cache.h>
 #include <arch/timer.h>
 #include <arch/memory.h>
+#include <arch/irq.h>
 
+#include <dc/asic.h>
 #include <dc/cdrom.h>
 #include <dc/g1ata.h>
 #include <dc/syscalls.h>
 
 #include <kos/thread.h>
+#include <kos/worker_thread.h>
 #include <kos/mutex.h>
+#include <kos/sem.h>
 #include <kos/dbglog.h>
 
 /*
@@ -42,6 +46,11 @@ they require their parameters to be in certain registers, which is
 normally the case with the default options. If in doubt, decompile the
 output and look to make sure.
 
+While a command is moving data by DMA, the thread waiting on it sleeps
+until the G1 DMA interrupt comes in, rather than polling the BIOS the whole
+time. Reads can also be queued with cdrom_read_sectors_async(), which hands
+them to a thread of their own and tells the caller when they're done.
+
 XXX: This could all be done in a non-blocking way by taking advantage of
 command queuing. Every call to syscall_gdrom_send_command returns a 
 'request id' which just needs to eventually be checked by cmd_stat. A 
@@ -58,6 +67,50 @@ mutex_t _g1_ata_mutex = MUTEX_INITIALIZER;
 
 static int cur_sector_size = 2048;
 
+/* Set while a thread sleeps on a DMA started by the BIOS. */
+static volatile int dma_waiting = 0;
+static semaphore_t dma_done = SEM_INITIALIZER(0);
+
+/* Thread that does the reads queued by cdrom_read_sectors_async() */
+static kthread_worker_t *read_worker = NULL;
+
+/* Called on GD DMA completion. This is also called by the G1 ATA driver's
+   handler for DMA that it didn't start itself. */
+void _cdrom_dma_irq_hnd(uint32_t code, void *data) {
+    (void)code;
+    (void)data;
+
+    if(dma_waiting) {
+        dma_waiting = 0;
+        sem_signal(&dma_done);
+        thd_schedule(1, 0);
+    }
+}
+
+/* Sleep until the DMA in progress, if there is one, is done. Returns 1 if it
+   slept, 0 if there was no DMA and -1 if it timed out. */
+static int cdrom_wait_dma(int timeout) {
+    uint32_t flags = irq_disable();
+
+    if(!g1_dma_in_progress()) {
+        irq_restore(flags);
+        return 0;
+    }
+
+    dma_waiting = 1;
+    irq_restore(flags);
+
+    if(sem_wait_timed(&dma_done, timeout)) {
+        dma_waiting = 0;
+
+        /* Don't leave a late signal around for the next DMA. */
+        sem_trywait(&dma_done);
+        return -1;
+    }
+
+    return 1;
+}
+
 /* Shortcut to cdrom_reinit_ex. Typically this is the only thing changed. */
 int cdrom_set_sector_size(int size) {
     return cdrom_reinit_ex(-1, -1, size);
@@ -77,7 +130,7 @@ int cdrom_exec_cmd_timed(int cmd, void *param, int timeout) {
     };
     gdc_cmd_hnd_t hnd;
     int n, rv = ERR_OK;
-    uint64_t begin;
+    uint64_t begin, elapsed = 0;
 
     assert(cmd > 0 && cmd < CMD_MAX);
     mutex_lock_scoped(&_g1_ata_mutex);
@@ -107,7 +160,9 @@ int cdrom_exec_cmd_timed(int cmd, void *param, int timeout) {
             break;
         }
         if(timeout) {
-            if((timer_ms_gettime64() - begin) >= (unsigned)timeout) {
+            elapsed = timer_ms_gettime64() - begin;
+
+            if(elapsed >= (unsigned)timeout) {
                 syscall_gdrom_abort_command(hnd);
                 syscall_gdrom_exec_server();
                 rv = ERR_TIMEOUT;
@@ -115,6 +170,13 @@ int cdrom_exec_cmd_timed(int cmd, void *param, int timeout) {
                 break;
             }
         }
+
+        /* Once the BIOS has the data moving, there's nothing to do until the
+           DMA is done, so sleep until then. */
+        if(cmd == CMD_DMAREAD &&
+           cdrom_wait_dma(timeout ? timeout - (int)elapsed : 0) > 0)
+            continue;
+
         thd_pass();
     } while(1);
 
@@ -312,6 +374,76 @@ int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode) {
     return rv;
 }
 
+static void read_thread(void *d) {
+    kthread_job_t *job;
+    cdrom_read_req_t *req;
+    cdrom_read_cb_t cb;
+    void *data;
+    int rv;
+
+    (void)d;
+
+    while((job = thd_worker_dequeue_job(read_worker))) {
+        req = (cdrom_read_req_t *)job->data;
+        rv = cdrom_read_sectors_ex(req->buffer, req->sector, req->cnt,
+                                   req->mode);
+
+        /* The request might be gone as soon as it's signaled. */
+        cb = req->cb;
+        data = req->data;
+        req->result = rv;
+        sem_signal(&req->done);
+
+        if(cb)
+            cb(rv, data);
+    }
+}
+
+/* Queue up a sector read */
+int cdrom_read_sectors_async(cdrom_read_req_t *req, void *buffer, int sector,
+                             int cnt, int mode, cdrom_read_cb_t cb,
+                             void *data) {
+    uintptr_t buf_addr = ((uintptr_t)buffer);
+
+    if(!read_worker)
+        return ERR_SYS;
+
+    if(mode == CDROM_READ_DMA && (buf_addr & 0x1f)) {
+        dbglog(DBG_ERROR, "cdrom_read_sectors_async: Unaligned memory for DMA (32-byte).\n");
+        return ERR_SYS;
+    }
+    else if(mode == CDROM_READ_PIO && (buf_addr & 0x01)) {
+        dbglog(DBG_ERROR, "cdrom_read_sectors_async: Unaligned memory for PIO (2-byte).\n");
+        return ERR_SYS;
+    }
+    else if(mode != CDROM_READ_DMA && mode != CDROM_READ_PIO) {
+        return ERR_SYS;
+    }
+
+    req->job.data = req;
+    req->buffer = buffer;
+    req->sector = sector;
+    req->cnt = cnt;
+    req->mode = mode;
+    req->cb = cb;
+    req->data = data;
+    req->result = ERR_OK;
+    sem_init(&req->done, 0);
+
+    thd_worker_add_job(read_worker, &req->job);
+    thd_worker_wakeup(read_worker);
+
+    return ERR_OK;
+}
+
+/* Wait for a queued read to finish */
+int cdrom_read_wait(cdrom_read_req_t *req) {
+    sem_wait(&req->done);
+    sem_destroy(&req->done);
+
+    return req->result;
+}
+
 /* Basic old sector read */
 int cdrom_read_sectors(void *buffer, int sector, int cnt) {
     return cdrom_read_sectors_ex(buffer, sector, cnt, CDROM_READ_PIO);
@@ -410,6 +542,7 @@ int cdrom_spin_down(void) {
 
 /* Initialize: assume no threading issues */
 void cdrom_init(void) {
+    kthread_attr_t attr = { 0 };
     uint32_t p;
     volatile uint32_t *react = (uint32_t *)(0x005f74e4 | MEM_AREA_P2_BASE);
     volatile uint32_t *bios = (uint32_t *)MEM_AREA_P2_BASE;
@@ -439,10 +572,23 @@ void cdrom_init(void) {
     syscall_gdrom_init();
     mutex_unlock(&_g1_ata_mutex);
 
+    /* Hook the GD DMA event so that reads can sleep while the data moves. */
+    asic_evt_set_handler(ASIC_EVT_GD_DMA, _cdrom_dma_irq_hnd, NULL);
+    asic_evt_enable(ASIC_EVT_GD_DMA, ASIC_IRQB);
+
+    /* Start the thread for queued reads. */
+    attr.label = "[cdrom]";
+    read_worker = thd_worker_create_ex(&attr, read_thread, NULL);
+
     cdrom_reinit();
 }
 
 void cdrom_shutdown(void) {
+    if(read_worker) {
+        thd_worker_destroy(read_worker);
+        read_worker = NULL;
+    }
 
-    /* What would you want done here? */
+    asic_evt_disable(ASIC_EVT_GD_DMA, ASIC_IRQB);
+    asic_evt_remove_handler(ASIC_EVT_GD_DMA);
 }
@@ -183,6 +183,7 @@ static kthread_t *dma_thd = NULL;
 
 /* From cdrom.c */
 extern mutex_t _g1_ata_mutex;
+extern void _cdrom_dma_irq_hnd(uint32_t code, void *data);
 
 #define g1_ata_wait_status(n) \
     do {} while((IN8(G1_ATA_ALTSTATUS) & (n)))
@@ -241,8 +242,6 @@ static void g1_dma_irq_hnd(uint32 code, void *data) {
     unsigned int nb_sectors;
 
     /* XXXX: Probably should look at the code to make sure it isn't an error. */
-    (void)code;
-    (void)data;
 
     if(dma_in_progress && !can_lba48 && dma_nb_sectors > 256) {
         dma_sector += 256;
@@ -274,6 +273,10 @@ static void g1_dma_irq_hnd(uint32 code, void *data) {
         g1_ata_select_device(G1_ATA_MASTER);
         mutex_unlock_as_thread(&_g1_ata_mutex, dma_thd);
     }
+    else if(code == ASIC_EVT_GD_DMA) {
+        /* Not ours, so it's a GD-ROM read done by the BIOS. */
+        _cdrom_dma_irq_hnd(code, data);
+    }
 }
 
 /* Set the device select register to select a particular device. */
@@ -1412,9 +1415,9 @@ void g1_ata_shutdown(void) {
 
     memset(&device, 0, sizeof(device));
 
-    /* Unhook the events and disable the IRQs. */
-    asic_evt_disable(ASIC_EVT_GD_DMA, ASIC_IRQB);
-    asic_evt_remove_handler(ASIC_EVT_GD_DMA);
+    /* Unhook the events and disable the IRQs, giving DMA completion back to
+       the GD-ROM driver. */
+    asic_evt_set_handler(ASIC_EVT_GD_DMA, _cdrom_dma_irq_hnd, NULL);
     asic_evt_disable(ASIC_EVT_GD_DMA_OVERRUN, ASIC_IRQB);
     asic_evt_remove_handler(ASIC_EVT_GD_DMA_OVERRUN);
     asic_evt_disable(ASIC_EVT_GD_DMA_ILLADDR, ASIC_IRQB);
@@ -618,13 +618,66 @@ static int rx_enq(int ring_offset, size_t pkt_size) {
         return 1;
 }
 
-/* Transmit a single packet */
+/* Bytes of a misaligned piece that are staged through an aligned buffer at a
+   time by bba_tx_copy(). */
+#define TX_STAGE_LEN    256
+
+/* Copy one piece of a packet out to RTL memory */
+static void bba_tx_copy(const uint8 *pkt, uint32 dst, int len) {
+    uint32_t stage[TX_STAGE_LEN / 4];
+    int n;
+
+    /* XXX could use store queues or memcpy8 here */
+
+    /* Byte accesses take one G2 bus cycle per byte, so as much as possible is
+       written with g2_write_block_32. Get the destination 32-bit aligned
+       first (the pieces after the headers usually start at 2 mod 4). */
+    n = (4 - (dst & 0x03)) & 0x03;
+
+    if(n > len)
+        n = len;
+
+    if(n) {
+        g2_write_block_8(pkt, dst, n);
+        pkt += n;
+        dst += n;
+        len -= n;
+    }
+
+    if(len >= 4 && !((uint32)pkt & 0x03)) {
+        g2_write_block_32((const uint32_t *)pkt, dst, len >> 2);
+        pkt += len & ~3;
+        dst += len & ~3;
+        len &= 3;
+    }
+    else {
+        /* The source isn't aligned the same way, so copy it to an aligned
+           buffer first. That's still far quicker than byte writes. */
+        while(len >= 4) {
+            n = len < TX_STAGE_LEN ? (len & ~3) : TX_STAGE_LEN;
+            memcpy(stage, pkt, n);
+            g2_write_block_32(stage, dst, n >> 2);
+            pkt += n;
+            dst += n;
+            len -= n;
+        }
+    }
+
+    /* Whatever doesn't fit in whole words is written with g2_write_block_8,
+       so as to not read past the end of the piece. */
+    if(len)
+        g2_write_block_8(pkt, dst, len);
+}
+
+/* Transmit a single packet, gathered from a chain of packet buffers */
 #ifdef TX_SEMA
-static int bba_rtx(const uint8 * pkt, int len, int wait)
+static int bba_rtx(const net_pbuf_t *p, int wait)
 #else
-static int bba_tx(const uint8 * pkt, int len, int wait)
+static int bba_tx_pbuf(const net_pbuf_t *p, int wait)
 #endif
 {
+    int len = 0;
+
     if(!link_stable) {
         if(wait == BBA_TX_WAIT) {
             while(!link_stable)
@@ -648,22 +701,13 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
         }
     }
 
-    /* Copy the packet out to RTL memory */
-    /* XXX could use store queues or memcpy8 here */
+    /* Copy the packet out to RTL memory, one piece at a time */
+    for(; p; p = p->next) {
+        if(len + p->len > TX_BUFFER_LEN)
+            return BBA_TX_ERROR;
 
-    //g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
-
-    /* Check alignment of the packet, if its 32-bit aligned, use
-       g2_write_block_32, if its 16-bit aligned, use g2_write_block_16,
-       otherwise, use g2_write_block_8. */
-    if(!((uint32)pkt & 0x03)) {
-        g2_write_block_32((uint32 *) pkt, txdesc[rtl.cur_tx], (len + 3) >> 2);
-    }
-    else if(!((uint32)pkt & 0x01)) {
-        g2_write_block_16((uint16 *) pkt, txdesc[rtl.cur_tx], (len + 1) >> 1);
-    }
-    else {
-        g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
+        bba_tx_copy(p->data, txdesc[rtl.cur_tx] + len, p->len);
+        len += p->len;
     }
 
     /* All packets must be at least 60 bytes, pad them with null bytes if
@@ -683,7 +727,7 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
 }
 
 #ifdef TX_SEMA
-int bba_tx(const uint8 * pkt, int len, int wait) {
+static int bba_tx_pbuf(const net_pbuf_t *p, int wait) {
     int res;
 
     if(irq_inside_int()) {
@@ -695,13 +739,22 @@ int bba_tx(const uint8 * pkt, int len, int wait) {
     else
         sem_wait(&tx_sema);
 
-    res = bba_rtx(pkt, len, wait);
+    res = bba_rtx(p, wait);
     sem_signal(&tx_sema);
 
     return res;
 }
 #endif
 
+/* Transmit a single packet */
+int bba_tx(const uint8 * pkt, int len, int wait) {
+    net_pbuf_t p;
+
+    net_pbuf_init(&p, (uint8 *)pkt, len, 0);
+
+    return bba_tx_pbuf(&p, wait);
+}
+
 void bba_lock(void) {
     //sem_wait(&bba_rx_sema2);
     //asic_evt_disable(ASIC_EVT_EXP_PCI, BBA_ASIC_IRQ);
@@ -933,7 +986,7 @@ static int bba_if_start(netif_t *self) {
     sem_init(&bba_rx_sema, 0);
     sem_init(&bba_rx_sema2, 1);
     bba_rx_thread = thd_create(0, bba_rx_threadfunc, 0);
-    bba_rx_thread->prio = 1;
+    thd_set_prio(bba_rx_thread, 1);
     thd_set_label(bba_rx_thread, "BBA-rx-thd");
 
     /* We need something like this to get DHCP to work (since it doesn't
@@ -989,6 +1042,18 @@ static int bba_if_tx(netif_t *self, const uint8 *data, int len, int blocking) {
     return 0;
 }
 
+static int bba_if_tx_pbuf(netif_t *self, const net_pbuf_t *p, int blocking) {
+    (void)self;
+
+    if(!(bba_if.flags & NETIF_RUNNING))
+        return -1;
+
+    if(bba_tx_pbuf(p, blocking) != BBA_TX_OK)
+        return -1;
+
+    return 0;
+}
+
 /* We'll auto-commit for now */
 static int bba_if_tx_commit(netif_t *self) {
     (void)self;
@@ -1155,6 +1220,7 @@ int bba_init(void) {
     bba_if.if_rx_poll = bba_if_rx_poll;
     bba_if.if_set_flags = bba_if_set_flags;
     bba_if.if_set_mc = bba_if_set_mc;
+    bba_if.if_tx_pbuf = bba_if_tx_pbuf;
 
     /* Attempt to set up our IP address et al from the flashrom */
     bba_set_ispcfg();
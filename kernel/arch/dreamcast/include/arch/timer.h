@@ -423,6 +423,19 @@ timer_primary_callback_t timer_primary_set_callback(timer_primary_callback_t cal
 */
 void timer_primary_wakeup(uint32_t millis);
 
+/** \brief   Request a primary timer wakeup with nanosecond resolution.
+    \ingroup tmu_primary
+
+    This function works exactly like timer_primary_wakeup(), except that the
+    delay is given in nanoseconds. The actual resolution is that of the timer
+    unit (80ns), and the wakeup is rounded up so that it never happens early.
+
+    \param  nanos           The number of nanoseconds to schedule for.
+
+    \sa timer_primary_wakeup()
+*/
+void timer_primary_wakeup_ns(uint64_t nanos);
+
 /** \cond */
 /* Init function */
 int timer_init(void);
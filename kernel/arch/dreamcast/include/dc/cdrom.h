@@ -13,6 +13,8 @@
 __BEGIN_DECLS
 
 #include <arch/types.h>
+#include <kos/sem.h>
+#include <kos/worker_thread.h>
 
 /** \file    dc/cdrom.h
     \brief   CD access to the GD-ROM drive.
@@ -417,6 +419,76 @@ int cdrom_read_toc(CDROM_TOC *toc_buffer, int session);
 */
 int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode);
 
+/** \brief    Completion callback for a queued sector read.
+    \ingroup  gdrom
+
+    \param  result          The result of the read (\ref cd_cmd_response).
+    \param  data            The data passed to cdrom_read_sectors_async().
+*/
+typedef void (*cdrom_read_cb_t)(int result, void *data);
+
+/** \brief    A queued sector read.
+    \ingroup  gdrom
+
+    This holds a read queued with cdrom_read_sectors_async(). It belongs to
+    the caller, who has to keep it around until the read is done, but none of
+    its fields should be touched directly.
+
+    \headerfile dc/cdrom.h
+*/
+typedef struct cdrom_read_req {
+    kthread_job_t job;          /**< \brief Entry in the read queue */
+    void *buffer;               /**< \brief Where the sectors go */
+    int sector;                 /**< \brief The first sector to read */
+    int cnt;                    /**< \brief The number of sectors to read */
+    int mode;                   /**< \brief \ref cd_read_sector_mode */
+    cdrom_read_cb_t cb;         /**< \brief Completion callback, or NULL */
+    void *data;                 /**< \brief Data for the callback */
+    semaphore_t done;           /**< \brief Signaled when the read is done */
+    int result;                 /**< \brief The result of the read */
+} cdrom_read_req_t;
+
+/** \brief    Queue up a read of one or more sectors from a CD-ROM.
+    \ingroup  gdrom
+
+    This function queues up a read like cdrom_read_sectors_ex() does, and
+    returns straight away. The reads are done in the order they were queued by
+    a thread of their own, so the caller can get on with something else (like
+    using the data of the last read) in the meantime.
+
+    When the read is done, the callback is called, in the thread that does the
+    reads, and the read can be waited for with cdrom_read_wait(). Either is
+    fine, or both. The callback must not wait on another queued read.
+
+    \param  req             The request to fill in and queue.
+    \param  buffer          Space to store the read sectors.
+    \param  sector          The sector to start reading from.
+    \param  cnt             The number of sectors to read.
+    \param  mode            \ref cd_read_sector_mode
+    \param  cb              The function to call when the read is done, or
+                            NULL.
+    \param  data            Data to pass to the callback.
+    \return                 ERR_OK if the read was queued, ERR_SYS if the
+                            buffer isn't aligned for the mode or reads can't be
+                            queued.
+
+    \see    cdrom_read_wait
+*/
+int cdrom_read_sectors_async(cdrom_read_req_t *req, void *buffer, int sector,
+                             int cnt, int mode, cdrom_read_cb_t cb,
+                             void *data);
+
+/** \brief    Wait for a queued read to finish.
+    \ingroup  gdrom
+
+    This function blocks until the given read is done, and can only be called
+    once for each read.
+
+    \param  req             The request given to cdrom_read_sectors_async().
+    \return                 \ref cd_cmd_response
+*/
+int cdrom_read_wait(cdrom_read_req_t *req);
+
 /** \brief    Read one or more sector from a CD-ROM in PIO mode.
     \ingroup  gdrom
 
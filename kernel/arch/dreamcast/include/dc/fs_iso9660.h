@@ -29,6 +29,7 @@
 #include <sys/cdefs.h>
 __BEGIN_DECLS
 
+#include <stdint.h>
 #include <arch/types.h>
 #include <kos/limits.h>
 #include <kos/fs.h>
@@ -37,6 +38,32 @@ __BEGIN_DECLS
     @{
 */
 
+/** \brief  Statistics for reads from one file.
+
+    Files that are read in order get the sectors after the ones that were read
+    read ahead in the background, and reads of whole sectors go straight into
+    the caller's buffer if it's aligned well enough. These count how much of
+    each kind of read a file got, and how long reading it took, which gives
+    its throughput. They're fetched with fs_ioctl() and
+    \ref ISO_IOCTL_READ_STATS.
+
+    \headerfile dc/fs_iso9660.h
+*/
+typedef struct iso_read_stats {
+    uint64_t bytes;         /**< \brief Bytes read from the file */
+    uint64_t direct_bytes;  /**< \brief Bytes read into the caller's buffer */
+    uint64_t ra_bytes;      /**< \brief Bytes that were read ahead */
+    uint64_t read_us;       /**< \brief Microseconds spent reading */
+    uint32_t commands;      /**< \brief Direct and read-ahead drive reads */
+    uint32_t ra_waits;      /**< \brief Reads that waited for read-ahead */
+} iso_read_stats_t;
+
+/** \brief  fs_ioctl() command to get the statistics of an open file.
+
+    The argument is a pointer to an \ref iso_read_stats_t to fill in.
+*/
+#define ISO_IOCTL_READ_STATS    0x49534f01
+
 /** \brief  Reset the internal ISO9660 cache.
 
     This function resets the cache of the ISO9660 driver, breaking connections
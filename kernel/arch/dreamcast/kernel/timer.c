@@ -99,12 +99,16 @@ int timer_prime(int which, uint32_t speed, int interrupts) {
     return timer_prime_apply(which, cd, interrupts);
 }
 
-/* Works like timer_prime, but takes an interval in milliseconds
+/* Works like timer_prime, but takes an interval in nanoseconds
    instead of a rate. Used by the primary timer stuff. */
-static int timer_prime_wait(int which, uint32_t millis, int interrupts) {
-    /* Calculate the countdown, formula is P0 * millis/div*1000. We
-       rearrange the math a bit here to avoid integer overflows. */
-    const uint32_t cd = (TIMER_PCK / TDIV(TIMER_TPSC)) * millis / 1000;
+static int timer_prime_wait(int which, uint32_t nanos, int interrupts) {
+    /* Calculate the countdown, rounding up so that we never fire early. One
+       tick is 80ns with the default prescalar, so this can't overflow. */
+    const uint32_t tick_ns = 1000000000 / (TIMER_PCK / TDIV(TIMER_TPSC));
+    uint32_t cd = (nanos + tick_ns - 1) / tick_ns;
+
+    if(!cd)
+        cd = 1;
 
     return timer_prime_apply(which, cd, interrupts);
 }
@@ -347,10 +351,12 @@ uint64_t timer_ns_gettime64(void) {
 
 /* Primary kernel timer. What we'll do here is handle actual timer IRQs
    internally, and call the callback only after the appropriate number of
-   millis has passed. For the DC you can't have timers spaced out more
+   nanos has passed. For the DC you can't have timers spaced out more
    than about one second, so we emulate longer waits with a counter. */
+#define TP_LEG_NS   1000000000ull
+
 static timer_primary_callback_t tp_callback;
-static uint32_t tp_ms_remaining;
+static uint64_t tp_ns_remaining;
 
 /* IRQ handler for the primary timer interrupt. */
 static void tp_handler(irq_t src, irq_context_t *cxt, void *data) {
@@ -358,7 +364,7 @@ static void tp_handler(irq_t src, irq_context_t *cxt, void *data) {
     (void)data;
 
     /* Are we at zero? */
-    if(tp_ms_remaining == 0) {
+    if(tp_ns_remaining == 0) {
         /* Disable any further timer events. The callback may
            re-enable them of course. */
         timer_stop(TMU0);
@@ -369,17 +375,17 @@ static void tp_handler(irq_t src, irq_context_t *cxt, void *data) {
             tp_callback(cxt);
     } 
     /* Do we have less than a second remaining? */
-    else if(tp_ms_remaining < 1000) {
+    else if(tp_ns_remaining < TP_LEG_NS) {
         /* Schedule a "last leg" timer. */
         timer_stop(TMU0);
-        timer_prime_wait(TMU0, tp_ms_remaining, 1);
+        timer_prime_wait(TMU0, (uint32_t)tp_ns_remaining, 1);
         timer_clear(TMU0);
         timer_start(TMU0);
-        tp_ms_remaining = 0;
+        tp_ns_remaining = 0;
     } 
     /* Otherwise, we're just counting down. */
     else {
-        tp_ms_remaining -= 1000;
+        tp_ns_remaining -= TP_LEG_NS;
     }
 }
 
@@ -412,23 +418,33 @@ void timer_primary_wakeup(uint32_t millis) {
         millis++;
     }
 
+    timer_primary_wakeup_ns(millis * 1000000ull);
+}
+
+void timer_primary_wakeup_ns(uint64_t nanos) {
+    /* Don't allow zero */
+    if(nanos == 0) {
+        assert_msg(nanos != 0, "Received invalid wakeup delay");
+        nanos++;
+    }
+
     /* Make sure we stop any previous wakeup */
     timer_stop(TMU0);
 
     /* If we have less than a second to wait, then just schedule the
        timeout event directly. Otherwise schedule a periodic second
        timer. We'll replace this on the last leg in the IRQ. */
-    if(millis >= 1000) {
-        timer_prime_wait(TMU0, 1000, 1);
+    if(nanos >= TP_LEG_NS) {
+        timer_prime_wait(TMU0, TP_LEG_NS, 1);
         timer_clear(TMU0);
         timer_start(TMU0);
-        tp_ms_remaining = millis - 1000;
+        tp_ns_remaining = nanos - TP_LEG_NS;
     }
     else {
-        timer_prime_wait(TMU0, millis, 1);
+        timer_prime_wait(TMU0, (uint32_t)nanos, 1);
         timer_clear(TMU0);
         timer_start(TMU0);
-        tp_ms_remaining = 0;
+        tp_ns_remaining = 0;
     }
 }
 
@@ -0,0 +1,438 @@
+/* KallistiOS ##version##
+
+   blockcache.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* A least-recently-used cache of block device data, shared by the filesystems
+   that sit on top of block devices. Entries live on a list in the order they
+   were last used, the least recently used one at the front, and in a hash
+   table keyed on their first device block. Finding an entry, moving it to the
+   back of the list and throwing one out are all constant time, unless a lot
+   of entries at the front are pinned. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <sys/queue.h>
+
+#include <kos/blockcache.h>
+#include <kos/mutex.h>
+#include <kos/cond.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+#include <arch/timer.h>
+
+#define ENTRY_VALID     0x0001
+#define ENTRY_DIRTY     0x0002
+
+typedef struct bc_entry {
+    TAILQ_ENTRY(bc_entry) lru;
+    LIST_ENTRY(bc_entry) hash;
+    uint64_t block;
+    uint64_t dirtied;
+    uint8_t *data;
+    uint16_t flags;
+    uint16_t pins;
+} bc_entry_t;
+
+LIST_HEAD(bc_bucket, bc_entry);
+
+struct blockcache {
+    LIST_ENTRY(blockcache) wb_list;
+    kos_blockdev_t *dev;
+    mutex_t mutex;
+    uint32_t flags;
+
+    size_t entry_blocks;
+    size_t entry_size;
+    size_t count;
+    bc_entry_t *entries;
+    bc_entry_t **sorted;
+    uint8_t *data;
+
+    uint32_t hash_bits;
+    struct bc_bucket *hash;
+    TAILQ_HEAD(bc_lru, bc_entry) lru;
+
+    blockcache_stats_t stats;
+};
+
+/* Caches with background write-back, and the thread that does it. The thread
+   goes away when the last of them does. */
+static LIST_HEAD(, blockcache) wb_caches = LIST_HEAD_INITIALIZER(wb_caches);
+static mutex_t wb_mutex = MUTEX_INITIALIZER;
+static condvar_t wb_cond = COND_INITIALIZER;
+static kthread_t *wb_thd;
+
+static inline struct bc_bucket *bc_bucket(blockcache_t *bc, uint64_t block) {
+    uint32_t h = (uint32_t)block ^ (uint32_t)(block >> 32);
+
+    return &bc->hash[(h * 0x9e3779b1) >> (32 - bc->hash_bits)];
+}
+
+static bc_entry_t *bc_find(blockcache_t *bc, uint64_t block) {
+    bc_entry_t *e;
+
+    LIST_FOREACH(e, bc_bucket(bc, block), hash) {
+        if(e->block == block)
+            return e;
+    }
+
+    return NULL;
+}
+
+static int bc_write(blockcache_t *bc, bc_entry_t *e) {
+    if(bc->dev->write_blocks(bc->dev, e->block, bc->entry_blocks, e->data))
+        return -1;
+
+    e->flags &= ~ENTRY_DIRTY;
+    ++bc->stats.writebacks;
+    return 0;
+}
+
+/* Find an entry to put a new block in, writing back what's in it if needed.
+   Entries that aren't in use are always at the front of the list. One that
+   can't be written back stays dirty, for blockcache_sync() to try again and
+   report, and goes to the back of the list so the next one gets a go. */
+static bc_entry_t *bc_evict(blockcache_t *bc, int *err) {
+    bc_entry_t *e, *next;
+    size_t left = bc->count;
+    int failed = 0;
+
+    for(e = TAILQ_FIRST(&bc->lru); e && left; e = next, --left) {
+        next = TAILQ_NEXT(e, lru);
+
+        if(e->pins)
+            continue;
+
+        if(!(e->flags & ENTRY_VALID))
+            return e;
+
+        if((e->flags & ENTRY_DIRTY) && bc_write(bc, e)) {
+            TAILQ_REMOVE(&bc->lru, e, lru);
+            TAILQ_INSERT_TAIL(&bc->lru, e, lru);
+            failed = 1;
+            continue;
+        }
+
+        LIST_REMOVE(e, hash);
+        e->flags = 0;
+        ++bc->stats.evictions;
+        return e;
+    }
+
+    *err = failed ? EIO : ENOBUFS;
+    return NULL;
+}
+
+static int bc_cmp(const void *a, const void *b) {
+    const bc_entry_t *ea = *(const bc_entry_t * const *)a;
+    const bc_entry_t *eb = *(const bc_entry_t * const *)b;
+
+    return ea->block < eb->block ? -1 : ea->block > eb->block;
+}
+
+/* Write back every entry that was dirtied at or before the given time, in
+   block order so the device sees them as sequentially as they can be. */
+static int bc_write_dirty(blockcache_t *bc, uint64_t before) {
+    size_t i, n = 0;
+    int rv = 0;
+
+    for(i = 0; i < bc->count; ++i) {
+        if((bc->entries[i].flags & ENTRY_DIRTY) &&
+           bc->entries[i].dirtied <= before)
+            bc->sorted[n++] = &bc->entries[i];
+    }
+
+    if(n > 1)
+        qsort(bc->sorted, n, sizeof(bc_entry_t *), bc_cmp);
+
+    for(i = 0; i < n; ++i) {
+        if(bc_write(bc, bc->sorted[i]))
+            rv = -1;
+    }
+
+    return rv;
+}
+
+static void *wb_thread(void *param) {
+    blockcache_t *bc;
+    uint64_t now;
+
+    (void)param;
+
+    mutex_lock(&wb_mutex);
+
+    while(!LIST_EMPTY(&wb_caches)) {
+        cond_wait_timed(&wb_cond, &wb_mutex, BLOCKCACHE_WB_AGE / 2);
+        now = timer_ms_gettime64();
+
+        LIST_FOREACH(bc, &wb_caches, wb_list) {
+            mutex_lock(&bc->mutex);
+
+            if(now >= BLOCKCACHE_WB_AGE &&
+               bc_write_dirty(bc, now - BLOCKCACHE_WB_AGE))
+                dbglog(DBG_WARNING, "blockcache: write-back failed\n");
+
+            mutex_unlock(&bc->mutex);
+        }
+    }
+
+    wb_thd = NULL;
+    mutex_unlock(&wb_mutex);
+    return NULL;
+}
+
+static int wb_add(blockcache_t *bc) {
+    kthread_attr_t attr = { 0 };
+    int rv = 0;
+
+    attr.create_detached = true;
+    attr.label = "[blockcache]";
+
+    mutex_lock(&wb_mutex);
+    LIST_INSERT_HEAD(&wb_caches, bc, wb_list);
+
+    if(!wb_thd && !(wb_thd = thd_create_ex(&attr, wb_thread, NULL))) {
+        LIST_REMOVE(bc, wb_list);
+        rv = -1;
+    }
+
+    mutex_unlock(&wb_mutex);
+    return rv;
+}
+
+static void wb_remove(blockcache_t *bc) {
+    mutex_lock(&wb_mutex);
+    LIST_REMOVE(bc, wb_list);
+    cond_signal(&wb_cond);
+    mutex_unlock(&wb_mutex);
+}
+
+blockcache_t *blockcache_create(kos_blockdev_t *dev, size_t entry_blocks,
+                                size_t budget, uint32_t flags) {
+    blockcache_t *bc;
+    size_t i, buckets;
+
+    if(!dev || !entry_blocks) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(!(bc = (blockcache_t *)calloc(1, sizeof(blockcache_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bc->dev = dev;
+    bc->flags = flags;
+    bc->entry_blocks = entry_blocks;
+    bc->entry_size = entry_blocks << dev->l_block_size;
+    bc->count = budget / bc->entry_size;
+
+    if(bc->count < 2)
+        bc->count = 2;
+
+    /* Aim for about one entry per bucket. */
+    for(bc->hash_bits = 1, buckets = 2; buckets < bc->count; buckets <<= 1)
+        ++bc->hash_bits;
+
+    bc->entries = (bc_entry_t *)calloc(bc->count, sizeof(bc_entry_t));
+    bc->sorted = (bc_entry_t **)malloc(bc->count * sizeof(bc_entry_t *));
+    bc->hash = (struct bc_bucket *)malloc(buckets * sizeof(struct bc_bucket));
+    bc->data = (uint8_t *)memalign(32, bc->count * bc->entry_size);
+
+    if(!bc->entries || !bc->sorted || !bc->hash || !bc->data) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    for(i = 0; i < buckets; ++i)
+        LIST_INIT(&bc->hash[i]);
+
+    TAILQ_INIT(&bc->lru);
+
+    for(i = 0; i < bc->count; ++i) {
+        bc->entries[i].data = bc->data + i * bc->entry_size;
+        TAILQ_INSERT_TAIL(&bc->lru, &bc->entries[i], lru);
+    }
+
+    bc->stats.entries = bc->count;
+    mutex_init(&bc->mutex, MUTEX_TYPE_NORMAL);
+
+    if((flags & BLOCKCACHE_WRITEBACK) && wb_add(bc)) {
+        mutex_destroy(&bc->mutex);
+        goto fail;
+    }
+
+    return bc;
+
+fail:
+    free(bc->data);
+    free(bc->hash);
+    free(bc->sorted);
+    free(bc->entries);
+    free(bc);
+    return NULL;
+}
+
+int blockcache_destroy(blockcache_t *bc) {
+    int rv;
+
+    if(bc->flags & BLOCKCACHE_WRITEBACK)
+        wb_remove(bc);
+
+    rv = blockcache_sync(bc);
+
+    mutex_destroy(&bc->mutex);
+    free(bc->data);
+    free(bc->hash);
+    free(bc->sorted);
+    free(bc->entries);
+    free(bc);
+
+    return rv;
+}
+
+uint8_t *blockcache_get(blockcache_t *bc, uint64_t block, uint32_t flags,
+                        int *err) {
+    bc_entry_t *e;
+    int rv = 0;
+
+    mutex_lock(&bc->mutex);
+
+    if((e = bc_find(bc, block))) {
+        ++bc->stats.hits;
+    }
+    else {
+        if(!(e = bc_evict(bc, &rv)))
+            goto fail;
+
+        if(!(flags & BLOCKCACHE_NOREAD) &&
+           bc->dev->read_blocks(bc->dev, block, bc->entry_blocks, e->data)) {
+            /* The entry is empty now, so leave it at the front. */
+            TAILQ_REMOVE(&bc->lru, e, lru);
+            TAILQ_INSERT_HEAD(&bc->lru, e, lru);
+            rv = EIO;
+            goto fail;
+        }
+
+        e->block = block;
+        e->flags = ENTRY_VALID;
+        LIST_INSERT_HEAD(bc_bucket(bc, block), e, hash);
+        ++bc->stats.misses;
+    }
+
+    if(flags & BLOCKCACHE_PIN)
+        ++e->pins;
+
+    TAILQ_REMOVE(&bc->lru, e, lru);
+    TAILQ_INSERT_TAIL(&bc->lru, e, lru);
+
+    mutex_unlock(&bc->mutex);
+    return e->data;
+
+fail:
+    mutex_unlock(&bc->mutex);
+
+    if(err)
+        *err = rv;
+
+    return NULL;
+}
+
+void blockcache_unpin(blockcache_t *bc, const void *data) {
+    size_t i = ((const uint8_t *)data - bc->data) / bc->entry_size;
+    bc_entry_t *e;
+
+    if(i >= bc->count)
+        return;
+
+    e = &bc->entries[i];
+    mutex_lock(&bc->mutex);
+
+    /* An entry that was dropped while it was pinned is free for reuse once
+       the last pin is gone. */
+    if(e->pins && !--e->pins && !(e->flags & ENTRY_VALID)) {
+        TAILQ_REMOVE(&bc->lru, e, lru);
+        TAILQ_INSERT_HEAD(&bc->lru, e, lru);
+    }
+
+    mutex_unlock(&bc->mutex);
+}
+
+int blockcache_mark_dirty(blockcache_t *bc, uint64_t block) {
+    bc_entry_t *e;
+    int rv = -1;
+
+    mutex_lock(&bc->mutex);
+
+    if((e = bc_find(bc, block))) {
+        /* Keep the time it first got dirty, so a block that's written over
+           and over still makes it out eventually. */
+        if(!(e->flags & ENTRY_DIRTY)) {
+            e->flags |= ENTRY_DIRTY;
+            e->dirtied = timer_ms_gettime64();
+        }
+
+        rv = 0;
+    }
+
+    mutex_unlock(&bc->mutex);
+    return rv;
+}
+
+int blockcache_sync(blockcache_t *bc) {
+    int rv;
+
+    mutex_lock(&bc->mutex);
+    rv = bc_write_dirty(bc, UINT64_MAX);
+    mutex_unlock(&bc->mutex);
+
+    if(rv) {
+        errno = EIO;
+        return -1;
+    }
+
+    if(bc->dev->flush && bc->dev->flush(bc->dev))
+        return -1;
+
+    return 0;
+}
+
+void blockcache_invalidate(blockcache_t *bc) {
+    bc_entry_t *e;
+    size_t i;
+
+    mutex_lock(&bc->mutex);
+
+    for(i = 0; i < (1U << bc->hash_bits); ++i)
+        LIST_INIT(&bc->hash[i]);
+
+    /* Pinned entries keep their pins, so they aren't reused while someone
+       still has them. The rest go to the front, to be used first. */
+    for(i = 0; i < bc->count; ++i) {
+        e = &bc->entries[i];
+        e->flags = 0;
+
+        if(!e->pins) {
+            TAILQ_REMOVE(&bc->lru, e, lru);
+            TAILQ_INSERT_HEAD(&bc->lru, e, lru);
+        }
+    }
+
+    mutex_unlock(&bc->mutex);
+}
+
+size_t blockcache_entry_size(const blockcache_t *bc) {
+    return bc->entry_size;
+}
+
+void blockcache_get_stats(blockcache_t *bc, blockcache_stats_t *stats) {
+    mutex_lock(&bc->mutex);
+    *stats = bc->stats;
+    mutex_unlock(&bc->mutex);
+}
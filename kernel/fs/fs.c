@@ -35,6 +35,7 @@ something like this:
 #include <stdlib.h>
 #include <limits.h>
 #include <kos/fs.h>
+#include <kos/fs_aio.h>
 #include <kos/thread.h>
 #include <kos/mutex.h>
 #include <kos/nmmgr.h>
@@ -330,6 +331,12 @@ static fs_hnd_t * fs_map_hnd(file_t fd) {
     return fd_table[fd];
 }
 
+/* In poll.c, stops anything from watching the fd */
+extern void __poll_fd_closed(int fd);
+
+/* In fs_aio.c, forgets about any asynchronous I/O on the fd */
+extern void __aio_fd_closed(int fd);
+
 /* Close a file and clean up the handle */
 int fs_close(file_t fd) {
     int retval;
@@ -337,6 +344,9 @@ int fs_close(file_t fd) {
 
     if(!h) return -1;
 
+    __poll_fd_closed(fd);
+    __aio_fd_closed(fd);
+
     /* Deref it and remove it from our table */
     retval = fs_hnd_unref(h);
 
@@ -684,10 +694,10 @@ int fs_complete(file_t fd, ssize_t * rv) {
 
     if(!h) return -1;
 
-    if(h->handler == NULL || h->handler->complete == NULL) {
-        errno = EINVAL;
-        return -1;
-    }
+    /* Without a completion of the handler's own, wait for anything queued
+       on the file with fs_aio_read() or fs_aio_write(). */
+    if(h->handler == NULL || h->handler->complete == NULL)
+        return fs_aio_complete(fd, rv);
 
     return h->handler->complete(h->hnd, rv);
 }
@@ -942,5 +952,6 @@ int fs_init(void) {
 }
 
 void fs_shutdown(void) {
+    fs_aio_shutdown();
     fs_fdtbl_destroy();
 }
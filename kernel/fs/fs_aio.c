@@ -0,0 +1,325 @@
+/* KallistiOS ##version##
+
+   fs_aio.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Asynchronous reads and writes. Each filesystem that gets a request gets an
+   I/O thread of its own, which does the requests queued on its files one at a
+   time. The thread works on a duplicate of the file descriptor, so that the
+   file stays open until the request is done even if the caller closes it.
+   The duplicate shares the file position with the caller's descriptor, so
+   requests with an offset of their own go through the filesystem's pread and
+   pwrite, which leave the position alone. Filesystems without those get a
+   seek there and back instead. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/queue.h>
+
+#include <kos/fs_aio.h>
+#include <kos/mutex.h>
+#include <kos/cond.h>
+#include <kos/opts.h>
+#include <arch/timer.h>
+
+typedef struct aio_dev {
+    LIST_ENTRY(aio_dev) list;
+    vfs_handler_t *vfs;
+    kthread_worker_t *worker;
+} aio_dev_t;
+
+/* What fs_complete() needs to know about each file descriptor. This is reset
+   when the descriptor is closed, and gen is bumped so that requests queued on
+   it before then don't count towards whatever gets the number next. */
+typedef struct aio_fd {
+    uint32_t gen;
+    int queued;
+    int pending;
+    ssize_t last;
+    int error;
+} aio_fd_t;
+
+static LIST_HEAD(, aio_dev) aio_devs = LIST_HEAD_INITIALIZER(aio_devs);
+static aio_fd_t *aio_fds;
+
+/* Protects everything above, and the done flag of every request. */
+static mutex_t aio_mutex = MUTEX_INITIALIZER;
+static condvar_t aio_cond = COND_INITIALIZER;
+
+static ssize_t aio_do(fs_aio_t *req) {
+    vfs_handler_t *vfs = fs_get_handler(req->dupfd);
+    void *hnd = fs_get_handle(req->dupfd);
+    _off64_t pos = -1;
+    ssize_t rv;
+    int err;
+
+    if(req->offset >= 0) {
+        if(req->write && vfs->pwrite)
+            return vfs->pwrite(hnd, req->buf, req->cnt, req->offset);
+        else if(!req->write && vfs->pread)
+            return vfs->pread(hnd, req->buf, req->cnt, req->offset);
+
+        if((pos = fs_tell64(req->dupfd)) < 0 ||
+           fs_seek64(req->dupfd, req->offset, SEEK_SET) < 0)
+            return -1;
+    }
+
+    if(req->write)
+        rv = fs_write(req->dupfd, req->buf, req->cnt);
+    else
+        rv = fs_read(req->dupfd, req->buf, req->cnt);
+
+    if(pos >= 0) {
+        err = errno;
+        fs_seek64(req->dupfd, pos, SEEK_SET);
+        errno = err;
+    }
+
+    return rv;
+}
+
+static void aio_thread(void *d) {
+    aio_dev_t *dev = (aio_dev_t *)d;
+    kthread_job_t *job;
+    fs_aio_t *req;
+    aio_fd_t *afd;
+
+    while((job = thd_worker_dequeue_job(dev->worker))) {
+        req = (fs_aio_t *)job->data;
+
+        errno = 0;
+        req->result = aio_do(req);
+        req->error = req->result < 0 ? errno : 0;
+        fs_close(req->dupfd);
+
+        if(req->cb)
+            req->cb(req);
+
+        mutex_lock(&aio_mutex);
+
+        afd = &aio_fds[req->fd];
+
+        if(afd->gen == req->gen) {
+            afd->pending--;
+            afd->last = req->result;
+            afd->error = req->error;
+        }
+
+        req->done = 1;
+        cond_broadcast(&aio_cond);
+        mutex_unlock(&aio_mutex);
+    }
+}
+
+/* Find the I/O thread of a filesystem, starting it if there isn't one yet.
+   Called with aio_mutex held. */
+static aio_dev_t *aio_get_dev(vfs_handler_t *vfs) {
+    kthread_attr_t attr = { 0 };
+    char label[64];
+    aio_dev_t *dev;
+
+    LIST_FOREACH(dev, &aio_devs, list) {
+        if(dev->vfs == vfs)
+            return dev;
+    }
+
+    if(!aio_fds && !(aio_fds = (aio_fd_t *)calloc(FD_SETSIZE,
+                                                  sizeof(aio_fd_t))))
+        return NULL;
+
+    if(!(dev = (aio_dev_t *)malloc(sizeof(aio_dev_t))))
+        return NULL;
+
+    snprintf(label, sizeof(label), "[aio %s]", vfs->nmmgr.pathname);
+    attr.label = label;
+
+    dev->vfs = vfs;
+
+    if(!(dev->worker = thd_worker_create_ex(&attr, aio_thread, dev))) {
+        free(dev);
+        return NULL;
+    }
+
+    LIST_INSERT_HEAD(&aio_devs, dev, list);
+    return dev;
+}
+
+static int aio_queue(fs_aio_t *req, file_t fd, void *buf, size_t cnt,
+                     _off64_t offset, fs_aio_cb_t cb, int write) {
+    vfs_handler_t *vfs;
+    aio_dev_t *dev;
+    file_t dupfd;
+
+    if((dupfd = fs_dup(fd)) < 0)
+        return -1;
+
+    /* The root directory doesn't have a handler to do anything with it. */
+    if(!(vfs = fs_get_handler(dupfd))) {
+        fs_close(dupfd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    req->job.data = req;
+    req->fd = fd;
+    req->dupfd = dupfd;
+    req->buf = buf;
+    req->cnt = cnt;
+    req->offset = offset;
+    req->cb = cb;
+    req->write = write;
+    req->done = 0;
+    req->result = -1;
+    req->error = EINPROGRESS;
+
+    mutex_lock(&aio_mutex);
+
+    if(!(dev = aio_get_dev(vfs))) {
+        mutex_unlock(&aio_mutex);
+        fs_close(dupfd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    req->gen = aio_fds[fd].gen;
+    aio_fds[fd].queued = 1;
+    aio_fds[fd].pending++;
+
+    thd_worker_add_job(dev->worker, &req->job);
+    thd_worker_wakeup(dev->worker);
+
+    mutex_unlock(&aio_mutex);
+    return 0;
+}
+
+int fs_aio_read(fs_aio_t *req, file_t fd, void *buf, size_t cnt,
+                _off64_t offset, fs_aio_cb_t cb) {
+    return aio_queue(req, fd, buf, cnt, offset, cb, 0);
+}
+
+int fs_aio_write(fs_aio_t *req, file_t fd, const void *buf, size_t cnt,
+                 _off64_t offset, fs_aio_cb_t cb) {
+    return aio_queue(req, fd, (void *)buf, cnt, offset, cb, 1);
+}
+
+int fs_aio_done(const fs_aio_t *req) {
+    return req->done;
+}
+
+ssize_t fs_aio_wait(fs_aio_t *req) {
+    mutex_lock(&aio_mutex);
+
+    while(!req->done)
+        cond_wait(&aio_cond, &aio_mutex);
+
+    mutex_unlock(&aio_mutex);
+
+    if(req->result < 0)
+        errno = req->error;
+
+    return req->result;
+}
+
+int fs_aio_suspend(fs_aio_t *const reqs[], int n, int timeout) {
+    uint64_t end = timer_ms_gettime64() + timeout;
+    uint64_t now;
+    int i, rv = -1;
+
+    mutex_lock(&aio_mutex);
+
+    for(;;) {
+        for(i = 0; i < n; i++) {
+            if(reqs[i] && reqs[i]->done) {
+                rv = 0;
+                goto out;
+            }
+        }
+
+        if(!timeout) {
+            cond_wait(&aio_cond, &aio_mutex);
+            continue;
+        }
+
+        if((now = timer_ms_gettime64()) >= end)
+            break;
+
+        cond_wait_timed(&aio_cond, &aio_mutex, (int)(end - now));
+    }
+
+    errno = ETIMEDOUT;
+
+out:
+    mutex_unlock(&aio_mutex);
+    return rv;
+}
+
+int fs_aio_complete(file_t fd, ssize_t *rv) {
+    aio_fd_t *afd;
+
+    if(fd < 0 || fd >= FD_SETSIZE) {
+        errno = EBADF;
+        return -1;
+    }
+
+    mutex_lock(&aio_mutex);
+
+    if(!aio_fds || !aio_fds[fd].queued) {
+        mutex_unlock(&aio_mutex);
+        errno = EINVAL;
+        return -1;
+    }
+
+    afd = &aio_fds[fd];
+
+    while(afd->pending)
+        cond_wait(&aio_cond, &aio_mutex);
+
+    if(rv)
+        *rv = afd->last;
+
+    if(afd->last < 0)
+        errno = afd->error;
+
+    mutex_unlock(&aio_mutex);
+    return 0;
+}
+
+/* Called by fs_close(). Whatever was queued on the file carries on, but its
+   results are forgotten. */
+void __aio_fd_closed(int fd) {
+    aio_fd_t *afd;
+
+    mutex_lock(&aio_mutex);
+
+    if(aio_fds) {
+        afd = &aio_fds[fd];
+        afd->gen++;
+        afd->queued = 0;
+        afd->pending = 0;
+        afd->last = 0;
+        afd->error = 0;
+
+        /* Anyone in fs_aio_complete() on it has nothing left to wait for. */
+        cond_broadcast(&aio_cond);
+    }
+
+    mutex_unlock(&aio_mutex);
+}
+
+void fs_aio_shutdown(void) {
+    aio_dev_t *dev;
+
+    /* The threads might need the mutex to finish what they're doing, so it
+       can't be held while waiting for them. */
+    while((dev = LIST_FIRST(&aio_devs))) {
+        LIST_REMOVE(dev, list);
+        thd_worker_destroy(dev->worker);
+        free(dev);
+    }
+
+    free(aio_fds);
+    aio_fds = NULL;
+}
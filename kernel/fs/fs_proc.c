@@ -0,0 +1,533 @@
+/* KallistiOS ##version##
+
+   fs_proc.c
+   Copyright (C) 2024 The KOS Team and contributors
+*/
+
+/* A read-only filesystem of generated text files, mounted on /proc. Each file
+   is rendered into a buffer when it is opened, and reads are served from that
+   buffer until it is closed. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <kos/fs_proc.h>
+#include <kos/thread.h>
+#include <kos/mutex.h>
+#include <arch/irq.h>
+#include <sys/queue.h>
+
+/* Text buffer that a file's contents are rendered into. */
+typedef struct proc_buf {
+    char *data;
+    size_t len;
+    size_t size;
+} proc_buf_t;
+
+/* File handles */
+typedef struct proc_fh_str {
+    proc_buf_t buf;                     /* rendered contents */
+    size_t pos;                         /* read position */
+    int dir;                            /* directory listing? */
+    dirent_t dirent;                    /* readdir result */
+
+    TAILQ_ENTRY(proc_fh_str) listent;   /* list entry */
+} proc_fh_t;
+
+/* Linked list of open files (controlled by "fh_mutex") */
+static TAILQ_HEAD(proc_fh_list, proc_fh_str) proc_fh;
+
+/* Thread mutex for proc_fh access */
+static mutex_t fh_mutex;
+
+/* Append formatted text to a buffer, growing it as needed. */
+static int proc_printf(proc_buf_t *buf, const char *fmt, ...) {
+    va_list ap;
+    size_t size;
+    char *data;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+    va_end(ap);
+
+    if(len < 0)
+        return -1;
+
+    if(buf->len + len >= buf->size) {
+        size = buf->size ? buf->size : 1024;
+
+        while(size <= buf->len + len)
+            size *= 2;
+
+        if(!(data = realloc(buf->data, size)))
+            return -1;
+
+        buf->data = data;
+        buf->size = size;
+
+        va_start(ap, fmt);
+        vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+        va_end(ap);
+    }
+
+    buf->len += len;
+
+    return len;
+}
+
+/* What is shown of a thread. The thread list can't be walked while the text
+   is being formatted (proc_printf() may block, and the thread could be reaped
+   meanwhile), so everything is copied out first with interrupts disabled. */
+typedef struct proc_thread {
+    tid_t tid;
+    prio_t prio;
+    char state[24];
+    uint64_t cpu_time;
+    char label[KTHREAD_LABEL_SIZE];
+#ifdef THD_STATS
+    kthread_stats_t stats;
+#endif
+} proc_thread_t;
+
+/* Where thd_each() copies the threads to. */
+typedef struct proc_thread_list {
+    proc_thread_t *thds;
+    size_t count;
+    size_t size;
+} proc_thread_list_t;
+
+static const char *proc_thd_state(kthread_t *thd) {
+    switch(thd->state) {
+        case STATE_ZOMBIE:
+            return "zombie";
+        case STATE_RUNNING:
+            return "running";
+        case STATE_READY:
+            return "ready";
+        case STATE_WAIT:
+            return thd->wait_msg ? thd->wait_msg : "wait";
+        case STATE_FINISHED:
+            return "finished";
+        default:
+            return "unknown";
+    }
+}
+
+static int proc_thread_copy(kthread_t *thd, void *d) {
+    proc_thread_list_t *list = d;
+    proc_thread_t *t;
+
+    /* Keep counting when full, so the caller knows how much room it needs. */
+    if(list->count++ >= list->size)
+        return 0;
+
+    t = &list->thds[list->count - 1];
+    t->tid = thd->tid;
+    t->prio = thd->prio;
+    strncpy(t->state, proc_thd_state(thd), sizeof(t->state) - 1);
+    t->state[sizeof(t->state) - 1] = '\0';
+    t->cpu_time = thd_get_cpu_time(thd);
+    strcpy(t->label, thd->label);
+#ifdef THD_STATS
+    thd_get_stats(thd, &t->stats);
+#endif
+
+    return 0;
+}
+
+static void proc_thread_line(proc_buf_t *buf, const proc_thread_t *t) {
+#ifdef THD_STATS
+    const kthread_stats_t *st = &t->stats;
+    int i;
+#endif
+
+    proc_printf(buf, "%5d %4d %-12s %12llu  %s\n", (int)t->tid,
+                (int)t->prio, t->state, t->cpu_time / 1000, t->label);
+
+#ifdef THD_STATS
+    proc_printf(buf, "      switches: %lu voluntary, %lu involuntary\n",
+                (unsigned long)st->voluntary_switches,
+                (unsigned long)st->involuntary_switches);
+    proc_printf(buf, "      run queue: %lu dispatches, avg %llu us, "
+                "max %llu us\n", (unsigned long)st->dispatches,
+                st->dispatches ? st->ready_time / st->dispatches / 1000 : 0,
+                st->ready_max / 1000);
+
+    for(i = 0; i < THD_STATS_WAITS && st->waits[i].mesg; ++i) {
+        proc_printf(buf, "      blocked: %-20s %8lu waits, %12llu us\n",
+                    st->waits[i].mesg, (unsigned long)st->waits[i].count,
+                    st->waits[i].time / 1000);
+    }
+#endif
+}
+
+static int proc_threads(proc_buf_t *buf) {
+    proc_thread_list_t list = { NULL, 0, 0 };
+    uint32_t flags;
+    size_t i;
+
+    /* Count the threads, then make room for them (plus a few, in case more
+       are created meanwhile) and copy them. Go around again if that still
+       wasn't enough. */
+    for(;;) {
+        flags = irq_disable();
+        list.count = 0;
+        thd_each(proc_thread_copy, &list);
+        irq_restore(flags);
+
+        if(list.count <= list.size)
+            break;
+
+        free(list.thds);
+        list.size = list.count + 8;
+
+        if(!(list.thds = malloc(list.size * sizeof(proc_thread_t)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    proc_printf(buf, "  tid prio state            cpu_us  name\n");
+
+    for(i = 0; i < list.count; ++i)
+        proc_thread_line(buf, &list.thds[i]);
+
+    free(list.thds);
+
+    return 0;
+}
+
+/* The files of the filesystem. */
+static const struct {
+    const char *name;
+    int (*render)(proc_buf_t *buf);
+} proc_files[] = {
+    { "threads", proc_threads },
+};
+
+#define PROC_FILE_COUNT (sizeof(proc_files) / sizeof(proc_files[0]))
+
+/* open function */
+static void *proc_open(vfs_handler_t *vfs, const char *fn, int mode) {
+    proc_fh_t *fh;
+    size_t i;
+
+    (void)vfs;
+
+    while(*fn == '/')
+        ++fn;
+
+    if((mode & O_MODE_MASK) != O_RDONLY) {
+        errno = EROFS;
+        return NULL;
+    }
+
+    if(!(fh = calloc(1, sizeof(proc_fh_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(!*fn) {
+        if(!(mode & O_DIR)) {
+            free(fh);
+            errno = EISDIR;
+            return NULL;
+        }
+
+        fh->dir = 1;
+    }
+    else {
+        for(i = 0; i < PROC_FILE_COUNT; ++i) {
+            if(!strcmp(fn, proc_files[i].name))
+                break;
+        }
+
+        if(i == PROC_FILE_COUNT) {
+            free(fh);
+            errno = ENOENT;
+            return NULL;
+        }
+
+        if(mode & O_DIR) {
+            free(fh);
+            errno = ENOTDIR;
+            return NULL;
+        }
+
+        if(proc_files[i].render(&fh->buf) < 0 || !fh->buf.data) {
+            free(fh->buf.data);
+            free(fh);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    mutex_lock(&fh_mutex);
+    TAILQ_INSERT_TAIL(&proc_fh, fh, listent);
+    mutex_unlock(&fh_mutex);
+
+    return fh;
+}
+
+/* Verify that a given hnd is actually in the list */
+static int proc_verify_hnd(void *hnd) {
+    proc_fh_t *cur;
+    int rv = 0;
+
+    mutex_lock(&fh_mutex);
+    TAILQ_FOREACH(cur, &proc_fh, listent) {
+        if((void *)cur == hnd) {
+            rv = 1;
+            break;
+        }
+    }
+    mutex_unlock(&fh_mutex);
+
+    if(!rv)
+        errno = EBADF;
+
+    return rv;
+}
+
+/* close a file */
+static int proc_close(void *hnd) {
+    proc_fh_t *fh = hnd;
+
+    if(!proc_verify_hnd(hnd))
+        return -1;
+
+    mutex_lock(&fh_mutex);
+    TAILQ_REMOVE(&proc_fh, fh, listent);
+    mutex_unlock(&fh_mutex);
+
+    free(fh->buf.data);
+    free(fh);
+
+    return 0;
+}
+
+/* read function */
+static ssize_t proc_read(void *hnd, void *buffer, size_t cnt) {
+    proc_fh_t *fh = hnd;
+
+    if(!proc_verify_hnd(hnd))
+        return -1;
+
+    if(fh->dir) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    if(cnt > fh->buf.len - fh->pos)
+        cnt = fh->buf.len - fh->pos;
+
+    memcpy(buffer, fh->buf.data + fh->pos, cnt);
+    fh->pos += cnt;
+
+    return cnt;
+}
+
+/* Seek elsewhere in a file */
+static off_t proc_seek(void *hnd, off_t offset, int whence) {
+    proc_fh_t *fh = hnd;
+
+    if(!proc_verify_hnd(hnd))
+        return -1;
+
+    switch(whence) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += fh->pos;
+            break;
+        case SEEK_END:
+            offset += fh->buf.len;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if(offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fh->pos = (size_t)offset > fh->buf.len ? fh->buf.len : (size_t)offset;
+
+    return fh->pos;
+}
+
+/* tell the current position in the file */
+static off_t proc_tell(void *hnd) {
+    if(!proc_verify_hnd(hnd))
+        return -1;
+
+    return ((proc_fh_t *)hnd)->pos;
+}
+
+/* return the filesize */
+static size_t proc_total(void *hnd) {
+    if(!proc_verify_hnd(hnd))
+        return -1;
+
+    return ((proc_fh_t *)hnd)->buf.len;
+}
+
+/* read a directory entry */
+static dirent_t *proc_readdir(void *hnd) {
+    proc_fh_t *fh = hnd;
+
+    if(!proc_verify_hnd(hnd))
+        return NULL;
+
+    if(!fh->dir) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+
+    if(fh->pos >= PROC_FILE_COUNT)
+        return NULL;
+
+    strcpy(fh->dirent.name, proc_files[fh->pos++].name);
+    fh->dirent.size = 0;
+    fh->dirent.attr = 0;
+    fh->dirent.time = 0;
+
+    return &fh->dirent;
+}
+
+static int proc_rewinddir(void *hnd) {
+    if(!proc_verify_hnd(hnd))
+        return -1;
+
+    ((proc_fh_t *)hnd)->pos = 0;
+
+    return 0;
+}
+
+static int proc_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
+                     int flag) {
+    size_t i;
+
+    (void)vfs;
+    (void)flag;
+
+    while(*path == '/')
+        ++path;
+
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = (dev_t)('p' | ('r' << 8) | ('o' << 16) | ('c' << 24));
+    st->st_nlink = 1;
+
+    if(!*path) {
+        st->st_mode = S_IFDIR | S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP |
+            S_IROTH | S_IXOTH;
+        st->st_size = -1;
+        st->st_nlink = 2;
+        return 0;
+    }
+
+    for(i = 0; i < PROC_FILE_COUNT; ++i) {
+        if(!strcmp(path, proc_files[i].name)) {
+            /* The size isn't known until the file is generated. */
+            st->st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+            return 0;
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+static int proc_fstat(void *hnd, struct stat *st) {
+    proc_fh_t *fh = hnd;
+
+    if(!proc_verify_hnd(hnd))
+        return -1;
+
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = (dev_t)('p' | ('r' << 8) | ('o' << 16) | ('c' << 24));
+    st->st_nlink = 1;
+
+    if(fh->dir) {
+        st->st_mode = S_IFDIR | S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP |
+            S_IROTH | S_IXOTH;
+        st->st_size = -1;
+        st->st_nlink = 2;
+    }
+    else {
+        st->st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+        st->st_size = fh->buf.len;
+    }
+
+    return 0;
+}
+
+/* handler interface */
+static vfs_handler_t vh = {
+    /* Name handler */
+    {
+        "/proc",        /* name */
+        0,              /* tbfi */
+        0x00010000,     /* Version 1.0 */
+        0,              /* flags */
+        NMMGR_TYPE_VFS, /* VFS handler */
+        NMMGR_LIST_INIT
+    },
+    0, NULL,            /* In-kernel, privdata */
+
+    proc_open,
+    proc_close,
+    proc_read,
+    NULL,               /* write */
+    proc_seek,
+    proc_tell,
+    proc_total,
+    proc_readdir,
+    NULL,               /* ioctl */
+    NULL,               /* rename/move */
+    NULL,               /* unlink */
+    NULL,               /* mmap */
+    NULL,               /* complete */
+    proc_stat,
+    NULL,               /* mkdir */
+    NULL,               /* rmdir */
+    NULL,               /* fcntl */
+    NULL,               /* poll */
+    NULL,               /* link */
+    NULL,               /* symlink */
+    NULL,               /* seek64 */
+    NULL,               /* tell64 */
+    NULL,               /* total64 */
+    NULL,               /* readlink */
+    proc_rewinddir,
+    proc_fstat
+};
+
+int fs_proc_init(void) {
+    TAILQ_INIT(&proc_fh);
+    mutex_init(&fh_mutex, MUTEX_TYPE_NORMAL);
+
+    return nmmgr_handler_add(&vh.nmmgr);
+}
+
+int fs_proc_shutdown(void) {
+    proc_fh_t *c, *n;
+
+    mutex_lock(&fh_mutex);
+
+    TAILQ_FOREACH_SAFE(c, &proc_fh, listent, n) {
+        TAILQ_REMOVE(&proc_fh, c, listent);
+        free(c->buf.data);
+        free(c);
+    }
+
+    mutex_unlock(&fh_mutex);
+    mutex_destroy(&fh_mutex);
+
+    return nmmgr_handler_remove(&vh.nmmgr);
+}
@@ -25,6 +25,7 @@ on sunsite.unc.edu in /pub/Linux/system/recovery/, or as a package under Debian
 #include <stdbool.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
@@ -77,6 +78,21 @@ static uint32 ntohl_32(const void *data) {
 struct rd_image;
 typedef LIST_HEAD(rdi_list, rd_image) rdi_list_t;
 
+/* A slot in the path index of an image. Entries are keyed on the directory
+   listing they're in and their name, but the name is checked against the
+   image itself, so it isn't kept here. */
+typedef struct rd_index_ent {
+    uint32          dir;        /* Offset of the directory listing */
+    uint32          obj;        /* Offset of the entry's header, 0 if free */
+} rd_index_ent_t;
+
+#define RD_INDEX_UNBUILT    0
+#define RD_INDEX_BUILT      1
+#define RD_INDEX_NONE       2
+
+/* How deep directories may nest for the index to follow them */
+#define RD_INDEX_DEPTH      64
+
 /* A single mounted romdisk image; a pointer to one of these will be in our
    VFS struct for each mount. */
 typedef struct rd_image {
@@ -87,6 +103,10 @@ typedef struct rd_image {
     const romdisk_hdr_t * hdr;      /* Pointer to the header */
     uint32          files;      /* Offset in the image to the files area */
     vfs_handler_t       * vfsh;     /* Our VFS mount struct */
+
+    volatile int    index_state; /* Whether the index has been built */
+    rd_index_ent_t  * index;    /* Path index */
+    uint32          index_mask; /* Number of index slots minus one */
 } rd_image_t;
 
 /* Global list of mounted romdisks */
@@ -169,6 +189,132 @@ static uint32_t romdisk_find_object(rd_image_t *mnt, const char *fn, size_t fnle
     return 0;
 }
 
+/* Hash a directory listing offset and a name, ignoring the name's case. */
+static uint32 romdisk_hash(uint32 dir, const char *fn, size_t fnlen) {
+    uint32 h = 2166136261U ^ dir;
+
+    while(fnlen--) {
+        h ^= (uint8)tolower((uint8)*fn++);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+/* Add an entry to the index. Entries that hash the same are found in the
+   order they were added, so this has to be called in directory order for
+   lookups to match what romdisk_find_object() would find. */
+static void romdisk_index_add(rd_image_t *mnt, uint32 dir, uint32 obj) {
+    const romdisk_file_t *fhdr = (const romdisk_file_t *)(mnt->image + obj);
+    uint32 i;
+
+    i = romdisk_hash(dir, fhdr->filename, strlen(fhdr->filename));
+
+    for(i &= mnt->index_mask; mnt->index[i].obj; i = (i + 1) & mnt->index_mask)
+        ;
+
+    mnt->index[i].dir = dir;
+    mnt->index[i].obj = obj;
+}
+
+/* Go through every file and directory below a directory listing, adding them
+   to the index if there is one yet. Returns how many there were. */
+static uint32 romdisk_index_walk(rd_image_t *mnt, uint32 dir, int depth) {
+    const romdisk_file_t *fhdr;
+    uint32 i, ni, type, count = 0;
+
+    if(depth > RD_INDEX_DEPTH)
+        return 0;
+
+    for(i = dir; i; i = ni) {
+        fhdr = (const romdisk_file_t *)(mnt->image + i);
+        ni = ntohl_32(&fhdr->next_header);
+        type = ni & ROMFH_MASK;
+        ni &= 0xfffffff0;
+
+        if(type != ROMFH_DIR && type != ROMFH_REG)
+            continue;
+
+        if(mnt->index)
+            romdisk_index_add(mnt, dir, i);
+
+        ++count;
+
+        if(type == ROMFH_DIR && strcmp(fhdr->filename, ".") &&
+           strcmp(fhdr->filename, ".."))
+            count += romdisk_index_walk(mnt, ntohl_32(&fhdr->spec_info),
+                                        depth + 1);
+    }
+
+    return count;
+}
+
+/* Build the index of an image, if it fits in FS_ROMDISK_INDEX_MAX. */
+static void romdisk_index_build(rd_image_t *mnt) {
+    uint32 count, slots;
+
+    count = romdisk_index_walk(mnt, mnt->files, 0);
+
+    /* Keep the table no more than three quarters full. */
+    for(slots = 16; slots < count + count / 3 + 1; slots <<= 1)
+        ;
+
+    if(slots * sizeof(rd_index_ent_t) > FS_ROMDISK_INDEX_MAX ||
+       !(mnt->index = (rd_index_ent_t *)calloc(slots,
+                                               sizeof(rd_index_ent_t)))) {
+        mnt->index_state = RD_INDEX_NONE;
+        return;
+    }
+
+    mnt->index_mask = slots - 1;
+    romdisk_index_walk(mnt, mnt->files, 0);
+    mnt->index_state = RD_INDEX_BUILT;
+}
+
+/* Look up an object in a directory listing with the index. */
+static uint32_t romdisk_index_find(rd_image_t *mnt, const char *fn,
+                                   size_t fnlen, bool dir, uint32_t offset) {
+    const romdisk_file_t *fhdr;
+    rd_index_ent_t *ent;
+    uint32 i, type;
+
+    i = romdisk_hash(offset, fn, fnlen) & mnt->index_mask;
+
+    for(; (ent = &mnt->index[i])->obj; i = (i + 1) & mnt->index_mask) {
+        if(ent->dir != offset)
+            continue;
+
+        fhdr = (const romdisk_file_t *)(mnt->image + ent->obj);
+        type = ntohl_32(&fhdr->next_header) & ROMFH_MASK;
+
+        if(type == (dir ? ROMFH_DIR : ROMFH_REG) &&
+           strlen(fhdr->filename) == fnlen &&
+           !strncasecmp(fhdr->filename, fn, fnlen))
+            return ent->obj;
+    }
+
+    return 0;
+}
+
+/* Look up an object in a directory listing, the fast way if there's an
+   index for the image. */
+static uint32_t romdisk_lookup(rd_image_t *mnt, const char *fn, size_t fnlen,
+                               bool dir, uint32_t offset) {
+    if(mnt->index_state == RD_INDEX_UNBUILT) {
+        mutex_lock(&fh_mutex);
+
+        if(mnt->index_state == RD_INDEX_UNBUILT)
+            romdisk_index_build(mnt);
+
+        mutex_unlock(&fh_mutex);
+    }
+
+    if(mnt->index_state == RD_INDEX_BUILT)
+        return romdisk_index_find(mnt, fn, fnlen, dir, offset);
+
+    return romdisk_find_object(mnt, fn, fnlen, dir, offset);
+}
+
 /* Locate an object anywhere in the image, starting at the root, and
    expecting a fully qualified path name. This is analogous to the
    find_object_path in iso9660.
@@ -188,7 +334,7 @@ static uint32_t romdisk_find(rd_image_t *mnt, const char *fn, bool dir) {
 
     while((cur = strchr(fn, '/'))) {
         if(cur != fn) {
-            i = romdisk_find_object(mnt, fn, cur - fn, true, i);
+            i = romdisk_lookup(mnt, fn, cur - fn, true, i);
 
             if(i == 0) return 0;
 
@@ -201,7 +347,7 @@ static uint32_t romdisk_find(rd_image_t *mnt, const char *fn, bool dir) {
 
     /* Locate the file in the resulting directory */
     if(*fn) {
-        i = romdisk_find_object(mnt, fn, strlen(fn), dir, i);
+        i = romdisk_lookup(mnt, fn, strlen(fn), dir, i);
         return i;
     }
     else {
@@ -307,6 +453,40 @@ static ssize_t romdisk_write(void *h, const void *buf, size_t bytes) {
     return -1;
 }
 
+/* Read from an offset, without moving the file position */
+static ssize_t romdisk_pread(void *h, void *buf, size_t bytes, _off64_t offset) {
+    file_t fd = (file_t)h;
+
+    /* Check that the fd is valid */
+    if(fd >= FS_ROMDISK_MAX_FILES || fh[fd].index == FH_INDEX_FREE || fh[fd].dir) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if((uint64)offset >= fh[fd].size)
+        return 0;
+
+    /* Is there enough left? */
+    if((offset + bytes) > fh[fd].size)
+        bytes = fh[fd].size - offset;
+
+    memcpy(buf, fh[fd].mnt->image + fh[fd].index + offset, bytes);
+
+    return bytes;
+}
+
+static ssize_t romdisk_pwrite(void *h, const void *buf, size_t bytes,
+                              _off64_t offset) {
+    (void)offset;
+
+    return romdisk_write(h, buf, bytes);
+}
+
 /* Seek elsewhere in a file */
 static off_t romdisk_seek(void * h, off_t offset, int whence) {
     file_t fd = (file_t)h;
@@ -615,7 +795,9 @@ static vfs_handler_t vh = {
     NULL,                       /* total64 */
     NULL,                       /* readlink */
     romdisk_rewinddir,
-    romdisk_fstat
+    romdisk_fstat,
+    romdisk_pread,
+    romdisk_pwrite
 };
 
 /* Are we initialized? */
@@ -665,6 +847,7 @@ void fs_romdisk_shutdown(void) {
         if(c->own_buffer)
             free((void *)c->image);
 
+        free(c->index);
         nmmgr_handler_remove(&c->vfsh->nmmgr);
         free(c->vfsh);
         free(c);
@@ -716,6 +899,11 @@ int fs_romdisk_mount(const char * mountpoint, const uint8 *img, int own_buffer)
     mnt->files = sizeof(romdisk_hdr_t)
                  + (strlen(hdr->volume_name) / RD_VN_MAX) * RD_VN_MAX;
 
+    /* The path index gets built on the first lookup. */
+    mnt->index_state = RD_INDEX_UNBUILT;
+    mnt->index = NULL;
+    mnt->index_mask = 0;
+
     /* Make a VFS struct */
     vfsh = (vfs_handler_t *)malloc(sizeof(vfs_handler_t));
 
@@ -773,6 +961,7 @@ int fs_romdisk_unmount(const char * mountpoint) {
             free((void *)n->image);
 
         /* Free the structs */
+        free(n->index);
         free(n->vfsh);
         free(n);
     }
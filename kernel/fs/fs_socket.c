@@ -15,6 +15,7 @@
 #include <malloc.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -29,6 +30,9 @@ static struct socket_list sockets;
 static mutex_t proto_rlock = RECURSIVE_MUTEX_INITIALIZER;
 static mutex_t list_rlock = RECURSIVE_MUTEX_INITIALIZER;
 
+/* Size of the buffer sendfile() reads files that can't be mapped into. */
+#define SENDFILE_BUFSZ  16384
+
 static int fs_socket_close(void *hnd) {
     net_socket_t *sock = (net_socket_t *)hnd;
 
@@ -504,6 +508,342 @@ ssize_t sendto(int sock, const void *message, size_t length, int flags,
                                  dest_len);
 }
 
+static net_socket_t *get_sock(int sock) {
+    net_socket_t *hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return NULL;
+    }
+
+    return hnd;
+}
+
+static size_t iov_len(const struct iovec *iov, int cnt) {
+    size_t len = 0;
+    int i;
+
+    for(i = 0; i < cnt; ++i)
+        len += iov[i].iov_len;
+
+    return len;
+}
+
+/* Receive one message through recvfrom, for protocols without recvmmsg. Data
+   for more than one buffer has to be received in one piece first. */
+static ssize_t msg_recv(net_socket_t *hnd, struct msghdr *msg, int flags) {
+    struct sockaddr *addr = (struct sockaddr *)msg->msg_name;
+    socklen_t *alen = addr ? &msg->msg_namelen : NULL;
+    size_t len, i, n;
+    uint8 *buf;
+    ssize_t rv;
+
+    msg->msg_flags = 0;
+    msg->msg_controllen = 0;
+
+    if(msg->msg_iovlen == 1)
+        return hnd->protocol->recvfrom(hnd, msg->msg_iov[0].iov_base,
+                                       msg->msg_iov[0].iov_len, flags, addr,
+                                       alen);
+
+    len = iov_len(msg->msg_iov, msg->msg_iovlen);
+
+    if(!(buf = (uint8 *)malloc(len ? len : 1))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    rv = hnd->protocol->recvfrom(hnd, buf, len, flags, addr, alen);
+
+    for(i = 0, len = 0; rv > 0 && len < (size_t)rv; ++i) {
+        n = msg->msg_iov[i].iov_len;
+
+        if(n > rv - len)
+            n = rv - len;
+
+        memcpy(msg->msg_iov[i].iov_base, buf + len, n);
+        len += n;
+    }
+
+    free(buf);
+    return rv;
+}
+
+/* Send one message through sendto, for protocols without sendmmsg. */
+static ssize_t msg_send(net_socket_t *hnd, const struct msghdr *msg,
+                        int flags) {
+    size_t len, i;
+    uint8 *buf;
+    ssize_t rv;
+
+    if(msg->msg_iovlen == 1)
+        return hnd->protocol->sendto(hnd, msg->msg_iov[0].iov_base,
+                                     msg->msg_iov[0].iov_len, flags,
+                                     (struct sockaddr *)msg->msg_name,
+                                     msg->msg_namelen);
+
+    len = iov_len(msg->msg_iov, msg->msg_iovlen);
+
+    if(!(buf = (uint8 *)malloc(len ? len : 1))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(i = 0, len = 0; i < (size_t)msg->msg_iovlen; ++i) {
+        memcpy(buf + len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+        len += msg->msg_iov[i].iov_len;
+    }
+
+    rv = hnd->protocol->sendto(hnd, buf, len, flags,
+                               (struct sockaddr *)msg->msg_name,
+                               msg->msg_namelen);
+    free(buf);
+    return rv;
+}
+
+ssize_t recvmsg(int sock, struct msghdr *msg, int flags) {
+    net_socket_t *hnd;
+    struct mmsghdr m;
+    int rv;
+
+    if(!(hnd = get_sock(sock)))
+        return -1;
+
+    if(msg == NULL || msg->msg_iovlen < 0 || msg->msg_iovlen > IOV_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!hnd->protocol->recvmmsg)
+        return msg_recv(hnd, msg, flags);
+
+    m.msg_hdr = *msg;
+    m.msg_len = 0;
+
+    if((rv = hnd->protocol->recvmmsg(hnd, &m, 1, flags, NULL)) <= 0)
+        return rv;
+
+    *msg = m.msg_hdr;
+    return m.msg_len;
+}
+
+ssize_t sendmsg(int sock, const struct msghdr *msg, int flags) {
+    net_socket_t *hnd;
+    struct mmsghdr m;
+    int rv;
+
+    if(!(hnd = get_sock(sock)))
+        return -1;
+
+    if(msg == NULL || msg->msg_iovlen < 0 || msg->msg_iovlen > IOV_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!hnd->protocol->sendmmsg)
+        return msg_send(hnd, msg, flags);
+
+    m.msg_hdr = *msg;
+    m.msg_len = 0;
+
+    if((rv = hnd->protocol->sendmmsg(hnd, &m, 1, flags)) <= 0)
+        return rv;
+
+    return m.msg_len;
+}
+
+int recvmmsg(int sock, struct mmsghdr *msgs, unsigned int vlen, int flags,
+             struct timespec *timeout) {
+    net_socket_t *hnd;
+    unsigned int i;
+    ssize_t rv;
+
+    if(!(hnd = get_sock(sock)))
+        return -1;
+
+    if(msgs == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    for(i = 0; i < vlen; ++i) {
+        if(msgs[i].msg_hdr.msg_iovlen < 0 ||
+           msgs[i].msg_hdr.msg_iovlen > IOV_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if(hnd->protocol->recvmmsg)
+        return hnd->protocol->recvmmsg(hnd, msgs, vlen, flags, timeout);
+
+    /* Only the first message may block here. */
+    for(i = 0; i < vlen; ++i) {
+        if((rv = msg_recv(hnd, &msgs[i].msg_hdr, flags)) < 0)
+            break;
+
+        msgs[i].msg_len = rv;
+        flags |= MSG_DONTWAIT;
+
+        if(!rv)
+            break;
+    }
+
+    return (i || vlen == 0) ? (int)i : -1;
+}
+
+int sendmmsg(int sock, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+    net_socket_t *hnd;
+    unsigned int i;
+    ssize_t rv;
+
+    if(!(hnd = get_sock(sock)))
+        return -1;
+
+    if(msgs == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    for(i = 0; i < vlen; ++i) {
+        if(msgs[i].msg_hdr.msg_iovlen < 0 ||
+           msgs[i].msg_hdr.msg_iovlen > IOV_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if(hnd->protocol->sendmmsg)
+        return hnd->protocol->sendmmsg(hnd, msgs, vlen, flags);
+
+    for(i = 0; i < vlen; ++i) {
+        if((rv = msg_send(hnd, &msgs[i].msg_hdr, flags)) < 0)
+            break;
+
+        msgs[i].msg_len = rv;
+    }
+
+    return (i || vlen == 0) ? (int)i : -1;
+}
+
+/* Write out everything we've been given, or as much as the socket takes
+   without blocking if it's non-blocking. */
+static ssize_t sendfile_write(file_t fd, net_socket_t *hnd, const uint8 *buf,
+                              size_t len) {
+    size_t done = 0;
+    ssize_t rv;
+
+    while(done < len) {
+        if(hnd)
+            rv = hnd->protocol->sendto(hnd, buf + done, len - done, 0, NULL, 0);
+        else
+            rv = fs_write(fd, buf + done, len - done);
+
+        if(rv <= 0)
+            return done ? (ssize_t)done : rv;
+
+        done += rv;
+    }
+
+    return done;
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    net_socket_t *hnd = NULL;
+    off_t pos, start;
+    size_t total, done = 0, bufsz, len;
+    uint8 *map, *buf;
+    ssize_t rv = 0, got;
+
+    if(!fs_get_handle(out_fd) || !fs_get_handle(in_fd)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(offset && *offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(fs_get_handler(out_fd) == &vh)
+        hnd = (net_socket_t *)fs_get_handle(out_fd);
+
+    if((pos = fs_tell(in_fd)) < 0)
+        return -1;
+
+    start = offset ? *offset : pos;
+
+    /* If the file lives in memory, hand it straight to the socket. */
+    if((map = (uint8 *)fs_mmap(in_fd)) &&
+       (total = fs_total(in_fd)) != (size_t)-1) {
+        if(start >= (off_t)total)
+            count = 0;
+        else if(count > total - start)
+            count = total - start;
+
+        if(count)
+            rv = sendfile_write(out_fd, hnd, map + start, count);
+
+        if(rv > 0)
+            done = rv;
+    }
+    else {
+        bufsz = count < SENDFILE_BUFSZ ? count : SENDFILE_BUFSZ;
+
+        if(!bufsz)
+            return 0;
+
+        if(!(buf = (uint8 *)malloc(bufsz))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        while(done < count) {
+            if(fs_seek(in_fd, start + done, SEEK_SET) < 0) {
+                rv = -1;
+                break;
+            }
+
+            len = count - done < bufsz ? count - done : bufsz;
+
+            /* A short read only shortens this piece, not the ones after. */
+            if((rv = got = fs_read(in_fd, buf, len)) <= 0)
+                break;
+
+            rv = sendfile_write(out_fd, hnd, buf, got);
+
+            if(rv > 0)
+                done += rv;
+
+            if(rv < got)
+                break;
+        }
+
+        free(buf);
+    }
+
+    /* With an offset given, the file position is left alone. Without one,
+       it moves past what was sent, not what was read. */
+    if(offset) {
+        *offset = start + done;
+        fs_seek(in_fd, pos, SEEK_SET);
+    }
+    else {
+        fs_seek(in_fd, start + done, SEEK_SET);
+    }
+
+    if(!done && rv < 0)
+        return -1;
+
+    return done;
+}
+
 int shutdown(int sock, int how) {
     net_socket_t *hnd;
 
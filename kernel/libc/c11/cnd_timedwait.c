@@ -9,18 +9,19 @@
 
 int cnd_timedwait(cnd_t *restrict cond, mtx_t *restrict mtx,
                   const struct timespec *restrict ts) {
-    int ms = 0;
+    uint64_t ns;
 
-    /* Calculate the number of milliseconds to sleep for. No, you don't get
-       anywhere near nanosecond precision here. */
-    ms = ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+    if(ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000)
+        return thrd_error;
+
+    ns = (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
 
-    /* The standard wording implies that we must wait at least the time period
-       specified, so if we have an uneven number of milliseconds, round up. */
-    if(ts->tv_nsec % 1000000)
-        ++ms;
+    /* A zero timeout would mean waiting forever to the lower layers, but here
+       it means the time is already up. Wait for the shortest time instead. */
+    if(!ns)
+        ns = 1;
 
-    if(cond_wait_timed(cond, mtx, ms)) {
+    if(cond_wait_timed_ns(cond, mtx, ns)) {
         if(errno == ETIMEDOUT)
             return thrd_timedout;
 
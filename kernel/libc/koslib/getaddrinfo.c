@@ -12,21 +12,29 @@
 /* The actual code for querying the DNS was taken from the old kos-ports lwIP
    port, and was originally written by Megan. This has been modified/extended a
    bit. The old lwip_gethostbyname() function was reworked a lot to create the
-   new getaddrinfo_dns() function. In addition, the dns_parse_response()
-   function got a bit of a makeover too.
+   lookup code in here. In addition, the dns_parse_response() function got a
+   bit of a makeover too.
 
    The implementations of getaddrinfo() and freeaddrinfo() are new to this
    version of the code though.
 
-   Eventually, I'd like to add some sort of caching of results to this file so
-   that if you look something up more than once, it doesn't have to go back out
-   to the server to do so. But, for now, there is no local database of cached
-   addresses...
+   Answers are kept in a small cache for as long as their TTL says, so looking
+   the same name up again doesn't have to go back out to the server. Names that
+   don't exist are cached too, for as long as the SOA record in the response
+   allows (or DNS_NEG_TTL, if there isn't one). When both IPv4 and IPv6
+   addresses are wanted, the A and AAAA questions go out together on the same
+   socket, as two separate queries since some resolvers can't handle more than
+   one question in a message. Each query gets a random ID, and a response is
+   only taken if it has that ID and repeats the question that was asked.
+
+   getaddrinfo() itself is built on getaddrinfo_start() and friends, which let
+   several lookups be waited on at once with poll().
 */
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <errno.h>
 #include <poll.h>
 
@@ -37,6 +45,8 @@
 
 #include <kos/net.h>
 #include <kos/dbglog.h>
+#include <kos/mutex.h>
+#include <arch/timer.h>
 
 /* How many attempts to make at contacting the DNS server before giving up. */
 #define DNS_ATTEMPTS    4
@@ -44,6 +54,18 @@
 /* How long to wait between attempts. */
 #define DNS_TIMEOUT     500
 
+/* How many answers to keep in the cache, and how many addresses from each. */
+#define DNS_CACHE_SIZE  16
+#define DNS_MAX_ADDRS   8
+
+/* How long to remember that a name doesn't exist if the server doesn't say,
+   and the longest anything is kept for, in seconds. */
+#define DNS_NEG_TTL     60
+#define DNS_MAX_TTL     3600
+
+/* Longest name we'll look up, including the terminator. */
+#define DNS_NAME_LEN    254
+
 /*
    This performs a simple DNS A-record query. It hasn't been tested extensively
    but so far it seems to work fine.
@@ -70,11 +92,58 @@ typedef struct dnsmsg {
     uint8_t data[];      // Payload
 } dnsmsg_t;
 
-static uint16_t qnum = 0;
+/* This is declared in <stdlib.h>, but only if __BSD_VISIBLE. */
+extern void arc4random_buf(void *, size_t);
 
 #define QTYPE_A         1
+#define QTYPE_CNAME     5
+#define QTYPE_SOA       6
 #define QTYPE_AAAA      28
 
+/* The answer to one question, as parsed out of a response. */
+typedef struct dns_answer {
+    int err;                            /* 0 or an EAI_* value */
+    uint32_t ttl;                       /* In seconds */
+    int count;
+    uint8_t addrs[DNS_MAX_ADDRS][16];   /* Only 4 bytes are used for A */
+} dns_answer_t;
+
+typedef struct dns_cache_ent {
+    char name[DNS_NAME_LEN];
+    uint16_t qtype;
+    uint64_t expires;                   /* In ms, 0 if the entry is unused */
+    dns_answer_t ans;
+} dns_cache_ent_t;
+
+/* Protects the cache. */
+static mutex_t dns_mutex = MUTEX_INITIALIZER;
+static dns_cache_ent_t dns_cache[DNS_CACHE_SIZE];
+
+/* A lookup in progress, see getaddrinfo_start(). */
+struct gai_request {
+    char name[DNS_NAME_LEN];
+    struct addrinfo hints;
+    uint16_t port;
+
+    int sock;
+    int tries;
+    uint64_t next_send;                 /* When to send again, in ms */
+
+    /* Set once the result is known without asking the server. */
+    int done;
+    int err;
+    struct addrinfo *res;
+
+    /* The questions being asked, A before AAAA. */
+    int nq;
+    struct {
+        uint16_t type;
+        uint16_t id;
+        int answered;
+        dns_answer_t ans;
+    } q[2];
+};
+
 /* Flags:
    Query/Response (1 bit) -- 0 = Query, 1 = Response
    Opcode (4 bits) -- 0 = Standard, 1 = Inverse, 2 = Status
@@ -114,74 +183,79 @@ static uint16_t qnum = 0;
      AAAA   28
  */
 
-// Construct a DNS query for an A record by host name. "buf" should
-// be at least 1500 bytes, to make sure there's room.
-static size_t dns_make_query(const char *host, dnsmsg_t *buf, int ip4,
-                             int ip6) {
-    int i, o = 0, ls, t;
+/* Construct a DNS query for one record type by host name. The name must
+   have been checked with dns_check_name() first, so that the query fits in
+   512 bytes. */
+static size_t dns_make_query(const char *host, dnsmsg_t *buf, uint16_t id,
+                             uint16_t qtype) {
+    int i, o, ls, t;
 
     // Build up the header.
-    buf->id = htons(qnum++);
+    buf->id = htons(id);
     buf->flags = htons(0x0100);
-    buf->qdcount = htons(ip4 + ip6);
+    buf->qdcount = htons(1);
     buf->ancount = htons(0);
     buf->nscount = htons(0);
     buf->arcount = htons(0);
 
-    /* Fill in the question section(s). */
+    /* Fill in the question section. */
     ls = 0;
-
-    if(ip4) {
-        o = ls + 1;
-        t = strlen(host);
-
-        for(i = 0; i <= t; i++) {
-            if(host[i] == '.' || i == t) {
-                buf->data[ls] = (o - ls) - 1;
-                ls = o;
-                o++;
-            }
-            else {
-                buf->data[o++] = host[i];
-            }
+    o = ls + 1;
+    t = strlen(host);
+
+    for(i = 0; i <= t; i++) {
+        if(host[i] == '.' || i == t) {
+            buf->data[ls] = (o - ls) - 1;
+            ls = o;
+            o++;
+        }
+        else {
+            buf->data[o++] = host[i];
         }
+    }
 
-        buf->data[ls] = 0;
+    buf->data[ls] = 0;
 
-        // Might be unaligned now... so just build it by hand.
-        buf->data[o++] = (uint8_t)(QTYPE_A >> 8);
-        buf->data[o++] = (uint8_t)QTYPE_A;
-        buf->data[o++] = 0x00;
-        buf->data[o++] = 0x01;
-        ls = o;
-    }
+    // Might be unaligned now... so just build it by hand.
+    buf->data[o++] = (uint8_t)(qtype >> 8);
+    buf->data[o++] = (uint8_t)qtype;
+    buf->data[o++] = 0x00;
+    buf->data[o++] = 0x01;
+
+    // Return the full message size.
+    return (size_t)(o + sizeof(dnsmsg_t));
+}
 
-    if(ip6) {
-        o = ls + 1;
-        t = strlen(host);
+/* Copy a host name to look up, dropping a trailing dot. Returns 0 if it's
+   something that can be put in a query, -1 otherwise. */
+static int dns_check_name(const char *host, char *out) {
+    size_t len = strlen(host), i, label = 0;
 
-        for(i = 0; i <= t; i++) {
-            if(host[i] == '.' || i == t) {
-                buf->data[ls] = (o - ls) - 1;
-                ls = o;
-                o++;
-            }
-            else {
-                buf->data[o++] = host[i];
-            }
-        }
+    if(len && host[len - 1] == '.')
+        --len;
 
-        buf->data[ls] = 0;
+    if(!len || len >= DNS_NAME_LEN)
+        return -1;
 
-        // Might be unaligned now... so just build it by hand.
-        buf->data[o++] = (uint8_t)(QTYPE_AAAA >> 8);
-        buf->data[o++] = (uint8_t)QTYPE_AAAA;
-        buf->data[o++] = 0x00;
-        buf->data[o++] = 0x01;
+    for(i = 0; i < len; ++i) {
+        if(host[i] != '.') {
+            if(++label > 63)
+                return -1;
+        }
+        else if(!label) {
+            return -1;
+        }
+        else {
+            label = 0;
+        }
     }
 
-    // Return the full message size.
-    return (size_t)(o + sizeof(dnsmsg_t));
+    if(!label)
+        return -1;
+
+    memcpy(out, host, len);
+    out[len] = 0;
+    return 0;
 }
 
 /* Resource records. A standard DNS response will have one query
@@ -211,215 +285,231 @@ static size_t dns_make_query(const char *host, dnsmsg_t *buf, int ip4,
    name, and the A answer contains the address.
  */
 
-// Scans through and skips a label in the data payload, starting
-// at the given offset. The new offset (after the label) will be
-// returned.
-static int dns_skip_label(dnsmsg_t *resp, int o) {
-    int cnt;
+/* Forward declaration... */
+static struct addrinfo *add_ipv4_ai(uint32_t ip, uint16_t port,
+                                    struct addrinfo *h, struct addrinfo *tail);
+static struct addrinfo *add_ipv6_ai(const struct in6_addr *ip, uint16_t port,
+                                    struct addrinfo *h, struct addrinfo *tail);
+
+static uint16_t dns_get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
 
-    // End of the label?
-    while(resp->data[o] != 0) {
+static uint32_t dns_get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Skip over a name in a message, starting at the given offset. Returns the
+   offset after it, or -1 if it runs off the end of the message. */
+static int dns_skip_name(const uint8_t *msg, int len, int o) {
+    while(o < len) {
         // Is it a pointer?
-        if((resp->data[o] & 0xc0) == 0xc0)
-            return o + 2;
+        if((msg[o] & 0xc0) == 0xc0)
+            return o + 2 <= len ? o + 2 : -1;
 
-        // Skip this part.
-        cnt = resp->data[o++];
-        o += cnt;
-    }
+        // End of the name?
+        if(!msg[o])
+            return o + 1;
 
-    // Skip the terminator
-    o++;
+        o += msg[o] + 1;
+    }
 
-    return o;
+    return -1;
 }
 
-// Scans through and copies out a label in the data payload,
-// starting at the given offset. The new offset (after the label)
-// will be returned as well as the label string.
-static int dns_copy_label(dnsmsg_t *resp, int o, char *outbuf) {
-    int cnt;
-    int rv = -1;
+/* Skip over a resource record, filling in its type, TTL and where its data
+   is. Returns the offset after it, or -1 if it runs off the end. */
+static int dns_skip_rr(const uint8_t *msg, int len, int o, uint16_t *type,
+                       uint32_t *ttl, int *rdata, int *rdlen) {
+    if((o = dns_skip_name(msg, len, o)) < 0 || o + 10 > len)
+        return -1;
 
-    // Do each part.
-    outbuf[0] = 0;
+    *type = dns_get16(msg + o);
+    *ttl = dns_get32(msg + o + 4);
+    *rdlen = dns_get16(msg + o + 8);
+    *rdata = o + 10;
 
-    for(;;) {
-        // Is it a pointer?
-        if((resp->data[o] & 0xc0) == 0xc0) {
-            int offs = ((resp->data[o] & ~0xc0) << 8) | resp->data[o + 1];
+    if(*rdata + *rdlen > len)
+        return -1;
 
-            if(rv < 0)
-                rv = o + 2;
+    return *rdata + *rdlen;
+}
 
-            o = offs - sizeof(dnsmsg_t);
+/* Make sure a response repeats the question that was asked, for the given
+   name and record type. Returns 0 if it does, -1 otherwise. */
+static int dns_check_question(const uint8_t *msg, int len, const char *name,
+                              uint16_t qtype) {
+    const char *p = name;
+    int i, n, o = sizeof(dnsmsg_t);
+
+    if(dns_get16(msg + 4) != 1)
+        return -1;
+
+    /* Compare it label by label. The name in the question comes first in the
+       message, so there's nothing before it for a pointer to point at. */
+    while(o < len && (n = msg[o++])) {
+        if(n > 63 || o + n > len)
+            return -1;
+
+        for(i = 0; i < n; ++i, ++p) {
+            if(!*p || tolower(msg[o + i]) != tolower((unsigned char)*p))
+                return -1;
         }
-        else {
-            cnt = resp->data[o++];
 
-            if(cnt) {
-                if(outbuf[0] != 0)
-                    strcat(outbuf, ".");
+        o += n;
 
-                strncat(outbuf, (char *)(resp->data + o), cnt);
-                o += cnt;
-            }
-            else {
-                break;
-            }
-        }
+        if(*p == '.')
+            ++p;
+        else if(*p)
+            return -1;
     }
 
-    if(rv < 0)
-        return o;
-    else
-        return rv;
-}
-
-/* Forward declaration... */
-static struct addrinfo *add_ipv4_ai(uint32_t ip, uint16_t port,
-                                    struct addrinfo *h, struct addrinfo *tail);
-static struct addrinfo *add_ipv6_ai(const struct in6_addr *ip, uint16_t port,
-                                    struct addrinfo *h, struct addrinfo *tail);
+    if(*p || o + 4 > len)
+        return -1;
 
-// Parse a response packet from the DNS server. The IP address
-// will be filled in upon a successful return, otherwise the
-// return value will be <0.
-static int dns_parse_response(dnsmsg_t *resp, struct addrinfo *hints,
-                              uint16_t port, struct addrinfo **res) {
-    int i, o, arecs;
-    uint16_t flags;
-    char tmp[64];
-    uint16_t ancnt, len;
-    struct addrinfo *ptr = NULL;
+    return dns_get16(msg + o) == qtype && dns_get16(msg + o + 2) == 1 ? 0 : -1;
+}
 
-    /* Check the flags first to see if it was successful. */
-    flags = ntohs(resp->flags);
+/* Parse a response from the DNS server to a question for the given record
+   type. The addresses found (if any) and how long they're good for are filled
+   in to ans, along with an error code if there weren't any. */
+static void dns_parse_response(const uint8_t *msg, int len, uint16_t qtype,
+                               dns_answer_t *ans) {
+    int i, o, cnt, rdata, rdlen, alen = qtype == QTYPE_A ? 4 : 16;
+    uint16_t flags, type;
+    uint32_t ttl, minttl = DNS_MAX_TTL;
 
-    if(!(flags & 0x8000)) {
-        /* Not our response! */
-        return EAI_AGAIN;
-    }
+    memset(ans, 0, sizeof(dns_answer_t));
+    flags = dns_get16(msg + 2);
 
     /* Did the server report an error? */
     switch(flags & 0x000f) {
         case 0:   /* No error */
+        case 3:   /* Name error */
             break;
 
         case 1:   /* Format error */
         case 4:   /* Not implemented */
         case 5:   /* Refused */
         default:
-            return EAI_FAIL;
-
-        case 3:   /* Name error */
-            return EAI_NONAME;
+            ans->err = EAI_FAIL;
+            return;
 
         case 2:   /* Server failure */
-            return EAI_AGAIN;
+            ans->err = EAI_AGAIN;
+            return;
     }
 
-    /* Getting zero answers is also a failure. */
-    ancnt = ntohs(resp->ancount);
-
-    if(ancnt < 1)
-        return EAI_NONAME;
-
     /* If we have any query sections (should have at least one), skip 'em. */
-    o = 0;
-    len = ntohs(resp->qdcount);
-
-    for(i = 0; i < len; i++) {
-        /* Skip the label. */
-        o = dns_skip_label(resp, o);
+    o = sizeof(dnsmsg_t);
+    cnt = dns_get16(msg + 4);
 
-        /* And the two type fields. */
-        o += 4;
+    for(i = 0; i < cnt && o >= 0; i++) {
+        if((o = dns_skip_name(msg, len, o)) >= 0)
+            o = o + 4 <= len ? o + 4 : -1;
     }
 
-    /* Ok, now the answer section (what we're interested in). */
-    arecs = 0;
+    /* Ok, now the answer section (what we're interested in). Anything other
+       than what we asked for is just skipped, but the TTL of any CNAME records
+       counts towards how long the answer is good for. */
+    cnt = dns_get16(msg + 6);
 
-    for(i = 0; i < ancnt; i++) {
-        /* Copy out the label, in case we need it. */
-        o = dns_copy_label(resp, o, tmp);
-
-        /* Get the type code. If it's not A or AAAA, skip it. */
-        if(resp->data[o] == 0 && resp->data[o + 1] == 1 &&
-           (hints->ai_family == AF_INET || hints->ai_family == AF_UNSPEC)) {
-            uint32_t addr;
+    for(i = 0; i < cnt && o >= 0; i++) {
+        if((o = dns_skip_rr(msg, len, o, &type, &ttl, &rdata, &rdlen)) < 0)
+            break;
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
+        if(type == qtype && rdlen == alen && ans->count < DNS_MAX_ADDRS) {
+            memcpy(ans->addrs[ans->count++], msg + rdata, alen);
+            minttl = ttl < minttl ? ttl : minttl;
+        }
+        else if(type == QTYPE_CNAME) {
+            minttl = ttl < minttl ? ttl : minttl;
+        }
+    }
 
-            /* Grab the address from the response. */
-            addr = htonl((resp->data[o] << 24) | (resp->data[o + 1] << 16) |
-                         (resp->data[o + 2] << 8) | resp->data[o + 3]);
+    if(ans->count) {
+        ans->ttl = minttl;
+        return;
+    }
 
-            /* Add this address to the chain. */
-            if(!(ptr = add_ipv4_ai(addr, port, hints, ptr)))
-                /* If something goes wrong in here, it's in calling malloc, so
-                   it is definitely a system error. */
-                return EAI_SYSTEM;
+    /* Nothing there, so the name doesn't exist (or has no addresses of this
+       type). The SOA record in the authority section, if any, says how long
+       to remember that for (RFC 2308). */
+    ans->err = EAI_NONAME;
+    ans->ttl = DNS_NEG_TTL;
+    cnt = dns_get16(msg + 8);
 
-            if(!*res)
-                *res = ptr;
+    for(i = 0; i < cnt && o >= 0; i++) {
+        if((o = dns_skip_rr(msg, len, o, &type, &ttl, &rdata, &rdlen)) < 0)
+            break;
 
-            o += len;
-            arecs++;
+        if(type == QTYPE_SOA && rdlen >= 4) {
+            minttl = dns_get32(msg + rdata + rdlen - 4);
+            ans->ttl = ttl < minttl ? ttl : minttl;
+            break;
         }
-        else if(resp->data[o] == 0 && resp->data[o + 1] == 28 &&
-                (hints->ai_family == AF_INET6 || hints->ai_family == AF_UNSPEC)) {
-            struct in6_addr addr;
+    }
+}
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
+/* Look for an answer that hasn't expired yet in the cache. */
+static int dns_cache_lookup(const char *name, uint16_t qtype,
+                            dns_answer_t *ans) {
+    uint64_t now = timer_ms_gettime64();
+    int i, rv = 0;
 
-            /* Grab the address from the response. */
-            memcpy(addr.s6_addr, &resp->data[o], 16);
+    mutex_lock(&dns_mutex);
 
-            /* Add this address to the chain. */
-            if(!(ptr = add_ipv6_ai(&addr, port, hints, ptr)))
-                /* If something goes wrong in here, it's in calling malloc, so
-                   it is definitely a system error. */
-                return EAI_SYSTEM;
+    for(i = 0; i < DNS_CACHE_SIZE; ++i) {
+        if(dns_cache[i].expires > now && dns_cache[i].qtype == qtype &&
+           !strcasecmp(dns_cache[i].name, name)) {
+            *ans = dns_cache[i].ans;
+            rv = 1;
+            break;
+        }
+    }
 
-            if(!*res)
-                *res = ptr;
+    mutex_unlock(&dns_mutex);
+    return rv;
+}
 
-            o += len;
-            arecs++;
+/* Remember an answer for as long as its TTL says, up to DNS_MAX_TTL. Only
+   answers that say something about the name are kept, not failures of the
+   server. When the cache is full, whatever would expire first makes room. */
+static void dns_cache_add(const char *name, uint16_t qtype,
+                          const dns_answer_t *ans) {
+    uint64_t now = timer_ms_gettime64();
+    dns_cache_ent_t *ent = NULL;
+    uint32_t ttl = ans->ttl < DNS_MAX_TTL ? ans->ttl : DNS_MAX_TTL;
+    int i;
+
+    if((ans->err && ans->err != EAI_NONAME) || !ttl)
+        return;
+
+    mutex_lock(&dns_mutex);
+
+    for(i = 0; i < DNS_CACHE_SIZE; ++i) {
+        if(dns_cache[i].qtype == qtype &&
+           !strcasecmp(dns_cache[i].name, name)) {
+            ent = &dns_cache[i];
+            break;
         }
-        else if(resp->data[o] == 0 && resp->data[o + 1] == 5) {
-            char tmp2[64];
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
-            o = dns_copy_label(resp, o, tmp2);
-        }
-        else {
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2 + len;
-        }
+        if(!ent || dns_cache[i].expires < ent->expires)
+            ent = &dns_cache[i];
     }
 
-    /* Did we find something? */
-    return arecs > 0 ? 0 : EAI_NONAME;
+    strcpy(ent->name, name);
+    ent->qtype = qtype;
+    ent->expires = now + (uint64_t)ttl * 1000;
+    ent->ans = *ans;
+
+    mutex_unlock(&dns_mutex);
 }
 
-static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
-                           uint16_t port, struct addrinfo **res) {
+/* Open a socket to the DNS server for a lookup. */
+static int gai_open(struct gai_request *req) {
     struct sockaddr_in toaddr;
-    uint8_t qb[512];
-    size_t size;
-    int sock, rv, tries;
     in_addr_t raddr;
-    ssize_t rsize = 0;
-    struct pollfd pfd;
 
     /* Make sure we have a network device to communicate on. */
     if(!net_default_dev) {
@@ -433,25 +523,8 @@ static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
         return EAI_FAIL;
     }
 
-    /* Setup a query */
-    if(hints->ai_family == AF_UNSPEC)
-        /* Note: This should (in theory) work, but it seems that some resolvers
-           cannot handle multiple questions in one query. So... while the code
-           here supports multiple questions in one query, this branch will never
-           actually be taken -- getaddrinfo() will always make two separate
-           calls if we need to do both IPv4 and IPv6. */
-        size = dns_make_query(name, (dnsmsg_t *)qb, 1, 1);
-    else if(hints->ai_family == AF_INET)
-        size = dns_make_query(name, (dnsmsg_t *)qb, 1, 0);
-    else if(hints->ai_family == AF_INET6)
-        size = dns_make_query(name, (dnsmsg_t *)qb, 0, 1);
-    else {
-        errno = EAFNOSUPPORT;
-        return EAI_SYSTEM;
-    }
-
     /* Make a socket to talk to the DNS server. */
-    if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    if((req->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
         return EAI_SYSTEM;
 
     /* "Connect" the socket to the DNS server's address. */
@@ -463,56 +536,155 @@ static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
     toaddr.sin_port = htons(53);
     toaddr.sin_addr.s_addr = htonl(raddr);
 
-    if(connect(sock, (struct sockaddr *)&toaddr, sizeof(toaddr))) {
-        close(sock);
+    if(connect(req->sock, (struct sockaddr *)&toaddr, sizeof(toaddr))) {
+        close(req->sock);
+        req->sock = -1;
         return EAI_SYSTEM;
     }
 
-    /* Set up the structure we'll use to feed to the poll function. */
-    pfd.fd = sock;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
+    return 0;
+}
+
+/* Send (or send again) every question that hasn't been answered yet. */
+static int gai_send(struct gai_request *req) {
+    uint8_t qb[512];
+    size_t size;
+    int i;
+
+    for(i = 0; i < req->nq; ++i) {
+        if(req->q[i].answered)
+            continue;
+
+        size = dns_make_query(req->name, (dnsmsg_t *)qb, req->q[i].id,
+                              req->q[i].type);
 
-    for(tries = 0; tries < DNS_ATTEMPTS; ++tries) {
-        /* Send the query to the server. */
-        if(send(sock, qb, size, 0) < 0) {
+        if(send(req->sock, qb, size, 0) < 0)
             return EAI_SYSTEM;
+    }
+
+    ++req->tries;
+    req->next_send = timer_ms_gettime64() + DNS_TIMEOUT;
+    return 0;
+}
+
+/* Take whatever responses have come in, without waiting for any. */
+static int gai_receive(struct gai_request *req) {
+    uint8_t qb[512];
+    ssize_t rsize;
+    uint16_t id;
+    int i, left = 0;
+
+    while((rsize = recv(req->sock, qb, sizeof(qb), MSG_DONTWAIT)) >= 0) {
+        /* Make sure it's a response, and one to a question we asked. Anything
+           else, including a response with the right ID that doesn't repeat
+           the question, is dropped. */
+        if(rsize < (ssize_t)sizeof(dnsmsg_t) || !(qb[2] & 0x80))
+            continue;
+
+        id = dns_get16(qb);
+
+        for(i = 0; i < req->nq; ++i) {
+            if(!req->q[i].answered && req->q[i].id == id &&
+               !dns_check_question(qb, rsize, req->name, req->q[i].type)) {
+                dns_parse_response(qb, rsize, req->q[i].type, &req->q[i].ans);
+                dns_cache_add(req->name, req->q[i].type, &req->q[i].ans);
+                req->q[i].answered = 1;
+                break;
+            }
         }
+    }
+
+    for(i = 0; i < req->nq; ++i)
+        left += !req->q[i].answered;
+
+    return left;
+}
+
+/* Put the addresses from the answers together, IPv4 first. */
+static int gai_result(struct gai_request *req, struct addrinfo **res) {
+    struct addrinfo *ptr = NULL;
+    dns_answer_t *ans;
+    uint32_t addr;
+    int i, j;
+
+    for(i = 0; i < req->nq; ++i) {
+        ans = &req->q[i].ans;
 
-        /* Wait for the timeout to expire or for us to get the response. */
-        if(poll(&pfd, 1, DNS_TIMEOUT) == 1) {
-            /* Get the response. */
-            if((rsize = recv(sock, qb, 512, 0)) < 0) {
+        for(j = 0; !ans->err && j < ans->count; ++j) {
+            if(req->q[i].type == QTYPE_A) {
+                memcpy(&addr, ans->addrs[j], 4);
+                ptr = add_ipv4_ai(addr, req->port, &req->hints, ptr);
+            }
+            else {
+                ptr = add_ipv6_ai((struct in6_addr *)ans->addrs[j], req->port,
+                                  &req->hints, ptr);
+            }
+
+            /* If something goes wrong in here, it's in calling malloc, so it
+               is definitely a system error. */
+            if(!ptr) {
+                freeaddrinfo(*res);
+                *res = NULL;
+                errno = ENOMEM;
                 return EAI_SYSTEM;
             }
 
-            break;
+            if(!*res)
+                *res = ptr;
         }
     }
 
-    /* Close the socket */
-    close(sock);
+    if(*res)
+        return 0;
 
-    /* If we never actually got a response, then there's probably a problem with
-       the server on the other end. I'm not entirely sure what to return in that
-       case, to be perfectly honest. I suppose that EAI_SYSTEM + ETIMEDOUT would
-       make the most sense, since that's really what happened... */
-    if(!rsize) {
+    /* With both IPv4 and IPv6, only a failure to get an answer about IPv4 is
+       worth reporting, otherwise the name just has no addresses. */
+    if(req->q[0].ans.err == EAI_SYSTEM)
         errno = ETIMEDOUT;
+
+    if(req->nq == 1 || req->q[0].ans.err != EAI_NONAME)
+        return req->q[0].ans.err;
+
+    return EAI_NONAME;
+}
+
+/* Set up a lookup of a host name, from the cache if possible. */
+static int gai_lookup(struct gai_request *req, const char *nodename) {
+    int i, rv;
+
+    if(dns_check_name(nodename, req->name))
+        return EAI_NONAME;
+
+    if(req->hints.ai_family == AF_INET || req->hints.ai_family == AF_UNSPEC)
+        req->q[req->nq++].type = QTYPE_A;
+
+    if(req->hints.ai_family == AF_INET6 || req->hints.ai_family == AF_UNSPEC)
+        req->q[req->nq++].type = QTYPE_AAAA;
+
+    if(!req->nq) {
+        errno = EAFNOSUPPORT;
         return EAI_SYSTEM;
     }
 
-    /* Parse the response. */
-    rv = dns_parse_response((dnsmsg_t *)qb, hints, port, res);
+    for(i = 0; i < req->nq; ++i) {
+        if(dns_cache_lookup(req->name, req->q[i].type, &req->q[i].ans))
+            req->q[i].answered = 1;
+    }
+
+    if(req->q[0].answered && (req->nq == 1 || req->q[1].answered))
+        return 0;
+
+    if((rv = gai_open(req)))
+        return rv;
 
-    /* If we got something in the result, but got an error value in the return,
-       free whatever we got. */
-    if(rv != 0 && *res) {
-        freeaddrinfo(*res);
-        *res = NULL;
+    /* Use IDs that can't be guessed from the last query, so that a forged
+       response is hard to get in ahead of the real one. */
+    for(i = 0; i < req->nq; ++i) {
+        req->q[i].id = (uint16_t)timer_us_gettime64() + i;
+        arc4random_buf(&req->q[i].id, sizeof(req->q[i].id));
     }
 
-    return rv;
+    return gai_send(req);
 }
 
 /* New stuff below here... */
@@ -612,23 +784,14 @@ void freeaddrinfo(struct addrinfo *ai) {
     }
 }
 
-int getaddrinfo(const char *nodename, const char *servname,
-                const struct addrinfo *hints, struct addrinfo **res) {
+/* Work out what to look up, and answer straight away where we can. */
+static int gai_setup(struct gai_request *req, const char *nodename,
+                     const char *servname, const struct addrinfo *hints) {
     in_port_t port = 0;
     unsigned long tmp;
     char *endp;
     int old_errno;
-    struct addrinfo ihints;
-
-    (void)hints;
-
-    /* What to do if res is NULL?... I'll assume we should return error... */
-    if(!res) {
-        errno = EFAULT;
-        return EAI_SYSTEM;
-    }
-
-    *res = NULL;
+    struct addrinfo *ihints = &req->hints;
 
     /* Check the input parameters... */
     if(!nodename && !servname)
@@ -652,54 +815,58 @@ int getaddrinfo(const char *nodename, const char *servname,
         port = htons((uint16_t)tmp);
     }
 
+    req->port = port;
+
     /* Did the user give us any hints? */
     if(hints)
-        memcpy(&ihints, hints, sizeof(ihints));
+        memcpy(ihints, hints, sizeof(struct addrinfo));
     else
-        memset(&ihints, 0, sizeof(ihints));
+        memset(ihints, 0, sizeof(struct addrinfo));
 
     /* Do we want a local address or a remote one? */
     if(!nodename) {
         struct addrinfo *r = NULL;
 
+        req->done = 1;
+
         /* Is the passive flag set to indicate we want everything set up for a
            bind? */
-        if(ihints.ai_flags & AI_PASSIVE) {
-            if(ihints.ai_family == AF_INET || ihints.ai_family == AF_UNSPEC) {
-                if(!(r = add_ipv4_ai(INADDR_ANY, port, &ihints, r)))
+        if(ihints->ai_flags & AI_PASSIVE) {
+            if(ihints->ai_family == AF_INET || ihints->ai_family == AF_UNSPEC) {
+                if(!(r = add_ipv4_ai(INADDR_ANY, port, ihints, r)))
                     return EAI_SYSTEM;
 
-                *res = r;
+                req->res = r;
             }
 
-            if(ihints.ai_family == AF_INET6 || ihints.ai_family == AF_UNSPEC) {
-                if(!(r = add_ipv6_ai(&in6addr_any, port, &ihints, r))) {
-                    freeaddrinfo(*res);
+            if(ihints->ai_family == AF_INET6 || ihints->ai_family == AF_UNSPEC) {
+                if(!(r = add_ipv6_ai(&in6addr_any, port, ihints, r))) {
+                    freeaddrinfo(req->res);
                     return EAI_SYSTEM;
                 }
 
-                if(!*res)
-                    *res = r;
+                if(!req->res)
+                    req->res = r;
             }
         }
         else {
-            if(ihints.ai_family == AF_INET || ihints.ai_family == AF_UNSPEC) {
+            if(ihints->ai_family == AF_INET || ihints->ai_family == AF_UNSPEC) {
                 uint32_t addr = htonl(0x7f000001);
 
-                if(!(r = add_ipv4_ai(addr, port, &ihints, r)))
+                if(!(r = add_ipv4_ai(addr, port, ihints, r)))
                     return EAI_SYSTEM;
 
-                *res = r;
+                req->res = r;
             }
 
-            if(ihints.ai_family == AF_INET6 || ihints.ai_family == AF_UNSPEC) {
-                if(!(r = add_ipv6_ai(&in6addr_loopback, port, &ihints, r))) {
-                    freeaddrinfo(*res);
+            if(ihints->ai_family == AF_INET6 || ihints->ai_family == AF_UNSPEC) {
+                if(!(r = add_ipv6_ai(&in6addr_loopback, port, ihints, r))) {
+                    freeaddrinfo(req->res);
                     return EAI_SYSTEM;
                 }
 
-                if(!*res)
-                    *res = r;
+                if(!req->res)
+                    req->res = r;
             }
         }
 
@@ -707,67 +874,153 @@ int getaddrinfo(const char *nodename, const char *servname,
     }
 
     /* Try to handle input as an IPv4 address */
-    if(ihints.ai_family == AF_INET || ihints.ai_family == AF_UNSPEC) {
+    if(ihints->ai_family == AF_INET || ihints->ai_family == AF_UNSPEC) {
         uint32_t ip4_addr;
 
         if(inet_pton(AF_INET, nodename, &ip4_addr) > 0) {
-            ihints.ai_family = AF_INET;
-            *res = add_ipv4_ai(ip4_addr, port, &ihints, NULL);
+            ihints->ai_family = AF_INET;
+            req->res = add_ipv4_ai(ip4_addr, port, ihints, NULL);
+            req->done = 1;
             return 0;
         }
     }
 
     /* Try to handle input as an IPv6 address */
-    if(ihints.ai_family == AF_INET6 || ihints.ai_family == AF_UNSPEC) {
+    if(ihints->ai_family == AF_INET6 || ihints->ai_family == AF_UNSPEC) {
         struct in6_addr addr;
 
         if(inet_pton(AF_INET6, nodename, &addr.s6_addr) > 0) {
-            ihints.ai_family = AF_INET6;
-            *res = add_ipv6_ai(&addr, port, &ihints, NULL);
+            ihints->ai_family = AF_INET6;
+            req->res = add_ipv6_ai(&addr, port, ihints, NULL);
+            req->done = 1;
             return 0;
         }
     }
 
     /* If we've gotten this far, do the lookup. */
-    if(ihints.ai_family == AF_UNSPEC) {
-        /* It seems that some resolvers really don't like multi-part questions.
-           So, make sure we only ever send one part at a time... */
-        struct addrinfo *res1 = NULL, *res2 = NULL;
-        int rv;
+    return gai_lookup(req, nodename);
+}
 
-        ihints.ai_family = AF_INET;
-        rv = getaddrinfo_dns(nodename, &ihints, port, &res1);
+int getaddrinfo_start(const char *nodename, const char *servname,
+                      const struct addrinfo *hints,
+                      struct gai_request **req) {
+    struct gai_request *r;
+    int rv;
 
-        if(rv && rv != EAI_NONAME)
-            return rv;
+    if(!req) {
+        errno = EFAULT;
+        return EAI_SYSTEM;
+    }
 
-        ihints.ai_family = AF_INET6;
-        getaddrinfo_dns(nodename, &ihints, port, &res2);
+    *req = NULL;
 
-        /* Figure out what to do with the result(s). */
-        if(res1 && res2) {
-            *res = res1;
+    if(!(r = (struct gai_request *)malloc(sizeof(struct gai_request))))
+        return EAI_MEMORY;
 
-            /* Go to the end of the chain. */
-            while(res1->ai_next) {
-                res1 = res1->ai_next;
-            }
+    memset(r, 0, sizeof(struct gai_request));
+    r->sock = -1;
 
-            res1->ai_next = res2;
-            return 0;
-        }
-        else if(res1) {
-            *res = res1;
-            return 0;
-        }
-        else if(res2) {
-            *res = res2;
-            return 0;
-        }
-        else {
-            return EAI_NONAME;
+    if((rv = gai_setup(r, nodename, servname, hints))) {
+        getaddrinfo_cancel(r);
+        return rv;
+    }
+
+    *req = r;
+    return 0;
+}
+
+int getaddrinfo_fd(const struct gai_request *req) {
+    return req->sock;
+}
+
+int getaddrinfo_timeout(const struct gai_request *req) {
+    uint64_t now;
+
+    if(req->sock < 0)
+        return 0;
+
+    now = timer_ms_gettime64();
+    return req->next_send > now ? (int)(req->next_send - now) : 0;
+}
+
+int getaddrinfo_finish(struct gai_request *req, struct addrinfo **res) {
+    int i, rv = 0;
+
+    /* What to do if res is NULL?... I'll assume we should return error... */
+    if(!res) {
+        errno = EFAULT;
+        return EAI_SYSTEM;
+    }
+
+    *res = NULL;
+
+    if(req->done) {
+        *res = req->res;
+        req->res = NULL;
+    }
+    else {
+        if(req->sock >= 0 && gai_receive(req)) {
+            if(timer_ms_gettime64() < req->next_send)
+                return EAI_INPROGRESS;
+
+            /* If we never actually got a response, then there's probably a
+               problem with the server on the other end. That gets reported
+               as EAI_SYSTEM with errno set to ETIMEDOUT. */
+            if(req->tries < DNS_ATTEMPTS) {
+                if(!(rv = gai_send(req)))
+                    return EAI_INPROGRESS;
+            }
+            else {
+                for(i = 0; i < req->nq; ++i) {
+                    if(!req->q[i].answered)
+                        req->q[i].ans.err = EAI_SYSTEM;
+                }
+            }
         }
+
+        if(!rv)
+            rv = gai_result(req, res);
     }
 
-    return getaddrinfo_dns(nodename, &ihints, port, res);
+    getaddrinfo_cancel(req);
+    return rv;
+}
+
+void getaddrinfo_cancel(struct gai_request *req) {
+    if(!req)
+        return;
+
+    if(req->sock >= 0)
+        close(req->sock);
+
+    freeaddrinfo(req->res);
+    free(req);
+}
+
+int getaddrinfo(const char *nodename, const char *servname,
+                const struct addrinfo *hints, struct addrinfo **res) {
+    struct gai_request *req;
+    struct pollfd pfd;
+    int rv;
+
+    /* What to do if res is NULL?... I'll assume we should return error... */
+    if(!res) {
+        errno = EFAULT;
+        return EAI_SYSTEM;
+    }
+
+    *res = NULL;
+
+    if((rv = getaddrinfo_start(nodename, servname, hints, &req)))
+        return rv;
+
+    /* Wait for the answers to come in, or for it to be time to ask again. */
+    while((rv = getaddrinfo_finish(req, res)) == EAI_INPROGRESS) {
+        pfd.fd = getaddrinfo_fd(req);
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, getaddrinfo_timeout(req));
+    }
+
+    return rv;
 }
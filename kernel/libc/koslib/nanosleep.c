@@ -10,8 +10,6 @@
 #include <kos/thread.h>
 
 int nanosleep(const struct timespec *rqtp, struct timespec *rmtp) {
-    int ms;
-
     /* Make sure we aren't inside an interrupt first... */
     if(irq_inside_int()) {
         if(rmtp)
@@ -21,17 +19,8 @@ int nanosleep(const struct timespec *rqtp, struct timespec *rmtp) {
         return -1;
     }
 
-    /* Calculate the number of milliseconds to sleep for. No, you don't get
-       anywhere near nanosecond precision here. */
-    ms = rqtp->tv_sec * 1000 + rqtp->tv_nsec / 1000000;
-
-    /* We need to sleep for *at least* how long is specified, so if they've
-       given us a non-whole number of milliseconds, then add one to the time. */
-    if(rqtp->tv_nsec % 1000000)
-        ++ms;
-
     /* Make sure they gave us something valid. */
-    if(ms < 0) {
+    if(rqtp->tv_sec < 0 || rqtp->tv_nsec < 0 || rqtp->tv_nsec >= 1000000000) {
         if(rmtp)
             *rmtp = *rqtp;
 
@@ -40,10 +29,10 @@ int nanosleep(const struct timespec *rqtp, struct timespec *rmtp) {
     }
 
     /* Sleep! */
-    thd_sleep(ms);
+    thd_sleep_ns((uint64_t)rqtp->tv_sec * 1000000000ull + rqtp->tv_nsec);
 
-    /* thd_sleep will always sleep for at least the specified time, so clear out
-       the remaining time, if it was given to us. */
+    /* thd_sleep_ns will always sleep for at least the specified time, so clear
+       out the remaining time, if it was given to us. */
     if(rmtp) {
         rmtp->tv_sec = 0;
         rmtp->tv_nsec = 0;
@@ -2,136 +2,658 @@
 
    poll.c
    Copyright (C) 2012 Lawrence Sebald
+   Copyright (C) 2024 The KOS Team and contributors
 
 */
 
+/* Both poll() and the epoll interface are built on the same thing here: an
+   instance holds a list of items, one per watched file descriptor, and each
+   file descriptor has a list of the items watching it. When something happens
+   on a file descriptor (__poll_event_trigger()), only the items on its own list
+   are looked at, and those that match are put on their instance's ready list.
+   Waiting only looks at what is on the ready list.
+
+   Items on the ready list are checked again with the handler's poll method
+   before being reported, since whatever happened may have been undone by then
+   (the data read, for instance). That's done without holding the lock here, as
+   the handlers take their own locks, and they call __poll_event_trigger() with
+   those held. Items being checked are marked busy, so that they can't be freed
+   from under us in the meantime. Level-triggered items that are still ready
+   are put back on the ready list, so that the next wait reports them again. */
+
 #include <poll.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/queue.h>
 
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <kos/fs.h>
 #include <kos/mutex.h>
 #include <kos/cond.h>
 
-struct poll_int {
-    LIST_ENTRY(poll_int) entry;
-    struct pollfd *fds;
-    nfds_t nfds;
-    int nmatched;
-    condvar_t cv;
+/* Values of ep_item::ready */
+#define EP_IDLE     0   /* Not on any ready list */
+#define EP_READY    1   /* On its instance's ready list */
+#define EP_AGAIN    2   /* Being put back on the ready list by ep_wait() */
+
+/* Number of items checked at once by ep_wait() */
+#define EP_BATCH    32
+
+/* Events that are always reported */
+#define EP_ALWAYS   (POLLERR | POLLHUP | POLLNVAL)
+
+struct ep_inst;
+
+struct ep_item {
+    TAILQ_ENTRY(ep_item) rdl;       /* Ready list */
+    LIST_ENTRY(ep_item) fdl;        /* Items watching the same fd */
+    LIST_ENTRY(ep_item) epl;        /* Items of the same instance */
+    struct ep_inst *ep;
+    int fd;
+    uint32_t events;
+    uint32_t revents;
+    epoll_data_t data;
+    int ready;
+    int busy;
+    int linked;
+    int heap;
 };
 
-LIST_HEAD(polllist, poll_int) poll_list;
+TAILQ_HEAD(ep_ready_list, ep_item);
+LIST_HEAD(ep_item_list, ep_item);
 
+struct ep_inst {
+    struct ep_ready_list ready;
+    struct ep_item_list items;
+    condvar_t cv;
+    int waiters;                    /* Threads in ep_wait() */
+    int closed;                     /* Being closed, once they've left */
+};
+
+static struct ep_item_list watch[FD_SETSIZE];
 static mutex_t mutex = MUTEX_INITIALIZER;
 
-void __poll_event_trigger(int fd, short event) {
-    struct poll_int *i;
-    nfds_t j;
-    int gotone = 0;
-    short mask;
+/* Check what is going on with a file descriptor right now. */
+static short ep_query(int fd, uint32_t events) {
+    vfs_handler_t *hndl;
+    void *hnd;
+    short ev = (short)(events & 0xFFFF);
+
+    if(fd < 0 || fd >= FD_SETSIZE || !(hndl = fs_get_handler(fd)) ||
+       !(hnd = fs_get_handle(fd)))
+        return POLLNVAL;
+
+    /* Assume its a regular file if there's no poll method in the handler. */
+    if(!hndl->poll)
+        return (POLLRDNORM | POLLWRNORM) & ev;
+
+    return hndl->poll(hnd, ev);
+}
+
+/* Put an item on its instance's ready list, if it isn't already on it. Must be
+   called with the lock held. */
+static void ep_ready(struct ep_item *it) {
+    if(it->ready == EP_IDLE) {
+        TAILQ_INSERT_TAIL(&it->ep->ready, it, rdl);
+        it->ready = EP_READY;
+    }
+
+    cond_signal(&it->ep->cv);
+}
+
+static void ep_init(struct ep_inst *ep) {
+    TAILQ_INIT(&ep->ready);
+    LIST_INIT(&ep->items);
+    cond_init(&ep->cv);
+    ep->waiters = 0;
+    ep->closed = 0;
+}
+
+static int ep_unbusy(struct ep_item *it);
+
+/* Start watching a file descriptor. Must be called with the lock held. The
+   item is marked busy, and has to be handed to ep_check() next. */
+static void ep_link(struct ep_inst *ep, struct ep_item *it, int fd,
+                    uint32_t events, epoll_data_t data) {
+    it->ep = ep;
+    it->fd = fd;
+    it->events = events;
+    it->revents = 0;
+    it->data = data;
+    it->ready = EP_IDLE;
+    it->busy = 1;
+    it->linked = 1;
+
+    LIST_INSERT_HEAD(&watch[fd], it, fdl);
+    LIST_INSERT_HEAD(&ep->items, it, epl);
+}
+
+/* Look at the file descriptor of an item that was just linked in. That's done
+   after linking it, so that nothing that happens in between can be missed,
+   and without the lock held, which is why the item was left busy. */
+static void ep_check(struct ep_item *it) {
+    short ev = ep_query(it->fd, it->events);
+
+    mutex_lock(&mutex);
+
+    if(ep_unbusy(it) && ev)
+        ep_ready(it);
+
+    mutex_unlock(&mutex);
+}
 
+static int ep_add(struct ep_inst *ep, struct ep_item *it, int fd,
+                  uint32_t events, epoll_data_t data) {
     if(mutex_lock_irqsafe(&mutex))
-        /* XXXX: Uhh... this is bad... */
-        return;
+        return -1;
+
+    ep_link(ep, it, fd, events, data);
+    mutex_unlock(&mutex);
+    ep_check(it);
+
+    return 0;
+}
+
+/* Stop watching a file descriptor. Must be called with the lock held. Returns
+   non-zero if the item can be freed now, otherwise ep_wait() will do it once
+   it is done with it. */
+static int ep_del(struct ep_item *it) {
+    if(!it->linked)
+        return 0;
+
+    LIST_REMOVE(it, fdl);
+    LIST_REMOVE(it, epl);
+
+    if(it->ready == EP_READY) {
+        TAILQ_REMOVE(&it->ep->ready, it, rdl);
+        it->ready = EP_IDLE;
+    }
+
+    it->linked = 0;
+
+    return !it->busy;
+}
+
+/* Tear down an instance, freeing any items it allocated. */
+static void ep_destroy(struct ep_inst *ep) {
+    struct ep_item *it;
+
+    mutex_lock(&mutex);
+
+    while((it = LIST_FIRST(&ep->items))) {
+        if(ep_del(it) && it->heap)
+            free(it);
+    }
+
+    mutex_unlock(&mutex);
+    cond_destroy(&ep->cv);
+}
+
+/* Done with an item that was being checked without the lock held. Returns
+   non-zero if it's still watched. */
+static int ep_unbusy(struct ep_item *it) {
+    if(!--it->busy && !it->linked) {
+        if(it->heap)
+            free(it);
+
+        return 0;
+    }
+
+    return it->linked;
+}
+
+/* Wait for events on an instance, see epoll_wait(). */
+static int ep_wait(struct ep_inst *ep, struct epoll_event *evs, int max,
+                   int timeout) {
+    struct ep_item *batch[EP_BATCH], *it;
+    struct ep_ready_list again;
+    short cur[EP_BATCH];
+    int fds[EP_BATCH];
+    uint32_t mask[EP_BATCH], ev;
+    uint64_t end = 0, now;
+    int n = 0, cnt, i, err = 0, closed;
+
+    /* We can't actually wait (or let the handlers lock anything) while we're
+       in an interrupt. */
+    if(irq_inside_int()) {
+        errno = EPERM;
+        return -1;
+    }
+
+    if(timeout > 0)
+        end = timer_ms_gettime64() + timeout;
+
+    TAILQ_INIT(&again);
+    mutex_lock(&mutex);
+    ++ep->waiters;
+
+    for(;;) {
+        /* The instance is being closed, so get out of its way. */
+        if(ep->closed) {
+            if(!n)
+                err = EBADF;
+
+            break;
+        }
+
+        /* Take a batch off the ready list. */
+        for(cnt = 0; cnt < EP_BATCH && n + cnt < max; ++cnt) {
+            if(!(it = TAILQ_FIRST(&ep->ready)))
+                break;
+
+            TAILQ_REMOVE(&ep->ready, it, rdl);
+            it->ready = EP_IDLE;
+            ++it->busy;
+            batch[cnt] = it;
+            fds[cnt] = it->fd;
+            mask[cnt] = it->events;
+        }
+
+        if(cnt) {
+            mutex_unlock(&mutex);
+
+            for(i = 0; i < cnt; ++i)
+                cur[i] = ep_query(fds[i], mask[i]);
+
+            mutex_lock(&mutex);
+
+            for(i = 0; i < cnt; ++i) {
+                it = batch[i];
+
+                if(!ep_unbusy(it))
+                    continue;
 
-    /* Look through the list of poll fds for any that match */
-    LIST_FOREACH(i, &poll_list, entry) {
-        for(j = 0; j < i->nfds; ++j) {
-            if(i->fds[j].fd == fd) {
-                mask = i->fds[j].events | POLLERR | POLLHUP | POLLNVAL;
-                if(event & mask) {
-                    i->fds[j].revents |= event & mask;
-                    ++i->nmatched;
-                    gotone = 1;
+                /* Errors and hangups may have been signalled without the poll
+                   method reporting them. */
+                ev = ((uint32_t)cur[i] | (it->revents & EP_ALWAYS)) &
+                     ((it->events & 0xFFFF) | EP_ALWAYS);
+
+                /* Anything that came in while we weren't looking is still to
+                   be reported, if the item is back on the ready list. */
+                if(it->ready == EP_IDLE)
+                    it->revents = 0;
+
+                if(!ev || (it->events & (EPOLLONESHOT | 0xFFFF)) ==
+                   EPOLLONESHOT)
+                    continue;
+
+                evs[n].events = ev;
+                evs[n].data = it->data;
+                ++n;
+
+                if(it->events & EPOLLONESHOT) {
+                    it->events &= EPOLLET | EPOLLONESHOT;
+                }
+                else if(!(it->events & EPOLLET) && it->ready == EP_IDLE) {
+                    /* Level-triggered, so it stays ready until a check says
+                       otherwise. It goes back once we're done, so that this
+                       call doesn't pick it up again. */
+                    TAILQ_INSERT_TAIL(&again, it, rdl);
+                    it->ready = EP_AGAIN;
+                    ++it->busy;
                 }
             }
+
+            continue;
+        }
+
+        if(n || !timeout)
+            break;
+
+        /* Nothing yet, so wait for something to happen. */
+        if(timeout > 0) {
+            now = timer_ms_gettime64();
+
+            if(now >= end)
+                break;
+
+            err = errno;
+
+            if(cond_wait_timed(&ep->cv, &mutex, (int)(end - now)))
+                errno = err;
         }
+        else {
+            cond_wait(&ep->cv, &mutex);
+        }
+    }
+
+    /* Put the level-triggered items back on the ready list. */
+    while((it = TAILQ_FIRST(&again))) {
+        TAILQ_REMOVE(&again, it, rdl);
+        it->ready = EP_IDLE;
+
+        if(ep_unbusy(it))
+            ep_ready(it);
+    }
+
+    /* Let epoll_vfs_close() know once the last waiter is gone. The instance
+       may be freed as soon as the lock is let go of. */
+    closed = ep->closed;
+
+    if(!--ep->waiters && closed)
+        cond_broadcast(&ep->cv);
+
+    mutex_unlock(&mutex);
+
+    if(closed && !n) {
+        errno = err;
+        return -1;
+    }
 
-        /* If we got any events, signal the waiting thread to wake it up. */
-        if(gotone) {
-            cond_signal(&i->cv);
-            gotone = 0;
+    return n;
+}
+
+void __poll_event_trigger(int fd, short event) {
+    struct ep_item *i;
+    uint32_t mask;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+        return;
+
+    if(mutex_lock_irqsafe(&mutex))
+        /* XXXX: Uhh... this is bad... */
+        return;
+
+    /* Only look at the items watching this fd */
+    LIST_FOREACH(i, &watch[fd], fdl) {
+        mask = (i->events & 0xFFFF) | EP_ALWAYS;
+
+        if(event & mask) {
+            i->revents |= event & mask;
+            ep_ready(i);
         }
     }
 
     mutex_unlock(&mutex);
 }
 
+/* Called when a file descriptor is closed, so that it stops being watched. */
+void __poll_fd_closed(int fd) {
+    struct ep_item *i;
+
+    if(fd < 0 || fd >= FD_SETSIZE || mutex_lock_irqsafe(&mutex))
+        return;
+
+    while((i = LIST_FIRST(&watch[fd]))) {
+        if(ep_del(i) && i->heap)
+            free(i);
+    }
+
+    mutex_unlock(&mutex);
+}
+
 int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
-    struct poll_int p = { { 0 }, fds, nfds, 0, COND_INITIALIZER };
-    int tmp;
+    struct ep_inst ep;
+    struct ep_item *items;
+    struct epoll_event *evs;
+    epoll_data_t data;
     nfds_t i;
-    vfs_handler_t *hndl;
-    void *hnd;
+    int n, j, rv = 0;
 
-    if(mutex_lock_irqsafe(&mutex))
+    if(nfds > FD_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* With nothing to look at, this is just a sleep. */
+    if(!nfds)
+        items = NULL;
+    else if(!(items = (struct ep_item *)malloc(nfds *
+                                               (sizeof(struct ep_item) +
+                                                sizeof(struct epoll_event))))) {
+        errno = ENOMEM;
         return -1;
+    }
+
+    evs = (struct epoll_event *)(items + nfds);
+    ep_init(&ep);
 
-    /* Check if any of the fds already match */
     for(i = 0; i < nfds; ++i) {
-        hndl = fs_get_handler(fds[i].fd);
-        hnd = fs_get_handle(fds[i].fd);
         fds[i].revents = 0;
+        items[i].linked = 0;
+        items[i].heap = 0;
 
-        /* If we didn't get one of these, then assume its a bad fd. */
-        if(!hndl || !hnd) {
+        /* If we didn't get a handle, then assume its a bad fd. */
+        if(fds[i].fd < 0 || fds[i].fd >= FD_SETSIZE ||
+           !fs_get_handle(fds[i].fd)) {
             fds[i].revents = POLLNVAL;
-            ++p.nmatched;
+            ++rv;
             continue;
         }
 
-        if(!hndl->poll) {
-            /* Assume its a regular file if there's no poll method in the
-               handler. */
-            if(fds[i].events & (POLLRDNORM | POLLWRNORM)) {
-                fds[i].revents |= (POLLRDNORM | POLLWRNORM) & fds[i].events;
-                ++p.nmatched;
-            }
-        }
-        else {
-            if((fds[i].revents = hndl->poll(hnd, fds[i].events))) {
-                ++p.nmatched;
-            }
+        data.u32 = i;
+
+        if(ep_add(&ep, &items[i], fds[i].fd, (uint16_t)fds[i].events, data)) {
+            rv = -1;
+            goto out;
         }
     }
 
-    /* If the user specified a 0 timeout, or we've already matched something,
-       bail out now. */
-    if(p.nmatched || !timeout) {
-        mutex_unlock(&mutex);
-        return p.nmatched;
+    /* Don't wait if we've already got something to report. */
+    if((n = ep_wait(&ep, evs, (int)nfds, rv ? 0 : timeout)) < 0) {
+        rv = -1;
+        goto out;
     }
 
-    /* We can't actually wait while we're in an interrupt, so if we got this far
-       it is an error. */
-    if(irq_inside_int()) {
-        mutex_unlock(&mutex);
-        errno = EPERM;
+    for(j = 0; j < n; ++j) {
+        fds[evs[j].data.u32].revents = (short)evs[j].events;
+        ++rv;
+    }
+
+out:
+    ep_destroy(&ep);
+    free(items);
+
+    return rv;
+}
+
+/* The epoll interface. Each instance gets a file descriptor of its own, so
+   that it can be closed like Linux's. */
+static int epoll_vfs_close(void *h) {
+    struct ep_inst *ep = (struct ep_inst *)h;
+
+    /* Wake anyone waiting on the instance, and wait for them to leave before
+       it goes away. */
+    mutex_lock(&mutex);
+    ep->closed = 1;
+    cond_broadcast(&ep->cv);
+
+    while(ep->waiters)
+        cond_wait(&ep->cv, &mutex);
+
+    mutex_unlock(&mutex);
+
+    ep_destroy(ep);
+    free(ep);
+
+    return 0;
+}
+
+static vfs_handler_t vh = {
+    /* Name handler */
+    {
+        "/epoll",       /* Name */
+        0,              /* tbfi */
+        0x00010000,     /* Version 1.0 */
+        0,              /* Flags */
+        NMMGR_TYPE_VFS,
+        NMMGR_LIST_INIT,
+    },
+
+    0, NULL,        /* No cache, privdata */
+
+    NULL,            /* open */
+    epoll_vfs_close, /* close */
+    NULL,            /* read */
+    NULL,            /* write */
+    NULL,            /* seek */
+    NULL,            /* tell */
+    NULL,            /* total */
+    NULL,            /* readdir */
+    NULL,            /* ioctl */
+    NULL,            /* rename */
+    NULL,            /* unlink */
+    NULL,            /* mmap */
+    NULL,            /* complete */
+    NULL,            /* stat */
+    NULL,            /* mkdir */
+    NULL,            /* rmdir */
+    NULL,            /* fcntl */
+    NULL,            /* poll */
+    NULL,            /* link */
+    NULL,            /* symlink */
+    NULL,            /* seek64 */
+    NULL,            /* tell64 */
+    NULL,            /* total64 */
+    NULL,            /* readlink */
+    NULL,            /* rewinddir */
+    NULL             /* fstat */
+};
+
+static struct ep_inst *ep_get(int epfd) {
+    if(epfd < 0 || epfd >= FD_SETSIZE || !fs_get_handle(epfd)) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if(fs_get_handler(epfd) != &vh) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return (struct ep_inst *)fs_get_handle(epfd);
+}
+
+int epoll_create1(int flags) {
+    struct ep_inst *ep;
+    int fd;
+
+    if(flags & ~EPOLL_CLOEXEC) {
+        errno = EINVAL;
         return -1;
     }
 
-    /* Map to the value used by cond_wait_timed() */
-    if(timeout == -1)
-        timeout = 0;
+    if(!(ep = (struct ep_inst *)malloc(sizeof(struct ep_inst)))) {
+        errno = ENOMEM;
+        return -1;
+    }
 
-    /* Add this instance to the list */
-    LIST_INSERT_HEAD(&poll_list, &p, entry);
+    ep_init(ep);
 
-    tmp = errno;
-    if(cond_wait_timed(&p.cv, &mutex, timeout)) {
-        errno = tmp;
-        tmp = 0;
-        goto out;
+    if((fd = fs_open_handle(&vh, ep)) < 0) {
+        ep_destroy(ep);
+        free(ep);
     }
 
-    tmp = p.nmatched;
+    return fd;
+}
 
-out:
-    /* Remove this instance from the list */
-    LIST_REMOVE(&p, entry);
+int epoll_create(int size) {
+    if(size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    struct ep_inst *ep;
+    struct ep_item *it, *nit = NULL;
+
+    if(!(ep = ep_get(epfd)))
+        return -1;
+
+    if(fd < 0 || fd >= FD_SETSIZE || !fs_get_handle(fd)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(fd == epfd || (op != EPOLL_CTL_DEL && !event)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Allocate a new item up front, so that looking for an existing one and
+       linking the new one in can be done without letting go of the lock. */
+    if(op == EPOLL_CTL_ADD) {
+        if(!(nit = (struct ep_item *)malloc(sizeof(struct ep_item)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        nit->heap = 1;
+    }
+
+    mutex_lock(&mutex);
+
+    LIST_FOREACH(it, &watch[fd], fdl) {
+        if(it->ep == ep)
+            break;
+    }
+
+    switch(op) {
+        case EPOLL_CTL_ADD:
+            if(it) {
+                mutex_unlock(&mutex);
+                free(nit);
+                errno = EEXIST;
+                return -1;
+            }
+
+            ep_link(ep, nit, fd, event->events, event->data);
+            mutex_unlock(&mutex);
+            ep_check(nit);
+            return 0;
+
+        case EPOLL_CTL_MOD:
+            if(!it)
+                break;
+
+            it->events = event->events;
+            it->data = event->data;
+            it->revents = 0;
+
+            /* Check it again on the next wait, in case it is ready already. */
+            ep_ready(it);
+            mutex_unlock(&mutex);
+            return 0;
+
+        case EPOLL_CTL_DEL:
+            if(!it)
+                break;
+
+            if(ep_del(it))
+                free(it);
+
+            mutex_unlock(&mutex);
+            return 0;
+
+        default:
+            mutex_unlock(&mutex);
+            errno = EINVAL;
+            return -1;
+    }
 
     mutex_unlock(&mutex);
-    return tmp;
+    errno = ENOENT;
+    return -1;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout) {
+    struct ep_inst *ep;
+
+    if(!(ep = ep_get(epfd)))
+        return -1;
+
+    if(maxevents <= 0 || !events) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ep_wait(ep, events, maxevents, timeout);
 }
@@ -0,0 +1,165 @@
+/* KallistiOS ##version##
+
+   aio.c
+   Copyright (C) 2024 The KOS Team and contributors
+*/
+
+#include <aio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <kos/opts.h>
+
+static int aio_queue(struct aiocb *aiocbp, int write) {
+    int rv;
+
+    if(aiocbp->aio_offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(write)
+        rv = fs_aio_write(&aiocbp->_aio_req, aiocbp->aio_fildes,
+                          (const void *)aiocbp->aio_buf, aiocbp->aio_nbytes,
+                          aiocbp->aio_offset, NULL);
+    else
+        rv = fs_aio_read(&aiocbp->_aio_req, aiocbp->aio_fildes,
+                         (void *)aiocbp->aio_buf, aiocbp->aio_nbytes,
+                         aiocbp->aio_offset, NULL);
+
+    /* POSIX wants EAGAIN for running out of resources. */
+    if(rv) {
+        if(errno == ENOMEM || errno == EMFILE)
+            errno = EAGAIN;
+
+        return -1;
+    }
+
+    aiocbp->_aio_queued = 1;
+    return 0;
+}
+
+int aio_read(struct aiocb *aiocbp) {
+    return aio_queue(aiocbp, 0);
+}
+
+int aio_write(struct aiocb *aiocbp) {
+    return aio_queue(aiocbp, 1);
+}
+
+int aio_error(const struct aiocb *aiocbp) {
+    if(!aiocbp->_aio_queued) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!fs_aio_done(&aiocbp->_aio_req))
+        return EINPROGRESS;
+
+    return aiocbp->_aio_req.error;
+}
+
+ssize_t aio_return(struct aiocb *aiocbp) {
+    if(!aiocbp->_aio_queued || !fs_aio_done(&aiocbp->_aio_req)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    aiocbp->_aio_queued = 0;
+    return aiocbp->_aio_req.result;
+}
+
+int aio_suspend(const struct aiocb *const list[], int nent,
+                const struct timespec *timeout) {
+    fs_aio_t **reqs;
+    int i, ms = 0, rv;
+
+    if(nent <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(reqs = (fs_aio_t **)malloc(nent * sizeof(fs_aio_t *)))) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    for(i = 0; i < nent; i++) {
+        if(list[i] && list[i]->_aio_queued)
+            reqs[i] = (fs_aio_t *)&list[i]->_aio_req;
+        else
+            reqs[i] = NULL;
+    }
+
+    if(timeout) {
+        ms = timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000;
+
+        /* A zero timeout means don't wait at all, rather than forever. */
+        if(!ms)
+            ms = -1;
+    }
+
+    if(ms < 0) {
+        for(rv = -1, i = 0; i < nent; i++) {
+            if(reqs[i] && fs_aio_done(reqs[i]))
+                rv = 0;
+        }
+    }
+    else {
+        rv = fs_aio_suspend(reqs, nent, ms);
+    }
+
+    free(reqs);
+
+    if(rv)
+        errno = EAGAIN;
+
+    return rv;
+}
+
+int aio_cancel(int fildes, struct aiocb *aiocbp) {
+    if(fildes < 0 || fildes >= FD_SETSIZE || !fs_get_handle(fildes)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(aiocbp && (!aiocbp->_aio_queued || fs_aio_done(&aiocbp->_aio_req)))
+        return AIO_ALLDONE;
+
+    return AIO_NOTCANCELED;
+}
+
+int lio_listio(int mode, struct aiocb *const list[], int nent,
+               struct sigevent *sig) {
+    int i, rv = 0;
+
+    (void)sig;
+
+    if(mode != LIO_WAIT && mode != LIO_NOWAIT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for(i = 0; i < nent; i++) {
+        if(!list[i] || list[i]->aio_lio_opcode == LIO_NOP)
+            continue;
+
+        if(aio_queue(list[i], list[i]->aio_lio_opcode == LIO_WRITE))
+            rv = -1;
+    }
+
+    if(mode == LIO_NOWAIT)
+        return rv;
+
+    for(i = 0; i < nent; i++) {
+        if(!list[i] || list[i]->aio_lio_opcode == LIO_NOP ||
+           !list[i]->_aio_queued)
+            continue;
+
+        if(fs_aio_wait(&list[i]->_aio_req) < 0) {
+            rv = -1;
+            errno = EIO;
+        }
+    }
+
+    return rv;
+}
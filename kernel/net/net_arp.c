@@ -165,7 +165,21 @@ int net_arp_insert(netif_t *nif, const uint8 mac[6], const uint8 ip[4],
    will have arrived. */
 int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
                    const ip_hdr_t *pkt, const uint8 *data, int data_size) {
+    net_pbuf_t p;
+
+    if(!pkt || !data || !data_size)
+        return net_arp_lookup_pbuf(nif, ip_in, mac_out, NULL, NULL);
+
+    net_pbuf_init(&p, (uint8 *)data, data_size, 0);
+    return net_arp_lookup_pbuf(nif, ip_in, mac_out, pkt, &p);
+}
+
+/* The same, with the packet data in a chain of packet buffers. It's only
+   copied if it has to be queued. */
+int net_arp_lookup_pbuf(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
+                        const ip_hdr_t *pkt, const net_pbuf_t *p) {
     netarp_t *cur;
+    size_t data_size;
 
     /* Garbage collect expired entries */
     net_arp_gc(nif);
@@ -199,7 +213,7 @@ int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
     cur->timestamp = timer_ms_gettime64();
 
     /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
+    if(pkt && p && (data_size = net_pbuf_chain_len(p))) {
         cur->data = (uint8 *)malloc(data_size);
 
         if(cur->data) {
@@ -211,7 +225,7 @@ int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
             }
             else {
                 memcpy(cur->pkt, pkt, sizeof(ip_hdr_t));
-                memcpy(cur->data, data, data_size);
+                net_pbuf_copy(p, cur->data, data_size);
                 cur->data_size = data_size;
             }
         }
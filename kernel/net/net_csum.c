@@ -0,0 +1,295 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_csum.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* The Internet checksum (RFC 1071). Data is added up 32 bits at a time into a
+   wider accumulator, and the carries are only folded back in once at the end,
+   which is valid since 2^32 and 2^16 are both 1 modulo 0xFFFF. On the SH4,
+   the inner loops use addc to chain the carries through the T bit, and only
+   count them once per block of 32 bytes.
+
+   Leading bytes are dealt with until the data is 32-bit aligned. A leading odd
+   byte puts every following byte in the other half of its 16-bit word, so the
+   sum of the rest is byte-swapped to make up for it (RFC 1071 section 2.B). */
+
+#include <string.h>
+
+#include "net_csum.h"
+
+/* Value of a byte in the first or second half of a 16-bit word in memory. */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CSUM_FIRST(b)   ((uint32_t)(b))
+#define CSUM_SECOND(b)  ((uint32_t)(b) << 8)
+#else
+#define CSUM_FIRST(b)   ((uint32_t)(b) << 8)
+#define CSUM_SECOND(b)  ((uint32_t)(b))
+#endif
+
+static inline uint16_t csum_fold(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16_t)sum;
+}
+
+#ifdef __sh__
+
+/* Sum blocks of 32 bytes. */
+static inline uint64_t csum_blocks(const uint32_t **src, size_t blocks) {
+    const uint32_t *s = *src;
+    uint32_t sum = 0, carry = 0, t0, t1;
+
+    __asm__("1:\n\t"
+            "clrt\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "movt   %[t0]\n\t"
+            "dt     %[n]\n\t"
+            "bf/s   1b\n\t"
+            "add    %[t0], %[carry]\n\t"
+            : [s] "+r"(s), [n] "+r"(blocks), [sum] "+r"(sum),
+              [carry] "+r"(carry), [t0] "=&r"(t0), [t1] "=&r"(t1)
+            :
+            : "t", "memory");
+
+    *src = s;
+
+    return (uint64_t)sum + carry;
+}
+
+/* Copy and sum blocks of 32 bytes. */
+static inline uint64_t csum_copy_blocks(uint32_t **dst, const uint32_t **src,
+                                        size_t blocks) {
+    const uint32_t *s = *src;
+    uint32_t *d = *dst;
+    uint32_t sum = 0, carry = 0, t0, t1;
+
+    __asm__("1:\n\t"
+            "clrt\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "mov.l  %[t0], @%[d]\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "mov.l  %[t1], @(4,%[d])\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "mov.l  %[t0], @(8,%[d])\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "mov.l  %[t1], @(12,%[d])\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "mov.l  %[t0], @(16,%[d])\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "mov.l  %[t1], @(20,%[d])\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "mov.l  @%[s]+, %[t0]\n\t"
+            "mov.l  @%[s]+, %[t1]\n\t"
+            "mov.l  %[t0], @(24,%[d])\n\t"
+            "addc   %[t0], %[sum]\n\t"
+            "mov.l  %[t1], @(28,%[d])\n\t"
+            "addc   %[t1], %[sum]\n\t"
+            "movt   %[t0]\n\t"
+            "add    #32, %[d]\n\t"
+            "dt     %[n]\n\t"
+            "bf/s   1b\n\t"
+            "add    %[t0], %[carry]\n\t"
+            : [s] "+r"(s), [d] "+r"(d), [n] "+r"(blocks), [sum] "+r"(sum),
+              [carry] "+r"(carry), [t0] "=&r"(t0), [t1] "=&r"(t1)
+            :
+            : "t", "memory");
+
+    *src = s;
+    *dst = d;
+
+    return (uint64_t)sum + carry;
+}
+
+#else
+
+static inline uint64_t csum_blocks(const uint32_t **src, size_t blocks) {
+    const uint32_t *s = *src;
+    uint64_t sum = 0;
+
+    while(blocks--) {
+        sum += s[0];
+        sum += s[1];
+        sum += s[2];
+        sum += s[3];
+        sum += s[4];
+        sum += s[5];
+        sum += s[6];
+        sum += s[7];
+        s += 8;
+    }
+
+    *src = s;
+
+    return sum;
+}
+
+static inline uint64_t csum_copy_blocks(uint32_t **dst, const uint32_t **src,
+                                        size_t blocks) {
+    const uint32_t *s = *src;
+    uint32_t *d = *dst;
+    uint64_t sum = 0;
+    int i;
+
+    while(blocks--) {
+        for(i = 0; i < 8; ++i) {
+            d[i] = s[i];
+            sum += s[i];
+        }
+
+        s += 8;
+        d += 8;
+    }
+
+    *src = s;
+    *dst = d;
+
+    return sum;
+}
+
+#endif /* __sh__ */
+
+uint16_t net_csum_partial(const void *data, size_t len, uint16_t sum) {
+    const uint8_t *s = (const uint8_t *)data;
+    const uint32_t *ws;
+    uint64_t acc = 0;
+    int odd = 0;
+
+    if(!len)
+        return sum;
+
+    if((uintptr_t)s & 1) {
+        acc = CSUM_SECOND(*s++);
+        odd = 1;
+        --len;
+    }
+
+    if(((uintptr_t)s & 2) && len >= 2) {
+        acc += *(const uint16_t *)s;
+        s += 2;
+        len -= 2;
+    }
+
+    ws = (const uint32_t *)s;
+
+    if(len >= 32) {
+        acc += csum_blocks(&ws, len >> 5);
+        len &= 31;
+    }
+
+    while(len >= 4) {
+        acc += *ws++;
+        len -= 4;
+    }
+
+    s = (const uint8_t *)ws;
+
+    if(len >= 2) {
+        acc += *(const uint16_t *)s;
+        s += 2;
+        len -= 2;
+    }
+
+    if(len)
+        acc += CSUM_FIRST(*s);
+
+    if(odd)
+        return net_csum_add(sum, net_csum_swab(csum_fold(acc)));
+    else
+        return net_csum_add(sum, csum_fold(acc));
+}
+
+uint16_t net_csum_copy(void *dst, const void *src, size_t len, uint16_t sum) {
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    const uint32_t *ws;
+    uint32_t *wd;
+    uint64_t acc = 0;
+    uint16_t h;
+    int odd = 0;
+
+    /* Copying a word at a time needs both sides to be aligned alike. Failing
+       that, the data will at least be in the cache for the second pass. */
+    if(((uintptr_t)s ^ (uintptr_t)d) & 3) {
+        memcpy(dst, src, len);
+        return net_csum_partial(dst, len, sum);
+    }
+
+    if(!len)
+        return sum;
+
+    if((uintptr_t)s & 1) {
+        acc = CSUM_SECOND(*s);
+        *d++ = *s++;
+        odd = 1;
+        --len;
+    }
+
+    if(((uintptr_t)s & 2) && len >= 2) {
+        h = *(const uint16_t *)s;
+        *(uint16_t *)d = h;
+        acc += h;
+        s += 2;
+        d += 2;
+        len -= 2;
+    }
+
+    ws = (const uint32_t *)s;
+    wd = (uint32_t *)d;
+
+    if(len >= 32) {
+        acc += csum_copy_blocks(&wd, &ws, len >> 5);
+        len &= 31;
+    }
+
+    while(len >= 4) {
+        acc += *wd++ = *ws++;
+        len -= 4;
+    }
+
+    s = (const uint8_t *)ws;
+    d = (uint8_t *)wd;
+
+    if(len >= 2) {
+        h = *(const uint16_t *)s;
+        *(uint16_t *)d = h;
+        acc += h;
+        s += 2;
+        d += 2;
+        len -= 2;
+    }
+
+    if(len) {
+        acc += CSUM_FIRST(*s);
+        *d = *s;
+    }
+
+    if(odd)
+        return net_csum_add(sum, net_csum_swab(csum_fold(acc)));
+    else
+        return net_csum_add(sum, csum_fold(acc));
+}
@@ -0,0 +1,38 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_csum.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+#ifndef __LOCAL_NET_CSUM_H
+#define __LOCAL_NET_CSUM_H
+
+/* This header (and net_csum.c) must not depend on anything else in KOS, so that
+   they can be built on the host by utils/csumtest. */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Add a block of data to a 16-bit one's complement sum. The data is taken to
+   start at an even offset of whatever is being checksummed. The sum is not
+   inverted, so it can be passed back in to continue the calculation. */
+uint16_t net_csum_partial(const void *data, size_t len, uint16_t sum);
+
+/* Same as net_csum_partial(), copying the data to dst along the way. */
+uint16_t net_csum_copy(void *dst, const void *src, size_t len, uint16_t sum);
+
+/* Add two 16-bit one's complement sums together. */
+static inline uint16_t net_csum_add(uint16_t a, uint16_t b) {
+    uint32_t sum = (uint32_t)a + b;
+
+    return (sum & 0xFFFF) + (sum >> 16);
+}
+
+/* Byte-swap a sum of data starting at an odd offset of whatever is being
+   checksummed, so that it can be added to the rest with net_csum_add(). */
+static inline uint16_t net_csum_swab(uint16_t sum) {
+    return (sum << 8) | (sum >> 8);
+}
+
+#endif /* __LOCAL_NET_CSUM_H */
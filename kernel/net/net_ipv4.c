@@ -20,48 +20,34 @@
 #include <arch/timer.h>
 
 #include "net_ipv4.h"
+#include "net_csum.h"
 #include "net_icmp.h"
 
 static net_ipv4_stats_t ipv4_stats = { 0 };
 
 /* Perform an IP-style checksum on a block of data */
 uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start) {
-    uint32 sum = start;
-    size_t i = bytes;
-
-    /* Make sure we don't do any unaligned memory accesses */
-    if(((uint32)data) & 0x01) {
-        const uint8 *ptr = data;
-
-        while(i > 1) {
-            sum += *ptr | ((*ptr + 1) << 8);
-            ptr += 2;
-            i -= 2;
-
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
-        }
-    }
-    else {
-        const uint16 *ptr = (const uint16 *)data;
-
-        while(i > 1) {
-            sum += *ptr++;
-            i -= 2;
+    return net_csum_partial(data, bytes, start) ^ 0xFFFF;
+}
 
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
-        }
+/* Perform an IP-style checksum on the data of a chain of packet buffers */
+uint16 net_ipv4_checksum_pbuf(const net_pbuf_t *p, uint16 start) {
+    uint16 sum = start;
+    int odd = 0;
+
+    for(; p; p = p->next) {
+        /* A buffer starting at an odd offset into the packet has all of its
+           bytes in the other half of each 16-bit word. */
+        if(odd)
+            sum = net_csum_add(sum,
+                               net_csum_swab(net_csum_partial(p->data, p->len,
+                                                              0)));
+        else
+            sum = net_csum_partial(p->data, p->len, sum);
+
+        odd ^= p->len & 1;
     }
 
-    /* Handle the last byte, if we have an odd byte count */
-    if(i)
-        sum += data[bytes - 1];
-
-    /* Take care of any carry bits */
-    while(sum >> 16)
-        sum = (sum >> 16) + (sum & 0xFFFF);
-
     return sum ^ 0xFFFF;
 }
 
@@ -90,12 +76,29 @@ static int is_broadcast(const uint8 dest[4], const uint8 bc[4]) {
     return 1;
 }
 
-/* Send a packet on the specified network adapter */
-int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
-                         size_t size) {
+/* Put the given amount of headers in front of a chain of packet buffers, in
+   the headroom of its first buffer if there is enough of it, otherwise in a
+   separate buffer set up over the given storage. */
+static net_pbuf_t *push_hdr(net_pbuf_t *p, net_pbuf_t *hp, uint8 *buf,
+                            size_t len) {
+    if(net_pbuf_push(p, len))
+        return p;
+
+    net_pbuf_init(hp, buf, len, 0);
+    hp->next = p;
+
+    return hp;
+}
+
+/* Send a packet held in a chain of packet buffers on the specified network
+   adapter. Headers may end up in the headroom of the first buffer. */
+int net_ipv4_send_packet_pbuf(netif_t *net, ip_hdr_t *hdr, net_pbuf_t *p) {
+    int ihl = 4 * (hdr->version_ihl & 0x0f);
+    size_t size = net_pbuf_chain_len(p);
+    uint8 hbuf[sizeof(eth_hdr_t) + 60];
     uint8 dest_ip[4];
     uint8 dest_mac[6];
-    uint8 pkt[size + sizeof(ip_hdr_t) + sizeof(eth_hdr_t)];
+    net_pbuf_t hp;
     eth_hdr_t *ehdr;
     int err;
 
@@ -112,27 +115,28 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
 
     /* Is this a loopback address (127/8)? */
     if(dest_ip[0] == 0x7F) {
+        uint8 pkt[ihl + size];
+
         /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
+        memcpy(pkt, hdr, ihl);
+        net_pbuf_copy(p, pkt + ihl, size);
 
         ++ipv4_stats.pkt_sent;
 
         /* Send it "away" */
-        net_ipv4_input(NULL, pkt, 4 * (hdr->version_ihl & 0x0f) + size, NULL);
+        net_ipv4_input(NULL, pkt, ihl + size, NULL);
 
         return 0;
     }
     else if(net->flags & NETIF_NOETH) {
-        /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
+        /* Put the IP header in front of the data */
+        p = push_hdr(p, &hp, hbuf, ihl);
+        memcpy(p->data, hdr, ihl);
 
         ++ipv4_stats.pkt_sent;
 
         /* Send it away */
-        return net->if_tx(net, pkt, 4 * (hdr->version_ihl & 0x0f) + size,
-                          NETIF_BLOCK);
+        return net_pbuf_tx(net, p, NETIF_BLOCK);
     }
 
     /* Are we sending a broadcast packet? */
@@ -148,8 +152,9 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
 
         /* Get our destination's MAC address. If we do not have the MAC address
            cached, return a distinguished error to the upper-level protocol so
-           that it can decide what to do. */
-        err = net_arp_lookup(net, dest_ip, dest_mac, hdr, data, size);
+           that it can decide what to do. The packet is copied out of its
+           buffers and queued until the reply comes in. */
+        err = net_arp_lookup_pbuf(net, dest_ip, dest_mac, hdr, p);
 
         if(err == -1) {
             errno = ENETUNREACH;
@@ -163,31 +168,37 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
         }
     }
 
-    /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
+    /* Put the ethernet and IP headers in front of the data */
+    p = push_hdr(p, &hp, hbuf, sizeof(eth_hdr_t) + ihl);
+
+    ehdr = (eth_hdr_t *)p->data;
     memcpy(ehdr->dest, dest_mac, 6);
     memcpy(ehdr->src, net->mac_addr, 6);
     ehdr->type[0] = 0x08;
     ehdr->type[1] = 0x00;
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, 4 * (hdr->version_ihl & 0x0f));
-    memcpy(pkt + sizeof(eth_hdr_t) + 4 * (hdr->version_ihl & 0x0f), data,
-           size);
+    memcpy(p->data + sizeof(eth_hdr_t), hdr, ihl);
 
     ++ipv4_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ip_hdr_t) + size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    net_pbuf_tx(net, p, NETIF_BLOCK);
 
     return 0;
 }
 
-int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
-                  int proto, uint32 src, uint32 dst) {
-    ip_hdr_t hdr;
+/* Send a packet on the specified network adapter */
+int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
+                         size_t size) {
+    net_pbuf_t p;
 
+    net_pbuf_init(&p, (uint8 *)data, size, 0);
+
+    return net_ipv4_send_packet_pbuf(net, hdr, &p);
+}
+
+static void fill_hdr(ip_hdr_t *hdr, size_t size, int id, int ttl, int proto,
+                     uint32 src, uint32 dst) {
     /* If the ID is -1, generate a random ID value that can be used in case the
        packet gets fragmented. */
     if(id == -1) {
@@ -195,22 +206,57 @@ int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
     }
 
     /* Fill in the IPv4 Header */
-    hdr.version_ihl = 0x45;
-    hdr.tos = 0;
-    hdr.length = htons(size + 20);
-    hdr.packet_id = id;
-    hdr.flags_frag_offs = 0;
-    hdr.ttl = ttl;
-    hdr.protocol = proto;
-    hdr.checksum = 0;
-    hdr.src = src;
-    hdr.dest = dst;
-
-    hdr.checksum = net_ipv4_checksum((uint8 *)&hdr, sizeof(ip_hdr_t), 0);
+    hdr->version_ihl = 0x45;
+    hdr->tos = 0;
+    hdr->length = htons(size + 20);
+    hdr->packet_id = id;
+    hdr->flags_frag_offs = 0;
+    hdr->ttl = ttl;
+    hdr->protocol = proto;
+    hdr->checksum = 0;
+    hdr->src = src;
+    hdr->dest = dst;
+
+    hdr->checksum = net_ipv4_checksum((uint8 *)hdr, sizeof(ip_hdr_t), 0);
+}
+
+int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
+                  int proto, uint32 src, uint32 dst) {
+    ip_hdr_t hdr;
+
+    fill_hdr(&hdr, size, id, ttl, proto, src, dst);
 
     return net_ipv4_frag_send(net, &hdr, data, size);
 }
 
+int net_ipv4_send_pbuf(netif_t *net, net_pbuf_t *p, int id, int ttl,
+                       int proto, uint32 src, uint32 dst) {
+    size_t size = net_pbuf_chain_len(p);
+    ip_hdr_t hdr;
+
+    if(net == NULL) {
+        net = net_default_dev;
+
+        if(!net) {
+            errno = ENETDOWN;
+            return -1;
+        }
+    }
+
+    fill_hdr(&hdr, size, id, ttl, proto, src, dst);
+
+    /* The fragmentation code only deals with packets in one piece. */
+    if(size + 20 >= (size_t)net->mtu) {
+        uint8 data[size];
+
+        net_pbuf_copy(p, data, size);
+
+        return net_ipv4_frag_send(net, &hdr, data, size);
+    }
+
+    return net_ipv4_send_packet_pbuf(net, &hdr, p);
+}
+
 int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
                    const eth_hdr_t *eth) {
     const ip_hdr_t *ip;
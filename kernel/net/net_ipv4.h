@@ -28,12 +28,20 @@ typedef struct {
 #undef packed
 
 uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start);
+uint16 net_ipv4_checksum_pbuf(const net_pbuf_t *p, uint16 start);
 int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
                          size_t size);
+int net_ipv4_send_packet_pbuf(netif_t *net, ip_hdr_t *hdr, net_pbuf_t *p);
 int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
                   int proto, uint32 src, uint32 dst);
+int net_ipv4_send_pbuf(netif_t *net, net_pbuf_t *p, int id, int ttl,
+                       int proto, uint32 src, uint32 dst);
 int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
                    const eth_hdr_t *eth);
+
+/* In net_arp.c */
+int net_arp_lookup_pbuf(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
+                        const ip_hdr_t *pkt, const net_pbuf_t *p);
 int net_ipv4_input_proto(netif_t *net, const ip_hdr_t *ip, const uint8 *data);
 
 uint16 net_ipv4_checksum_pseudo(in_addr_t src, in_addr_t dst, uint8 proto,
@@ -59,13 +59,27 @@ static int is_in_network(netif_t *net, const struct in6_addr *ip) {
     return 0;
 }
 
-/* Send a packet on the specified network adapter */
-int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
-                         size_t data_size) {
-    uint8 pkt[data_size + sizeof(ipv6_hdr_t) + sizeof(eth_hdr_t)];
+/* Make room for len bytes of headers in front of p, the same way the IPv4
+   code does. */
+static net_pbuf_t *push_hdr(net_pbuf_t *p, net_pbuf_t *hp, uint8 *buf,
+                            size_t len) {
+    if(net_pbuf_push(p, len))
+        return p;
+
+    net_pbuf_init(hp, buf, len, 0);
+    hp->next = p;
+
+    return hp;
+}
+
+/* Send a chain of packet buffers on the specified network adapter */
+int net_ipv6_send_packet_pbuf(netif_t *net, ipv6_hdr_t *hdr, net_pbuf_t *p) {
+    size_t data_size = net_pbuf_chain_len(p);
+    uint8 hbuf[sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t)];
     uint8 dst_mac[6];
     int err;
     struct in6_addr dst = hdr->dst_addr;
+    net_pbuf_t hp;
     eth_hdr_t *ehdr;
 
     if(!net) {
@@ -79,8 +93,10 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
 
     /* Are we sending a packet to loopback? */
     if(IN6_IS_ADDR_LOOPBACK(&hdr->dst_addr)) {
+        uint8 pkt[sizeof(ipv6_hdr_t) + data_size];
+
         memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
+        net_pbuf_copy(p, pkt + sizeof(ipv6_hdr_t), data_size);
 
         ++ipv6_stats.pkt_sent;
 
@@ -89,14 +105,13 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
         return 0;
     }
     else if(net->flags & NETIF_NOETH) {
-        memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
+        p = push_hdr(p, &hp, hbuf, sizeof(ipv6_hdr_t));
+        memcpy(p->data, hdr, sizeof(ipv6_hdr_t));
 
         ++ipv6_stats.pkt_sent;
 
         /* Send the packet away */
-        return net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size,
-                          NETIF_BLOCK);
+        return net_pbuf_tx(net, p, NETIF_BLOCK);
     }
     else if(IN6_IS_ADDR_MULTICAST(&hdr->dst_addr)) {
         dst_mac[0] = dst_mac[1] = 0x33;
@@ -110,7 +125,9 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
             dst = net->ip6_gateway;
         }
 
-        err = net_ndp_lookup(net, &dst, dst_mac, hdr, data, data_size);
+        /* If the neighbor isn't known yet, the packet is copied out of its
+           buffers and queued until it answers. */
+        err = net_ndp_lookup_pbuf(net, &dst, dst_mac, hdr, p);
 
         if(err == -1) {
             errno = ENETUNREACH;
@@ -122,29 +139,39 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
         }
     }
 
-    /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
+    /* Put the ethernet and IP headers in front of the data */
+    p = push_hdr(p, &hp, hbuf, sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t));
+
+    ehdr = (eth_hdr_t *)p->data;
     memcpy(ehdr->dest, dst_mac, 6);
     memcpy(ehdr->src, net->mac_addr, 6);
     ehdr->type[0] = 0x86;
     ehdr->type[1] = 0xDD;
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, sizeof(ipv6_hdr_t));
-    memcpy(pkt + sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t), data, data_size);
+    memcpy(p->data + sizeof(eth_hdr_t), hdr, sizeof(ipv6_hdr_t));
 
     ++ipv6_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    net_pbuf_tx(net, p, NETIF_BLOCK);
 
     return 0;
 }
 
-int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
-                  int hop_limit, int proto, const struct in6_addr *src,
-                  const struct in6_addr *dst) {
+/* Send a packet on the specified network adapter */
+int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
+                         size_t data_size) {
+    net_pbuf_t p;
+
+    net_pbuf_init(&p, (uint8 *)data, data_size, 0);
+
+    return net_ipv6_send_packet_pbuf(net, hdr, &p);
+}
+
+int net_ipv6_send_pbuf(netif_t *net, net_pbuf_t *p, int hop_limit, int proto,
+                       const struct in6_addr *src,
+                       const struct in6_addr *dst) {
+    size_t data_size = net_pbuf_chain_len(p);
     ipv6_hdr_t hdr;
 
     if(!net) {
@@ -170,9 +197,9 @@ int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
        send function to do the rest. Note that only V4-mapped addresses are
        supported here (::ffff:x.y.z.w) */
     if(IN6_IS_ADDR_V4MAPPED(src) && IN6_IS_ADDR_V4MAPPED(dst)) {
-        return net_ipv4_send(net, data, data_size, -1, hop_limit, proto,
-                             src->__s6_addr.__s6_addr32[3],
-                             dst->__s6_addr.__s6_addr32[3]);
+        return net_ipv4_send_pbuf(net, p, -1, hop_limit, proto,
+                                  src->__s6_addr.__s6_addr32[3],
+                                  dst->__s6_addr.__s6_addr32[3]);
     }
     else if(IN6_IS_ADDR_V4MAPPED(src) || IN6_IS_ADDR_V4MAPPED(dst) ||
             IN6_IS_ADDR_V4COMPAT(src) || IN6_IS_ADDR_V4COMPAT(dst)) {
@@ -189,7 +216,17 @@ int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
     hdr.dst_addr = *dst;
 
     /* XXXX: Handle fragmentation... */
-    return net_ipv6_send_packet(net, &hdr, data, data_size);
+    return net_ipv6_send_packet_pbuf(net, &hdr, p);
+}
+
+int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
+                  int hop_limit, int proto, const struct in6_addr *src,
+                  const struct in6_addr *dst) {
+    net_pbuf_t p;
+
+    net_pbuf_init(&p, (uint8 *)data, data_size, 0);
+
+    return net_ipv6_send_pbuf(net, &p, hop_limit, proto, src, dst);
 }
 
 int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
@@ -45,11 +45,20 @@ typedef struct ipv6_pseudo_hdr_s {
 
 int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
                          size_t data_size);
+int net_ipv6_send_packet_pbuf(netif_t *net, ipv6_hdr_t *hdr, net_pbuf_t *p);
 int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
                   int hop_limit, int proto, const struct in6_addr *src,
                   const struct in6_addr *dst);
+int net_ipv6_send_pbuf(netif_t *net, net_pbuf_t *p, int hop_limit, int proto,
+                       const struct in6_addr *src,
+                       const struct in6_addr *dst);
 int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
                    const eth_hdr_t *eth);
+
+/* In net_ndp.c */
+int net_ndp_lookup_pbuf(netif_t *net, const struct in6_addr *ip,
+                        uint8 mac_out[6], const ipv6_hdr_t *pkt,
+                        const net_pbuf_t *p);
 uint16 net_ipv6_checksum_pseudo(const struct in6_addr *src,
                                 const struct in6_addr *dst,
                                 uint32 upper_len, uint8 next_hdr);
@@ -158,8 +158,23 @@ static void net_ndp_send_sol(netif_t *net, const struct in6_addr *ip) {
 
 int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
                    const ipv6_hdr_t *pkt, const uint8 *data, int data_size) {
+    net_pbuf_t p;
+
+    if(!pkt || !data || !data_size)
+        return net_ndp_lookup_pbuf(net, ip, mac_out, NULL, NULL);
+
+    net_pbuf_init(&p, (uint8 *)data, data_size, 0);
+    return net_ndp_lookup_pbuf(net, ip, mac_out, pkt, &p);
+}
+
+/* The same, with the packet data in a chain of packet buffers. It's only
+   copied if it has to be queued. */
+int net_ndp_lookup_pbuf(netif_t *net, const struct in6_addr *ip,
+                        uint8 mac_out[6], const ipv6_hdr_t *pkt,
+                        const net_pbuf_t *p) {
     ndp_entry_t *i;
     uint64 now = timer_ms_gettime64();
+    size_t data_size;
 
     /* Garbage collect, so we don't end up returning really stale entries */
     net_ndp_gc();
@@ -191,7 +206,7 @@ int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
     i->state = NDP_STATE_INCOMPLETE;
 
     /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
+    if(pkt && p && (data_size = net_pbuf_chain_len(p))) {
         i->data = (uint8 *)malloc(data_size);
 
         if(i->data) {
@@ -203,7 +218,7 @@ int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
             }
             else {
                 memcpy(i->pkt, pkt, sizeof(ipv6_hdr_t));
-                memcpy(i->data, data, data_size);
+                net_pbuf_copy(p, i->data, data_size);
                 i->data_size = data_size;
             }
         }
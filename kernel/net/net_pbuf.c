@@ -0,0 +1,138 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_pbuf.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Packet buffers let the upper layers of the stack describe a packet as a
+   chain of pieces (headers built on the stack, payload still in a socket's
+   send buffer, etc) and pass it all the way down to the device without ever
+   putting it back together in one place, unless the device can't deal with
+   chains. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <kos/net.h>
+
+static net_pbuf_stats_t pbuf_stats = { 0 };
+
+void net_pbuf_init(net_pbuf_t *p, void *buf, size_t size, size_t headroom) {
+    p->next = NULL;
+    p->buf = (uint8 *)buf;
+    p->size = size;
+    p->data = p->buf + headroom;
+    p->len = size - headroom;
+    p->ref = 1;
+    p->flags = 0;
+}
+
+net_pbuf_t *net_pbuf_alloc(size_t headroom, size_t len) {
+    net_pbuf_t *p;
+
+    if(!(p = (net_pbuf_t *)malloc(sizeof(net_pbuf_t) + headroom + len))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    net_pbuf_init(p, p + 1, headroom + len, headroom);
+    p->flags = NET_PBUF_HEAP;
+
+    return p;
+}
+
+net_pbuf_t *net_pbuf_ref(const void *data, size_t len) {
+    net_pbuf_t *p;
+
+    if(!(p = (net_pbuf_t *)malloc(sizeof(net_pbuf_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    net_pbuf_init(p, (void *)data, len, 0);
+    p->flags = NET_PBUF_HEAP | NET_PBUF_REF;
+
+    return p;
+}
+
+void net_pbuf_hold(net_pbuf_t *p) {
+    ++p->ref;
+}
+
+void net_pbuf_free(net_pbuf_t *p) {
+    net_pbuf_t *next;
+
+    while(p && !--p->ref) {
+        next = p->next;
+
+        if(p->flags & NET_PBUF_HEAP)
+            free(p);
+
+        p = next;
+    }
+}
+
+void net_pbuf_cat(net_pbuf_t *head, net_pbuf_t *tail) {
+    while(head->next)
+        head = head->next;
+
+    head->next = tail;
+}
+
+void *net_pbuf_push(net_pbuf_t *p, size_t len) {
+    if((p->flags & NET_PBUF_REF) || (size_t)(p->data - p->buf) < len)
+        return NULL;
+
+    p->data -= len;
+    p->len += len;
+
+    return p->data;
+}
+
+size_t net_pbuf_chain_len(const net_pbuf_t *p) {
+    size_t len = 0;
+
+    for(; p; p = p->next)
+        len += p->len;
+
+    return len;
+}
+
+size_t net_pbuf_copy(const net_pbuf_t *p, void *out, size_t size) {
+    uint8 *dst = (uint8 *)out;
+    size_t len;
+
+    for(; p && size; p = p->next) {
+        len = p->len < size ? p->len : size;
+        memcpy(dst, p->data, len);
+        dst += len;
+        size -= len;
+    }
+
+    return dst - (uint8 *)out;
+}
+
+int net_pbuf_tx(netif_t *net, const net_pbuf_t *p, int blocking) {
+    size_t len = net_pbuf_chain_len(p);
+
+    pbuf_stats.tx_bytes += len;
+
+    if(net->if_tx_pbuf)
+        return net->if_tx_pbuf(net, p, blocking);
+
+    /* A single buffer can go out as is, otherwise it has to be flattened. */
+    if(!p->next)
+        return net->if_tx(net, p->data, len, blocking);
+    else {
+        uint8 pkt[len];
+
+        pbuf_stats.tx_copied += net_pbuf_copy(p, pkt, len);
+
+        return net->if_tx(net, pkt, len, blocking);
+    }
+}
+
+net_pbuf_stats_t net_pbuf_get_stats(void) {
+    return pbuf_stats;
+}
@@ -26,6 +26,7 @@
 
 #include "net_ipv4.h"
 #include "net_ipv6.h"
+#include "net_csum.h"
 #include "net_thd.h"
 
 /* Since some of this is a bit odd in its implementation, here's a few notes on
@@ -76,18 +77,54 @@
    of the list. Since we cannot bind a socket to an already used port for
    listening, that means that any fully-created sockets should appear in the
    list in front of those created for listening to a port (and thus that are
-   only partially-created). This simplifies the procedure for finding matching
-   sockets for incoming packets, since this makes sure that the fully-created
-   socket will be found first if it exists when simply iterating through the
-   list of sockets.
+   only partially-created). Incoming packets aren't matched by walking the
+   list, though. Sockets with a remote address (fully-created ones) are also
+   kept in a hash table keyed on the remote address and both ports, and the
+   ones that are only bound or listening in another one keyed on the local
+   port. The first table is always searched before the second, so the
+   fully-created socket still wins if there is one.
+
+   On congestion control:
+   The retransmission timeout is estimated from round-trip time samples as
+   described in RFC 6298, with samples taken one segment at a time and never
+   from retransmitted segments (Karn's algorithm). Sending is limited by a
+   congestion window that follows the slow start and congestion avoidance
+   rules of RFC 5681. Three duplicate ACKs trigger a fast retransmit and
+   NewReno fast recovery (RFC 6582), where each partial ACK retransmits the
+   next hole right away. After a retransmission timeout, the congestion window
+   collapses to one segment and the holes are filled in the same way, one per
+   ACK, rather than resending everything that was outstanding.
+
+   On TCP extensions:
+   Window scaling and timestamps (RFC 7323) and selective acknowledgements
+   (RFC 2018) are offered on every active open and accepted on passive opens
+   if the peer offers them. Window scaling only matters when the receive
+   buffer is made larger than 64KiB with SO_RCVBUF. Timestamps give an RTT
+   sample on every ACK and protect against wrapped sequence numbers (PAWS).
+   SACK blocks from the peer are kept in a small scoreboard, which lets fast
+   recovery resend just the holes rather than one segment per round trip.
+
+   On receiving:
+   Segments that arrive ahead of a hole are written straight into the receive
+   buffer at the spot where they belong, and only their sequence ranges are
+   queued. Once the hole is filled, everything up to the next hole is handed
+   to the reader at once. Since the data lives inside the advertised window,
+   it can never take up more than the receive buffer, and no memory needs to
+   be allocated for it while handling a packet. The queued ranges are what we
+   report back in our SACK blocks.
+
+   Data received in order is acknowledged for every second full-sized segment,
+   or after TCP_DELACK_TIME at the latest, rather than for every segment, and
+   any data we send in the meantime carries the ACK for free. The TCP_QUICKACK
+   option turns this off for a socket. There is no Nagle algorithm on the send
+   side, so TCP_NODELAY is always on.
 
    On what's actually here:
-   I didn't bother implementing any TCP extensions beyond RFC 793. That means
-   that I just ignore things like the timestamp option and the selective
-   acknowledgement option. That also means that the window size maxes out at
-   65535. Some extensions may be implemented in the future, if I see fit to do
-   so. That all said, everything in here works just fine over IPv4 or IPv6, and
-   can be used just fine to communicate with "normal" TCP/IP implementations.
+   Other than the above, I didn't bother implementing any TCP extensions beyond
+   RFC 793. Some extensions may be implemented in the future, if I see fit to
+   do so. That all said, everything in here works just fine over IPv4 or IPv6,
+   and can be used just fine to communicate with "normal" TCP/IP
+   implementations.
 */
 
 typedef struct tcp_hdr {
@@ -102,6 +139,15 @@ typedef struct tcp_hdr {
     uint8_t options[];
 } __attribute__((packed)) tcp_hdr_t;
 
+/* Maximum number of SACK blocks in one segment, and the size of the
+   scoreboard of blocks reported by the peer. */
+#define TCP_MAX_SACK            4
+#define TCP_MAX_SACKED          8
+
+/* Maximum number of holes we keep track of in the data we have received. A
+   segment that would start a new one past that is dropped. */
+#define TCP_MAX_OOO             8
+
 /* Listening socket. Each one of these is an incoming connection from a socket
    that is in the listen state */
 struct lsock {
@@ -111,6 +157,26 @@ struct lsock {
     uint32_t isn;
     uint32_t wnd;
     uint16_t mss;
+    uint8_t wscale;
+    uint8_t opts;
+    uint32_t ts_recent;
+};
+
+/* A range of sequence numbers, as found in a SACK block */
+struct tcp_seq_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+/* Options parsed from an incoming segment */
+struct tcp_opts {
+    uint16_t mss;
+    uint8_t flags;
+    uint8_t wscale;
+    uint32_t tsval;
+    uint32_t tsecr;
+    int nsack;
+    struct tcp_seq_range sack[TCP_MAX_SACK];
 };
 
 /* Send/receive variables... */
@@ -134,6 +200,8 @@ struct rcvrec {
 
 struct tcp_sock {
     LIST_ENTRY(tcp_sock) sock_list;
+    LIST_ENTRY(tcp_sock) hash_list;
+    int hashed;
     struct sockaddr_in6 local_addr;
     struct sockaddr_in6 remote_addr;
 
@@ -172,6 +240,84 @@ struct tcp_sock {
             uint64_t timer;
             condvar_t send_cv;
             condvar_t recv_cv;
+
+            /* Retransmission timeout estimation. The smoothed RTT is scaled
+               by 8 and the RTT variance by 4, all in milliseconds. */
+            uint32_t rto;
+            uint32_t srtt;
+            uint32_t rttvar;
+            uint32_t rtt_seq;
+            uint64_t rtt_time;
+            int rtt_active;
+            int backoff;
+
+            /* With timestamps, a lower bound on when the oldest data in
+               flight was first sent (as a TSval), so that stale echoes can
+               be told apart from real RTT samples. It is moved up to ts_mark
+               once everything before ts_mark_seq has been acknowledged. */
+            uint32_t ts_una;
+            uint32_t ts_mark;
+            uint32_t ts_mark_seq;
+            int ts_mark_active;
+
+            /* Congestion control (all in bytes) */
+            uint32_t cwnd;
+            uint32_t ssthresh;
+            uint32_t recover;
+            int dupacks;
+            int ca_state;
+
+            /* Counters, reported through TCP_INFO */
+            struct {
+                uint32_t segs_in;
+                uint32_t segs_out;
+                uint32_t retrans;
+                uint32_t fast_retrans;
+                uint32_t timeouts;
+                uint32_t dupacks;
+                uint64_t bytes_acked;
+                uint64_t bytes_received;
+                uint32_t ooo_segs;
+                uint32_t ooo_hits;
+                uint32_t ooo_drops;
+                uint32_t data_segs_in;
+                uint32_t acks_out;
+                uint32_t acks_delayed;
+            } stats;
+
+            /* Negotiated extensions (RFC 7323 and RFC 2018) */
+            uint8_t sack_ok;
+            uint8_t ts_ok;
+            uint8_t wscale_ok;
+            uint8_t snd_wscale;
+            uint8_t rcv_wscale;
+            uint32_t ts_recent;
+            uint32_t last_ack_sent;
+
+            /* Blocks above snd.una that the peer has SACKed, sorted and
+               merged, and the highest sequence number retransmitted from one
+               of the holes between them during this recovery. */
+            struct tcp_seq_range sacked[TCP_MAX_SACKED];
+            int nsacked;
+            uint32_t sack_rexmit;
+
+            /* Blocks above rcv.nxt that we have received, most recent
+               first, to be reported back to the peer. */
+            struct tcp_seq_range rcv_sack[TCP_MAX_SACK];
+            int rcv_sack_cnt;
+
+            /* Segments received above rcv.nxt, sorted and merged. Their data
+               is already in the receive buffer, at the spot where it will be
+               once the holes before it are filled in, so it is bounded by
+               the receive window and needs no memory of its own. */
+            struct tcp_seq_range ooo[TCP_MAX_OOO];
+            int ooo_cnt;
+
+            /* Delayed ACK: when the ACK for data received in order has to go
+               out if nothing else has carried it by then (0 if none is owed),
+               and how much data it covers. */
+            uint64_t ack_due;
+            uint32_t ack_bytes;
         } data;
     };
 };
@@ -179,8 +325,20 @@ struct tcp_sock {
 LIST_HEAD(tcp_sock_list, tcp_sock);
 
 static struct tcp_sock_list tcp_socks = LIST_HEAD_INITIALIZER(0);
+
+/* Hash tables used to match incoming segments to sockets, see the note on
+   matching sockets at the top of the file. These are protected by tcp_sem,
+   just like the list. */
+#define TCP_HASH_BITS   6
+#define TCP_HASH_SIZE   (1 << TCP_HASH_BITS)
+
+static struct tcp_sock_list tcp_conn_hash[TCP_HASH_SIZE];
+static struct tcp_sock_list tcp_port_hash[TCP_HASH_SIZE];
 static rw_semaphore_t tcp_sem = RWSEM_INITIALIZER;
-static int thd_cb_id = 0;
+
+/* Timer for everything that sockets have to do on their own (retransmissions,
+   leaving TIME-WAIT, etc), armed for whichever socket needs it first. */
+static net_timer_t tcp_timer;
 
 /* Default starting window size for connections. This should be big enough as a
    starting point, in general. If you need to adjust it, you can do so... */
@@ -193,8 +351,38 @@ static int thd_cb_id = 0;
    to be 15 seconds, since that's what Mac OS X does. */
 #define TCP_DEFAULT_MSL     15000
 
-/* Default retransmission timeout (in milliseconds). */
-#define TCP_DEFAULT_RTTO    2000
+/* Initial retransmission timeout (in milliseconds), as per RFC 6298. */
+#define TCP_DEFAULT_RTTO    1000
+
+/* Bounds on the retransmission timeout (in milliseconds). RFC 6298 suggests a
+   minimum of one second, but like most other stacks we go lower than that,
+   since we mostly live on LANs. The net thread only checks the timers every
+   50ms anyway. */
+#define TCP_MIN_RTTO        200
+#define TCP_MAX_RTTO        60000
+
+/* Number of duplicate ACKs that trigger a fast retransmit */
+#define TCP_DUPACK_THRESH   3
+
+/* Longest time to hold back the ACK for data received in order, in the hope
+   that it can go out along with data of our own (RFC 1122 says no more than
+   500ms, but most stacks use 200ms at most). */
+#define TCP_DELACK_TIME     100
+
+/* Largest send or receive buffer that may be set with setsockopt(). Window
+   scaling lets us advertise up to 1GiB, but that's quite a bit more than we
+   want to spend on a single socket. */
+#define TCP_MAX_BUFFER      (1024 * 1024)
+
+/* Largest window scale shift allowed by RFC 7323 */
+#define TCP_MAX_WSCALE      14
+
+/* Most space options can take up in a TCP header */
+#define TCP_MAX_OPTS        40
+
+/* Space to leave in front of outgoing headers for the IP and ethernet headers
+   to be put in place */
+#define TCP_HEADROOM        (sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t))
 
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define TCP_DEFAULT_HOPS    64
@@ -229,10 +417,21 @@ static int thd_cb_id = 0;
 #define TCP_IFLAG_CANBEDEL      0x00000001
 #define TCP_IFLAG_QUEUEDCLOSE   0x00000002
 #define TCP_IFLAG_ACCEPTWAIT    0x00000004
+#define TCP_IFLAG_QUICKACK      0x00000008
 
 #define TCP_OPT_EOL             0
 #define TCP_OPT_NOP             1
 #define TCP_OPT_MSS             2
+#define TCP_OPT_WSCALE          3
+#define TCP_OPT_SACK_PERM       4
+#define TCP_OPT_SACK            5
+#define TCP_OPT_TIMESTAMP       8
+
+/* Flags for the options found in a segment (struct tcp_opts) */
+#define TCP_OPTF_MSS            0x01
+#define TCP_OPTF_WSCALE         0x02
+#define TCP_OPTF_SACK_PERM      0x04
+#define TCP_OPTF_TIMESTAMP      0x08
 
 /* A few macros for comparing sequence numbers */
 #define SEQ_LT(x, y)    (((int32_t)((x) - (y))) < 0)
@@ -241,6 +440,7 @@ static int thd_cb_id = 0;
 #define SEQ_GE(x, y)    (((int32_t)((x) - (y))) >= 0)
 
 #define MAX(x, y)       ((x) > (y) ? (x) : (y))
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
 
 /* Forward declarations */
 static fs_socket_proto_t proto;
@@ -250,8 +450,15 @@ static void tcp_rst(netif_t *net, const struct in6_addr *src,
                     uint32_t ack);
 static int tcp_send_syn(struct tcp_sock *sock, int ack);
 static void tcp_send_ack(struct tcp_sock *sock);
-static void tcp_send_data(struct tcp_sock *sock, int resend);
+static inline int tcp_ack_delayed(const struct tcp_sock *sock);
+static inline uint32_t tcp_ts_now(void);
+static void tcp_send_data(struct tcp_sock *sock);
 static void tcp_send_fin_ack(struct tcp_sock *sock);
+static void tcp_cc_init(struct tcp_sock *sock);
+static uint8_t tcp_wscale_for(uint32_t bufsz);
+static void tcp_hash_remove(struct tcp_sock *sock);
+static void tcp_hash_update(struct tcp_sock *sock);
+static void tcp_timer_update(struct tcp_sock *sock);
 
 /* Sockets interface... */
 static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
@@ -439,6 +646,7 @@ retry:
 
 ret_remove:
     LIST_REMOVE(sock, sock_list);
+    tcp_hash_remove(sock);
     mutex_unlock(&sock->mutex);
     mutex_destroy(&sock->mutex);
     free(sock);
@@ -458,6 +666,7 @@ ret_no_remove:
 
     /* Don't free anything here, it will be dealt with later on in the
        net_thd callback. */
+    tcp_timer_update(sock);
     mutex_unlock(&sock->mutex);
     rwsem_write_unlock(&tcp_sem);
     return;
@@ -514,6 +723,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
             free(sock->listen.queue);
             cond_destroy(&sock->listen.cv);
             LIST_REMOVE(sock, sock_list);
+            tcp_hash_remove(sock);
             mutex_unlock(&sock->mutex);
             mutex_destroy(&sock->mutex);
             free(sock);
@@ -608,6 +818,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     sock2->hop_limit = sock->hop_limit;
     sock2->rcvbuf_sz = sock->rcvbuf_sz;
     sock2->sndbuf_sz = sock->sndbuf_sz;
+    sock2->intflags = sock->intflags & TCP_IFLAG_QUICKACK;
     sock2->data.rcv.wnd = sock->rcvbuf_sz;
 
     /* Fill in the address, if they asked for it. */
@@ -709,15 +920,35 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     sock2->data.snd.mss = lsock.mss;
     sock2->data.rcv.nxt = lsock.isn + 1;
     sock2->data.rcv.irs = lsock.isn;
+    sock2->data.rto = TCP_DEFAULT_RTTO;
+
+    /* Turn on whichever extensions the other side offered. */
+    sock2->data.sack_ok = !!(lsock.opts & TCP_OPTF_SACK_PERM);
+    sock2->data.ts_ok = !!(lsock.opts & TCP_OPTF_TIMESTAMP);
+    sock2->data.ts_recent = lsock.ts_recent;
+
+    if(lsock.opts & TCP_OPTF_WSCALE) {
+        sock2->data.wscale_ok = 1;
+        sock2->data.snd_wscale = lsock.wscale;
+        sock2->data.rcv_wscale = tcp_wscale_for(sock2->rcvbuf_sz);
+    }
+
+    tcp_cc_init(sock2);
 
     /* Since nothing else has a pointer to this socket, this will not fail. */
     mutex_trylock(&sock2->mutex);
 
     /* Send the <SYN,ACK> packet now, add it to the list, and clean up. */
+    sock2->data.ts_una = tcp_ts_now();
+    sock2->data.ts_mark_active = 0;
     tcp_send_syn(sock2, 1);
-    sock2->data.timer = timer_ms_gettime64();
+    sock2->data.timer = sock2->data.rtt_time = timer_ms_gettime64();
+    sock2->data.rtt_seq = sock2->data.snd.iss;
+    sock2->data.rtt_active = 1;
     fd = sock2->sock;
     LIST_INSERT_HEAD(&tcp_socks, sock2, sock_list);
+    tcp_hash_update(sock2);
+    tcp_timer_update(sock2);
     mutex_unlock(&sock2->mutex);
 
     sock->state &= ~TCP_STATE_ACCEPTING;
@@ -869,6 +1100,8 @@ static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
         sock->local_addr.sin6_port = htons(port);
     }
 
+    tcp_hash_update(sock);
+
     /* Release the locks, we're done */
     mutex_unlock(&sock->mutex);
     rwsem_write_unlock(&tcp_sem);
@@ -1008,6 +1241,7 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     /* Set the remote address on the socket and go to the SYN-SENT state (this
        includes setting up all the data we need for that). */
     sock->remote_addr = realaddr6;
+    tcp_hash_update(sock);
 
     if(!(sock->data.rcvbuf = (uint8_t *)malloc(sock->rcvbuf_sz))) {
         errno = ENOBUFS;
@@ -1049,6 +1283,20 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     sock->data.snd.iss = timer_us_gettime64() >> 2;
     sock->data.snd.una = sock->data.snd.iss;
     sock->data.snd.nxt = sock->data.snd.iss + 1;
+    sock->data.rto = TCP_DEFAULT_RTTO;
+    sock->data.timer = sock->data.rtt_time = timer_ms_gettime64();
+    sock->data.rtt_seq = sock->data.snd.iss;
+    sock->data.rtt_active = 1;
+
+    /* Offer all of the extensions we support. Whatever the other side doesn't
+       agree to gets turned back off when the <SYN,ACK> comes in. */
+    sock->data.sack_ok = sock->data.ts_ok = sock->data.wscale_ok = 1;
+    sock->data.snd_wscale = 0;
+    sock->data.rcv_wscale = tcp_wscale_for(sock->rcvbuf_sz);
+    sock->data.ts_recent = 0;
+    sock->data.ts_una = tcp_ts_now();
+    sock->data.ts_mark_active = 0;
+    sock->data.nsacked = sock->data.rcv_sack_cnt = sock->data.ooo_cnt = 0;
     sock->state = TCP_STATE_SYN_SENT;
 
     /* Send a <SYN> packet */
@@ -1058,6 +1306,8 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
         return -1;
     }
 
+    tcp_timer_update(sock);
+
     /* Release the write lock... */
     rwsem_write_unlock(&tcp_sem);
 
@@ -1275,8 +1525,9 @@ static ssize_t net_tcp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
             sock->data.rcvbuf_head = size - tmp;
     }
 
-    /* If we've got nothing left, move the pointers back to the beginning */
-    if(!sock->data.rcvbuf_cur_sz) {
+    /* If we've got nothing left, move the pointers back to the beginning,
+       unless there's out of order data waiting past the tail. */
+    if(!sock->data.rcvbuf_cur_sz && !sock->data.ooo_cnt) {
         sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
     }
 
@@ -1439,7 +1690,8 @@ static ssize_t net_tcp_sendto(net_socket_t *hnd, const void *message,
     }
 
     /* Send some data! */
-    tcp_send_data(sock, 0);
+    tcp_send_data(sock);
+    tcp_timer_update(sock);
 
 out:
     mutex_unlock(&sock->mutex);
@@ -1471,6 +1723,7 @@ static int net_tcp_getsockopt(net_socket_t *hnd, int level, int option_name,
                               void *option_value, socklen_t *option_len) {
     int tmp;
     struct tcp_sock *sock;
+    struct tcp_info info;
 
     if(!option_value || !option_len) {
         errno = EFAULT;
@@ -1540,6 +1793,61 @@ static int net_tcp_getsockopt(net_socket_t *hnd, int level, int option_name,
                 case TCP_NODELAY:
                     tmp = 1;
                     goto copy_int;
+
+                case TCP_QUICKACK:
+                    tmp = !!(sock->intflags & TCP_IFLAG_QUICKACK);
+                    goto copy_int;
+
+                case TCP_INFO:
+                    memset(&info, 0, sizeof(info));
+
+                    /* Listening sockets don't have any of this. */
+                    if(sock->state != TCP_STATE_LISTEN) {
+                        info.tcpi_ca_state = sock->data.ca_state;
+                        info.tcpi_backoff = sock->data.backoff;
+                        info.tcpi_options =
+                            (sock->data.ts_ok ? TCPI_OPT_TIMESTAMPS : 0) |
+                            (sock->data.sack_ok ? TCPI_OPT_SACK : 0) |
+                            (sock->data.wscale_ok ? TCPI_OPT_WSCALE : 0);
+                        info.tcpi_snd_wscale = sock->data.snd_wscale;
+                        info.tcpi_rcv_wscale = sock->data.rcv_wscale;
+                        info.tcpi_rto = sock->data.rto * 1000;
+                        info.tcpi_rtt = (sock->data.srtt >> 3) * 1000;
+                        info.tcpi_rttvar = (sock->data.rttvar >> 2) * 1000;
+                        info.tcpi_snd_mss = sock->data.snd.mss;
+                        info.tcpi_snd_cwnd = sock->data.cwnd;
+                        info.tcpi_snd_ssthresh = sock->data.ssthresh;
+                        info.tcpi_snd_wnd = sock->data.snd.wnd;
+                        info.tcpi_unacked = sock->data.snd.nxt -
+                            sock->data.snd.una;
+                        info.tcpi_segs_in = sock->data.stats.segs_in;
+                        info.tcpi_segs_out = sock->data.stats.segs_out;
+                        info.tcpi_total_retrans = sock->data.stats.retrans;
+                        info.tcpi_fast_retrans = sock->data.stats.fast_retrans;
+                        info.tcpi_timeouts = sock->data.stats.timeouts;
+                        info.tcpi_dupacks = sock->data.stats.dupacks;
+                        info.tcpi_bytes_acked = sock->data.stats.bytes_acked;
+                        info.tcpi_bytes_received =
+                            sock->data.stats.bytes_received;
+                        info.tcpi_data_segs_in =
+                            sock->data.stats.data_segs_in;
+                        info.tcpi_acks_out = sock->data.stats.acks_out;
+                        info.tcpi_acks_delayed =
+                            sock->data.stats.acks_delayed;
+                        info.tcpi_ooo_segs = sock->data.stats.ooo_segs;
+                        info.tcpi_ooo_hits = sock->data.stats.ooo_hits;
+                        info.tcpi_ooo_drops = sock->data.stats.ooo_drops;
+
+                        for(tmp = 0; tmp < sock->data.ooo_cnt; ++tmp)
+                            info.tcpi_ooo_bytes += sock->data.ooo[tmp].end -
+                                sock->data.ooo[tmp].start;
+                    }
+
+                    if(*option_len > sizeof(info))
+                        *option_len = sizeof(info);
+
+                    memcpy(option_value, &info, *option_len);
+                    goto simply_return;
             }
 
             break;
@@ -1599,11 +1907,13 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                         goto ret_inval;
 
                     tmp = *(uint32_t *)option_value;
-                    /* Receive buffer size must be in the range 256 - 65535 */
+                    /* Receive buffer size must be in the range 256 - 1MiB.
+                       Anything over 65535 only helps if it's set before the
+                       connection is made, so that window scaling is used. */
                     if(tmp < 256)
                         tmp = 256;
-                    else if(tmp > 65535)
-                        tmp = 65535;
+                    else if(tmp > TCP_MAX_BUFFER)
+                        tmp = TCP_MAX_BUFFER;
 
                     new_ptr = realloc(sock->data.rcvbuf, tmp);
                     if(!new_ptr)
@@ -1618,11 +1928,11 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                         goto ret_inval;
 
                     tmp = *(uint32_t *)option_value;
-                    /* Send buffer size must be in the range 2048 - 65535 */
+                    /* Send buffer size must be in the range 2048 - 1MiB */
                     if(tmp < 2048)
                         tmp = 2048;
-                    else if(tmp > 65535)
-                        tmp = 65535;
+                    else if(tmp > TCP_MAX_BUFFER)
+                        tmp = TCP_MAX_BUFFER;
 
                     new_ptr = realloc(sock->data.sndbuf, tmp);
                     if(!new_ptr) {
@@ -1707,6 +2017,23 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                         goto ret_inval;
 
                     goto ret_success;
+
+                case TCP_QUICKACK:
+                    if(option_len != sizeof(int))
+                        goto ret_inval;
+
+                    tmp = *((int *)option_value);
+
+                    if(tmp)
+                        sock->intflags |= TCP_IFLAG_QUICKACK;
+                    else
+                        sock->intflags &= ~TCP_IFLAG_QUICKACK;
+
+                    /* Don't sit on anything that was being held back. */
+                    if(tmp && tcp_ack_delayed(sock))
+                        tcp_send_ack(sock);
+
+                    goto ret_success;
             }
 
             break;
@@ -2058,185 +2385,997 @@ static void tcp_bpkt_rst(netif_t *net, const struct in6_addr *src,
                   dst, src);
 }
 
+static inline void tcp_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t tcp_get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+        ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Our timestamp clock ticks once per millisecond. */
+static inline uint32_t tcp_ts_now(void) {
+    return (uint32_t)timer_ms_gettime64();
+}
+
+/* Smallest window scale that lets us advertise a whole buffer of the given
+   size. */
+static uint8_t tcp_wscale_for(uint32_t bufsz) {
+    uint8_t shift = 0;
+
+    while(shift < TCP_MAX_WSCALE && (bufsz >> shift) > 65535)
+        ++shift;
+
+    return shift;
+}
+
+/* The receive window, as it goes in the header of a non-SYN segment. */
+static inline uint16_t tcp_adv_wnd(const struct tcp_sock *sock) {
+    return (uint16_t)MIN(sock->data.rcv.wnd >> sock->data.rcv_wscale, 65535);
+}
+
+/* Fill in the header of an outgoing segment on a synchronized connection,
+   including the timestamp option and, if asked for, any SACK blocks. Returns
+   the length of the header. */
+static int tcp_fill_hdr(struct tcp_sock *sock, tcp_hdr_t *hdr, uint32_t seq,
+                        uint16_t flags, int sack) {
+    uint8_t *opt = hdr->options;
+    int i, n, len = 0;
+
+    hdr->src_port = sock->local_addr.sin6_port;
+    hdr->dst_port = sock->remote_addr.sin6_port;
+    hdr->seq = htonl(seq);
+    hdr->ack = htonl(sock->data.rcv.nxt);
+    hdr->wnd = htons(tcp_adv_wnd(sock));
+    hdr->checksum = 0;
+    hdr->urg = 0;
+
+    sock->data.last_ack_sent = sock->data.rcv.nxt;
+
+    /* Whatever this is, it takes care of any ACK we were holding back. */
+    if(flags & TCP_FLAG_ACK) {
+        sock->data.ack_due = 0;
+        sock->data.ack_bytes = 0;
+    }
+
+    if(sock->data.ts_ok) {
+        opt[0] = TCP_OPT_NOP;
+        opt[1] = TCP_OPT_NOP;
+        opt[2] = TCP_OPT_TIMESTAMP;
+        opt[3] = 10;
+        tcp_put32(opt + 4, tcp_ts_now());
+        tcp_put32(opt + 8, sock->data.ts_recent);
+        len = 12;
+    }
+
+    if(sack && sock->data.sack_ok && sock->data.rcv_sack_cnt) {
+        /* Only three blocks fit next to a timestamp. */
+        n = MIN(sock->data.rcv_sack_cnt, sock->data.ts_ok ? 3 : 4);
+        opt[len] = TCP_OPT_NOP;
+        opt[len + 1] = TCP_OPT_NOP;
+        opt[len + 2] = TCP_OPT_SACK;
+        opt[len + 3] = 2 + 8 * n;
+        len += 4;
+
+        for(i = 0; i < n; ++i, len += 8) {
+            tcp_put32(opt + len, sock->data.rcv_sack[i].start);
+            tcp_put32(opt + len + 4, sock->data.rcv_sack[i].end);
+        }
+    }
+
+    hdr->off_flags = htons(flags | TCP_OFFSET(5 + len / 4));
+
+    return sizeof(tcp_hdr_t) + len;
+}
+
+/* Parse the options of an incoming segment. Returns -1 if they are
+   malformed. */
+static int tcp_parse_opts(const tcp_hdr_t *tcp, uint16_t flags,
+                          struct tcp_opts *o) {
+    const uint8_t *opt = tcp->options;
+    int j = 0, len, end_of_opts = TCP_GET_OFFSET(flags) - 20;
+
+    /* Options that aren't there read as zero, since some of them get copied
+       into the connection regardless. */
+    memset(o, 0, sizeof(*o));
+
+    while(j < end_of_opts) {
+        if(opt[j] == TCP_OPT_EOL)
+            break;
+
+        if(opt[j] == TCP_OPT_NOP) {
+            ++j;
+            continue;
+        }
+
+        if(j + 2 > end_of_opts)
+            return -1;
+
+        len = opt[j + 1];
+
+        if(len < 2 || j + len > end_of_opts)
+            return -1;
+
+        switch(opt[j]) {
+            case TCP_OPT_MSS:
+                if(len != 4)
+                    return -1;
+
+                o->mss = (opt[j + 2] << 8) | opt[j + 3];
+                o->flags |= TCP_OPTF_MSS;
+                break;
+
+            case TCP_OPT_WSCALE:
+                if(len != 3)
+                    return -1;
+
+                o->wscale = MIN(opt[j + 2], TCP_MAX_WSCALE);
+                o->flags |= TCP_OPTF_WSCALE;
+                break;
+
+            case TCP_OPT_SACK_PERM:
+                if(len != 2)
+                    return -1;
+
+                o->flags |= TCP_OPTF_SACK_PERM;
+                break;
+
+            case TCP_OPT_SACK:
+                if((len - 2) % 8)
+                    return -1;
+
+                for(len = 2; len < opt[j + 1] && o->nsack < TCP_MAX_SACK;
+                    len += 8, ++o->nsack) {
+                    o->sack[o->nsack].start = tcp_get32(opt + j + len);
+                    o->sack[o->nsack].end = tcp_get32(opt + j + len + 4);
+                }
+
+                len = opt[j + 1];
+                break;
+
+            case TCP_OPT_TIMESTAMP:
+                if(len != 10)
+                    return -1;
+
+                o->tsval = tcp_get32(opt + j + 2);
+                o->tsecr = tcp_get32(opt + j + 6);
+                o->flags |= TCP_OPTF_TIMESTAMP;
+                break;
+
+            default:
+                /* Skip unknown options */
+                break;
+        }
+
+        j += len;
+    }
+
+    return 0;
+}
+
 static int tcp_send_syn(struct tcp_sock *sock, int ack) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t) + 4];
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + 20];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    uint8_t *opt = hdr->options;
     uint16_t cs;
+    int len;
 
-    /* Fill in the base packet */
+    /* Fill in the base packet. The window in a SYN is never scaled. */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
     hdr->seq = htonl(sock->data.snd.iss);
     hdr->ack = htonl(sock->data.rcv.nxt);
+    hdr->wnd = htons(MIN(sock->data.rcv.wnd, 65535));
+    hdr->checksum = 0;
+    hdr->urg = 0;
+
+    /* Fill in our SYN options. On a <SYN,ACK>, only the ones that the other
+       side offered are left enabled by now. */
+    opt[0] = TCP_OPT_MSS;
+    opt[1] = 4;
+    opt[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
+    opt[3] = TCP_DEFAULT_MSS & 0xFF;
+    len = 4;
+
+    if(sock->data.sack_ok) {
+        if(!sock->data.ts_ok) {
+            opt[len++] = TCP_OPT_NOP;
+            opt[len++] = TCP_OPT_NOP;
+        }
+
+        opt[len++] = TCP_OPT_SACK_PERM;
+        opt[len++] = 2;
+    }
+
+    if(sock->data.ts_ok) {
+        if(!sock->data.sack_ok) {
+            opt[len++] = TCP_OPT_NOP;
+            opt[len++] = TCP_OPT_NOP;
+        }
+
+        opt[len++] = TCP_OPT_TIMESTAMP;
+        opt[len++] = 10;
+        tcp_put32(opt + len, tcp_ts_now());
+        tcp_put32(opt + len + 4, sock->data.ts_recent);
+        len += 8;
+    }
+
+    if(sock->data.wscale_ok) {
+        opt[len++] = TCP_OPT_NOP;
+        opt[len++] = TCP_OPT_WSCALE;
+        opt[len++] = 3;
+        opt[len++] = sock->data.rcv_wscale;
+    }
 
     if(ack) {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_OFFSET(6));
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK |
+                               TCP_OFFSET(5 + len / 4));
     }
     else {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(6));
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(5 + len / 4));
     }
 
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->checksum = 0;
-    hdr->urg = 0;
-
-    /* Fill in our SYN options. The only one we worry about right now is MSS. */
-    hdr->options[0] = TCP_OPT_MSS;
-    hdr->options[1] = 4;
-    hdr->options[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
-    hdr->options[3] = TCP_DEFAULT_MSS & 0xFF;
+    len += sizeof(tcp_hdr_t);
 
     /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                   &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t) + 4, IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t) + 4, cs);
+                                  len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, cs);
 
-    return net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t) + 4,
+    return net_ipv6_send(sock->data.net, rawpkt, len,
                          sock->hop_limit, IPPROTO_TCP,
                          &sock->local_addr.sin6_addr,
                          &sock->remote_addr.sin6_addr);
 }
 
 static void tcp_send_fin_ack(struct tcp_sock *sock) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t)];
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
     uint16_t cs;
+    int len;
 
     /* Fill in the base packet */
-    hdr->src_port = sock->local_addr.sin6_port;
-    hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->seq = htonl(sock->data.snd.nxt);
-    hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_FIN | TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->checksum = 0;
-    hdr->urg = 0;
+    len = tcp_fill_hdr(sock, hdr, sock->data.snd.nxt,
+                       TCP_FLAG_FIN | TCP_FLAG_ACK, 1);
 
     /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                   &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t), cs);
+                                  len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, cs);
 
-    net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t), sock->hop_limit,
+    net_ipv6_send(sock->data.net, rawpkt, len, sock->hop_limit,
                   IPPROTO_TCP, &sock->local_addr.sin6_addr,
                   &sock->remote_addr.sin6_addr);
 }
 
 static void tcp_send_ack(struct tcp_sock *sock) {
-    tcp_hdr_t hdr;
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
+    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
     uint16_t c;
+    int len;
+
+    ++sock->data.stats.acks_out;
 
     /* Fill in the base packet */
-    hdr.src_port = sock->local_addr.sin6_port;
-    hdr.dst_port = sock->remote_addr.sin6_port;
-    hdr.seq = htonl(sock->data.snd.nxt);
-    hdr.ack = htonl(sock->data.rcv.nxt);
-    hdr.off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr.wnd = htons(sock->data.rcv.wnd);
-    hdr.checksum = 0;
-    hdr.urg = 0;
+    len = tcp_fill_hdr(sock, hdr, sock->data.snd.nxt, TCP_FLAG_ACK, 1);
 
     /* Calculate the real checksum */
     c = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                  &sock->remote_addr.sin6_addr,
-                                 sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr.checksum = net_ipv4_checksum((const uint8 *)&hdr, sizeof(tcp_hdr_t), c);
+                                 len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, c);
 
-    net_ipv6_send(sock->data.net, (const uint8 *)&hdr, sizeof(tcp_hdr_t),
+    net_ipv6_send(sock->data.net, rawpkt, len,
                   sock->hop_limit, IPPROTO_TCP, &sock->local_addr.sin6_addr,
                   &sock->remote_addr.sin6_addr);
 }
 
-static void tcp_send_data(struct tcp_sock *sock, int resend) {
-    uint32_t wnd = sock->data.snd.wnd, snd;
-    int sz = sizeof(tcp_hdr_t);
-    uint8_t rawpkt[1500];
-    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
-    uint16_t cs;
-    uint8_t *sb, *buf;
-    uint32_t seq, unacked, head;
+/* Amount of data that fits in one full-sized segment, leaving room for the
+   timestamp option if it is in use. */
+static inline uint32_t tcp_smss(const struct tcp_sock *sock) {
+    return sock->data.snd.mss - sizeof(tcp_hdr_t) - (sock->data.ts_ok ? 12 : 0);
+}
+
+/* Is an ACK for received data being held back? */
+static inline int tcp_ack_delayed(const struct tcp_sock *sock) {
+    switch(sock->state) {
+        case TCP_STATE_ESTABLISHED:
+        case TCP_STATE_FIN_WAIT_1:
+        case TCP_STATE_FIN_WAIT_2:
+        case TCP_STATE_CLOSE_WAIT:
+            return sock->data.ack_due != 0;
 
-    if(!resend) {
-        seq = sock->data.snd.nxt;
-        unacked = sock->data.snd.nxt - sock->data.snd.una;
-        wnd -= unacked;
-        head = sock->data.sndbuf_head;
+        default:
+            return 0;
     }
-    else {
-        seq = sock->data.snd.una;
-        unacked = 0;
-        head = sock->data.sndbuf_acked;
+}
+
+/* Acknowledge sz bytes that just came in order. As allowed by RFC 1122 (and
+   RFC 5681), the ACK is held back until a second full-sized segment has come
+   in or TCP_DELACK_TIME has passed, unless we send something first that it can
+   ride along on. When there is a hole in the data or one was just filled in,
+   the other side is recovering from a loss and needs to hear from us now. */
+static void tcp_ack_data(struct tcp_sock *sock, uint32_t sz, int now) {
+    ++sock->data.stats.data_segs_in;
+    sock->data.ack_bytes += sz;
+
+    if(now || (sock->intflags & TCP_IFLAG_QUICKACK) ||
+       sock->data.ack_bytes >= 2 * tcp_smss(sock)) {
+        tcp_send_ack(sock);
+        return;
     }
 
-    if(!wnd)
-        wnd = 1;
+    ++sock->data.stats.acks_delayed;
 
-    /* Fill in the base packet */
-    hdr->src_port = sock->local_addr.sin6_port;
-    hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->urg = 0;
+    if(!sock->data.ack_due)
+        sock->data.ack_due = timer_ms_gettime64() + TCP_DELACK_TIME;
+}
 
-    /* Put on some data if we should do so */
-    while(sock->data.sndbuf_cur_sz - unacked && wnd) {
-        hdr->seq = htonl(seq);
-        hdr->checksum = 0;
-        buf = rawpkt + sizeof(tcp_hdr_t);
-        sb = sock->data.sndbuf + head;
-        snd = wnd;
+/* Send one segment of data from the send buffer. The data is not copied out
+   of the send buffer, rather the segment is sent as a chain of packet buffers
+   made of the headers followed by one or two pieces of the buffer (two when
+   the data wraps around its end). */
+static void tcp_send_seg(struct tcp_sock *sock, uint32_t seq, uint32_t len) {
+    uint8_t rawpkt[TCP_HEADROOM + sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
+    tcp_hdr_t *hdr = (tcp_hdr_t *)(rawpkt + TCP_HEADROOM);
+    net_pbuf_t hp, dp[2];
+    uint32_t sz, head, first;
+    uint16_t cs;
+
+    /* Fill in the base packet. Leave out SACK blocks so that a full-sized
+       segment still fits. */
+    sz = tcp_fill_hdr(sock, hdr, seq, TCP_FLAG_ACK, 0);
+    net_pbuf_init(&hp, rawpkt, TCP_HEADROOM + sz, TCP_HEADROOM);
 
-        if(snd > sock->data.snd.mss - sizeof(tcp_hdr_t))
-            snd = sock->data.snd.mss - sizeof(tcp_hdr_t);
+    /* Find the data in the send buffer */
+    head = sock->data.sndbuf_acked + (seq - sock->data.snd.una);
 
-        if(snd > sock->data.sndbuf_cur_sz - unacked)
-            snd = sock->data.sndbuf_cur_sz - unacked;
+    if(head >= sock->sndbuf_sz)
+        head -= sock->sndbuf_sz;
 
-        /* Copy in the data */
-        if(head + snd <= sock->sndbuf_sz) {
-            memcpy(buf, sb, snd);
-            head += snd;
+    first = sock->sndbuf_sz - head;
+
+    if(first > len)
+        first = len;
+
+    net_pbuf_init(&dp[0], sock->data.sndbuf + head, first, 0);
+    hp.next = &dp[0];
+
+    if(first < len) {
+        net_pbuf_init(&dp[1], sock->data.sndbuf, len - first, 0);
+        dp[0].next = &dp[1];
+    }
+
+    /* Calculate the checksum */
+    cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
+                                  &sock->remote_addr.sin6_addr, sz + len,
+                                  IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum_pbuf(&hp, cs);
+
+    net_ipv6_send_pbuf(sock->data.net, &hp, sock->hop_limit, IPPROTO_TCP,
+                       &sock->local_addr.sin6_addr,
+                       &sock->remote_addr.sin6_addr);
+    ++sock->data.stats.segs_out;
+}
+
+/* Send as much new data as the peer's window and the congestion window
+   allow. */
+static void tcp_send_data(struct tcp_sock *sock) {
+    uint32_t wnd, snd, seq, unacked, pending, head;
+
+    /* Data written before our SYN has been acknowledged stays queued until it
+       is, as RFC 793 says. */
+    if(sock->state != TCP_STATE_ESTABLISHED &&
+       sock->state != TCP_STATE_CLOSE_WAIT)
+        return;
+
+    seq = sock->data.snd.nxt;
+    unacked = sock->data.snd.nxt - sock->data.snd.una;
+    head = sock->data.sndbuf_head;
+
+    if(sock->data.sndbuf_cur_sz <= unacked)
+        return;
+
+    pending = sock->data.sndbuf_cur_sz - unacked;
+    wnd = MIN(sock->data.snd.wnd, sock->data.cwnd);
+    wnd = wnd > unacked ? wnd - unacked : 0;
+
+    /* If the peer's window is closed and nothing is in flight, probe it with
+       a single byte. */
+    if(!wnd && !unacked)
+        wnd = 1;
+
+    if(!wnd)
+        return;
 
-            if(head == sock->sndbuf_sz)
-                head = 0;
+    /* Start the retransmission timer, unless it is already running for
+       data that is still in flight. */
+    if(!unacked)
+        sock->data.timer = timer_ms_gettime64();
+
+    /* Keep track of when the oldest data in flight was first sent, for
+       tcp_new_ack(). Retransmissions don't count. */
+    if(sock->data.ts_ok) {
+        if(!unacked) {
+            sock->data.ts_una = tcp_ts_now();
+            sock->data.ts_mark_active = 0;
         }
-        else {
-            sz = sock->sndbuf_sz - head;
-            memcpy(buf, sb, sz);
-            memcpy(buf + sz, sock->data.sndbuf, snd - sz);
-            head = snd - sz;
+        else if(!sock->data.ts_mark_active) {
+            sock->data.ts_mark = tcp_ts_now();
+            sock->data.ts_mark_seq = seq;
+            sock->data.ts_mark_active = 1;
         }
+    }
 
-        sz = snd + sizeof(tcp_hdr_t);
-        wnd -= snd;
-        seq += snd;
-        unacked += snd;
+    /* Put on some data if we should do so */
+    while(pending && wnd) {
+        snd = MIN(wnd, tcp_smss(sock));
+        snd = MIN(snd, pending);
+
+        /* Time this segment, if we aren't timing one already. With
+           timestamps, every ACK gives us a sample instead. */
+        if(!sock->data.rtt_active && !sock->data.ts_ok) {
+            sock->data.rtt_active = 1;
+            sock->data.rtt_seq = seq;
+            sock->data.rtt_time = timer_ms_gettime64();
+        }
+
+        tcp_send_seg(sock, seq, snd);
+
+        head += snd;
 
-        /* Calculate the checksum */
-        cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                      &sock->remote_addr.sin6_addr, sz,
-                                      IPPROTO_TCP);
-        hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
+        if(head >= sock->sndbuf_sz)
+            head -= sock->sndbuf_sz;
 
-        net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit, IPPROTO_TCP,
-                      &sock->local_addr.sin6_addr,
-                      &sock->remote_addr.sin6_addr);
+        wnd -= snd;
+        seq += snd;
+        pending -= snd;
     }
 
-    sock->data.timer = timer_ms_gettime64();
     sock->data.sndbuf_head = head;
     sock->data.snd.nxt = seq;
 }
 
+/* Retransmit up to one segment of data starting at the given sequence
+   number. */
+static void tcp_retransmit(struct tcp_sock *sock, uint32_t seq, uint32_t len) {
+    len = MIN(len, sock->data.snd.nxt - seq);
+    len = MIN(len, tcp_smss(sock));
+
+    if(!len)
+        return;
+
+    /* Never take RTT samples from retransmitted data (Karn's algorithm). */
+    sock->data.rtt_active = 0;
+
+    tcp_send_seg(sock, seq, len);
+    sock->data.timer = timer_ms_gettime64();
+    ++sock->data.stats.retrans;
+
+    if(SEQ_GT(seq + len, sock->data.sack_rexmit))
+        sock->data.sack_rexmit = seq + len;
+}
+
+/* Retransmit the first unacknowledged segment. */
+static inline void tcp_retransmit_una(struct tcp_sock *sock) {
+    tcp_retransmit(sock, sock->data.snd.una, tcp_smss(sock));
+}
+
+/* Add a range of sequence numbers to a sorted list of ranges, merging it with
+   any that it overlaps or touches. Returns the index of the range that now
+   contains it, or -1 if the list is full. */
+static int tcp_range_add(struct tcp_seq_range *r, int *cnt, int max,
+                         uint32_t start, uint32_t end) {
+    int j, k;
+
+    /* Find where the range goes, then swallow any it overlaps. */
+    for(j = 0; j < *cnt && SEQ_LT(r[j].end, start); ++j) ;
+
+    for(k = j; k < *cnt && SEQ_LE(r[k].start, end); ++k) {
+        if(SEQ_LT(r[k].start, start))
+            start = r[k].start;
+
+        if(SEQ_GT(r[k].end, end))
+            end = r[k].end;
+    }
+
+    if(k == j) {
+        /* Nothing overlaps, so make room. */
+        if(*cnt == max)
+            return -1;
+
+        memmove(r + j + 1, r + j, (*cnt - j) * sizeof(*r));
+        ++*cnt;
+    }
+    else if(k > j + 1) {
+        memmove(r + j + 1, r + k, (*cnt - k) * sizeof(*r));
+        *cnt -= k - j - 1;
+    }
+
+    r[j].start = start;
+    r[j].end = end;
+
+    return j;
+}
+
+/* Add the SACK blocks of an incoming ACK to the scoreboard. Blocks that don't
+   make sense are ignored, as are new ones once the scoreboard is full (the
+   peer will report them again). */
+static void tcp_sack_update(struct tcp_sock *sock, const struct tcp_opts *o) {
+    uint32_t start, end;
+    int i;
+
+    for(i = 0; i < o->nsack; ++i) {
+        start = o->sack[i].start;
+        end = o->sack[i].end;
+
+        if(!SEQ_LT(start, end) || !SEQ_GT(end, sock->data.snd.una) ||
+           SEQ_GT(end, sock->data.snd.nxt))
+            continue;
+
+        if(SEQ_LT(start, sock->data.snd.una))
+            start = sock->data.snd.una;
+
+        tcp_range_add(sock->data.sacked, &sock->data.nsacked, TCP_MAX_SACKED,
+                      start, end);
+    }
+}
+
+/* Drop everything below snd.una from the scoreboard. */
+static void tcp_sack_prune(struct tcp_sock *sock) {
+    struct tcp_seq_range *sb = sock->data.sacked;
+    int i;
+
+    for(i = 0; i < sock->data.nsacked; ++i) {
+        if(SEQ_GT(sb[i].end, sock->data.snd.una))
+            break;
+    }
+
+    if(i) {
+        memmove(sb, sb + i, (sock->data.nsacked - i) * sizeof(*sb));
+        sock->data.nsacked -= i;
+    }
+
+    if(sock->data.nsacked && SEQ_LT(sb[0].start, sock->data.snd.una))
+        sb[0].start = sock->data.snd.una;
+}
+
+/* Find the next hole below the highest SACKed block that hasn't been
+   retransmitted yet during this recovery. Returns 0 if there isn't one. */
+static int tcp_sack_next_hole(struct tcp_sock *sock, uint32_t *seq,
+                              uint32_t *len) {
+    const struct tcp_seq_range *sb = sock->data.sacked;
+    uint32_t from = sock->data.snd.una;
+    int i;
+
+    if(SEQ_GT(sock->data.sack_rexmit, from))
+        from = sock->data.sack_rexmit;
+
+    for(i = 0; i < sock->data.nsacked; ++i) {
+        if(SEQ_LT(from, sb[i].start)) {
+            *seq = from;
+            *len = sb[i].start - from;
+            return 1;
+        }
+
+        if(SEQ_GT(sb[i].end, from))
+            from = sb[i].end;
+    }
+
+    return 0;
+}
+
+/* Drop the blocks we report to the peer that rcv.nxt has caught up with. */
+static void tcp_rcv_sack_prune(struct tcp_sock *sock) {
+    int i, j;
+
+    for(i = j = 0; i < sock->data.rcv_sack_cnt; ++i) {
+        if(SEQ_GT(sock->data.rcv_sack[i].end, sock->data.rcv.nxt))
+            sock->data.rcv_sack[j++] = sock->data.rcv_sack[i];
+    }
+
+    sock->data.rcv_sack_cnt = j;
+}
+
+/* Copy data into the receive buffer, the given number of bytes past its
+   tail. */
+static void tcp_rcvbuf_put(struct tcp_sock *sock, uint32_t off,
+                           const uint8_t *buf, uint32_t sz) {
+    uint32_t pos = sock->data.rcvbuf_tail + off, tmp;
+
+    if(pos >= sock->rcvbuf_sz)
+        pos -= sock->rcvbuf_sz;
+
+    if(pos + sz <= sock->rcvbuf_sz) {
+        memcpy(sock->data.rcvbuf + pos, buf, sz);
+    }
+    else {
+        tmp = sock->rcvbuf_sz - pos;
+        memcpy(sock->data.rcvbuf + pos, buf, tmp);
+        memcpy(sock->data.rcvbuf, buf + tmp, sz - tmp);
+    }
+}
+
+/* Copy the data of a segment that is next in line for an established
+   connection straight into the receive buffer, adding the whole segment to
+   the checksum on the way. The data doesn't become part of the stream until
+   rcv.nxt moves past it, so nothing is lost if the checksum turns out to be
+   bad. Returns 0 if the segment doesn't qualify, and nothing was done. */
+static int tcp_rcv_direct(struct tcp_sock *sock, const tcp_hdr_t *tcp,
+                          uint16_t flags, size_t size, uint16_t *sum) {
+    const uint8_t *buf = (const uint8_t *)tcp;
+    uint32_t hdrlen = TCP_GET_OFFSET(flags), sz, pos, tmp;
+    uint16_t part;
+
+    if(sock->state != TCP_STATE_ESTABLISHED ||
+       (flags & (TCP_FLAG_SYN | TCP_FLAG_RST | TCP_FLAG_URG)) ||
+       hdrlen < sizeof(tcp_hdr_t) || hdrlen >= size ||
+       ntohl(tcp->seq) != sock->data.rcv.nxt || sock->data.ooo_cnt ||
+       size - hdrlen > sock->data.rcv.wnd)
+        return 0;
+
+    sz = size - hdrlen;
+    pos = sock->data.rcvbuf_tail;
+
+    if(pos >= sock->rcvbuf_sz)
+        pos -= sock->rcvbuf_sz;
+
+    tmp = MIN(sz, sock->rcvbuf_sz - pos);
+
+    /* The header is a multiple of 4 bytes long, so the data starts at an even
+       offset. */
+    *sum = net_csum_partial(buf, hdrlen, *sum);
+    *sum = net_csum_copy(sock->data.rcvbuf + pos, buf + hdrlen, tmp, *sum);
+
+    if(tmp < sz) {
+        part = net_csum_copy(sock->data.rcvbuf, buf + hdrlen + tmp, sz - tmp,
+                             0);
+        *sum = net_csum_add(*sum, (tmp & 1) ? net_csum_swab(part) : part);
+    }
+
+    return 1;
+}
+
+/* Hand data that is already in the receive buffer over to the reader. */
+static void tcp_rcvbuf_advance(struct tcp_sock *sock, uint32_t sz) {
+    sock->data.rcv.nxt += sz;
+    sock->data.rcv.wnd -= sz;
+    sock->data.rcvbuf_cur_sz += sz;
+    sock->data.rcvbuf_tail += sz;
+    sock->data.stats.bytes_received += sz;
+
+    if(sock->data.rcvbuf_tail > sock->rcvbuf_sz)
+        sock->data.rcvbuf_tail -= sock->rcvbuf_sz;
+}
+
+/* Queue a segment that arrived ahead of rcv.nxt. The segment must fit within
+   the receive window. */
+static void tcp_ooo_queue(struct tcp_sock *sock, uint32_t seq,
+                          const uint8_t *buf, uint32_t sz) {
+    struct tcp_seq_range blk, *r = sock->data.rcv_sack;
+    int i, j;
+
+    i = tcp_range_add(sock->data.ooo, &sock->data.ooo_cnt, TCP_MAX_OOO, seq,
+                      seq + sz);
+
+    if(i < 0) {
+        ++sock->data.stats.ooo_drops;
+        return;
+    }
+
+    tcp_rcvbuf_put(sock, seq - sock->data.rcv.nxt, buf, sz);
+    ++sock->data.stats.ooo_segs;
+
+    /* The block holding the newest segment is reported first, followed by the
+       ones reported before that it hasn't swallowed (RFC 2018). */
+    blk = sock->data.ooo[i];
+
+    for(i = j = 0; i < sock->data.rcv_sack_cnt; ++i) {
+        if(SEQ_LT(r[i].start, blk.start) || SEQ_GT(r[i].end, blk.end))
+            r[j++] = r[i];
+    }
+
+    if(j == TCP_MAX_SACK)
+        --j;
+
+    memmove(r + 1, r, j * sizeof(*r));
+    r[0] = blk;
+    sock->data.rcv_sack_cnt = j + 1;
+}
+
+/* Move any queued data that rcv.nxt has caught up with over to the
+   reader. */
+static void tcp_ooo_splice(struct tcp_sock *sock) {
+    struct tcp_seq_range *r = sock->data.ooo;
+
+    while(sock->data.ooo_cnt && SEQ_LE(r[0].start, sock->data.rcv.nxt)) {
+        if(SEQ_GT(r[0].end, sock->data.rcv.nxt)) {
+            tcp_rcvbuf_advance(sock, r[0].end - sock->data.rcv.nxt);
+            ++sock->data.stats.ooo_hits;
+        }
+
+        memmove(r, r + 1, --sock->data.ooo_cnt * sizeof(*r));
+    }
+
+    tcp_rcv_sack_prune(sock);
+}
+
+/* Set up the congestion window for a connection once the MSS is known. */
+static void tcp_cc_init(struct tcp_sock *sock) {
+    const uint32_t smss = tcp_smss(sock);
+
+    /* Initial window from RFC 3390 */
+    sock->data.cwnd = MIN(4 * smss, MAX(2 * smss, 4380));
+    sock->data.ssthresh = UINT32_MAX;
+    sock->data.ca_state = TCP_CA_Open;
+    sock->data.dupacks = 0;
+}
+
+/* Update the retransmission timeout with a new RTT sample (in milliseconds),
+   as described in RFC 6298. */
+static void tcp_rtt_sample(struct tcp_sock *sock, uint32_t rtt) {
+    int32_t delta;
+    uint32_t rto;
+
+    if(!sock->data.srtt && !sock->data.rttvar) {
+        sock->data.srtt = rtt << 3;
+        sock->data.rttvar = rtt << 1;
+    }
+    else {
+        delta = rtt - (sock->data.srtt >> 3);
+        sock->data.srtt += delta;
+
+        if(delta < 0)
+            delta = -delta;
+
+        sock->data.rttvar += delta - (sock->data.rttvar >> 2);
+    }
+
+    /* RTO = SRTT + max(G, 4 * RTTVAR), where the clock granularity G is one
+       millisecond. */
+    rto = (sock->data.srtt >> 3) + MAX(1, sock->data.rttvar);
+    sock->data.rto = MIN(MAX(rto, TCP_MIN_RTTO), TCP_MAX_RTTO);
+    sock->data.backoff = 0;
+}
+
+/* Handle an ACK that acknowledges new data. */
+static void tcp_new_ack(struct tcp_sock *sock, uint32_t ack, uint32_t acked,
+                        const struct tcp_opts *o) {
+    const uint32_t smss = tcp_smss(sock);
+    const uint64_t now = timer_ms_gettime64();
+    uint32_t seq, len;
+
+    tcp_sack_prune(sock);
+
+    if(sock->data.ts_ok && (o->flags & TCP_OPTF_TIMESTAMP)) {
+        /* The peer echoes back the time we sent whatever it is
+           acknowledging. An echo from before the acknowledged data was first
+           sent is left over from an earlier segment (a duplicate ACK for a
+           spurious retransmission, say), and says nothing about the RTT
+           (RFC 7323, section 4.1). */
+        if(o->tsecr && SEQ_GE(o->tsecr, sock->data.ts_una))
+            tcp_rtt_sample(sock, tcp_ts_now() - o->tsecr);
+
+        if(sock->data.ts_mark_active && SEQ_GT(ack, sock->data.ts_mark_seq)) {
+            sock->data.ts_una = sock->data.ts_mark;
+            sock->data.ts_mark_active = 0;
+        }
+    }
+    else if(sock->data.rtt_active && SEQ_GT(ack, sock->data.rtt_seq)) {
+        sock->data.rtt_active = 0;
+        tcp_rtt_sample(sock, (uint32_t)(now - sock->data.rtt_time));
+    }
+
+    sock->data.dupacks = 0;
+    sock->data.stats.bytes_acked += acked;
+
+    /* Restart the retransmission timer, since things are moving. */
+    sock->data.timer = now;
+
+    if(sock->data.ca_state != TCP_CA_Open) {
+        if(SEQ_GE(ack, sock->data.recover)) {
+            /* Everything outstanding when the loss was detected is now
+               acknowledged. Leaving fast recovery, deflate the window. */
+            if(sock->data.ca_state == TCP_CA_Recovery)
+                sock->data.cwnd = MIN(sock->data.ssthresh,
+                                      MAX(sock->data.snd.nxt - ack, smss) +
+                                      smss);
+
+            sock->data.ca_state = TCP_CA_Open;
+            return;
+        }
+
+        /* A partial ACK means the next segment was lost too, so fill that
+           hole right away instead of waiting for another timeout. With SACK,
+           fill the next hole we haven't already resent instead. */
+        if(tcp_sack_next_hole(sock, &seq, &len))
+            tcp_retransmit(sock, seq, len);
+        else if(SEQ_GE(ack, sock->data.sack_rexmit))
+            tcp_retransmit_una(sock);
+
+        if(sock->data.ca_state == TCP_CA_Recovery) {
+            sock->data.cwnd = sock->data.cwnd > acked ?
+                sock->data.cwnd - acked : 0;
+
+            if(acked >= smss)
+                sock->data.cwnd += smss;
+
+            return;
+        }
+    }
+
+    if(!acked)
+        return;
+
+    if(sock->data.cwnd < sock->data.ssthresh)
+        /* Slow start */
+        sock->data.cwnd += MIN(acked, smss);
+    else
+        /* Congestion avoidance */
+        sock->data.cwnd += MAX(1, smss * smss / sock->data.cwnd);
+}
+
+/* Handle a duplicate ACK. */
+static void tcp_dup_ack(struct tcp_sock *sock) {
+    const uint32_t smss = tcp_smss(sock);
+    uint32_t flight, seq, len;
+
+    ++sock->data.stats.dupacks;
+
+    if(sock->data.ca_state == TCP_CA_Recovery) {
+        /* Each duplicate ACK means a segment has left the network, so we can
+           send another one. Fill in a hole if the peer has told us about one,
+           otherwise send new data. */
+        sock->data.cwnd += smss;
+
+        if(tcp_sack_next_hole(sock, &seq, &len))
+            tcp_retransmit(sock, seq, len);
+        else
+            tcp_send_data(sock);
+
+        return;
+    }
+
+    if(++sock->data.dupacks != TCP_DUPACK_THRESH ||
+       sock->data.ca_state != TCP_CA_Open)
+        return;
+
+    /* Fast retransmit, and enter fast recovery. */
+    flight = sock->data.snd.nxt - sock->data.snd.una;
+    sock->data.ssthresh = MAX(flight / 2, 2 * smss);
+    sock->data.recover = sock->data.snd.nxt;
+    sock->data.ca_state = TCP_CA_Recovery;
+    sock->data.sack_rexmit = sock->data.snd.una;
+    ++sock->data.stats.fast_retrans;
+
+    tcp_retransmit_una(sock);
+    sock->data.cwnd = sock->data.ssthresh + TCP_DUPACK_THRESH * smss;
+}
+
+/* Handle expiry of the retransmission timer on a synchronized connection. */
+static void tcp_rto_expired(struct tcp_sock *sock) {
+    const uint32_t smss = tcp_smss(sock);
+    uint32_t flight = sock->data.snd.nxt - sock->data.snd.una;
+
+    ++sock->data.stats.timeouts;
+
+    /* Back off the timer */
+    sock->data.rto = MIN(sock->data.rto * 2, TCP_MAX_RTTO);
+    ++sock->data.backoff;
+
+    if(!flight) {
+        /* Nothing was in flight, so the peer's window must be closed. Probe
+           it again. */
+        sock->data.timer = timer_ms_gettime64();
+        tcp_send_data(sock);
+        return;
+    }
+
+    /* Only reduce the threshold on the first timeout of a loss episode, since
+       the flight size is meaningless once we're already backing off. */
+    if(sock->data.ca_state != TCP_CA_Loss)
+        sock->data.ssthresh = MAX(flight / 2, 2 * smss);
+
+    sock->data.cwnd = smss;
+    sock->data.recover = sock->data.snd.nxt;
+    sock->data.ca_state = TCP_CA_Loss;
+    sock->data.dupacks = 0;
+
+    /* The peer is allowed to renege on what it has SACKed, and after a
+       timeout we have to assume that it did (RFC 2018). */
+    sock->data.nsacked = 0;
+    sock->data.sack_rexmit = sock->data.snd.una;
+
+    tcp_retransmit_una(sock);
+}
+
 #define ADDR_EQUAL(a1, a2) \
     (((a1).__s6_addr.__s6_addr32[0] == (a2).__s6_addr.__s6_addr32[0]) && \
      ((a1).__s6_addr.__s6_addr32[1] == (a2).__s6_addr.__s6_addr32[1]) && \
      ((a1).__s6_addr.__s6_addr32[2] == (a2).__s6_addr.__s6_addr32[2]) && \
      ((a1).__s6_addr.__s6_addr32[3] == (a2).__s6_addr.__s6_addr32[3]))
 
+static inline unsigned int tcp_hash_port(uint16_t lport) {
+    return (lport * 2654435761U) >> (32 - TCP_HASH_BITS);
+}
+
+static inline unsigned int tcp_hash_conn(const struct in6_addr *raddr,
+                                         uint16_t rport, uint16_t lport) {
+    uint32_t h = raddr->__s6_addr.__s6_addr32[0] ^
+        raddr->__s6_addr.__s6_addr32[1] ^ raddr->__s6_addr.__s6_addr32[2] ^
+        raddr->__s6_addr.__s6_addr32[3] ^ (((uint32_t)rport << 16) | lport);
+
+    return ((h ^ (h >> 16)) * 2654435761U) >> (32 - TCP_HASH_BITS);
+}
+
+/* Take a socket out of whichever hash table it is in. The caller must hold
+   the write lock on tcp_sem. */
+static void tcp_hash_remove(struct tcp_sock *sock) {
+    if(sock->hashed) {
+        LIST_REMOVE(sock, hash_list);
+        sock->hashed = 0;
+    }
+}
+
+/* Put a socket in the hash table that matches its addresses, after they have
+   changed. Sockets that aren't bound to a port yet can't get any packets, so
+   they aren't in either table. The caller must hold the write lock on
+   tcp_sem. */
+static void tcp_hash_update(struct tcp_sock *sock) {
+    struct tcp_sock_list *head;
+
+    tcp_hash_remove(sock);
+
+    if(!sock->local_addr.sin6_port)
+        return;
+
+    if(IN6_IS_ADDR_UNSPECIFIED(&sock->remote_addr.sin6_addr))
+        head = &tcp_port_hash[tcp_hash_port(sock->local_addr.sin6_port)];
+    else
+        head = &tcp_conn_hash[tcp_hash_conn(&sock->remote_addr.sin6_addr,
+                                            sock->remote_addr.sin6_port,
+                                            sock->local_addr.sin6_port)];
+
+    LIST_INSERT_HEAD(head, sock, hash_list);
+    sock->hashed = 1;
+}
+
+static inline int tcp_sock_match(const struct tcp_sock *i,
+                                 const struct in6_addr *src,
+                                 const struct in6_addr *dst,
+                                 uint16_t sport, uint16_t dport, int domain) {
+    /* Ignore any closed sockets */
+    if(i->state == TCP_STATE_CLOSED)
+        return 0;
+
+    /* Ignore any sockets that are IPv6 only when we have an incoming IPv4
+       packet, or any that are IPv4 only when we have an incoming IPv6
+       packet. */
+    if((domain == AF_INET && (i->flags & FS_SOCKET_V6ONLY)) ||
+            (domain == AF_INET6 && i->domain == AF_INET))
+        return 0;
+
+    /* See if the remote end matches what's in the socket */
+    if(!IN6_IS_ADDR_UNSPECIFIED(&i->remote_addr.sin6_addr) &&
+            (!ADDR_EQUAL(i->remote_addr.sin6_addr, *src) ||
+             i->remote_addr.sin6_port != sport))
+        return 0;
+
+    /* See if it matches the local end */
+    if((!IN6_IS_ADDR_UNSPECIFIED(&i->local_addr.sin6_addr) &&
+            !ADDR_EQUAL(i->local_addr.sin6_addr, *dst)) ||
+            i->local_addr.sin6_port != dport)
+        return 0;
+
+    return 1;
+}
+
 /* Match a socket to an incoming packet. If an actual socket is returned, it is
    the caller's responsibility  to release the socket's mutex when they're done
    with it. */
@@ -2244,41 +3383,32 @@ static struct tcp_sock *find_sock(const struct in6_addr *src,
                                   const struct in6_addr *dst,
                                   uint16_t sport, uint16_t dport, int domain) {
     struct tcp_sock *i;
+    struct tcp_sock_list *head;
 
-    LIST_FOREACH(i, &tcp_socks, sock_list) {
-        /* Ignore any closed sockets */
-        if(i->state == TCP_STATE_CLOSED)
-            continue;
-
-        /* Ignore any sockets that are IPv6 only when we have an incoming IPv4
-           packet, or any that are IPv4 only when we have an incoming IPv6
-           packet. */
-        if((domain == AF_INET && (i->flags & FS_SOCKET_V6ONLY)) ||
-                (domain == AF_INET6 && i->domain == AF_INET))
-            continue;
-
-        /* See if the remote end matches what's in the socket */
-        if(!IN6_IS_ADDR_UNSPECIFIED(&i->remote_addr.sin6_addr) &&
-                (!ADDR_EQUAL(i->remote_addr.sin6_addr, *src) ||
-                 i->remote_addr.sin6_port != sport))
-            continue;
+    /* Look for a fully-created socket first, then for one that is listening.
+       See the comment at the top of the file for more discussion of this, if
+       you're interested. */
+    head = &tcp_conn_hash[tcp_hash_conn(src, sport, dport)];
 
-        /* See if it matches the local end */
-        if((!IN6_IS_ADDR_UNSPECIFIED(&i->local_addr.sin6_addr) &&
-                !ADDR_EQUAL(i->local_addr.sin6_addr, *dst)) ||
-                i->local_addr.sin6_port != dport)
-            continue;
+    LIST_FOREACH(i, head, hash_list) {
+        if(tcp_sock_match(i, src, dst, sport, dport, domain))
+            goto found;
+    }
 
-        if(mutex_lock_irqsafe(&i->mutex))
-            return (struct tcp_sock *) -1;
+    head = &tcp_port_hash[tcp_hash_port(dport)];
 
-        /* Because we always add new sockets to the head of the list, this
-           should be sufficient to match the socket. See the comment at the top
-           of the file for more discussion of this, if you're interested. */
-        return i;
+    LIST_FOREACH(i, head, hash_list) {
+        if(tcp_sock_match(i, src, dst, sport, dport, domain))
+            goto found;
     }
 
     return NULL;
+
+found:
+    if(mutex_lock_irqsafe(&i->mutex))
+        return (struct tcp_sock *) -1;
+
+    return i;
 }
 
 extern void __poll_event_trigger(int fd, short event);
@@ -2290,9 +3420,10 @@ extern void __poll_event_trigger(int fd, short event);
 static int listen_pkt(netif_t *src, const struct in6_addr *srca,
                       const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                       struct tcp_sock *s, uint16_t flags, int size) {
-    int j = 0;
-    int end_of_opts;
+    int j;
+    struct tcp_opts o;
     uint16_t mss = 576;
+    struct lsock *ls = NULL;
 
     (void)size;
 
@@ -2305,35 +3436,11 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
         return -1;
 
     /* Parse options now, in case we need to update the max segment size. */
-    end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-    while(j < end_of_opts) {
-        switch(tcp->options[j]) {
-            case TCP_OPT_EOL:
-                j = end_of_opts;
-                break;
-
-            case TCP_OPT_NOP:
-                ++j;
-                break;
-
-            case TCP_OPT_MSS:
-                if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                    return -1;
-
-                mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                j += 4;
-                break;
-
-            default:
-
-                /* Skip unknown options */
-                if(j + 1 > end_of_opts || j + tcp->options[j + 1] > end_of_opts)
-                    return -1;
+    if(tcp_parse_opts(tcp, flags, &o))
+        return -1;
 
-                j += tcp->options[j + 1];
-        }
-    }
+    if(o.flags & TCP_OPTF_MSS)
+        mss = o.mss;
 
     /* Silently cap the MSS... */
     if(mss > 1460)
@@ -2347,35 +3454,41 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
         if(ADDR_EQUAL(s->listen.queue[j].remote_addr.sin6_addr, *srca) &&
                 ADDR_EQUAL(s->listen.queue[j].local_addr.sin6_addr, *dsta) &&
                 s->listen.queue[j].remote_addr.sin6_port == tcp->src_port) {
-            s->listen.queue[j].isn = ntohl(tcp->seq);
-            s->listen.queue[j].mss = mss;
-            return 0;
+            ls = &s->listen.queue[j];
+            break;
         }
     }
 
-    /* Next, see if we have space for this one in the queue... */
-    if(s->listen.count == s->listen.backlog)
-        return -1;
+    if(!ls) {
+        /* Next, see if we have space for this one in the queue... */
+        if(s->listen.count == s->listen.backlog)
+            return -1;
+
+        /* The rest of the processing is put off until the program does an
+           accept(). Save the connection in the list of incoming sockets. */
+        ls = &s->listen.queue[s->listen.tail];
+        ls->net = src;
+        ls->remote_addr.sin6_addr = *srca;
+        ls->remote_addr.sin6_port = tcp->src_port;
+        ls->local_addr.sin6_addr = *dsta;
+        ls->local_addr.sin6_port = tcp->dst_port;
+        ++s->listen.count;
+        ++s->listen.tail;
+
+        if(s->listen.tail == s->listen.backlog)
+            s->listen.tail = 0;
+
+        /* Signal the condvar, in case anyone's waiting */
+        __poll_event_trigger(s->sock, POLLRDNORM);
+        cond_signal(&s->listen.cv);
+    }
 
-    /* The rest of the processing is put off until the program does an accept().
-       Save the connection in the list of incoming sockets. */
-    s->listen.queue[s->listen.tail].net = src;
-    s->listen.queue[s->listen.tail].remote_addr.sin6_addr = *srca;
-    s->listen.queue[s->listen.tail].remote_addr.sin6_port = tcp->src_port;
-    s->listen.queue[s->listen.tail].local_addr.sin6_addr = *dsta;
-    s->listen.queue[s->listen.tail].local_addr.sin6_port = tcp->dst_port;
-    s->listen.queue[s->listen.tail].isn = ntohl(tcp->seq);
-    s->listen.queue[s->listen.tail].mss = mss;
-    s->listen.queue[s->listen.tail].wnd = ntohs(tcp->wnd);
-    ++s->listen.count;
-    ++s->listen.tail;
-
-    if(s->listen.tail == s->listen.backlog)
-        s->listen.tail = 0;
-
-    /* Signal the condvar, in case anyone's waiting */
-    __poll_event_trigger(s->sock, POLLRDNORM);
-    cond_signal(&s->listen.cv);
+    ls->isn = ntohl(tcp->seq);
+    ls->mss = mss;
+    ls->wnd = ntohs(tcp->wnd);
+    ls->opts = o.flags;
+    ls->wscale = o.wscale;
+    ls->ts_recent = o.tsval;
 
     /* We're done, return success. */
     return 0;
@@ -2388,10 +3501,13 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
                        struct tcp_sock *s, uint16_t flags, int size) {
     uint32_t ack, seq;
     int sz = size - TCP_GET_OFFSET(flags), gotack = 0;
-    int j = 0, end_of_opts, mss = 536;
+    int mss = 536;
+    struct tcp_opts o;
 
     (void)src;
 
+    ++s->data.stats.segs_in;
+
     /* Grab the ack and seq numbers from the packet */
     ack = ntohl(tcp->ack);
     seq = ntohl(tcp->seq);
@@ -2424,44 +3540,39 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
         s->data.rcv.nxt = seq + 1;
         s->data.rcv.irs = seq;
 
-        end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-        while(j < end_of_opts) {
-            switch(tcp->options[j]) {
-                case TCP_OPT_EOL:
-                    j = end_of_opts;
-                    break;
-
-                case TCP_OPT_NOP:
-                    ++j;
-                    break;
-
-                case TCP_OPT_MSS:
-
-                    if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                        return -1;
-
-                    mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                    j += 4;
-                    break;
+        if(tcp_parse_opts(tcp, flags, &o))
+            return -1;
 
-                default:
+        if(o.flags & TCP_OPTF_MSS)
+            mss = o.mss;
 
-                    /* Skip unknown options */
-                    if(j + 1 > end_of_opts ||
-                            j + tcp->options[j + 1] > end_of_opts)
-                        return -1;
+        /* Keep only the extensions that both sides offered. Window scaling
+           has to be used in both directions or not at all. */
+        s->data.sack_ok = !!(o.flags & TCP_OPTF_SACK_PERM);
+        s->data.ts_ok = !!(o.flags & TCP_OPTF_TIMESTAMP);
+        s->data.ts_recent = o.tsval;
 
-                    j += tcp->options[j + 1];
-            }
+        if(o.flags & TCP_OPTF_WSCALE) {
+            s->data.snd_wscale = o.wscale;
+        }
+        else {
+            s->data.wscale_ok = 0;
+            s->data.snd_wscale = s->data.rcv_wscale = 0;
         }
 
         s->data.snd.mss = mss > 1460 ? 1460 : mss;
-        s->data.snd.wnd = htons(tcp->wnd);
+        s->data.snd.wnd = ntohs(tcp->wnd);
+        tcp_cc_init(s);
 
         if(gotack) {
             s->data.snd.una = ack;
 
+            if(s->data.rtt_active) {
+                s->data.rtt_active = 0;
+                tcp_rtt_sample(s, (uint32_t)(timer_ms_gettime64() -
+                                             s->data.rtt_time));
+            }
+
             /* If the ack covers our iss, then we've established the connection.
                Update the state and ack it. */
             if(SEQ_GT(ack, s->data.snd.iss)) {
@@ -2486,15 +3597,18 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
    described in pages 69-76 of the RFC. */
 static int process_pkt(netif_t *src, const struct in6_addr *srca,
                        const struct in6_addr *dsta, const tcp_hdr_t *tcp,
-                       struct tcp_sock *s, uint16_t flags, size_t size) {
-    uint32_t seq, ack, up;
+                       struct tcp_sock *s, uint16_t flags, size_t size,
+                       int direct) {
+    uint32_t seq, ack, up, acked, dup;
     size_t sz;
-    int bad_pkt = 0, tmp, acksyn = 0;
+    int bad_pkt = 0, acksyn = 0, ooo;
     const uint8_t *buf = (const uint8_t *)tcp;
-    uint8_t *rb;
+    struct tcp_opts o;
 
     (void)src;
 
+    ++s->data.stats.segs_in;
+
     /* Grab the seq and ack values from the header. */
     seq = ntohl(tcp->seq);
     ack = ntohl(tcp->ack);
@@ -2503,6 +3617,19 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
     sz = size - TCP_GET_OFFSET(flags);
     buf += TCP_GET_OFFSET(flags);
 
+    /* Ignore any options we can't make sense of, rather than the segment. */
+    if(tcp_parse_opts(tcp, flags, &o)) {
+        o.flags = 0;
+        o.nsack = 0;
+    }
+
+    /* Reject old duplicates by their timestamps (PAWS, RFC 7323). */
+    if(s->data.ts_ok && (o.flags & TCP_OPTF_TIMESTAMP) &&
+       !(flags & TCP_FLAG_RST) && SEQ_LT(o.tsval, s->data.ts_recent)) {
+        tcp_send_ack(s);
+        return 0;
+    }
+
     if(s->data.rcv.wnd == 0) {
         if(sz || seq != s->data.rcv.nxt)
             bad_pkt = 1;
@@ -2514,12 +3641,26 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
                 bad_pkt = 1;
         }
         else {
+            /* Either end of the segment may be in the window, since a
+               retransmission can overlap what we already have. */
             if(!(SEQ_GE(seq, s->data.rcv.nxt) &&
-                    SEQ_LT(seq, s->data.rcv.nxt + s->data.rcv.wnd)))
+                    SEQ_LT(seq, s->data.rcv.nxt + s->data.rcv.wnd)) &&
+               !(SEQ_GT(seq + sz, s->data.rcv.nxt) &&
+                    SEQ_LE(seq + sz, s->data.rcv.nxt + s->data.rcv.wnd)))
                 bad_pkt = 1;
         }
     }
 
+    /* Remember the timestamp to echo back, if the segment starts at or before
+       what we last acknowledged. This comes before the check below, so that
+       the ACK for a duplicate segment echoes its timestamp rather than an
+       older one (RFC 7323, section 4.3). */
+    if(s->data.ts_ok && (o.flags & TCP_OPTF_TIMESTAMP) &&
+       !(flags & TCP_FLAG_RST) &&
+       SEQ_LE(seq, s->data.last_ack_sent) &&
+       SEQ_GE(o.tsval, s->data.ts_recent))
+        s->data.ts_recent = o.tsval;
+
     /* If the sequence number isn't valid, check the RST bit. If its not set,
        send the appropriate ACK. */
     if(bad_pkt) {
@@ -2581,10 +3722,15 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         }
     }
 
+    /* Record anything the other side has selectively acknowledged. */
+    if(s->data.sack_ok && o.nsack && SEQ_LE(ack, s->data.snd.nxt))
+        tcp_sack_update(s, &o);
+
     /* Check the ack number for validity */
     if(SEQ_LT(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)) {
-        s->data.sndbuf_acked += (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.sndbuf_cur_sz -= (int32_t)(ack - s->data.snd.una - acksyn);
+        acked = ack - s->data.snd.una - acksyn;
+        s->data.sndbuf_acked += acked;
+        s->data.sndbuf_cur_sz -= acked;
         s->data.snd.una = ack;
         __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
         cond_signal(&s->data.send_cv);
@@ -2594,10 +3740,21 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
 
         if(SEQ_LT(s->data.snd.wl1, seq) ||
                 (s->data.snd.wl1 == seq && SEQ_LE(s->data.snd.wl2, ack))) {
-            s->data.snd.wnd = ntohs(tcp->wnd);
+            s->data.snd.wnd = ntohs(tcp->wnd) << s->data.snd_wscale;
             s->data.snd.wl1 = seq;
             s->data.snd.wl2 = ack;
         }
+
+        tcp_new_ack(s, ack, acked, &o);
+    }
+    else if(ack == s->data.snd.una && ack != s->data.snd.nxt) {
+        /* An ACK that doesn't move anything while we have data in flight. If
+           it doesn't carry data or a window update either, it is a duplicate,
+           which most likely means a segment was lost (RFC 5681). */
+        if(!sz && !(flags & TCP_FLAG_FIN) &&
+           (uint32_t)ntohs(tcp->wnd) << s->data.snd_wscale ==
+           s->data.snd.wnd)
+            tcp_dup_ack(s);
     }
     else if(SEQ_GT(ack, s->data.snd.nxt)) {
         /* This ACKs something we haven't sent, so try to correct the other side
@@ -2658,37 +3815,47 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
 
     if(s->state == TCP_STATE_ESTABLISHED || s->state == TCP_STATE_FIN_WAIT_1 ||
             s->state == TCP_STATE_FIN_WAIT_2) {
+        /* Trim off anything at the front that we already have. */
+        if(SEQ_LT(seq, s->data.rcv.nxt)) {
+            dup = MIN(s->data.rcv.nxt - seq, sz);
+            buf += dup;
+            sz -= dup;
+            seq += dup;
+        }
+
         /* Next, check the data size versus our window. If its more than the
            window, truncate the data and copy out what we can. */
-        if(sz > s->data.rcv.wnd) {
-            sz = s->data.rcv.wnd;
+        if(seq - s->data.rcv.nxt + sz > s->data.rcv.wnd) {
+            sz = s->data.rcv.wnd - (seq - s->data.rcv.nxt);
             bad_pkt = 1;
         }
 
-        /* Copy the data out */
-        if(sz) {
-            rb = s->data.rcvbuf + s->data.rcvbuf_tail;
-            s->data.rcv.nxt += sz;
-            s->data.rcv.wnd -= sz;
-            s->data.rcvbuf_cur_sz += sz;
-
-            if(s->data.rcvbuf_tail + sz <= s->rcvbuf_sz) {
-                memcpy(rb, buf, sz);
-                s->data.rcvbuf_tail += sz;
-            }
-            else {
-                tmp = s->rcvbuf_sz - s->data.rcvbuf_tail;
-                memcpy(rb, buf, tmp);
-                sz -= tmp;
-                buf += tmp;
-                memcpy(s->data.rcvbuf, buf, sz);
-                s->data.rcvbuf_tail = sz;
+        if(seq != s->data.rcv.nxt) {
+            /* There's a hole before this segment. Hold on to it until the
+               hole is filled, and let the other side know right away with a
+               duplicate ACK, so that it can fast retransmit. We don't look at
+               the FIN until we get there. */
+            if(sz) {
+                tcp_ooo_queue(s, seq, buf, sz);
+                tcp_send_ack(s);
             }
 
-            /* Signal any waiting thread and send an ack for what we read */
+            bad_pkt = 1;
+        }
+        else if(sz) {
+            /* Copy the data out (unless tcp_rcv_direct() already did), along
+               with anything that was waiting on it */
+            if(!direct)
+                tcp_rcvbuf_put(s, 0, buf, sz);
+
+            ooo = s->data.ooo_cnt;
+            tcp_rcvbuf_advance(s, sz);
+            tcp_ooo_splice(s);
+
+            /* Signal any waiting thread and acknowledge what we read */
             __poll_event_trigger(s->sock, POLLRDNORM);
             cond_signal(&s->data.recv_cv);
-            tcp_send_ack(s);
+            tcp_ack_data(s, sz, ooo);
         }
     }
     else if(sz) {
@@ -2697,6 +3864,11 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         bad_pkt = 1;
     }
 
+    /* The ACK may have opened up the windows, so send anything that was held
+       back by them. */
+    if(s->state == TCP_STATE_ESTABLISHED || s->state == TCP_STATE_CLOSE_WAIT)
+        tcp_send_data(s);
+
     /* Finally, check the FIN bit. We don't try to ack it if the packet had too
        much data. */
     if(!bad_pkt && (flags & TCP_FLAG_FIN)) {
@@ -2744,7 +3916,7 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
     const tcp_hdr_t *tcp;
     uint16_t flags;
     struct tcp_sock *s;
-    int rv = -1;
+    int rv = -1, direct = 0;
     uint16_t c;
 
     switch(domain) {
@@ -2772,24 +3944,34 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
     }
 
     tcp = (const tcp_hdr_t *)data;
-
-    /* Check the TCP checksum */
+    flags = ntohs(tcp->off_flags);
     c = net_ipv6_checksum_pseudo(&srca, &dsta, size, IPPROTO_TCP);
-    c = net_ipv4_checksum(data, size, c);
 
-    if(c) {
+    if(rwsem_read_lock_irqsafe(&tcp_sem))
+        return -1;
+
+    /* Find a matching socket */
+    s = find_sock(&srca, &dsta, tcp->src_port, tcp->dst_port, domain);
+
+    /* Check the TCP checksum. In-order data for an established connection is
+       checksummed as it is copied into the receive buffer. */
+    if(s && s != (struct tcp_sock *) - 1 &&
+       tcp_rcv_direct(s, tcp, flags, size, &c))
+        direct = 1;
+    else
+        c = net_csum_partial(data, size, c);
+
+    if(c != 0xFFFF) {
         /* The checksum should be 0 on success, so discard the packet if it does
            not match that expectation. */
+        if(s && s != (struct tcp_sock *) - 1)
+            mutex_unlock(&s->mutex);
+
+        rwsem_read_unlock(&tcp_sem);
         return 0;
     }
 
-    flags = ntohs(tcp->off_flags);
-
-    if(rwsem_read_lock_irqsafe(&tcp_sem))
-        return -1;
-
-    /* Find a matching socket */
-    if((s = find_sock(&srca, &dsta, tcp->src_port, tcp->dst_port, domain))) {
+    if(s) {
         /* Make sure we take care of busy sockets... */
         if(s == (struct tcp_sock *) - 1) {
             rwsem_read_unlock(&tcp_sem);
@@ -2820,10 +4002,12 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
             case TCP_STATE_CLOSING:
             case TCP_STATE_LAST_ACK:
             case TCP_STATE_TIME_WAIT:
-                rv = process_pkt(src, &srca, &dsta, tcp, s, flags, size);
+                rv = process_pkt(src, &srca, &dsta, tcp, s, flags, size,
+                                 direct);
                 break;
         }
 
+        tcp_timer_update(s);
         mutex_unlock(&s->mutex);
     }
 
@@ -2837,9 +4021,61 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
     return 0;
 }
 
-static void tcp_thd_cb(void *arg) {
+/* Work out when a socket next needs tcp_timer_cb() to look at it, or 0 if
+   it doesn't. */
+static uint64_t tcp_sock_deadline(const struct tcp_sock *sock) {
+    uint64_t when = 0;
+
+    switch(sock->state) {
+        case TCP_STATE_SYN_SENT:
+        case TCP_STATE_SYN_RECEIVED:
+            return sock->data.timer + sock->data.rto;
+
+        case TCP_STATE_TIME_WAIT:
+            return sock->data.timer + 2 * TCP_DEFAULT_MSL;
+
+        case TCP_STATE_ESTABLISHED:
+        case TCP_STATE_CLOSE_WAIT:
+            if(sock->data.sndbuf_cur_sz)
+                when = sock->data.timer + sock->data.rto;
+            else if(sock->intflags & TCP_IFLAG_QUEUEDCLOSE)
+                return timer_ms_gettime64();
+
+            break;
+
+        case TCP_STATE_FIN_WAIT_1:
+        case TCP_STATE_FIN_WAIT_2:
+            break;
+
+        default:
+            /* Closed sockets that nobody has a handle to any more get freed
+               by the timer. */
+            if((sock->state & 0x0F) == TCP_STATE_CLOSED &&
+               (sock->intflags & TCP_IFLAG_CANBEDEL))
+                return timer_ms_gettime64();
+
+            return 0;
+    }
+
+    /* A delayed ACK may have to go out before anything else. */
+    if(tcp_ack_delayed(sock) && (!when || sock->data.ack_due < when))
+        when = sock->data.ack_due;
+
+    return when;
+}
+
+/* Make sure the timer fires in time for the socket, after anything that may
+   have changed what it is waiting on. */
+static void tcp_timer_update(struct tcp_sock *sock) {
+    uint64_t when = tcp_sock_deadline(sock);
+
+    if(when)
+        net_timer_set_earliest(&tcp_timer, when);
+}
+
+static void tcp_timer_cb(void *arg) {
     struct tcp_sock *i, *tmp;
-    uint64_t timer;
+    uint64_t timer, when, next = 0;
 
     (void)arg;
 
@@ -2858,9 +4094,12 @@ static void tcp_thd_cb(void *arg) {
                 /* If our last <SYN> was sent more than one  retransmission
                    timeout period ago and we are still in the SYN-SENT state,
                    send another one. */
-                if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
+                if(i->data.timer + i->data.rto <= timer) {
                     tcp_send_syn(i, 0);
                     i->data.timer = timer;
+                    i->data.rto = MIN(i->data.rto * 2, TCP_MAX_RTTO);
+                    ++i->data.backoff;
+                    i->data.rtt_active = 0;
                 }
 
                 break;
@@ -2870,9 +4109,12 @@ static void tcp_thd_cb(void *arg) {
                 /* If our last <SYN,ACK> was sent more than one  retransmission
                    timeout period ago and we are still in the SYN-RECEIVED
                    state, send another one. */
-                if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
+                if(i->data.timer + i->data.rto <= timer) {
                     tcp_send_syn(i, 1);
                     i->data.timer = timer;
+                    i->data.rto = MIN(i->data.rto * 2, TCP_MAX_RTTO);
+                    ++i->data.backoff;
+                    i->data.rtt_active = 0;
                 }
 
                 break;
@@ -2891,8 +4133,8 @@ static void tcp_thd_cb(void *arg) {
             case TCP_STATE_CLOSE_WAIT:
 
                 if(i->data.sndbuf_cur_sz &&
-                        i->data.timer + TCP_DEFAULT_RTTO <= timer) {
-                    tcp_send_data(i, 1);
+                        i->data.timer + i->data.rto <= timer) {
+                    tcp_rto_expired(i);
                 }
                 else if(!i->data.sndbuf_cur_sz &&
                         (i->intflags & TCP_IFLAG_QUEUEDCLOSE)) {
@@ -2909,6 +4151,11 @@ static void tcp_thd_cb(void *arg) {
 
                 break;
         }
+
+        /* Send the ACK for data we've been holding on to, if nothing else
+           has gone out with it by now. */
+        if(tcp_ack_delayed(i) && i->data.ack_due <= timer)
+            tcp_send_ack(i);
     }
 
     rwsem_read_unlock(&tcp_sem);
@@ -2924,6 +4171,7 @@ static void tcp_thd_cb(void *arg) {
         if((i->intflags & TCP_IFLAG_CANBEDEL) &&
                 (i->state & 0x0F) == TCP_STATE_CLOSED) {
             LIST_REMOVE(i, sock_list);
+            tcp_hash_remove(i);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
             mutex_destroy(&i->mutex);
@@ -2931,10 +4179,17 @@ static void tcp_thd_cb(void *arg) {
             free(i->data.rcvbuf);
             free(i);
         }
+        else if((when = tcp_sock_deadline(i)) && (!next || when < next)) {
+            next = when;
+        }
 
         i = tmp;
     }
 
+    /* Come back when the next socket needs us. */
+    if(next)
+        net_timer_set_earliest(&tcp_timer, next);
+
     rwsem_write_unlock(&tcp_sem);
 }
 
@@ -2963,8 +4218,7 @@ static fs_socket_proto_t proto = {
 };
 
 int net_tcp_init(void) {
-    if((thd_cb_id = net_thd_add_callback(tcp_thd_cb, NULL, 50)) < 0)
-        return -1;
+    net_timer_init(&tcp_timer, tcp_timer_cb, NULL);
 
     return fs_socket_proto_add(&proto);
 }
@@ -2972,9 +4226,8 @@ int net_tcp_init(void) {
 void net_tcp_shutdown(void) {
     struct tcp_sock *i, *tmp;
 
-    /* Kill the thread and make sure we can grab the lock */
-    if(thd_cb_id >= 0)
-        net_thd_del_callback(thd_cb_id);
+    /* Stop the timer and make sure we can grab the lock */
+    net_timer_cancel(&tcp_timer);
 
     /* Disable IRQs so we can kill the sockets in peace... */
     irq_disable_scoped();
@@ -2990,6 +4243,7 @@ void net_tcp_shutdown(void) {
         }
         else {
             LIST_REMOVE(i, sock_list);
+            tcp_hash_remove(i);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
             mutex_destroy(&i->mutex);
@@ -2,14 +2,23 @@
 
    kernel/net/net_thd.c
    Copyright (C) 2009, 2012, 2013 Lawrence Sebald
+   Copyright (C) 2024 The KOS Team and contributors
 
 */
 
+/* The network thread runs timers, kept in a queue sorted by their deadlines.
+   It sleeps until the first one is due, and is woken early whenever a timer
+   gets put at the front of the queue. Periodic callbacks are timers that
+   re-arm themselves after running. */
+
 #include <sys/queue.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include <kos/thread.h>
+#include <kos/genwait.h>
+#include <arch/irq.h>
 #include <arch/timer.h>
 #include "net_thd.h"
 
@@ -20,40 +29,139 @@ struct thd_cb {
     void (*cb)(void *);
     void *data;
     uint64 timeout;
-    uint64 nextrun;
+    net_timer_t timer;
 };
 
 TAILQ_HEAD(thd_cb_queue, thd_cb);
 
 static struct thd_cb_queue cbs;
+static struct net_timer_queue timers;
+static struct thd_cb *running;
 static kthread_t *thd;
 static int done = 0;
 static int cbid_top;
 
+/* Take a timer out of the queue. Interrupts must be disabled. */
+static void timer_dequeue(net_timer_t *t) {
+    if(t->queued) {
+        TAILQ_REMOVE(&timers, t, entry);
+        t->queued = 0;
+    }
+}
+
+/* Put a timer in the queue, after any others due at the same time.
+   Interrupts must be disabled. */
+static void timer_enqueue(net_timer_t *t, uint64 expires) {
+    net_timer_t *i;
+
+    t->expires = expires;
+    t->queued = 1;
+
+    /* New timers tend to be due after everything else, so look from the
+       back. */
+    TAILQ_FOREACH_REVERSE(i, &timers, net_timer_queue, entry) {
+        if(i->expires <= expires) {
+            TAILQ_INSERT_AFTER(&timers, i, t, entry);
+            return;
+        }
+    }
+
+    TAILQ_INSERT_HEAD(&timers, t, entry);
+
+    /* The thread might be sleeping until something later, so wake it up to
+       take a look. */
+    genwait_wake_all(&timers);
+}
+
+void net_timer_init(net_timer_t *t, void (*cb)(void *), void *data) {
+    t->expires = 0;
+    t->cb = cb;
+    t->data = data;
+    t->queued = 0;
+}
+
+void net_timer_set(net_timer_t *t, uint64 expires) {
+    irq_disable_scoped();
+
+    timer_dequeue(t);
+    timer_enqueue(t, expires);
+}
+
+void net_timer_set_earliest(net_timer_t *t, uint64 expires) {
+    irq_disable_scoped();
+
+    if(t->queued && t->expires <= expires)
+        return;
+
+    timer_dequeue(t);
+    timer_enqueue(t, expires);
+}
+
+void net_timer_cancel(net_timer_t *t) {
+    irq_disable_scoped();
+
+    timer_dequeue(t);
+}
+
+int net_timer_pending(const net_timer_t *t) {
+    return t->queued;
+}
+
 static void *net_thd_thd(void *data) {
-    struct thd_cb *cb;
+    net_timer_t *t;
     uint64 now;
+    uint32 flags;
 
     (void)data;
 
+    flags = irq_disable();
+
     while(!done) {
         now = timer_ms_gettime64();
+        t = TAILQ_FIRST(&timers);
+
+        if(t && t->expires <= now) {
+            timer_dequeue(t);
+            irq_restore(flags);
 
-        /* Run any callbacks that need to be run now. */
-        TAILQ_FOREACH(cb, &cbs, thds) {
-            if(now >= cb->nextrun) {
-                cb->cb(cb->data);
-                cb->nextrun = now + cb->timeout;
-            }
+            t->cb(t->data);
+
+            flags = irq_disable();
+            continue;
         }
 
-        /* Go to sleep til we need to be run again. */
-        thd_sleep(50);
+        /* Go to sleep til the first timer is due, or one is added in front
+           of it. */
+        if(!t)
+            genwait_wait(&timers, "net_thd", 0, NULL);
+        else if(t->expires - now > INT_MAX)
+            genwait_wait(&timers, "net_thd", INT_MAX, NULL);
+        else
+            genwait_wait(&timers, "net_thd", (int)(t->expires - now), NULL);
     }
 
+    irq_restore(flags);
+
     return NULL;
 }
 
+/* Run a periodic callback, and schedule its next run. If the callback gets
+   deleted while it is running, it is freed here instead. */
+static void thd_cb_run(void *data) {
+    struct thd_cb *cb = (struct thd_cb *)data;
+
+    running = cb;
+    cb->cb(cb->data);
+
+    irq_disable_scoped();
+    running = NULL;
+
+    if(cb->cbid == -1)
+        free(cb);
+    else
+        timer_enqueue(&cb->timer, timer_ms_gettime64() + cb->timeout);
+}
+
 int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout) {
     struct thd_cb *newcb;
 
@@ -65,16 +173,17 @@ int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout) {
         return -1;
     }
 
-    newcb->cbid = cbid_top++;
     newcb->cb = cb;
     newcb->data = data;
     newcb->timeout = timeout;
-    newcb->nextrun = timer_ms_gettime64() + timeout;
+    net_timer_init(&newcb->timer, thd_cb_run, newcb);
 
     /* Disable interrupts, insert, and re-enable interrupts */
     irq_disable_scoped();
 
+    newcb->cbid = cbid_top++;
     TAILQ_INSERT_TAIL(&cbs, newcb, thds);
+    timer_enqueue(&newcb->timer, timer_ms_gettime64() + timeout);
 
     return newcb->cbid;
 }
@@ -90,7 +199,13 @@ int net_thd_del_callback(int cbid) {
     TAILQ_FOREACH(cb, &cbs, thds) {
         if(cb->cbid == cbid) {
             TAILQ_REMOVE(&cbs, cb, thds);
-            free(cb);
+            timer_dequeue(&cb->timer);
+
+            if(cb == running)
+                cb->cbid = -1;
+            else
+                free(cb);
+
             return 0;
         }
     }
@@ -106,6 +221,7 @@ int net_thd_is_current(void) {
 void net_thd_kill(void) {
     /* Do things gracefully, if we can... Otherwise, punt. */
     done = 1;
+    genwait_wake_all(&timers);
 
     if(!irq_inside_int()) {
         thd_join(thd, NULL);
@@ -119,6 +235,7 @@ void net_thd_kill(void) {
 
 int net_thd_init(void) {
     TAILQ_INIT(&cbs);
+    TAILQ_INIT(&timers);
     done = 0;
     cbid_top = 1;
 
@@ -129,6 +246,7 @@ int net_thd_init(void) {
 
 void net_thd_shutdown(void) {
     struct thd_cb *c, *n;
+    net_timer_t *t;
 
     /* Kill the thread. */
     if(thd) {
@@ -145,4 +263,8 @@ void net_thd_shutdown(void) {
     }
 
     TAILQ_INIT(&cbs);
+
+    /* Whatever else is still queued belongs to someone else. */
+    while((t = TAILQ_FIRST(&timers)))
+        timer_dequeue(t);
 }
@@ -2,6 +2,7 @@
 
    kernel/net/net_thd.h
    Copyright (C) 2009, 2012, 2013 Lawrence Sebald
+   Copyright (C) 2024 The KOS Team and contributors
 
 */
 
@@ -13,6 +14,34 @@
 __BEGIN_DECLS
 
 #include <arch/types.h>
+#include <sys/queue.h>
+
+/* One-shot timer run by the network thread. Set it up with net_timer_init(),
+   then arm it for an absolute time (in milliseconds, as returned by
+   timer_ms_gettime64()). The callback runs once, on the network thread, at or
+   after that time, and may re-arm the timer. */
+typedef struct net_timer {
+    TAILQ_ENTRY(net_timer) entry;
+
+    uint64 expires;
+    void (*cb)(void *);
+    void *data;
+    int queued;
+} net_timer_t;
+
+TAILQ_HEAD(net_timer_queue, net_timer);
+
+void net_timer_init(net_timer_t *t, void (*cb)(void *), void *data);
+
+/* Arm the timer, replacing whatever time it was armed for before. */
+void net_timer_set(net_timer_t *t, uint64 expires);
+
+/* Arm the timer, unless it is already armed for the same time or earlier. */
+void net_timer_set_earliest(net_timer_t *t, uint64 expires);
+
+/* Disarm the timer. This does not wait for the callback, if it is running. */
+void net_timer_cancel(net_timer_t *t);
+int net_timer_pending(const net_timer_t *t);
 
 int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout);
 int net_thd_del_callback(int cbid);
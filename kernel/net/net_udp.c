@@ -18,6 +18,7 @@
 #include <sys/queue.h>
 #include <kos/fs_socket.h>
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <sys/socket.h>
 #include <netinet/udp.h>
 #include <netinet/udplite.h>
@@ -33,6 +34,16 @@
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define UDP_DEFAULT_HOPS    64
 
+/* Room for the ethernet and IP headers in front of the UDP header */
+#define UDP_HEADROOM        (sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t))
+
+/* Default and largest size of the receive buffer of a socket */
+#define UDP_DEFAULT_RCVBUF  16384
+#define UDP_MAX_BUFFER      (1024 * 1024)
+
+/* Pieces of a message sendmmsg() sends without putting them together first */
+#define UDP_MAX_CHAIN       8
+
 #define packed __attribute__((packed))
 typedef struct {
     uint16 src_port    packed;
@@ -42,20 +53,26 @@ typedef struct {
 } udp_hdr_t;
 #undef packed
 
-struct udp_pkt {
-    TAILQ_ENTRY(udp_pkt) pkt_queue;
+/* Received datagrams are kept in a ring in the socket's receive buffer, each
+   one in one piece after a header. When one doesn't fit before the end of the
+   buffer, it goes at the start instead, and the space left at the end is
+   marked as skipped (if there is any). Everything is kept 4-byte aligned. */
+typedef struct udp_rec {
+    uint16 size;
+    uint16 reserved;
     struct sockaddr_in6 from;
-    uint8 *data;
-    uint16 datasize;
-};
+} udp_rec_t;
 
-TAILQ_HEAD(udp_pkt_queue, udp_pkt);
+#define UDP_REC_SKIP        0xFFFF
+#define UDP_REC_SIZE(sz)    ((sizeof(udp_rec_t) + (sz) + 3) & ~3)
 
 #define UDPSOCK_NO_CHECKSUM 0x00000001
 #define UDPSOCK_LITE_RCVCOV 0x00000002
 
 struct udp_sock {
     LIST_ENTRY(udp_sock) sock_list;
+    LIST_ENTRY(udp_sock) hash_list;
+    int hashed;
     struct sockaddr_in6 local_addr;
     struct sockaddr_in6 remote_addr;
 
@@ -71,7 +88,12 @@ struct udp_sock {
         uint16_t recv_cscov;
     } udp_lite;
 
-    struct udp_pkt_queue packets;
+    /* Receive ring, see udp_rec_t */
+    uint8 *rcvbuf;
+    uint32 rcvbuf_sz;
+    uint32 rcv_head;
+    uint32 rcv_tail;
+    int rcv_count;
 };
 
 LIST_HEAD(udp_sock_list, udp_sock);
@@ -80,10 +102,279 @@ static struct udp_sock_list net_udp_sockets = LIST_HEAD_INITIALIZER(0);
 static mutex_t udp_mutex = MUTEX_INITIALIZER;
 static net_udp_stats_t udp_stats = { 0 };
 
+/* Bound sockets, hashed on their local port. Since only one socket may be
+   bound to any given port, this is all that is needed to match incoming
+   packets to sockets (and to find free ports). Protected by udp_mutex. */
+#define UDP_HASH_BITS   6
+#define UDP_HASH_SIZE   (1 << UDP_HASH_BITS)
+
+static struct udp_sock_list udp_port_hash[UDP_HASH_SIZE];
+
+static inline unsigned int udp_hash_port(uint16 port) {
+    return (port * 2654435761U) >> (32 - UDP_HASH_BITS);
+}
+
+/* Find the socket bound to a port (in network byte order), if any. */
+static struct udp_sock *udp_port_lookup(uint16 port) {
+    struct udp_sock *iter;
+
+    LIST_FOREACH(iter, &udp_port_hash[udp_hash_port(port)], hash_list) {
+        if(iter->local_addr.sin6_port == port)
+            return iter;
+    }
+
+    return NULL;
+}
+
+/* Grab the first unused port >= 1024, in network byte order. */
+static uint16 udp_port_alloc(void) {
+    uint16 port = 1024;
+
+    while(udp_port_lookup(htons(port)))
+        ++port;
+
+    return htons(port);
+}
+
+static void udp_hash_remove(struct udp_sock *sock) {
+    if(sock->hashed) {
+        LIST_REMOVE(sock, hash_list);
+        sock->hashed = 0;
+    }
+}
+
+/* Rehash a socket after its local port has changed. */
+static void udp_hash_update(struct udp_sock *sock) {
+    udp_hash_remove(sock);
+
+    if(sock->local_addr.sin6_port) {
+        LIST_INSERT_HEAD(&udp_port_hash[udp_hash_port(sock->local_addr.sin6_port)],
+                         sock, hash_list);
+        sock->hashed = 1;
+    }
+}
+
 static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
                             const struct sockaddr_in6 *dst, const uint8 *data,
                             size_t size, uint32_t flags, int hops,
                             uint32_t iflags, int proto, uint16_t cscov);
+static int net_udp_send_pbuf(netif_t *net, const struct sockaddr_in6 *src,
+                             const struct sockaddr_in6 *dst, net_pbuf_t *data,
+                             uint32_t flags, int hops, uint32_t iflags,
+                             int proto, uint16_t cscov);
+
+extern void __poll_event_trigger(int fd, short event);
+
+/* Make room for a datagram at the tail of a socket's receive ring. */
+static udp_rec_t *udp_ring_alloc(struct udp_sock *sock, size_t size) {
+    uint32 need = UDP_REC_SIZE(size);
+    uint32 pos;
+
+    if(!sock->rcv_count)
+        sock->rcv_head = sock->rcv_tail = 0;
+
+    if(sock->rcv_tail >= sock->rcv_head) {
+        if(sock->rcvbuf_sz - sock->rcv_tail >= need) {
+            pos = sock->rcv_tail;
+        }
+        else if(need < sock->rcv_head) {
+            if(sock->rcv_tail < sock->rcvbuf_sz)
+                ((udp_rec_t *)(sock->rcvbuf + sock->rcv_tail))->size =
+                    UDP_REC_SKIP;
+
+            pos = 0;
+        }
+        else {
+            return NULL;
+        }
+    }
+    else if(sock->rcv_head - sock->rcv_tail > need) {
+        pos = sock->rcv_tail;
+    }
+    else {
+        return NULL;
+    }
+
+    sock->rcv_tail = pos + need;
+    ++sock->rcv_count;
+
+    return (udp_rec_t *)(sock->rcvbuf + pos);
+}
+
+/* Look at the oldest datagram in a socket's receive ring, if any. */
+static udp_rec_t *udp_ring_first(struct udp_sock *sock) {
+    if(!sock->rcv_count)
+        return NULL;
+
+    if(sock->rcv_head == sock->rcvbuf_sz ||
+       ((udp_rec_t *)(sock->rcvbuf + sock->rcv_head))->size == UDP_REC_SKIP)
+        sock->rcv_head = 0;
+
+    return (udp_rec_t *)(sock->rcvbuf + sock->rcv_head);
+}
+
+/* Drop the datagram returned by udp_ring_first(). */
+static void udp_ring_pop(struct udp_sock *sock) {
+    udp_rec_t *rec = (udp_rec_t *)(sock->rcvbuf + sock->rcv_head);
+
+    sock->rcv_head += UDP_REC_SIZE(rec->size);
+
+    if(!--sock->rcv_count)
+        sock->rcv_head = sock->rcv_tail = 0;
+}
+
+/* Move a socket's received datagrams to a new buffer of the given size,
+   keeping as many as fit. */
+static int udp_ring_resize(struct udp_sock *sock, uint32 size) {
+    uint8 *buf;
+    udp_rec_t *rec;
+    uint32 pos = 0, len;
+    int count = 0;
+
+    if(!(buf = (uint8 *)malloc(size)))
+        return -1;
+
+    while((rec = udp_ring_first(sock))) {
+        len = UDP_REC_SIZE(rec->size);
+
+        if(pos + len <= size) {
+            memcpy(buf + pos, rec, len);
+            pos += len;
+            ++count;
+        }
+        else {
+            ++udp_stats.pkt_recv_no_space;
+        }
+
+        udp_ring_pop(sock);
+    }
+
+    free(sock->rcvbuf);
+    sock->rcvbuf = buf;
+    sock->rcvbuf_sz = size;
+    sock->rcv_head = 0;
+    sock->rcv_tail = pos;
+    sock->rcv_count = count;
+
+    return 0;
+}
+
+/* Queue up a received datagram on a socket. */
+static int udp_enqueue(struct udp_sock *sock, const struct in6_addr *addr,
+                       uint16 port, const uint8 *data, size_t size) {
+    udp_rec_t *rec;
+
+    if(!(rec = udp_ring_alloc(sock, size))) {
+        ++udp_stats.pkt_recv_no_space;
+        return -1;
+    }
+
+    rec->size = size;
+    memset(&rec->from, 0, sizeof(struct sockaddr_in6));
+    rec->from.sin6_family = AF_INET6;
+    rec->from.sin6_addr = *addr;
+    rec->from.sin6_port = port;
+    memcpy(rec + 1, data, size);
+
+    ++udp_stats.pkt_recv;
+    __poll_event_trigger(sock->sock, POLLRDNORM);
+    genwait_wake_one(sock);
+
+    return 0;
+}
+
+/* Give the address a datagram came from in the socket's address family. */
+static void udp_fill_addr(const struct udp_sock *sock,
+                          const struct sockaddr_in6 *from,
+                          struct sockaddr *addr, socklen_t *addr_len) {
+    if(sock->domain == AF_INET) {
+        struct sockaddr_in realaddr;
+
+        memset(&realaddr, 0, sizeof(struct sockaddr_in));
+        realaddr.sin_family = AF_INET;
+        realaddr.sin_addr.s_addr = from->sin6_addr.__s6_addr.__s6_addr32[3];
+        realaddr.sin_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in)) {
+            memcpy(addr, &realaddr, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
+            *addr_len = sizeof(struct sockaddr_in);
+        }
+    }
+    else if(sock->domain == AF_INET6) {
+        struct sockaddr_in6 realaddr6;
+
+        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
+        realaddr6.sin6_family = AF_INET6;
+        realaddr6.sin6_addr = from->sin6_addr;
+        realaddr6.sin6_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in6)) {
+            memcpy(addr, &realaddr6, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
+            *addr_len = sizeof(struct sockaddr_in6);
+        }
+    }
+}
+
+/* Work out where a datagram goes, from the address given (if any) and the
+   address the socket is connected to (if any). */
+static int udp_dest(int domain, const struct sockaddr_in6 *remote,
+                    const struct sockaddr *addr, socklen_t addr_len,
+                    struct sockaddr_in6 *realaddr6) {
+    const struct sockaddr_in *realaddr;
+
+    if(!IN6_IS_ADDR_UNSPECIFIED(&remote->sin6_addr) &&
+       remote->sin6_port != 0) {
+        if(addr) {
+            errno = EISCONN;
+            return -1;
+        }
+
+        *realaddr6 = *remote;
+    }
+    else if(addr == NULL) {
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    else if(addr->sa_family != domain) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+    else if(domain == AF_INET6) {
+        if(addr_len != sizeof(struct sockaddr_in6)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        *realaddr6 = *((const struct sockaddr_in6 *)addr);
+    }
+    else if(domain == AF_INET) {
+        if(addr_len != sizeof(struct sockaddr_in)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        realaddr = (const struct sockaddr_in *)addr;
+        memset(realaddr6, 0, sizeof(struct sockaddr_in6));
+        realaddr6->sin6_family = AF_INET6;
+        realaddr6->sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        realaddr6->sin6_addr.__s6_addr.__s6_addr32[3] =
+            realaddr->sin_addr.s_addr;
+        realaddr6->sin6_port = realaddr->sin_port;
+    }
+    else {
+        /* Shouldn't be able to get here... */
+        errno = EBADF;
+        return -1;
+    }
+
+    return 0;
+}
 
 static int net_udp_accept(net_socket_t *hnd, struct sockaddr *addr,
                           socklen_t *addr_len) {
@@ -169,38 +460,23 @@ static int net_udp_bind(net_socket_t *hnd, const struct sockaddr *addr,
     if(realaddr6.sin6_port != 0) {
         /* Make sure we don't already have a socket bound to the port
            specified */
-        LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-            if(iter == udpsock)
-                continue;
+        iter = udp_port_lookup(realaddr6.sin6_port);
 
-            if(iter->local_addr.sin6_port == realaddr6.sin6_port) {
-                mutex_unlock(&udp_mutex);
-                errno = EADDRINUSE;
-                return -1;
-            }
+        if(iter && iter != udpsock) {
+            mutex_unlock(&udp_mutex);
+            errno = EADDRINUSE;
+            return -1;
         }
 
         udpsock->local_addr = realaddr6;
     }
     else {
-        uint16 port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
-        }
-
         udpsock->local_addr = realaddr6;
-        udpsock->local_addr.sin6_port = htons(port);
+        udpsock->local_addr.sin6_port = udp_port_alloc();
     }
 
+    udp_hash_update(udpsock);
+
     udpsock->sock = hnd->fd;
 
     mutex_unlock(&udp_mutex);
@@ -311,7 +587,7 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
                                 int flags, struct sockaddr *addr,
                                 socklen_t *addr_len) {
     struct udp_sock *udpsock;
-    struct udp_pkt *pkt;
+    udp_rec_t *rec;
 
     if(mutex_lock_irqsafe(&udp_mutex))
         return -1;
@@ -335,7 +611,7 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
         return -1;
     }
 
-    if(TAILQ_EMPTY(&udpsock->packets) &&
+    if(!udpsock->rcv_count &&
        ((udpsock->flags & FS_SOCKET_NONBLOCK) || (flags & MSG_DONTWAIT) ||
         irq_inside_int())) {
         mutex_unlock(&udp_mutex);
@@ -343,75 +619,132 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
         return -1;
     }
 
-    while(TAILQ_EMPTY(&udpsock->packets)) {
+    while(!udpsock->rcv_count) {
         mutex_unlock(&udp_mutex);
         genwait_wait(udpsock, "net_udp_recvfrom", 0, NULL);
         mutex_lock(&udp_mutex);
     }
 
-    pkt = TAILQ_FIRST(&udpsock->packets);
+    rec = udp_ring_first(udpsock);
+
+    if(rec->size < length)
+        length = rec->size;
+
+    memcpy(buffer, rec + 1, length);
+
+    if(addr != NULL)
+        udp_fill_addr(udpsock, &rec->from, addr, addr_len);
+
+    /* Remove the packet if we're pulling data out of the queue. */
+    if(!(flags & MSG_PEEK))
+        udp_ring_pop(udpsock);
+
+    mutex_unlock(&udp_mutex);
 
-    if(pkt->datasize > length) {
-        memcpy(buffer, pkt->data, length);
+    return length;
+}
+
+/* Copy a received datagram out to a message's buffers. */
+static void udp_copy_msg(const struct udp_sock *udpsock, const udp_rec_t *rec,
+                         struct mmsghdr *m) {
+    struct msghdr *msg = &m->msg_hdr;
+    const uint8 *data = (const uint8 *)(rec + 1);
+    size_t n, done = 0;
+    int i;
+
+    for(i = 0; i < msg->msg_iovlen && done < rec->size; ++i) {
+        n = msg->msg_iov[i].iov_len;
+
+        if(n > rec->size - done)
+            n = rec->size - done;
+
+        memcpy(msg->msg_iov[i].iov_base, data + done, n);
+        done += n;
     }
-    else {
-        memcpy(buffer, pkt->data, pkt->datasize);
-        length = pkt->datasize;
+
+    m->msg_len = done;
+    msg->msg_flags = done < rec->size ? MSG_TRUNC : 0;
+    msg->msg_controllen = 0;
+
+    if(msg->msg_name)
+        udp_fill_addr(udpsock, &rec->from, (struct sockaddr *)msg->msg_name,
+                      &msg->msg_namelen);
+}
+
+static int net_udp_recvmmsg(net_socket_t *hnd, struct mmsghdr *msgs,
+                            unsigned int vlen, int flags,
+                            struct timespec *timeout) {
+    struct udp_sock *udpsock;
+    udp_rec_t *rec;
+    unsigned int cnt = 0;
+    uint64 now, end = 0;
+    int wait = 0;
+
+    if(timeout)
+        end = timer_ms_gettime64() + timeout->tv_sec * 1000 +
+              timeout->tv_nsec / 1000000;
+
+    if(mutex_lock_irqsafe(&udp_mutex))
+        return -1;
+
+    udpsock = (struct udp_sock *)hnd->data;
+
+    if(udpsock == NULL) {
+        mutex_unlock(&udp_mutex);
+        errno = EBADF;
+        return -1;
     }
 
-    if(addr != NULL) {
-        if(udpsock->domain == AF_INET) {
-            struct sockaddr_in realaddr;
+    if(udpsock->flags & (SHUT_RD << 24)) {
+        mutex_unlock(&udp_mutex);
+        return 0;
+    }
 
-            memset(&realaddr, 0, sizeof(struct sockaddr_in));
-            realaddr.sin_family = AF_INET;
-            realaddr.sin_addr.s_addr =
-                pkt->from.sin6_addr.__s6_addr.__s6_addr32[3];
-            realaddr.sin_port = pkt->from.sin6_port;
+    for(;;) {
+        /* Take everything there is, up to what we've been asked for. */
+        while(cnt < vlen && (rec = udp_ring_first(udpsock))) {
+            udp_copy_msg(udpsock, rec, &msgs[cnt++]);
 
-            if(*addr_len < sizeof(struct sockaddr_in)) {
-                memcpy(addr, &realaddr, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
-                *addr_len = sizeof(struct sockaddr_in);
-            }
+            if(flags & MSG_PEEK)
+                break;
+
+            udp_ring_pop(udpsock);
         }
-        else if(udpsock->domain == AF_INET6) {
-            struct sockaddr_in6 realaddr6;
 
-            memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-            realaddr6.sin6_family = AF_INET6;
-            realaddr6.sin6_addr = pkt->from.sin6_addr;
-            realaddr6.sin6_port = pkt->from.sin6_port;
+        if(cnt == vlen || (flags & MSG_PEEK && cnt) ||
+           (flags & MSG_WAITFORONE && cnt) ||
+           (udpsock->flags & FS_SOCKET_NONBLOCK) || (flags & MSG_DONTWAIT) ||
+           irq_inside_int())
+            break;
 
-            if(*addr_len < sizeof(struct sockaddr_in6)) {
-                memcpy(addr, &realaddr6, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
-                *addr_len = sizeof(struct sockaddr_in6);
-            }
+        if(timeout) {
+            now = timer_ms_gettime64();
+
+            if(now >= end)
+                break;
+
+            wait = (int)(end - now);
         }
-    }
 
-    /* Remove the packet if we're pulling data out of the queue. */
-    if(!(flags & MSG_PEEK)) {
-        TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt->data);
-        free(pkt);
+        mutex_unlock(&udp_mutex);
+        genwait_wait(udpsock, "net_udp_recvmmsg", wait, NULL);
+        mutex_lock(&udp_mutex);
     }
 
     mutex_unlock(&udp_mutex);
 
-    return length;
+    if(!cnt && vlen) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    return cnt;
 }
 
 static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
                               size_t length, int flags,
                               const struct sockaddr *addr, socklen_t addr_len) {
     struct udp_sock *udpsock;
-    struct sockaddr_in *realaddr;
     struct sockaddr_in6 realaddr6;
     uint32_t sflags, iflags;
     int hops, proto;
@@ -435,76 +768,122 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
         goto err;
     }
 
-    if(!IN6_IS_ADDR_UNSPECIFIED(&udpsock->remote_addr.sin6_addr) &&
-       udpsock->remote_addr.sin6_port != 0) {
-        if(addr) {
-            errno = EISCONN;
-            goto err;
-        }
+    if(udp_dest(udpsock->domain, &udpsock->remote_addr, addr, addr_len,
+                &realaddr6) < 0)
+        goto err;
 
-        realaddr6 = udpsock->remote_addr;
-    }
-    else if(addr == NULL) {
-        errno = EDESTADDRREQ;
+    if(message == NULL) {
+        errno = EFAULT;
         goto err;
     }
-    else if(addr->sa_family != udpsock->domain) {
-        errno = EAFNOSUPPORT;
-        goto err;
+
+    if(udpsock->local_addr.sin6_port == 0) {
+        udpsock->local_addr.sin6_port = udp_port_alloc();
+        udp_hash_update(udpsock);
     }
-    else if(udpsock->domain == AF_INET6) {
-        if(addr_len != sizeof(struct sockaddr_in6)) {
-            errno = EINVAL;
-            goto err;
+
+    local_addr = udpsock->local_addr;
+    sflags = udpsock->flags;
+    iflags = udpsock->int_flags;
+    hops = udpsock->hop_limit;
+    proto = udpsock->proto;
+    cscov = udpsock->udp_lite.send_cscov;
+    mutex_unlock(&udp_mutex);
+
+    return net_udp_send_raw(NULL, &local_addr, &realaddr6,
+                            (const uint8 *)message, length, sflags, hops,
+                            iflags, proto, cscov);
+err:
+    mutex_unlock(&udp_mutex);
+    return -1;
+}
+
+/* Send one message from sendmmsg(). Messages in a few pieces are sent from
+   where they are, anything more gets put together first. */
+static int udp_send_msg(const struct sockaddr_in6 *src,
+                        const struct sockaddr_in6 *dst,
+                        const struct msghdr *msg, uint32_t sflags, int hops,
+                        uint32_t iflags, int proto, uint16_t cscov) {
+    net_pbuf_t p[UDP_MAX_CHAIN];
+    uint8 *buf;
+    size_t len = 0;
+    int i, rv;
+
+    if(msg->msg_iovlen <= 0) {
+        net_pbuf_init(p, NULL, 0, 0);
+        return net_udp_send_pbuf(NULL, src, dst, p, sflags, hops, iflags,
+                                 proto, cscov);
+    }
+
+    if(msg->msg_iovlen <= UDP_MAX_CHAIN) {
+        for(i = 0; i < msg->msg_iovlen; ++i) {
+            net_pbuf_init(&p[i], (uint8 *)msg->msg_iov[i].iov_base,
+                          msg->msg_iov[i].iov_len, 0);
+
+            if(i)
+                p[i - 1].next = &p[i];
         }
 
-        realaddr6 = *((struct sockaddr_in6 *)addr);
+        return net_udp_send_pbuf(NULL, src, dst, p, sflags, hops, iflags,
+                                 proto, cscov);
     }
-    else if(udpsock->domain == AF_INET) {
-        if(addr_len != sizeof(struct sockaddr_in)) {
-            errno = EINVAL;
-            goto err;
-        }
 
-        realaddr = (struct sockaddr_in *)addr;
-        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-        realaddr6.sin6_family = AF_INET6;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr32[3] =
-            realaddr->sin_addr.s_addr;
-        realaddr6.sin6_port = realaddr->sin_port;
+    for(i = 0; i < msg->msg_iovlen; ++i)
+        len += msg->msg_iov[i].iov_len;
+
+    if(!(buf = (uint8 *)malloc(len))) {
+        errno = ENOMEM;
+        return -1;
     }
-    else {
-        /* Shouldn't be able to get here... */
+
+    for(len = 0, i = 0; i < msg->msg_iovlen; ++i) {
+        memcpy(buf + len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+        len += msg->msg_iov[i].iov_len;
+    }
+
+    rv = net_udp_send_raw(NULL, src, dst, buf, len, sflags, hops, iflags,
+                          proto, cscov);
+    free(buf);
+    return rv;
+}
+
+static int net_udp_sendmmsg(net_socket_t *hnd, struct mmsghdr *msgs,
+                            unsigned int vlen, int flags) {
+    struct udp_sock *udpsock;
+    struct msghdr *msg;
+    struct sockaddr_in6 local_addr, remote_addr, realaddr6;
+    uint32_t sflags, iflags;
+    int domain, hops, proto, rv;
+    uint16_t cscov;
+    unsigned int i;
+
+    (void)flags;
+
+    if(mutex_lock_irqsafe(&udp_mutex))
+        return -1;
+
+    udpsock = (struct udp_sock *)hnd->data;
+
+    if(udpsock == NULL) {
+        mutex_unlock(&udp_mutex);
         errno = EBADF;
-        goto err;
+        return -1;
     }
 
-    if(message == NULL) {
-        errno = EFAULT;
-        goto err;
+    if(udpsock->flags & (SHUT_WR << 24)) {
+        mutex_unlock(&udp_mutex);
+        errno = EPIPE;
+        return -1;
     }
 
     if(udpsock->local_addr.sin6_port == 0) {
-        uint16 port = 1024, tmp = 0;
-        struct udp_sock *iter;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
-        }
-
-        udpsock->local_addr.sin6_port = htons(port);
+        udpsock->local_addr.sin6_port = udp_port_alloc();
+        udp_hash_update(udpsock);
     }
 
     local_addr = udpsock->local_addr;
+    remote_addr = udpsock->remote_addr;
+    domain = udpsock->domain;
     sflags = udpsock->flags;
     iflags = udpsock->int_flags;
     hops = udpsock->hop_limit;
@@ -512,12 +891,27 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
     cscov = udpsock->udp_lite.send_cscov;
     mutex_unlock(&udp_mutex);
 
-    return net_udp_send_raw(NULL, &local_addr, &realaddr6,
-                            (const uint8 *)message, length, sflags, hops,
-                            iflags, proto, cscov);
-err:
-    mutex_unlock(&udp_mutex);
-    return -1;
+    /* Send them in order, stopping at the first one that fails. */
+    for(i = 0; i < vlen; ++i) {
+        msg = &msgs[i].msg_hdr;
+
+        if(udp_dest(domain, &remote_addr, (const struct sockaddr *)msg->msg_name,
+                    msg->msg_namelen, &realaddr6) < 0)
+            break;
+
+        if(msg->msg_iovlen > 0 && msg->msg_iov == NULL) {
+            errno = EFAULT;
+            break;
+        }
+
+        if((rv = udp_send_msg(&local_addr, &realaddr6, msg, sflags, hops,
+                              iflags, proto, cscov)) < 0)
+            break;
+
+        msgs[i].msg_len = rv;
+    }
+
+    return (i || !vlen) ? (int)i : -1;
 }
 
 static int net_udp_shutdownsock(net_socket_t *hnd, int how) {
@@ -570,12 +964,20 @@ static int net_udp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     }
 
     memset(udpsock, 0, sizeof(struct udp_sock));
-    TAILQ_INIT(&udpsock->packets);
+
+    if(!(udpsock->rcvbuf = (uint8 *)malloc(UDP_DEFAULT_RCVBUF))) {
+        free(udpsock);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    udpsock->rcvbuf_sz = UDP_DEFAULT_RCVBUF;
     udpsock->domain = domain;
     udpsock->proto = proto;
     udpsock->hop_limit = UDP_DEFAULT_HOPS;
 
     if(mutex_lock_irqsafe(&udp_mutex)) {
+        free(udpsock->rcvbuf);
         free(udpsock);
         return -1;
     }
@@ -589,8 +991,6 @@ static int net_udp_socket(net_socket_t *hnd, int domain, int type, int proto) {
 
 static void net_udp_close(net_socket_t *hnd) {
     struct udp_sock *udpsock;
-    struct udp_pkt *pkt;
-    struct udp_pkt *it;
 
     if(mutex_lock_irqsafe(&udp_mutex))
         return;
@@ -603,18 +1003,10 @@ static void net_udp_close(net_socket_t *hnd) {
         return;
     }
 
-    it = udpsock->packets.tqh_first;
-    while(it) {
-        pkt = it;
-        it = it->pkt_queue.tqe_next;
-
-        free(pkt->data);
-        TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt);
-    }
-
     LIST_REMOVE(udpsock, sock_list);
+    udp_hash_remove(udpsock);
 
+    free(udpsock->rcvbuf);
     free(udpsock);
     mutex_unlock(&udp_mutex);
 }
@@ -640,6 +1032,10 @@ static int net_udp_getsockopt(net_socket_t *hnd, int level, int option_name,
                     tmp = 0;
                     goto copy_int;
 
+                case SO_RCVBUF:
+                    tmp = sock->rcvbuf_sz;
+                    goto copy_int;
+
                 case SO_TYPE:
                     tmp = SOCK_DGRAM;
                     goto copy_int;
@@ -754,6 +1150,26 @@ static int net_udp_setsockopt(net_socket_t *hnd, int level, int option_name,
                 case SO_ERROR:
                 case SO_TYPE:
                     goto ret_inval;
+
+                case SO_RCVBUF:
+                    if(option_len != sizeof(uint32_t))
+                        goto ret_inval;
+
+                    tmp = *(uint32_t *)option_value;
+
+                    /* Receive buffer size must be in the range 256 - 1MiB. */
+                    if(tmp < 256)
+                        tmp = 256;
+                    else if(tmp > UDP_MAX_BUFFER)
+                        tmp = UDP_MAX_BUFFER;
+
+                    if(udp_ring_resize(sock, tmp & ~3) < 0) {
+                        mutex_unlock(&udp_mutex);
+                        errno = ENOMEM;
+                        return -1;
+                    }
+
+                    goto ret_success;
             }
 
             break;
@@ -1093,7 +1509,7 @@ static short net_udp_poll(net_socket_t *hnd, short events) {
         return POLLNVAL;
     }
 
-    if(!TAILQ_EMPTY(&sock->packets))
+    if(sock->rcv_count)
         rv |= POLLRDNORM;
 
     mutex_unlock(&udp_mutex);
@@ -1101,15 +1517,13 @@ static short net_udp_poll(net_socket_t *hnd, short events) {
     return rv & events;
 }
 
-extern void __poll_event_trigger(int fd, short event);
-
 static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
                           size_t size) {
     udp_hdr_t *hdr = (udp_hdr_t *)data;
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
-    struct udp_pkt *pkt;
+    struct in6_addr addr;
 
     (void)src;
 
@@ -1166,7 +1580,8 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
         /* If the mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, &udp_port_hash[udp_hash_port(hdr->dst_port)],
+                 hash_list) {
         /* Don't even bother looking at IPv6-only sockets */
         if(sock->domain == AF_INET6 && (sock->flags & FS_SOCKET_V6ONLY))
             continue;
@@ -1204,33 +1619,12 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        memset(pkt, 0, sizeof(struct udp_pkt));
-
-        pkt->datasize = size - sizeof(udp_hdr_t);
+        memset(&addr, 0, sizeof(struct in6_addr));
+        addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        addr.__s6_addr.__s6_addr32[3] = ip->src;
 
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
-            free(pkt);
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        pkt->from.sin6_family = AF_INET6;
-        pkt->from.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
-        pkt->from.sin6_addr.__s6_addr.__s6_addr32[3] = ip->src;
-        pkt->from.sin6_port = hdr->src_port;
-
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
-        TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
-
-        ++udp_stats.pkt_recv;
-        __poll_event_trigger(sock->sock, POLLRDNORM);
-        genwait_wake_one(sock);
+        udp_enqueue(sock, &addr, hdr->src_port, data + sizeof(udp_hdr_t),
+                    size - sizeof(udp_hdr_t));
         mutex_unlock(&udp_mutex);
 
         return 0;
@@ -1248,7 +1642,6 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
-    struct udp_pkt *pkt;
 
     (void)src;
 
@@ -1303,7 +1696,8 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
         /* If the mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, &udp_port_hash[udp_hash_port(hdr->dst_port)],
+                 hash_list) {
         /* Don't even bother looking at IPv4 sockets */
         if(sock->domain == AF_INET)
             continue;
@@ -1341,32 +1735,8 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        memset(pkt, 0, sizeof(struct udp_pkt));
-
-        pkt->datasize = size - sizeof(udp_hdr_t);
-
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
-            free(pkt);
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        pkt->from.sin6_family = AF_INET6;
-        pkt->from.sin6_addr = ip->src_addr;
-        pkt->from.sin6_port = hdr->src_port;
-
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
-        TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
-
-        ++udp_stats.pkt_recv;
-        __poll_event_trigger(sock->sock, POLLRDNORM);
-        genwait_wake_one(sock);
+        udp_enqueue(sock, &ip->src_addr, hdr->src_port,
+                    data + sizeof(udp_hdr_t), size - sizeof(udp_hdr_t));
         mutex_unlock(&udp_mutex);
 
         return 0;
@@ -1396,8 +1766,21 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
                             const struct sockaddr_in6 *dst, const uint8 *data,
                             size_t size, uint32_t flags, int hops,
                             uint32_t iflags, int proto, uint16_t cscov) {
-    uint8 buf[size + sizeof(udp_hdr_t)];
-    udp_hdr_t *hdr = (udp_hdr_t *)buf;
+    net_pbuf_t dp;
+
+    net_pbuf_init(&dp, (uint8 *)data, size, 0);
+    return net_udp_send_pbuf(net, src, dst, &dp, flags, hops, iflags, proto,
+                             cscov);
+}
+
+static int net_udp_send_pbuf(netif_t *net, const struct sockaddr_in6 *src,
+                             const struct sockaddr_in6 *dst, net_pbuf_t *data,
+                             uint32_t flags, int hops, uint32_t iflags,
+                             int proto, uint16_t cscov) {
+    uint8 buf[UDP_HEADROOM + sizeof(udp_hdr_t)];
+    udp_hdr_t *hdr = (udp_hdr_t *)(buf + UDP_HEADROOM);
+    net_pbuf_t hp;
+    size_t size = net_pbuf_chain_len(data);
     uint16 cs;
     int err;
     struct in6_addr srcaddr = src->sin6_addr;
@@ -1440,7 +1823,9 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
         }
     }
 
-    memcpy(buf + sizeof(udp_hdr_t), data, size);
+    /* The header goes in front of the data, which stays where it is. */
+    net_pbuf_init(&hp, buf, sizeof(buf), UDP_HEADROOM);
+    hp.next = data;
     size += sizeof(udp_hdr_t);
 
     hdr->src_port = src->sin6_port;
@@ -1454,7 +1839,7 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
         if(!(iflags & UDPSOCK_NO_CHECKSUM)) {
             cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size,
                                           proto);
-            hdr->checksum = net_ipv4_checksum(buf, size, cs);
+            hdr->checksum = net_ipv4_checksum_pbuf(&hp, cs);
         }
     }
     else {
@@ -1467,12 +1852,12 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
         }
 
         cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size, proto);
-        hdr->checksum = net_ipv4_checksum(buf, size, cs);
+        hdr->checksum = net_ipv4_checksum_pbuf(&hp, cs);
     }
 
     /* Pass everything off to the network layer to do the rest. */
-    err = net_ipv6_send(net, buf, size, hops, proto, &srcaddr,
-                        &dst->sin6_addr);
+    err = net_ipv6_send_pbuf(net, &hp, hops, proto, &srcaddr,
+                             &dst->sin6_addr);
 
     if(err < 0) {
         ++udp_stats.pkt_send_failed;
@@ -1509,7 +1894,9 @@ static fs_socket_proto_t proto = {
     net_udp_getsockname,
     net_udp_getpeername,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 static fs_socket_proto_t proto_lite = {
@@ -1532,7 +1919,9 @@ static fs_socket_proto_t proto_lite = {
     net_udp_getsockname,
     net_udp_getpeername,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 int net_udp_init(void) {
@@ -58,6 +58,10 @@ int cond_destroy(condvar_t *cv) {
 }
 
 int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
+    return cond_wait_timed_ns(cv, m, timeout > 0 ? timeout * 1000000ull : 0);
+}
+
+int cond_wait_timed_ns(condvar_t *cv, mutex_t *m, uint64_t timeout) {
     int rv;
 
     if(irq_inside_int()) {
@@ -78,8 +82,8 @@ int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
     mutex_unlock(m);
 
     /* Now block us until we're signaled */
-    rv = genwait_wait(cv, timeout ? "cond_wait_timed" : "cond_wait", timeout,
-                      NULL);
+    rv = genwait_wait_ns(cv, timeout ? "cond_wait_timed" : "cond_wait",
+                         timeout, NULL);
 
     if(rv < 0 && errno == EAGAIN)
         errno = ETIMEDOUT;
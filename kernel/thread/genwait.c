@@ -35,39 +35,126 @@ static TAILQ_HEAD(slpquehead, kthread) slpque[TABLESIZE];
    ready to run at a later time will be placed here. Note that this doesn't
    deal with pre-emptive timeslice context switching, only things that are
    specifically blocked for a timed event (thd_sleep, genwait_wait, etc).
-   This queue is sorted by remaining time (smallest at the front). */
-static struct ktqueue timer_queue;
 
-/* Internal function to insert a thread on the timer queue. Maintains
-   sorting order by wait time. */
-static void tq_insert(kthread_t * thd) {
-    kthread_t * t;
+   This is a pairing heap ordered by wait_timeout (smallest at the root),
+   threaded through the timerq fields of each kthread_t, so it needs no
+   allocation. Insertion and peeking at the next timeout are O(1), and
+   removal of any thread (timeout or early wakeup) is O(log n) amortized,
+   which matters since all of this happens with interrupts disabled. */
+static kthread_t *timer_queue;
+
+/* Meld two heap roots together, returning the new root. */
+static kthread_t *tq_meld(kthread_t *a, kthread_t *b) {
+    kthread_t *t;
+
+    if(!a)
+        return b;
+    if(!b)
+        return a;
+
+    /* Keep the earliest timeout at the root. On a tie the existing root wins,
+       so that threads with equal timeouts tend to expire in FIFO order. */
+    if(b->wait_timeout < a->wait_timeout) {
+        t = a;
+        a = b;
+        b = t;
+    }
 
-    /* Search for its place; note that new threads will be placed at
-       the end of a group with the same timeout. */
-    TAILQ_FOREACH_REVERSE(t, &timer_queue, slpquehead, timerq) {
-        if(thd->wait_timeout >= t->wait_timeout) {
-            TAILQ_INSERT_AFTER(&timer_queue, t, thd, timerq);
-            return;
+    /* Make b the first child of a. */
+    b->timerq.prev = a;
+    b->timerq.next = a->timerq.child;
+
+    if(a->timerq.child)
+        a->timerq.child->timerq.prev = b;
+
+    a->timerq.child = b;
+
+    return a;
+}
+
+/* Standard two-pass pairing of a list of siblings into a single heap. */
+static kthread_t *tq_merge_pairs(kthread_t *first) {
+    kthread_t *a, *b, *next, *list = NULL, *root = NULL;
+
+    /* First pass: meld siblings pairwise from left to right, pushing each
+       result onto a stack (linked through timerq.next). */
+    while(first) {
+        a = first;
+        b = a->timerq.next;
+        next = b ? b->timerq.next : NULL;
+
+        a->timerq.prev = a->timerq.next = NULL;
+
+        if(b) {
+            b->timerq.prev = b->timerq.next = NULL;
+            a = tq_meld(a, b);
         }
+
+        a->timerq.next = list;
+        list = a;
+        first = next;
     }
 
-    /* Couldn't find anything scheduled earlier, put this at the start. */
-    TAILQ_INSERT_HEAD(&timer_queue, thd, timerq);
+    /* Second pass: meld the stack back together from right to left. */
+    while(list) {
+        next = list->timerq.next;
+        list->timerq.next = NULL;
+        root = tq_meld(root, list);
+        list = next;
+    }
+
+    return root;
+}
+
+/* Internal function to insert a thread on the timer queue. */
+static void tq_insert(kthread_t *thd) {
+    thd->timerq.child = NULL;
+    thd->timerq.next = NULL;
+    thd->timerq.prev = NULL;
+
+    timer_queue = tq_meld(timer_queue, thd);
 }
 
 /* Internal function to remove a thread from the timer queue. */
-static void tq_remove(kthread_t * thd) {
-    TAILQ_REMOVE(&timer_queue, thd, timerq);
+static void tq_remove(kthread_t *thd) {
+    kthread_t *sub;
+
+    if(thd == timer_queue) {
+        timer_queue = tq_merge_pairs(thd->timerq.child);
+    }
+    else {
+        /* Unlink us from our parent (if we're its first child) or from our
+           left sibling, then put our own subtree back into the heap. */
+        if(thd->timerq.prev->timerq.child == thd)
+            thd->timerq.prev->timerq.child = thd->timerq.next;
+        else
+            thd->timerq.prev->timerq.next = thd->timerq.next;
+
+        if(thd->timerq.next)
+            thd->timerq.next->timerq.prev = thd->timerq.prev;
+
+        sub = tq_merge_pairs(thd->timerq.child);
+        timer_queue = tq_meld(timer_queue, sub);
+    }
+
+    thd->timerq.child = NULL;
+    thd->timerq.next = NULL;
+    thd->timerq.prev = NULL;
 }
 
 /* Returns the top thread on the timer queue (next event). If nothing is
    queued, we'll return NULL. */
 static kthread_t * tq_next(void) {
-    return TAILQ_FIRST(&timer_queue);
+    return timer_queue;
 }
 
 int genwait_wait(void * obj, const char * mesg, int timeout, void (*callback)(void *)) {
+    return genwait_wait_ns(obj, mesg,
+                           timeout > 0 ? timeout * 1000000ull : 0, callback);
+}
+
+int genwait_wait_ns(void *obj, const char *mesg, uint64_t timeout,
+                    void (*callback)(void *)) {
     kthread_t   * me;
 
     /* Twiddle interrupt state */
@@ -84,9 +171,13 @@ int genwait_wait(void * obj, const char * mesg, int timeout, void (*callback)(vo
     me->wait_obj = obj;
     me->wait_msg = mesg;
 
-    if(timeout > 0) {
+#ifdef THD_STATS
+    me->stats_mark = timer_ns_gettime64();
+#endif
+
+    if(timeout) {
         /* If we have a timeout, insert us on the timer queue. */
-        me->wait_timeout = timer_ms_gettime64() + timeout;
+        me->wait_timeout = timer_ns_gettime64() + timeout;
         tq_insert(me);
     }
     else
@@ -111,6 +202,10 @@ static void genwait_unqueue(kthread_t * thd) {
         if(thd->wait_timeout)
             tq_remove(thd);
 
+#ifdef THD_STATS
+        thd_stats_wait_done(thd, timer_ns_gettime64());
+#endif
+
         /* Clean up wait stuff */
         thd->wait_obj = NULL;
         thd->wait_msg = NULL;
@@ -219,6 +314,21 @@ int genwait_wake_thd(void *obj, kthread_t *thd, int err) {
     return 0;
 }
 
+kthread_t *genwait_top_waiter(void *obj) {
+    kthread_t *t, *top = NULL;
+
+    irq_disable_scoped();
+
+    /* Find the highest priority match, favoring the one that has been waiting
+       the longest in case of a tie. */
+    TAILQ_FOREACH(t, &slpque[LOOKUP(obj)], thdq) {
+        if(t->wait_obj == obj && (!top || t->prio < top->prio))
+            top = t;
+    }
+
+    return top;
+}
+
 void genwait_check_timeouts(uint64 tm) {
     kthread_t   *t;
 
@@ -263,7 +373,7 @@ int genwait_init(void) {
     for(i = 0; i < TABLESIZE; i++)
         TAILQ_INIT(&slpque[i]);
 
-    TAILQ_INIT(&timer_queue);
+    timer_queue = NULL;
     return 0;
 }
 
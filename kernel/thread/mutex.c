@@ -35,11 +35,17 @@ mutex_t *mutex_create(void) {
     rv->dynamic = 1;
     rv->holder = NULL;
     rv->count = 0;
+    rv->flags = 0;
+    rv->pi_next = NULL;
 
     return rv;
 }
 
 int mutex_init(mutex_t *m, int mtype) {
+    const int flags = mtype & MUTEX_PRIO_INHERIT;
+
+    mtype &= ~MUTEX_PRIO_INHERIT;
+
     /* Check the type */
     if(mtype < MUTEX_TYPE_NORMAL || mtype > MUTEX_TYPE_RECURSIVE) {
         errno = EINVAL;
@@ -51,10 +57,89 @@ int mutex_init(mutex_t *m, int mtype) {
     m->dynamic = 0;
     m->holder = NULL;
     m->count = 0;
+    m->flags = flags;
+    m->pi_next = NULL;
 
     return 0;
 }
 
+/* Change the dynamic priority of a thread, moving it to its new run queue
+   bucket if it is currently queued. */
+static void mutex_set_prio(kthread_t *thd, prio_t prio, bool front_of_line) {
+    if(thd->flags & THD_QUEUED) {
+        thd_remove_from_runnable(thd);
+        thd->prio = prio;
+        thd_add_to_runnable(thd, front_of_line);
+    }
+    else {
+        thd->prio = prio;
+    }
+}
+
+/* Boost the holder of a priority inheritance mutex (and the holders of any
+   priority inheritance mutexes it is blocked on in turn) to the given
+   priority. Assumes interrupts are disabled. */
+static void mutex_pi_boost(mutex_t *m, prio_t prio) {
+    kthread_t *thd;
+
+    while(m && (thd = m->holder) && thd != IRQ_THREAD && thd->prio > prio) {
+        mutex_set_prio(thd, prio, true);
+        m = thd->pi_wait;
+    }
+}
+
+/* Recompute the dynamic priority of a thread from its static priority and the
+   highest priority waiter on each of the priority inheritance mutexes it still
+   holds, and let that propagate down the chain of mutexes it is blocked on.
+   Assumes interrupts are disabled. */
+static void mutex_pi_update(kthread_t *thd) {
+    kthread_t *top;
+    mutex_t *m;
+    prio_t prio;
+
+    while(thd && thd != IRQ_THREAD) {
+        prio = thd->real_prio;
+
+        for(m = thd->pi_held; m; m = m->pi_next) {
+            if((top = genwait_top_waiter(m)) && top->prio < prio)
+                prio = top->prio;
+        }
+
+        if(prio == thd->prio)
+            break;
+
+        mutex_set_prio(thd, prio, prio < thd->prio);
+
+        thd = thd->pi_wait ? thd->pi_wait->holder : NULL;
+    }
+}
+
+/* Record that the given thread now holds the mutex. */
+static void mutex_take(mutex_t *m, kthread_t *thd) {
+    m->holder = thd;
+    m->count = 1;
+
+    if((m->flags & MUTEX_PRIO_INHERIT) && thd != IRQ_THREAD) {
+        m->pi_next = thd->pi_held;
+        thd->pi_held = m;
+    }
+}
+
+/* Remove the mutex from the list of priority inheritance mutexes held by the
+   given thread. */
+static void mutex_pi_release(mutex_t *m, kthread_t *thd) {
+    mutex_t **i;
+
+    for(i = &thd->pi_held; *i; i = &(*i)->pi_next) {
+        if(*i == m) {
+            *i = m->pi_next;
+            break;
+        }
+    }
+
+    m->pi_next = NULL;
+}
+
 int mutex_destroy(mutex_t *m) {
     irq_disable_scoped();
 
@@ -92,7 +177,16 @@ int mutex_lock_irqsafe(mutex_t *m) {
 }
 
 int mutex_lock_timed(mutex_t *m, int timeout) {
-    uint64_t deadline = 0;
+    if(timeout < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return mutex_lock_timed_ns(m, timeout * 1000000ull);
+}
+
+int mutex_lock_timed_ns(mutex_t *m, uint64_t timeout) {
+    uint64_t deadline = 0, now;
     int rv = 0;
 
     if((rv = irq_inside_int())) {
@@ -104,11 +198,6 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
         return -1;
     }
 
-    if(timeout < 0) {
-        errno = EINVAL;
-        return -1;
-    }
-
     irq_disable_scoped();
 
     if(m->type < MUTEX_TYPE_NORMAL || m->type > MUTEX_TYPE_RECURSIVE) {
@@ -116,8 +205,7 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
         rv = -1;
     }
     else if(!m->count) {
-        m->count = 1;
-        m->holder = thd_current;
+        mutex_take(m, thd_current);
     }
     else if(m->type == MUTEX_TYPE_RECURSIVE && m->holder == thd_current) {
         if(m->count == INT_MAX) {
@@ -134,44 +222,54 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
     }
     else {
         if(timeout)
-            deadline = timer_ms_gettime64() + timeout;
+            deadline = timer_ns_gettime64() + timeout;
 
         for(;;) {
             /* Check whether we should boost priority. */
-            if (m->holder->prio >= thd_current->prio) {
-                m->holder->prio = thd_current->prio;
-
-                /* Reschedule if currently scheduled. */
-                if(m->holder->state == STATE_READY) {
-                    /* Thread list is sorted by priority, update the position
-                     * of the thread holding the lock */
-                    thd_remove_from_runnable(m->holder);
-                    thd_add_to_runnable(m->holder, true);
-                }
+            if(m->flags & MUTEX_PRIO_INHERIT) {
+                thd_current->pi_wait = m;
+                mutex_pi_boost(m, thd_current->prio);
+            }
+            else if(m->holder && m->holder != IRQ_THREAD &&
+                    m->holder->prio >= thd_current->prio) {
+                mutex_set_prio(m->holder, thd_current->prio, true);
             }
 
-            rv = genwait_wait(m, timeout ? "mutex_lock_timed" : "mutex_lock",
-                              timeout, NULL);
+            rv = genwait_wait_ns(m, timeout ? "mutex_lock_timed" : "mutex_lock",
+                                 timeout, NULL);
+            thd_current->pi_wait = NULL;
+
             if(rv < 0) {
                 errno = ETIMEDOUT;
                 break;
             }
 
+            /* A priority inheritance mutex is handed straight over to us. */
+            if(m->holder == thd_current)
+                break;
+
             if(!m->holder) {
-                m->holder = thd_current;
-                m->count = 1;
+                mutex_take(m, thd_current);
                 break;
             }
 
             if(timeout) {
-                timeout = deadline - timer_ms_gettime64();
-                if(timeout <= 0) {
+                now = timer_ns_gettime64();
+                if(now >= deadline) {
                     errno = ETIMEDOUT;
                     rv = -1;
                     break;
                 }
+
+                timeout = deadline - now;
             }
         }
+
+        /* We either hold the lock now, and have to inherit the priority of
+           whoever is still waiting on it, or we gave up, and the holder may
+           not need to be boosted any more. */
+        if(m->flags & MUTEX_PRIO_INHERIT)
+            mutex_pi_update(rv < 0 ? m->holder : thd_current);
     }
 
     return rv;
@@ -202,19 +300,17 @@ int mutex_trylock(mutex_t *m) {
         return -1;
     }
 
-    m->holder = thd;
+    if(!m->count) {
+        mutex_take(m, thd);
+        return 0;
+    }
 
     switch(m->type) {
         case MUTEX_TYPE_NORMAL:
         case MUTEX_TYPE_OLDNORMAL:
         case MUTEX_TYPE_ERRORCHECK:
-            if(m->count) {
-                errno = EDEADLK;
-                return -1;
-            }
-
-            m->count = 1;
-            break;
+            errno = EDEADLK;
+            return -1;
 
         case MUTEX_TYPE_RECURSIVE:
             if(m->count == INT_MAX) {
@@ -230,6 +326,7 @@ int mutex_trylock(mutex_t *m) {
 }
 
 static int mutex_unlock_common(mutex_t *m, kthread_t *thd) {
+    kthread_t *holder = m->holder, *next;
     int wakeup = 0;
 
     irq_disable_scoped();
@@ -271,10 +368,24 @@ static int mutex_unlock_common(mutex_t *m, kthread_t *thd) {
     }
 
     /* If we need to wake up a thread, do so. */
-    if(wakeup) {
+    if(wakeup && (m->flags & MUTEX_PRIO_INHERIT)) {
+        /* Drop whatever priority we inherited through this mutex. */
+        if(holder && holder != IRQ_THREAD) {
+            mutex_pi_release(m, holder);
+            mutex_pi_update(holder);
+        }
+
+        /* Hand the lock over to the highest priority waiter before waking it,
+           so that nothing of lower priority can take it in the meantime. */
+        if((next = genwait_top_waiter(m))) {
+            mutex_take(m, next);
+            genwait_wake_thd(m, next, 0);
+        }
+    }
+    else if(wakeup) {
         /* Restore real priority in case we were dynamically boosted. */
-        if (thd != IRQ_THREAD)
-            thd->prio = thd->real_prio;
+        if(thd != IRQ_THREAD && thd->prio != thd->real_prio)
+            mutex_set_prio(thd, thd->real_prio, false);
 
         genwait_wake_one(m);
     }
@@ -0,0 +1,309 @@
+/* KallistiOS ##version##
+
+   pool.c
+   Copyright (C) 2024 The KOS Team and contributors
+*/
+
+/* A thread pool with one job deque per worker thread. Jobs submitted from
+   the outside are handed out round-robin to the back of the workers' deques,
+   while jobs submitted from inside a running job go to the front of the
+   current worker's deque. Workers take their own jobs from the front, so
+   those children run soon, while their data is still warm. A worker whose
+   deque is empty steals from the back of the others' before going to sleep,
+   which gets it the oldest (and usually biggest) piece of work rather than
+   something its owner is about to need. Everything here is protected by
+   disabling interrupts, as is the case for the rest of the threading code. */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/queue.h>
+
+#include <arch/irq.h>
+#include <kos/genwait.h>
+#include <kos/once.h>
+#include <kos/tls.h>
+#include <kos/thread_pool.h>
+
+typedef struct pool_worker {
+    kthread_pool_t *pool;
+    kthread_t *thd;
+    kthread_pool_job_t *current;
+    kthread_wait_group_t *helping;
+    TAILQ_HEAD(pool_jobs, kthread_pool_job) jobs;
+} pool_worker_t;
+
+struct kthread_pool {
+    unsigned int count;
+    unsigned int next;
+    unsigned int helpers;
+    bool quit;
+    pool_worker_t workers[];
+};
+
+/* Each worker thread keeps a pointer to its worker structure in this key, so
+   that submitting a job doesn't have to search for it. */
+static kthread_key_t pool_key;
+static kthread_once_t pool_key_once = KTHREAD_ONCE_INIT;
+
+static void pool_key_init(void) {
+    kthread_key_create(&pool_key, NULL);
+}
+
+/* Find the worker structure of the calling thread, if it is part of the
+   pool. */
+static pool_worker_t *pool_self(kthread_pool_t *pool) {
+    pool_worker_t *w = kthread_getspecific(pool_key);
+
+    return (w && w->pool == pool) ? w : NULL;
+}
+
+/* Grab the next job for a worker: the newest of its own first, otherwise
+   steal the oldest one from another worker. Assumes interrupts are
+   disabled. */
+static kthread_pool_job_t *pool_take(kthread_pool_t *pool, pool_worker_t *w) {
+    kthread_pool_job_t *job;
+    unsigned int i, idx;
+
+    if((job = TAILQ_FIRST(&w->jobs))) {
+        TAILQ_REMOVE(&w->jobs, job, entry);
+        return job;
+    }
+
+    idx = w - pool->workers;
+
+    for(i = 1; i < pool->count; ++i) {
+        w = &pool->workers[(idx + i) % pool->count];
+
+        if((job = TAILQ_LAST(&w->jobs, pool_jobs))) {
+            TAILQ_REMOVE(&w->jobs, job, entry);
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+/* Mark one unit of work of a job done, completing it (and possibly its
+   parents) when nothing else is outstanding. */
+static void pool_finish(kthread_pool_t *pool, kthread_pool_job_t *job) {
+    kthread_pool_job_t *parent;
+    kthread_wait_group_t *group;
+    unsigned int i;
+
+    irq_disable_scoped();
+
+    while(job && !--job->pending) {
+        /* The job may be reused as soon as the group is signalled, so grab
+           everything we need from it first. */
+        parent = job->parent;
+        group = job->group;
+
+        if(group && !--group->count) {
+            genwait_wake_all(group);
+
+            /* Workers helping out in thd_pool_wait_group() sleep on the pool
+               rather than on the group, so wake just the ones waiting for
+               this group. */
+            for(i = 0; pool->helpers && i < pool->count; ++i) {
+                if(pool->workers[i].helping == group)
+                    genwait_wake_thd(pool, pool->workers[i].thd, 0);
+            }
+        }
+
+        job = parent;
+    }
+}
+
+static void pool_run(kthread_pool_t *pool, pool_worker_t *w,
+                     kthread_pool_job_t *job) {
+    kthread_pool_job_t *prev = w->current;
+
+    w->current = job;
+    job->routine(job->job.data);
+    w->current = prev;
+
+    pool_finish(pool, job);
+}
+
+static void *pool_thread(void *d) {
+    pool_worker_t *w = d;
+    kthread_pool_t *pool = w->pool;
+    kthread_pool_job_t *job;
+    uint32_t flags;
+
+    kthread_setspecific(pool_key, w);
+
+    for(;;) {
+        flags = irq_disable();
+
+        job = pool_take(pool, w);
+
+        if(!job) {
+            if(pool->quit) {
+                irq_restore(flags);
+                break;
+            }
+
+            genwait_wait(pool, "thd_pool", 0, NULL);
+            irq_restore(flags);
+            continue;
+        }
+
+        irq_restore(flags);
+
+        pool_run(pool, w, job);
+    }
+
+    return NULL;
+}
+
+kthread_pool_t *thd_pool_create_ex(const kthread_attr_t *attr,
+                                   unsigned int threads) {
+    kthread_pool_t *pool;
+    unsigned int i;
+    uint32_t flags;
+
+    if(!threads) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    kthread_once(&pool_key_once, pool_key_init);
+
+    pool = malloc(sizeof(*pool) + threads * sizeof(pool_worker_t));
+
+    if(!pool) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pool->count = 0;
+    pool->next = 0;
+    pool->helpers = 0;
+    pool->quit = false;
+
+    for(i = 0; i < threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].thd = NULL;
+        pool->workers[i].current = NULL;
+        pool->workers[i].helping = NULL;
+        TAILQ_INIT(&pool->workers[i].jobs);
+    }
+
+    /* Don't let any of the workers run until all of them exist. */
+    flags = irq_disable();
+
+    for(i = 0; i < threads; ++i) {
+        pool->workers[i].thd = thd_create_ex(attr, pool_thread,
+                                             &pool->workers[i]);
+
+        if(!pool->workers[i].thd) {
+            irq_restore(flags);
+            thd_pool_destroy(pool);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        if(!attr || !attr->label)
+            thd_set_label(pool->workers[i].thd, "[thd_pool]");
+
+        pool->count++;
+    }
+
+    irq_restore(flags);
+
+    return pool;
+}
+
+void thd_pool_destroy(kthread_pool_t *pool) {
+    unsigned int i;
+    uint32_t flags;
+
+    assert(pool != NULL);
+    assert(pool_self(pool) == NULL);
+
+    flags = irq_disable();
+    pool->quit = true;
+    genwait_wake_all(pool);
+    irq_restore(flags);
+
+    for(i = 0; i < pool->count; ++i)
+        thd_join(pool->workers[i].thd, NULL);
+
+    free(pool);
+}
+
+void thd_pool_submit(kthread_pool_t *pool, kthread_pool_job_t *job,
+                     kthread_wait_group_t *group) {
+    pool_worker_t *w = NULL;
+
+    assert(pool != NULL);
+    assert(job != NULL && job->routine != NULL);
+
+    irq_disable_scoped();
+
+    job->pending = 1;
+    job->group = group;
+    job->parent = NULL;
+
+    if(group)
+        group->count++;
+
+    if(!irq_inside_int())
+        w = pool_self(pool);
+
+    if(w && w->current) {
+        /* A child of the job currently running on this worker. */
+        job->parent = w->current;
+        job->parent->pending++;
+        TAILQ_INSERT_HEAD(&w->jobs, job, entry);
+    }
+    else {
+        w = &pool->workers[pool->next++ % pool->count];
+        TAILQ_INSERT_TAIL(&w->jobs, job, entry);
+    }
+
+    genwait_wake_one(pool);
+}
+
+int thd_pool_wait_group(kthread_pool_t *pool, kthread_wait_group_t *group) {
+    kthread_pool_job_t *job;
+    pool_worker_t *w;
+    uint32_t flags;
+
+    if(irq_inside_int()) {
+        errno = EPERM;
+        return -1;
+    }
+
+    w = pool_self(pool);
+    flags = irq_disable();
+
+    while(group->count) {
+        if(!w) {
+            genwait_wait(group, "thd_pool_wait_group", 0, NULL);
+            continue;
+        }
+
+        /* We're one of the pool's workers, so rather than blocking a thread
+           that could be doing useful work, help out until the group is
+           done. */
+        if((job = pool_take(pool, w))) {
+            irq_restore(flags);
+            pool_run(pool, w, job);
+            flags = irq_disable();
+        }
+        else {
+            pool->helpers++;
+            w->helping = group;
+            genwait_wait(pool, "thd_pool_wait_group", 0, NULL);
+            w->helping = NULL;
+            pool->helpers--;
+        }
+    }
+
+    irq_restore(flags);
+
+    return 0;
+}
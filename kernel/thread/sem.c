@@ -82,6 +82,16 @@ int sem_destroy(semaphore_t *sm) {
 
 /* Wait on a semaphore, with timeout (in milliseconds) */
 int sem_wait_timed(semaphore_t *sem, int timeout) {
+    /* Check for smarty clients */
+    if(timeout < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return sem_wait_timed_ns(sem, timeout * 1000000ull);
+}
+
+int sem_wait_timed_ns(semaphore_t *sem, uint64_t timeout) {
     int rv = 0;
 
     /* Make sure we're not inside an interrupt */
@@ -93,12 +103,6 @@ int sem_wait_timed(semaphore_t *sem, int timeout) {
         return -1;
     }
 
-    /* Check for smarty clients */
-    if(timeout < 0) {
-        errno = EINVAL;
-        return -1;
-    }
-
     /* Disable interrupts */
     irq_disable_scoped();
 
@@ -113,8 +117,8 @@ int sem_wait_timed(semaphore_t *sem, int timeout) {
     else {
         /* Block us until we're signaled */
         sem->count--;
-        rv = genwait_wait(sem, timeout ? "sem_wait_timed" : "sem_wait", timeout,
-                          NULL);
+        rv = genwait_wait_ns(sem, timeout ? "sem_wait_timed" : "sem_wait",
+                             timeout, NULL);
 
         /* Did we fail to get the lock? */
         if(rv < 0) {
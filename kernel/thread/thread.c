@@ -62,17 +62,47 @@ static alignas(8) uint8_t thd_idle_stack[64];
 /* Scheduler timer interrupt frequency (Hertz) */
 static unsigned int thd_sched_ms = 1000 / THD_SCHED_HZ;
 
+/* Tickless mode. When enabled, the primary timer is not re-armed for every
+   timeslice; instead it is programmed for the earlier of the next genwait
+   timeout and the end of the current timeslice, where the latter is only
+   taken into account if another (non-idle) thread is ready to run. */
+static bool thd_tickless = false;
+
+/* Longest we will let the primary timer go without firing in tickless mode,
+   just so that nothing can ever leave us asleep indefinitely. */
+#define THD_TICKLESS_MAX_MS 1000
+
+/* Absolute time (in ns) the primary timer is programmed to fire at, and (in
+   tickless mode) whether that is bounded by a timeslice already. */
+static uint64_t thd_timer_deadline;
+static bool thd_timer_sliced;
+
+/* End of the current timeslice when not in tickless mode. The primary timer
+   fires then, or earlier if a genwait timeout is due before it. */
+static uint64_t thd_tick_end;
+
 /* Thread list. This includes all threads except dead ones. */
 static struct ktlist thd_list;
 
 /* Run queue. This is more like on a standard time sharing system than the
-   previous versions. The top element of this priority queue should be the
-   thread that is ready to run next. When a thread is scheduled, it will be
-   removed from this queue. When it's de-scheduled, it will be re-inserted
-   by its priority value at the end of its priority group. Note that right
-   now this condition is being broken because sleeping threads are on the
-   same queue. We deal with those in thd_switch below. */
-static struct ktqueue run_queue;
+   previous versions. The queue is split into one FIFO bucket per priority
+   level, and a two-level bitmap records which buckets are non-empty, so that
+   enqueueing, dequeueing and finding the thread that is ready to run next are
+   all constant time operations regardless of how many threads exist. When a
+   thread is scheduled, it will be removed from its bucket. When it's
+   de-scheduled, it will be re-inserted at the end of its priority group (or
+   at the front, for front_of_line). Only threads in STATE_READY are ever
+   placed on the run queue. */
+#define RUNQ_BUCKETS    (PRIO_MAX + 1)
+#define RUNQ_WORDS      ((RUNQ_BUCKETS + 31) / 32)
+#define RUNQ_TOP_WORDS  ((RUNQ_WORDS + 31) / 32)
+
+static struct ktqueue run_queue[RUNQ_BUCKETS];
+
+/* One bit per priority level (set when the bucket is non-empty), and one bit
+   per word of run_queue_map (set when the word is non-zero). */
+static uint32_t run_queue_map[RUNQ_WORDS];
+static uint32_t run_queue_top[RUNQ_TOP_WORDS];
 
 /* The currently executing thread. This thread should not be on any queues. */
 kthread_t *thd_current = NULL;
@@ -143,7 +173,7 @@ int thd_pslist(int (*pf)(const char *fmt, ...)) {
             pf("%d\t", cur->prio);
 
         pf("%08lx  ", cur->flags);
-        pf("%12lu", (uint32_t)cur->wait_timeout);
+        pf("%12lu", (uint32_t)(cur->wait_timeout / 1000000));
 
         ns_time = perf_cntr_timer_ns();
         cpu_time = thd_get_cpu_time(cur);
@@ -161,22 +191,34 @@ int thd_pslist(int (*pf)(const char *fmt, ...)) {
 
 int thd_pslist_queue(int (*pf)(const char *fmt, ...)) {
     kthread_t *cur;
+    unsigned int w;
+    uint32_t bits;
+    prio_t prio;
 
     pf("Queued threads:\n");
     pf("addr\t\ttid\tprio\tflags\twait_timeout\tstate     name\n");
-    TAILQ_FOREACH(cur, &run_queue, thdq) {
-        pf("%08lx\t", CONTEXT_PC(cur->context));
-        pf("%d\t", cur->tid);
 
-        if(cur->prio == PRIO_MAX)
-            pf("MAX\t");
-        else
-            pf("%d\t", cur->prio);
-
-        pf("%08lx\t", cur->flags);
-        pf("%ld\t\t", (uint32_t)cur->wait_timeout);
-        pf("%10s", thd_state_to_str(cur));
-        pf("%s\n", cur->label);
+    /* Walk the non-empty buckets in priority order, which gives the same
+       ordering the scheduler will pick threads in. */
+    for(w = 0; w < RUNQ_WORDS; ++w) {
+        for(bits = run_queue_map[w]; bits; bits &= bits - 1) {
+            prio = w * 32 + __builtin_ctz(bits);
+
+            TAILQ_FOREACH(cur, &run_queue[prio], thdq) {
+                pf("%08lx\t", CONTEXT_PC(cur->context));
+                pf("%d\t", cur->tid);
+
+                if(cur->prio == PRIO_MAX)
+                    pf("MAX\t");
+                else
+                    pf("%d\t", cur->prio);
+
+                pf("%08lx\t", cur->flags);
+                pf("%ld\t\t", (uint32_t)(cur->wait_timeout / 1000000));
+                pf("%10s", thd_state_to_str(cur));
+                pf("%s\n", cur->label);
+            }
+        }
     }
 
     return 0;
@@ -305,57 +347,88 @@ void thd_exit(void *rv) {
 /*****************************************************************************/
 /* Thread creation and deletion */
 
+/* Mark the run queue bucket for the given priority as non-empty. */
+static inline void runq_set(prio_t prio) {
+    const unsigned int w = prio >> 5;
+
+    run_queue_map[w] |= 1u << (prio & 31);
+    run_queue_top[w >> 5] |= 1u << (w & 31);
+}
+
+/* Mark the run queue bucket for the given priority as empty. */
+static inline void runq_clear(prio_t prio) {
+    const unsigned int w = prio >> 5;
+
+    run_queue_map[w] &= ~(1u << (prio & 31));
+
+    if(!run_queue_map[w])
+        run_queue_top[w >> 5] &= ~(1u << (w & 31));
+}
+
+/* Returns the first thread of the highest priority (lowest value) non-empty
+   bucket, or NULL if the run queue is empty. */
+static inline kthread_t *runq_first(void) {
+    unsigned int i, w;
+
+    for(i = 0; i < RUNQ_TOP_WORDS; ++i) {
+        if(run_queue_top[i]) {
+            w = i * 32 + __builtin_ctz(run_queue_top[i]);
+            return TAILQ_FIRST(&run_queue[w * 32 +
+                                          __builtin_ctz(run_queue_map[w])]);
+        }
+    }
+
+    return NULL;
+}
+
 /* Enqueue a process in the runnable queue; adds it right after the
    process group of the same priority (front_of_line==0) or
    right before the process group of the same priority (front_of_line!=0).
    See thd_schedule for why this is helpful. */
 void thd_add_to_runnable(kthread_t *t, bool front_of_line) {
-    kthread_t *i;
-    int done;
-
     if(t->flags & THD_QUEUED)
         return;
 
-    done = 0;
+    if(front_of_line)
+        TAILQ_INSERT_HEAD(&run_queue[t->prio], t, thdq);
+    else
+        TAILQ_INSERT_TAIL(&run_queue[t->prio], t, thdq);
 
-    if(!front_of_line) {
-        /* Look for a thread of lower priority and insert
-           before it. If there is nothing on the run queue, we'll
-           fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio > t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
-                break;
-            }
-        }
-    }
-    else {
-        /* Look for a thread of the same or lower priority and
-           insert before it. If there is nothing on the run queue,
-           we'll fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio >= t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
-                break;
-            }
-        }
-    }
+    runq_set(t->prio);
+    t->flags |= THD_QUEUED;
 
-    /* Didn't find one, put it at the end */
-    if(!done)
-        TAILQ_INSERT_TAIL(&run_queue, t, thdq);
+#ifdef THD_STATS
+    t->stats_mark = timer_ns_gettime64();
+#endif
 
-    t->flags |= THD_QUEUED;
+    /* In tickless mode, the timer may be programmed far beyond the end of a
+       timeslice since there was nothing to share the CPU with. That is no
+       longer the case, so pull the wakeup in. */
+    if(thd_tickless && !thd_timer_sliced && t != thd_idle_thd) {
+        const uint64_t now = timer_ns_gettime64();
+        const uint64_t slice = thd_sched_ms * 1000000ull;
+
+        thd_timer_sliced = true;
+
+        if(thd_timer_deadline > now + slice) {
+            thd_timer_deadline = now + slice;
+            timer_primary_wakeup_ns(slice);
+        }
+    }
 }
 
-/* Removes a thread from the runnable queue, if it's there. */
+/* Removes a thread from the runnable queue, if it's there. Note that the
+   thread's priority must not have changed since it was enqueued, since that
+   is what selects its bucket. */
 int thd_remove_from_runnable(kthread_t *thd) {
     if(!(thd->flags & THD_QUEUED)) return 0;
 
     thd->flags &= ~THD_QUEUED;
-    TAILQ_REMOVE(&run_queue, thd, thdq);
+    TAILQ_REMOVE(&run_queue[thd->prio], thd, thdq);
+
+    if(TAILQ_EMPTY(&run_queue[thd->prio]))
+        runq_clear(thd->prio);
+
     return 0;
 }
 
@@ -626,8 +699,19 @@ int thd_set_prio(kthread_t *thd, prio_t prio) {
     if((prio < 0) || (prio > PRIO_MAX))
         return -2;
 
-    /* Set the new priority */
-    thd->prio = prio;
+    irq_disable_scoped();
+
+    /* Set the new priority, moving the thread to its new run queue bucket
+       if it is currently queued. */
+    if(thd->flags & THD_QUEUED) {
+        thd_remove_from_runnable(thd);
+        thd->prio = prio;
+        thd_add_to_runnable(thd, false);
+    }
+    else {
+        thd->prio = prio;
+    }
+
     thd->real_prio = prio;
     return 0;
 }
@@ -635,6 +719,99 @@ int thd_set_prio(kthread_t *thd, prio_t prio) {
 /*****************************************************************************/
 /* Scheduling routines */
 
+/* Program the primary timer for the next event we actually care about in
+   tickless mode. Assumes interrupts are disabled and that thd_current has
+   already been chosen. */
+static void thd_tickless_arm(uint64_t now) {
+    const kthread_t *next = runq_first();
+    const uint64_t slice = thd_sched_ms * 1000000ull;
+    const uint64_t max = THD_TICKLESS_MAX_MS * 1000000ull;
+    uint64_t deadline = genwait_next_timeout();
+    bool sliced = next && next != thd_idle_thd;
+
+    /* Only preempt at the end of the timeslice if there is someone else that
+       could use the CPU. */
+    if(sliced && (!deadline || deadline > now + slice))
+        deadline = now + slice;
+
+    if(!deadline || deadline > now + max)
+        deadline = now + max;
+    else if(deadline <= now)
+        deadline = now + 1;
+
+    thd_timer_deadline = deadline;
+    thd_timer_sliced = sliced;
+    timer_primary_wakeup_ns(deadline - now);
+}
+
+/* Program the primary timer when not in tickless mode: for the end of the
+   timeslice, or for the next genwait timeout if that comes first, so that
+   timeouts aren't rounded up to the next tick. Assumes interrupts are
+   disabled. */
+static void thd_periodic_arm(uint64_t now) {
+    uint64_t deadline = genwait_next_timeout();
+
+    if(now >= thd_tick_end)
+        thd_tick_end = now + thd_sched_ms * 1000000ull;
+
+    if(!deadline || deadline > thd_tick_end)
+        deadline = thd_tick_end;
+    else if(deadline <= now)
+        deadline = now + 1;
+
+    thd_timer_deadline = deadline;
+    timer_primary_wakeup_ns(deadline - now);
+}
+
+#ifdef THD_STATS
+/* Set when the scheduler is entered because the current thread asked for it
+   (by blocking or yielding) rather than because it was preempted. */
+static bool thd_stats_voluntary;
+
+/* Account for a context switch from prev to next. */
+static void thd_stats_switch(kthread_t *prev, kthread_t *next, uint64_t now) {
+    uint64_t latency;
+
+    if(prev == next)
+        return;
+
+    if(thd_stats_voluntary || prev->state != STATE_READY)
+        prev->stats.voluntary_switches++;
+    else
+        prev->stats.involuntary_switches++;
+
+    latency = now - next->stats_mark;
+    next->stats.dispatches++;
+    next->stats.ready_time += latency;
+
+    if(latency > next->stats.ready_max)
+        next->stats.ready_max = latency;
+}
+
+void thd_stats_wait_done(kthread_t *thd, uint64_t now) {
+    kthread_wait_stats_t *w = thd->stats.waits;
+    const char *mesg = thd->wait_msg ? thd->wait_msg : "wait";
+    int i;
+
+    /* Find the slot for this message, or the first free one. */
+    for(i = 0; i < THD_STATS_WAITS - 1; ++i, ++w) {
+        if(!w->mesg || w->mesg == mesg || !strcmp(w->mesg, mesg))
+            break;
+    }
+
+    if(!w->mesg)
+        w->mesg = mesg;
+    else if(i == THD_STATS_WAITS - 1 && w->mesg != mesg &&
+            strcmp(w->mesg, mesg))
+        w->mesg = "other";
+
+    w->count++;
+    w->time += now - thd->stats_mark;
+}
+#else
+#define thd_stats_switch(prev, next, now) ((void)(prev))
+#endif
+
 static void thd_update_cpu_time(kthread_t *thd) {
     const uint64_t ns = perf_cntr_timer_ns();
 
@@ -661,10 +838,10 @@ static void thd_update_cpu_time(kthread_t *thd) {
    don't want a full context switch inside the same priority group.
 */
 void thd_schedule(bool front_of_line, uint64_t now) {
-    kthread_t *thd;
+    kthread_t *thd, *prev = thd_current;
 
     if(now == 0)
-        now = timer_ms_gettime64();
+        now = timer_ns_gettime64();
 
     /* If there's only two thread left, it's the idle task and the reaper task:
        exit the OS */
@@ -683,14 +860,10 @@ void thd_schedule(bool front_of_line, uint64_t now) {
     /* Look for timed out waits */
     genwait_check_timeouts(now);
 
-    /* Search downwards through the run queue for a runnable thread; if
-       we don't find a normal runnable thread, the idle process will
-       always be there at the bottom. */
-    TAILQ_FOREACH(thd, &run_queue, thdq) {
-        /* Is it runnable? If not, keep going */
-        if(thd->state == STATE_READY)
-            break;
-    }
+    /* Grab the first thread of the highest priority group; if there is no
+       normal runnable thread, the idle process will always be there at the
+       bottom. */
+    thd = runq_first();
 
     /* If we didn't already re-enqueue the thread and we are supposed to do so,
        do it now. */
@@ -715,6 +888,7 @@ void thd_schedule(bool front_of_line, uint64_t now) {
     thd_remove_from_runnable(thd);
 
     thd_update_cpu_time(thd);
+    thd_stats_switch(prev, thd, now);
 
     thd_current = thd;
     _impure_ptr = &thd->thd_reent;
@@ -730,6 +904,18 @@ void thd_schedule(bool front_of_line, uint64_t now) {
     }
 
     irq_set_context(&thd_current->context);
+
+    if(thd_tickless) {
+        thd_tickless_arm(now);
+    }
+    else {
+        /* A thread may have just started waiting on a timeout that is due
+           before the timer is going to fire. */
+        uint64_t deadline = genwait_next_timeout();
+
+        if(deadline && deadline < thd_timer_deadline)
+            thd_periodic_arm(now);
+    }
 }
 
 /* Temporary priority boosting function: call this from within an interrupt
@@ -761,6 +947,7 @@ void thd_schedule_next(kthread_t *thd) {
     thd_remove_from_runnable(thd);
 
     thd_update_cpu_time(thd);
+    thd_stats_switch(thd_current, thd, timer_ns_gettime64());
 
     thd_current = thd;
     _impure_ptr = &thd->thd_reent;
@@ -770,12 +957,18 @@ void thd_schedule_next(kthread_t *thd) {
 
 /* See kos/thread.h for description */
 irq_context_t *thd_choose_new(void) {
-    uint64_t now = timer_ms_gettime64();
+    uint64_t now = timer_ns_gettime64();
 
     //printf("thd_choose_new() woken at %d\n", (uint32_t)now);
 
     /* Do any re-scheduling */
+#ifdef THD_STATS
+    thd_stats_voluntary = true;
+    thd_schedule(0, now);
+    thd_stats_voluntary = false;
+#else
     thd_schedule(0, now);
+#endif
 
     /* Return the new IRQ context back to the caller */
     return &thd_current->context;
@@ -789,14 +982,23 @@ irq_context_t *thd_choose_new(void) {
    threads, swap out contexts, and sleep. */
 static void thd_timer_hnd(irq_context_t *context) {
     /* Get the system time */
-    uint64_t now = timer_ms_gettime64();
+    uint64_t now = timer_ns_gettime64();
 
     (void)context;
 
     //printf("timer woke at %d\n", (uint32_t)now);
 
-    thd_schedule(0, now);
-    timer_primary_wakeup(thd_sched_ms);
+    /* In tickless mode, thd_schedule() programs the timer itself. */
+    if(thd_tickless) {
+        thd_schedule(0, now);
+        return;
+    }
+
+    /* If we were woken before the end of the timeslice, it was for a timeout,
+       so wake whoever it was for without taking the CPU away from the current
+       thread's priority group. */
+    thd_schedule(now < thd_tick_end, now);
+    thd_periodic_arm(now);
 }
 
 /*****************************************************************************/
@@ -805,17 +1007,21 @@ static void thd_timer_hnd(irq_context_t *context) {
    sleep because it eases the load on the system for the other
    threads. */
 void thd_sleep(unsigned int ms) {
+    thd_sleep_ns(ms * 1000000ull);
+}
+
+void thd_sleep_ns(uint64_t ns) {
     /* This should never happen. This should, perhaps, assert. */
     if(thd_mode == THD_MODE_NONE) {
         dbglog(DBG_WARNING, "thd_sleep called when threading not "
                "initialized.\n");
-        timer_spin_sleep(ms);
+        timer_spin_sleep((ns + 999999) / 1000000);
         return;
     }
 
     /* A timeout of zero is the same as thd_pass() and passing zero
-       down to genwait_wait() causes bad juju. */
-    if(!ms) {
+       down to genwait_wait_ns() causes bad juju. */
+    if(!ns) {
         thd_pass();
         return;
     }
@@ -825,7 +1031,7 @@ void thd_sleep(unsigned int ms) {
        sleep cases into a single case, which is nice for scheduling
        purposes. 0xffffffff definitely doesn't exist as an object, so we'll
        use that for straight up timeouts. */
-    genwait_wait((void *)0xffffffff, "thd_sleep", ms, NULL);
+    genwait_wait_ns((void *)0xffffffff, "thd_sleep", ns, NULL);
 }
 
 /* Manually cause a re-schedule */
@@ -973,6 +1179,46 @@ uint64_t thd_get_cpu_time(kthread_t *thd) {
     return thd->cpu_time.total;
 }
 
+int thd_get_stats(kthread_t *thd, kthread_stats_t *stats) {
+#ifdef THD_STATS
+    if(!thd)
+        thd = thd_current;
+
+    irq_disable_scoped();
+    *stats = thd->stats;
+
+    return 0;
+#else
+    (void)thd;
+    (void)stats;
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int thd_reset_stats(kthread_t *thd) {
+#ifdef THD_STATS
+    irq_disable_scoped();
+
+    if(thd) {
+        memset(&thd->stats, 0, sizeof(thd->stats));
+    }
+    else {
+        LIST_FOREACH(thd, &thd_list, t_list) {
+            memset(&thd->stats, 0, sizeof(thd->stats));
+        }
+    }
+
+    return 0;
+#else
+    (void)thd;
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 /*****************************************************************************/
 
 /* Change threading modes */
@@ -1000,6 +1246,28 @@ int thd_set_hz(unsigned int hertz) {
     return 0;
 }
 
+bool thd_get_tickless(void) {
+    return thd_tickless;
+}
+
+void thd_set_tickless(bool enable) {
+    irq_disable_scoped();
+
+    if(thd_tickless == enable)
+        return;
+
+    thd_tickless = enable;
+
+    /* Nothing to re-arm if the scheduler isn't running yet. */
+    if(thd_mode == THD_MODE_NONE)
+        return;
+
+    if(enable)
+        thd_tickless_arm(timer_ns_gettime64());
+    else
+        thd_periodic_arm(timer_ns_gettime64());
+}
+
 /* Delete a TLS key. Note that currently this doesn't prevent you from reusing
    the key after deletion. This seems ok, as the pthreads standard states that
    using the key after deletion results in "undefined behavior".
@@ -1065,6 +1333,7 @@ int thd_init(void) {
     };
 
     kthread_t *kern;
+    int i;
 
     /* Make sure we're not already running */
     if(thd_mode != THD_MODE_NONE)
@@ -1080,7 +1349,11 @@ int thd_init(void) {
     LIST_INIT(&thd_list);
 
     /* Initialize the run queue */
-    TAILQ_INIT(&run_queue);
+    for(i = 0; i < RUNQ_BUCKETS; ++i)
+        TAILQ_INIT(&run_queue[i]);
+
+    memset(run_queue_map, 0, sizeof(run_queue_map));
+    memset(run_queue_top, 0, sizeof(run_queue_top));
 
     /* Start off with no "current" thread */
     thd_current = NULL;
@@ -1123,9 +1396,13 @@ int thd_init(void) {
     timer_primary_set_callback(thd_timer_hnd);
 
     /* Schedule our first wakeup */
-    timer_primary_wakeup(thd_sched_ms);
+    if(thd_tickless)
+        thd_tickless_arm(timer_ns_gettime64());
+    else
+        thd_periodic_arm(timer_ns_gettime64());
 
-    dbglog(DBG_DEBUG, "thd: pre-emption enabled, HZ=%u\n", thd_get_hz());
+    dbglog(DBG_DEBUG, "thd: pre-emption enabled, HZ=%u%s\n", thd_get_hz(),
+           thd_tickless ? " (tickless)" : "");
 
     return 0;
 }
@@ -0,0 +1,128 @@
+/* KallistiOS ##version##
+
+   utils/blockcache_bench/bench_kos.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* The parts of the kernel that the block cache needs, on top of host threads.
+   Locks spin, and condition variables are polled, which is slow but plenty for
+   one cache and its write-back thread. Time runs TIME_SCALE times faster than
+   it really does, so the write-back thread doesn't take seconds to test. This
+   is also what libkosext2fs uses outside of KOS (see its Makefile.nonkos), with
+   TIME_SCALE set to 1. */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <kos/mutex.h>
+#include <kos/cond.h>
+#include <kos/thread.h>
+#include <arch/timer.h>
+
+#ifndef TIME_SCALE
+#define TIME_SCALE  100
+#endif
+
+kthread_t *thd_current = NULL;
+
+void dbglog(int level, const char *fmt, ...) {
+    va_list ap;
+
+    (void)level;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+static uint64_t real_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t timer_us_gettime64(void) {
+    return real_us() * TIME_SCALE;
+}
+
+uint64_t timer_ms_gettime64(void) {
+    return timer_us_gettime64() / 1000;
+}
+
+/* Threads */
+static kthread_t thd_dummy;
+
+kthread_t *thd_create_ex(const kthread_attr_t *attr,
+                         void *(*routine)(void *param), void *param) {
+    pthread_t thd;
+
+    (void)attr;
+
+    if(pthread_create(&thd, NULL, routine, param))
+        return NULL;
+
+    pthread_detach(thd);
+    return &thd_dummy;
+}
+
+/* Mutexes */
+int mutex_init(mutex_t *m, int mtype) {
+    memset(m, 0, sizeof(mutex_t));
+    m->type = mtype;
+    return 0;
+}
+
+int mutex_destroy(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int mutex_lock(mutex_t *m) {
+    while(__atomic_exchange_n(&m->count, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    return 0;
+}
+
+int mutex_unlock(mutex_t *m) {
+    __atomic_store_n(&m->count, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Condition variables: signals bump a counter that waiters poll. */
+int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
+    int gen = __atomic_load_n(&cv->dummy, __ATOMIC_ACQUIRE);
+    uint64_t end = real_us() + (uint64_t)timeout * 1000 / TIME_SCALE;
+    struct timespec ts = { 0, 100000 };
+    int rv = -1;
+
+    mutex_unlock(m);
+
+    while(!timeout || real_us() < end) {
+        if(__atomic_load_n(&cv->dummy, __ATOMIC_ACQUIRE) != gen) {
+            rv = 0;
+            break;
+        }
+
+        nanosleep(&ts, NULL);
+    }
+
+    mutex_lock(m);
+
+    if(rv)
+        errno = ETIMEDOUT;
+
+    return rv;
+}
+
+int cond_signal(condvar_t *cv) {
+    __atomic_add_fetch(&cv->dummy, 1, __ATOMIC_RELEASE);
+    return 0;
+}
@@ -0,0 +1,486 @@
+/* KallistiOS ##version##
+
+   utils/blockcache_bench/blockcache_bench.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Tests the block cache against a block device backed by a file, and then
+   times it against the kind of cache the filesystems had before it: an array
+   kept in LRU order, searched from the most recently used end, with entries
+   shifted down to move one to the back.
+
+   Usage: blockcache_bench [-t] [-n lookups]
+
+   With -t, only the tests are run. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <kos/blockcache.h>
+#include <arch/timer.h>
+
+#define BLOCK_LOG       9
+#define BLOCK_SIZE      (1 << BLOCK_LOG)
+#define DEV_BLOCKS      65536
+
+/* The device: a temporary file, with each block filled with its number. */
+typedef struct file_dev {
+    FILE *fp;
+    uint32_t reads;
+    uint32_t writes;
+    int fail_writes;
+} file_dev_t;
+
+static int file_read_blocks(kos_blockdev_t *d, uint64_t block, size_t count,
+                            void *buf) {
+    file_dev_t *fd = (file_dev_t *)d->dev_data;
+
+    ++fd->reads;
+
+    if(block + count > DEV_BLOCKS ||
+       pread(fileno(fd->fp), buf, count << BLOCK_LOG, block << BLOCK_LOG) !=
+       (ssize_t)(count << BLOCK_LOG)) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int file_write_blocks(kos_blockdev_t *d, uint64_t block, size_t count,
+                             const void *buf) {
+    file_dev_t *fd = (file_dev_t *)d->dev_data;
+
+    ++fd->writes;
+
+    if(fd->fail_writes || block + count > DEV_BLOCKS ||
+       pwrite(fileno(fd->fp), buf, count << BLOCK_LOG, block << BLOCK_LOG) !=
+       (ssize_t)(count << BLOCK_LOG)) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+static uint64_t file_count_blocks(kos_blockdev_t *d) {
+    (void)d;
+    return DEV_BLOCKS;
+}
+
+static file_dev_t file_dev;
+static kos_blockdev_t dev = {
+    .dev_data = &file_dev,
+    .l_block_size = BLOCK_LOG,
+    .read_blocks = file_read_blocks,
+    .write_blocks = file_write_blocks,
+    .count_blocks = file_count_blocks
+};
+
+static int dev_open(void) {
+    uint32_t buf[BLOCK_SIZE / 4];
+    uint32_t i, j;
+
+    if(!(file_dev.fp = tmpfile())) {
+        perror("tmpfile");
+        return -1;
+    }
+
+    for(i = 0; i < DEV_BLOCKS; ++i) {
+        for(j = 0; j < BLOCK_SIZE / 4; ++j)
+            buf[j] = i;
+
+        fwrite(buf, sizeof(buf), 1, file_dev.fp);
+    }
+
+    fflush(file_dev.fp);
+    return 0;
+}
+
+static uint32_t dev_block_value(uint64_t block) {
+    uint32_t v = 0;
+
+    if(pread(fileno(file_dev.fp), &v, 4, block << BLOCK_LOG) != 4)
+        return (uint32_t)-1;
+
+    return v;
+}
+
+/* Tests */
+static int failed;
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            printf("  FAILED at line %d: %s\n", __LINE__, #cond); \
+            ++failed; \
+        } \
+    } while(0)
+
+static void test_read(void) {
+    blockcache_t *bc = blockcache_create(&dev, 4, 16 * 4 * BLOCK_SIZE, 0);
+    blockcache_stats_t st;
+    uint32_t *data;
+    uint32_t i, reads;
+    int err;
+
+    printf("reading through the cache\n");
+
+    for(i = 0; i < 64; ++i) {
+        data = (uint32_t *)blockcache_get(bc, i * 4, 0, &err);
+        CHECK(data && data[0] == i * 4 && data[3 * BLOCK_SIZE / 4] == i * 4 + 3);
+    }
+
+    /* The last 16 are still there, the first ones aren't. */
+    reads = file_dev.reads;
+
+    for(i = 48; i < 64; ++i)
+        CHECK(blockcache_get(bc, i * 4, 0, &err));
+
+    CHECK(file_dev.reads == reads);
+    CHECK(blockcache_get(bc, 0, 0, &err) && file_dev.reads == reads + 1);
+
+    /* Reads off the end of the device fail. The first one still pushes an entry
+       out, but the second reuses the empty one it left. */
+    CHECK(!blockcache_get(bc, DEV_BLOCKS, 0, &err) && err == EIO);
+    CHECK(!blockcache_get(bc, DEV_BLOCKS, 0, &err) && err == EIO);
+
+    blockcache_get_stats(bc, &st);
+    CHECK(st.entries == 16 && st.hits == 16 && st.misses == 65);
+    CHECK(st.evictions == 50);
+
+    blockcache_invalidate(bc);
+    reads = file_dev.reads;
+    CHECK(blockcache_get(bc, 63 * 4, 0, &err) && file_dev.reads == reads + 1);
+
+    blockcache_destroy(bc);
+}
+
+static void test_write(void) {
+    blockcache_t *bc = blockcache_create(&dev, 1, 4 * BLOCK_SIZE, 0);
+    uint32_t *data;
+    uint32_t i;
+    int err;
+
+    printf("writing back dirty entries\n");
+
+    /* Dirty entries get written when they're pushed out... */
+    data = (uint32_t *)blockcache_get(bc, 100, 0, &err);
+    data[0] = 0x12345678;
+    CHECK(!blockcache_mark_dirty(bc, 100));
+    CHECK(blockcache_mark_dirty(bc, 101) == -1);
+
+    for(i = 0; i < 4; ++i)
+        CHECK(blockcache_get(bc, 200 + i, 0, &err));
+
+    CHECK(dev_block_value(100) == 0x12345678);
+
+    /* ...and when the cache is synced. */
+    data = (uint32_t *)blockcache_get(bc, 300, BLOCKCACHE_NOREAD, &err);
+    memset(data, 0, BLOCK_SIZE);
+    blockcache_mark_dirty(bc, 300);
+    CHECK(dev_block_value(300) == 300);
+    CHECK(!blockcache_sync(bc));
+    CHECK(dev_block_value(300) == 0);
+
+    /* Invalidating throws dirty data away. */
+    data = (uint32_t *)blockcache_get(bc, 400, 0, &err);
+    data[0] = 0;
+    blockcache_mark_dirty(bc, 400);
+    blockcache_invalidate(bc);
+    CHECK(dev_block_value(400) == 400);
+
+    /* A block that can't be written back stays dirty, but doesn't stop the
+       others being replaced. */
+    data = (uint32_t *)blockcache_get(bc, 450, 0, &err);
+    data[0] = 0;
+    blockcache_mark_dirty(bc, 450);
+    file_dev.fail_writes = 1;
+
+    for(i = 0; i < 8; ++i)
+        CHECK(blockcache_get(bc, 600 + i, 0, &err));
+
+    CHECK(blockcache_sync(bc) == -1);
+    file_dev.fail_writes = 0;
+    CHECK(!blockcache_sync(bc));
+    CHECK(dev_block_value(450) == 0);
+
+    blockcache_destroy(bc);
+}
+
+static void test_pin(void) {
+    blockcache_t *bc = blockcache_create(&dev, 1, 4 * BLOCK_SIZE, 0);
+    uint8_t *pinned[4];
+    uint32_t i, reads;
+    int err;
+
+    printf("pinning entries\n");
+
+    pinned[0] = blockcache_get(bc, 10, BLOCKCACHE_PIN, &err);
+
+    for(i = 0; i < 16; ++i)
+        CHECK(blockcache_get(bc, 20 + i, 0, &err));
+
+    reads = file_dev.reads;
+    CHECK(blockcache_get(bc, 10, 0, &err) == pinned[0]);
+    CHECK(file_dev.reads == reads);
+
+    /* With everything pinned, there's no room for anything else. */
+    for(i = 1; i < 4; ++i)
+        pinned[i] = blockcache_get(bc, 10 + i, BLOCKCACHE_PIN, &err);
+
+    CHECK(!blockcache_get(bc, 50, 0, &err) && err == ENOBUFS);
+
+    blockcache_unpin(bc, pinned[2]);
+    CHECK(blockcache_get(bc, 50, 0, &err));
+    CHECK(blockcache_get(bc, 10, 0, &err) == pinned[0]);
+
+    for(i = 0; i < 4; ++i)
+        blockcache_unpin(bc, pinned[i]);
+
+    /* Invalidating leaves a pinned entry's data alone until it's unpinned. */
+    pinned[0] = blockcache_get(bc, 10, BLOCKCACHE_PIN, &err);
+    blockcache_invalidate(bc);
+
+    for(i = 0; i < 8; ++i)
+        CHECK(blockcache_get(bc, 20 + i, 0, &err) != pinned[0]);
+
+    CHECK(*(uint32_t *)pinned[0] == 10);
+    blockcache_unpin(bc, pinned[0]);
+    CHECK(blockcache_get(bc, 30, 0, &err) == pinned[0]);
+
+    blockcache_destroy(bc);
+}
+
+static void test_writeback(void) {
+    blockcache_t *bc = blockcache_create(&dev, 1, 4 * BLOCK_SIZE,
+                                         BLOCKCACHE_WRITEBACK);
+    uint32_t *data;
+    uint64_t start;
+    int err;
+
+    printf("writing back in the background\n");
+
+    data = (uint32_t *)blockcache_get(bc, 500, 0, &err);
+    data[0] = 0xdeadbeef;
+    blockcache_mark_dirty(bc, 500);
+    CHECK(dev_block_value(500) == 500);
+
+    start = timer_ms_gettime64();
+
+    while(dev_block_value(500) != 0xdeadbeef &&
+          timer_ms_gettime64() - start < 4 * BLOCKCACHE_WB_AGE)
+        usleep(1000);
+
+    CHECK(dev_block_value(500) == 0xdeadbeef);
+    CHECK(timer_ms_gettime64() - start >= BLOCKCACHE_WB_AGE / 2);
+
+    blockcache_destroy(bc);
+}
+
+/* The old way: an array of entries from least to most recently used. */
+typedef struct old_entry {
+    uint8_t *data;
+    uint64_t block;
+    int valid;
+} old_entry_t;
+
+typedef struct old_cache {
+    old_entry_t **e;
+    int count;
+    size_t entry_blocks;
+} old_cache_t;
+
+static old_cache_t *old_create(size_t entry_blocks, int count) {
+    old_cache_t *c = malloc(sizeof(old_cache_t));
+    int i;
+
+    c->e = malloc(sizeof(old_entry_t *) * count);
+    c->count = count;
+    c->entry_blocks = entry_blocks;
+
+    for(i = 0; i < count; ++i) {
+        c->e[i] = calloc(1, sizeof(old_entry_t));
+        c->e[i]->data = malloc(entry_blocks << BLOCK_LOG);
+    }
+
+    return c;
+}
+
+static void old_destroy(old_cache_t *c) {
+    int i;
+
+    for(i = 0; i < c->count; ++i) {
+        free(c->e[i]->data);
+        free(c->e[i]);
+    }
+
+    free(c->e);
+    free(c);
+}
+
+static void old_make_mru(old_cache_t *c, int i) {
+    old_entry_t *tmp = c->e[i];
+
+    for(; i < c->count - 1; ++i)
+        c->e[i] = c->e[i + 1];
+
+    c->e[c->count - 1] = tmp;
+}
+
+static uint8_t *old_get(old_cache_t *c, uint64_t block) {
+    int i;
+
+    for(i = c->count - 1; i >= 0; --i) {
+        if(c->e[i]->valid && c->e[i]->block == block) {
+            old_make_mru(c, i);
+            return c->e[c->count - 1]->data;
+        }
+    }
+
+    if(dev.read_blocks(&dev, block, c->entry_blocks, c->e[0]->data))
+        return NULL;
+
+    c->e[0]->block = block;
+    c->e[0]->valid = 1;
+    old_make_mru(c, 0);
+    return c->e[c->count - 1]->data;
+}
+
+/* Benchmarks, timed with the real clock (the kernel's runs fast here). */
+static uint32_t rng = 1;
+static volatile uint32_t sink;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t rand_next(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* Random lookups over twice as many entries as fit, with 80% of them going
+   to a fifth of those. Sequential lookups go through each entry a block at a
+   time, like reading a file does. */
+static uint64_t pattern(int seq, uint32_t i, int count, size_t entry_blocks) {
+    uint32_t span = count * 2;
+
+    if(seq)
+        return ((i / entry_blocks) % (DEV_BLOCKS / entry_blocks)) *
+               entry_blocks;
+
+    if(rand_next() % 10 < 8)
+        return (rand_next() % (span / 5)) * entry_blocks;
+
+    return (rand_next() % span) * entry_blocks;
+}
+
+static void bench(int seq, int count, size_t entry_blocks, uint32_t lookups) {
+    blockcache_t *bc;
+    old_cache_t *oc;
+    blockcache_stats_t st;
+    uint64_t start, t_old, t_new;
+    uint32_t i, r_old, r_new;
+    int err;
+
+    oc = old_create(entry_blocks, count);
+    bc = blockcache_create(&dev, entry_blocks,
+                           (size_t)count * (entry_blocks << BLOCK_LOG), 0);
+
+    rng = 1;
+    r_old = file_dev.reads;
+    start = now_us();
+
+    for(i = 0; i < lookups; ++i)
+        sink = *old_get(oc, pattern(seq, i, count, entry_blocks));
+
+    t_old = now_us() - start;
+    r_old = file_dev.reads - r_old;
+
+    rng = 1;
+    r_new = file_dev.reads;
+    start = now_us();
+
+    for(i = 0; i < lookups; ++i)
+        sink = *blockcache_get(bc, pattern(seq, i, count, entry_blocks), 0,
+                               &err);
+
+    t_new = now_us() - start;
+    r_new = file_dev.reads - r_new;
+
+    blockcache_get_stats(bc, &st);
+
+    printf("%-10s  %5d x %5d  %8u %8u  %6.1f%%  %8.3f %8.3f\n",
+           seq ? "sequential" : "random", count,
+           (int)(entry_blocks << BLOCK_LOG), r_old, r_new,
+           100.0 * st.hits / lookups,
+           (double)t_old / lookups, (double)t_new / lookups);
+
+    blockcache_destroy(bc);
+    old_destroy(oc);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t lookups = 200000;
+    int tests_only = 0, opt;
+    static const int counts[] = { 16, 64, 256, 1024 };
+    size_t i;
+
+    while((opt = getopt(argc, argv, "tn:")) != -1) {
+        switch(opt) {
+            case 't':
+                tests_only = 1;
+                break;
+
+            case 'n':
+                lookups = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-t] [-n lookups]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(dev_open())
+        return 1;
+
+    test_read();
+    test_write();
+    test_pin();
+    test_writeback();
+
+    if(failed) {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+
+    printf("all tests passed\n\n");
+
+    if(tests_only)
+        return 0;
+
+    printf("%-10s  %13s  %17s  %7s  %17s\n", "", "", "device reads", "",
+           "us per lookup");
+    printf("%-10s  %13s  %8s %8s  %7s  %8s %8s\n", "pattern", "entries",
+           "old", "new", "hits", "old", "new");
+
+    for(i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+        bench(0, counts[i], 4, lookups);
+
+    for(i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+        bench(1, counts[i], 4, lookups);
+
+    fclose(file_dev.fp);
+    return 0;
+}
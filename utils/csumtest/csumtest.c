@@ -0,0 +1,237 @@
+/* KallistiOS ##version##
+
+   csumtest.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+   Test the Internet checksum routines of the network stack (net_csum.c). The
+   file is built as is on the PC and checked against a plain 16-bit at a time
+   implementation, which is also what the throughput is compared to.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "net_csum.h"
+
+#define MAX_LEN         2048
+#define ITERATIONS      100000
+#define BENCH_LEN       1460
+#define BENCH_ROUNDS    200000
+
+/* The way net_ipv4_checksum() used to work, one 16-bit word at a time, with
+   its odd address case fixed (it used to add the first byte plus one, instead
+   of the second byte). */
+static uint16_t ref_csum(const uint8_t *data, size_t bytes, uint16_t start) {
+    uint32_t sum = start;
+    size_t i = bytes;
+
+    if(((uintptr_t)data) & 0x01) {
+        const uint8_t *ptr = data;
+
+        while(i > 1) {
+            sum += ptr[0] | (ptr[1] << 8);
+            ptr += 2;
+            i -= 2;
+
+            while(sum >> 16)
+                sum = (sum >> 16) + (sum & 0xFFFF);
+        }
+    }
+    else {
+        const uint16_t *ptr = (const uint16_t *)data;
+
+        while(i > 1) {
+            sum += *ptr++;
+            i -= 2;
+
+            while(sum >> 16)
+                sum = (sum >> 16) + (sum & 0xFFFF);
+        }
+    }
+
+    if(i)
+        sum += data[bytes - 1];
+
+    while(sum >> 16)
+        sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return sum;
+}
+
+/* One's complement sums have two zeroes. */
+static int same_sum(uint16_t a, uint16_t b) {
+    return a == b || ((a == 0 || a == 0xFFFF) && (b == 0 || b == 0xFFFF));
+}
+
+static uint8_t src[MAX_LEN + 8], dst[MAX_LEN + 16], flat[MAX_LEN];
+
+static int test_partial(void) {
+    size_t len, off, split;
+    uint16_t start, want, got;
+    int i, j;
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        len = rand() % MAX_LEN;
+        off = rand() % 8;
+        start = rand();
+
+        for(j = 0; j < (int)len; ++j)
+            src[off + j] = rand();
+
+        /* The reference only deals with little-endian, aligned data. */
+        memcpy(flat, src + off, len);
+        want = ref_csum(flat, len, start);
+        got = net_csum_partial(src + off, len, start);
+
+        if(!same_sum(want, got)) {
+            printf("partial: len %zu, offset %zu: got %04x, want %04x\n",
+                   len, off, got, want);
+            return -1;
+        }
+
+        /* Continue from a split point, swapping the second half if it starts
+           at an odd offset. */
+        split = len ? rand() % len : 0;
+        got = net_csum_partial(src + off, split, start);
+
+        if(split & 1)
+            got = net_csum_add(got, net_csum_swab(
+                net_csum_partial(src + off + split, len - split, 0)));
+        else
+            got = net_csum_partial(src + off + split, len - split, got);
+
+        if(!same_sum(want, got)) {
+            printf("partial: len %zu, offset %zu, split %zu: got %04x, "
+                   "want %04x\n", len, off, split, got, want);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int test_copy(void) {
+    size_t len, soff, doff;
+    uint16_t start, want, got;
+    int i, j;
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        len = rand() % MAX_LEN;
+        soff = rand() % 8;
+        doff = rand() % 8;
+        start = rand();
+
+        for(j = 0; j < (int)len; ++j)
+            src[soff + j] = rand();
+
+        memset(dst, 0xA5, sizeof(dst));
+
+        memcpy(flat, src + soff, len);
+        want = ref_csum(flat, len, start);
+        got = net_csum_copy(dst + 4 + doff, src + soff, len, start);
+
+        if(!same_sum(want, got)) {
+            printf("copy: len %zu, offsets %zu/%zu: got %04x, want %04x\n",
+                   len, soff, doff, got, want);
+            return -1;
+        }
+
+        if(memcmp(dst + 4 + doff, src + soff, len)) {
+            printf("copy: len %zu, offsets %zu/%zu: bad data\n", len, soff,
+                   doff);
+            return -1;
+        }
+
+        /* Make sure nothing around the destination was touched. */
+        for(j = 0; j < (int)(4 + doff); ++j) {
+            if(dst[j] != 0xA5)
+                goto overrun;
+        }
+
+        for(j = 4 + doff + len; j < (int)sizeof(dst); ++j) {
+            if(dst[j] != 0xA5)
+                goto overrun;
+        }
+    }
+
+    return 0;
+
+overrun:
+    printf("copy: len %zu, offsets %zu/%zu: wrote out of bounds\n", len, soff,
+           doff);
+    return -1;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double secs, uint16_t sum) {
+    printf("%-24s %8.1f MB/s (%04x)\n", name,
+           (double)BENCH_LEN * BENCH_ROUNDS / secs / 1e6, sum);
+}
+
+static void bench(void) {
+    static uint32_t sbuf[MAX_LEN / 4], dbuf[MAX_LEN / 4];
+    volatile uint16_t sum = 0;
+    double start;
+    int i;
+
+    for(i = 0; i < MAX_LEN / 4; ++i)
+        sbuf[i] = rand();
+
+    start = now();
+
+    for(i = 0; i < BENCH_ROUNDS; ++i)
+        sum = ref_csum((const uint8_t *)sbuf, BENCH_LEN, sum);
+
+    report("16-bit reference", now() - start, sum);
+
+    start = now();
+
+    for(i = 0; i < BENCH_ROUNDS; ++i)
+        sum = net_csum_partial(sbuf, BENCH_LEN, sum);
+
+    report("net_csum_partial", now() - start, sum);
+
+    start = now();
+
+    for(i = 0; i < BENCH_ROUNDS; ++i) {
+        memcpy(dbuf, sbuf, BENCH_LEN);
+        sum = ref_csum((const uint8_t *)dbuf, BENCH_LEN, sum);
+    }
+
+    report("memcpy + reference", now() - start, sum);
+
+    start = now();
+
+    for(i = 0; i < BENCH_ROUNDS; ++i)
+        sum = net_csum_copy(dbuf, sbuf, BENCH_LEN, sum);
+
+    report("net_csum_copy", now() - start, sum);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    srand(1);
+
+    if(test_partial() || test_copy()) {
+        printf("FAILED\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Checksums match the reference\n");
+
+    bench();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+/* KallistiOS ##version##
+
+   utils/netsim/host/arch/types.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Stands in for the Dreamcast's arch/types.h, whose 32-bit types are longs,
+   which are twice that size on most hosts. */
+
+#ifndef __ARCH_TYPES_H
+#define __ARCH_TYPES_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t uint64;
+typedef uint32_t uint32;
+typedef uint16_t uint16;
+typedef uint8_t uint8;
+typedef int64_t int64;
+typedef int32_t int32;
+typedef int16_t int16;
+typedef char int8;
+
+typedef volatile uint64 vuint64;
+typedef volatile uint32 vuint32;
+typedef volatile uint16 vuint16;
+typedef volatile uint8 vuint8;
+typedef volatile int64 vint64;
+typedef volatile int32 vint32;
+typedef volatile int16 vint16;
+typedef volatile int8 vint8;
+
+typedef uintptr_t ptr_t;
+
+typedef int handle_t;
+typedef handle_t tid_t;
+typedef handle_t prio_t;
+
+#ifndef BYTE_ORDER
+#ifndef LITTLE_ENDIAN
+#include <sys/_types.h>
+#endif
+
+#define BYTE_ORDER  LITTLE_ENDIAN
+#endif
+
+__END_DECLS
+
+#endif  /* __ARCH_TYPES_H */
@@ -0,0 +1,26 @@
+/* KallistiOS ##version##
+
+   utils/netsim/host/netsim_host.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Included ahead of everything when building KOS code for the host. The KOS
+   headers expect a few of Newlib's internal types to be around. */
+
+#ifndef __NETSIM_HOST_H
+#define __NETSIM_HOST_H
+
+#include <sys/types.h>
+#include <fcntl.h>
+
+/* KOS has its own value for this one. */
+#undef O_ASYNC
+
+typedef long long _off64_t;
+typedef long _off_t;
+typedef int _ssize_t;
+
+#include <kos/dbglog.h>
+
+#endif /* __NETSIM_HOST_H */
@@ -0,0 +1,8 @@
+/* KallistiOS ##version##
+
+   utils/netsim/host/newlib.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Nothing needed from here on the host. */
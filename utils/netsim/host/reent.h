@@ -0,0 +1,8 @@
+/* KallistiOS ##version##
+
+   utils/netsim/host/reent.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+#include <sys/reent.h>
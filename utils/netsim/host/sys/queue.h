@@ -0,0 +1,41 @@
+/* KallistiOS ##version##
+
+   utils/netsim/host/sys/queue.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* The queue.h of glibc lacks the _SAFE iterators that Newlib's has. */
+
+#include_next <sys/queue.h>
+
+#ifndef LIST_FOREACH_SAFE
+#define LIST_FOREACH_SAFE(var, head, field, tvar) \
+    for((var) = LIST_FIRST((head)); \
+        (var) && ((tvar) = LIST_NEXT((var), field), 1); (var) = (tvar))
+#endif
+
+#ifndef TAILQ_FOREACH_SAFE
+#define TAILQ_FOREACH_SAFE(var, head, field, tvar) \
+    for((var) = TAILQ_FIRST((head)); \
+        (var) && ((tvar) = TAILQ_NEXT((var), field), 1); (var) = (tvar))
+#endif
+
+#ifndef STAILQ_FOREACH_SAFE
+#define STAILQ_FOREACH_SAFE(var, head, field, tvar) \
+    for((var) = STAILQ_FIRST((head)); \
+        (var) && ((tvar) = STAILQ_NEXT((var), field), 1); (var) = (tvar))
+#endif
+
+#ifndef SLIST_FOREACH_SAFE
+#define SLIST_FOREACH_SAFE(var, head, field, tvar) \
+    for((var) = SLIST_FIRST((head)); \
+        (var) && ((tvar) = SLIST_NEXT((var), field), 1); (var) = (tvar))
+#endif
+
+#ifndef TAILQ_FOREACH_REVERSE_SAFE
+#define TAILQ_FOREACH_REVERSE_SAFE(var, head, headname, field, tvar) \
+    for((var) = TAILQ_LAST((head), headname); \
+        (var) && ((tvar) = TAILQ_PREV((var), headname, field), 1); \
+        (var) = (tvar))
+#endif
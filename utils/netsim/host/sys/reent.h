@@ -0,0 +1,25 @@
+/* KallistiOS ##version##
+
+   utils/netsim/host/sys/reent.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Just enough of Newlib's reentrancy structure for the thread headers. */
+
+#ifndef __NETSIM_SYS_REENT_H
+#define __NETSIM_SYS_REENT_H
+
+struct _reent {
+    int _errno;
+};
+
+#define _REENT_INIT_PTR(x) ((void)(x))
+
+static inline void _reclaim_reent(struct _reent *r) {
+    (void)r;
+}
+
+extern struct _reent *_impure_ptr;
+
+#endif /* __NETSIM_SYS_REENT_H */
@@ -0,0 +1,620 @@
+/* KallistiOS ##version##
+
+   utils/netsim/netsim.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Runs the network stack on the host, against itself, over a simulated link
+   with a configurable delay, loss and rate. The time it takes in the
+   simulation shows how the protocols behave; the time it takes on the host
+   shows how much work the stack does for it. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "netsim.h"
+
+#define TCP_BULK_PORT   5000
+#define TCP_RR_PORT     5001
+#define UDP_PORT        5002
+#define UDP_CLIENT_PORT 5003
+#define UDP_BATCH_PORT  5004
+
+/* Datagrams sent with each sendmmsg() in the batch test, and their size. */
+#define UDP_BATCH       16
+#define UDP_BATCH_SIZE  512
+
+/* Nothing is allowed to take longer than this, in simulated time. */
+#define TIME_LIMIT      (600 * 1000000ULL)
+
+extern int netsim_dbglog_level;
+
+static size_t bulk_size = 4 * 1024 * 1024;
+static int iterations = 100;
+static int buf_size = 0;
+static uint32_t max_rto = 0;
+
+static uint8 pattern(size_t i) {
+    return (uint8)(i * 7 + (i >> 11));
+}
+
+static void peer_addr(struct sockaddr_in *sin, int port) {
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    memcpy(&sin->sin_addr.s_addr, netsim_peer_ip, 4);
+}
+
+/* Let the simulation go on until the next event, failing if there won't be
+   one. */
+static int wait_event(uint64_t deadline) {
+    if(!netsim_step(deadline)) {
+        fprintf(stderr, "stuck at %.3f s\n", netsim_now / 1000000.0);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int set_bufs(int fd) {
+    if(!buf_size)
+        return 0;
+
+    if(ns_setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size,
+                     sizeof(buf_size)) < 0 ||
+       ns_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size,
+                     sizeof(buf_size)) < 0) {
+        perror("setsockopt");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Set up a connection from the stack to itself. */
+static int tcp_pair(int port, int *client, int *server) {
+    struct sockaddr_in sin;
+    uint64_t deadline = netsim_now + TIME_LIMIT;
+    int lfd, cfd, sfd = -1;
+
+    if((lfd = ns_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0 ||
+       (cfd = ns_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = INADDR_ANY;
+
+    if(set_bufs(lfd) < 0 || set_bufs(cfd) < 0)
+        return -1;
+
+    if(ns_bind(lfd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+       ns_listen(lfd, 1) < 0) {
+        perror("bind/listen");
+        return -1;
+    }
+
+    peer_addr(&sin, port);
+
+    if(ns_connect(cfd, (struct sockaddr *)&sin, sizeof(sin)) < 0 &&
+       errno != EINPROGRESS) {
+        perror("connect");
+        return -1;
+    }
+
+    while(sfd < 0 || !(ns_poll(cfd, POLLOUT) & POLLOUT)) {
+        if(sfd < 0 && (sfd = ns_accept(lfd, NULL, NULL)) < 0 &&
+           errno != EWOULDBLOCK && errno != EAGAIN) {
+            perror("accept");
+            return -1;
+        }
+
+        if((sfd < 0 || !(ns_poll(cfd, POLLOUT) & POLLOUT)) &&
+           wait_event(deadline) < 0)
+            return -1;
+    }
+
+    ns_close(lfd);
+    *client = cfd;
+    *server = sfd;
+    return 0;
+}
+
+static int get_info(int fd, struct tcp_info *info) {
+    socklen_t len = sizeof(*info);
+
+    return ns_getsockopt(fd, IPPROTO_TCP, TCP_INFO, info, &len);
+}
+
+static int test_tcp_bulk(void) {
+    static uint8 buf[65536];
+    uint64_t start, deadline = netsim_now + TIME_LIMIT;
+    size_t sent = 0, rcvd = 0;
+    clock_t cpu;
+    struct tcp_info info;
+    netsim_link_stats_t ls;
+    double secs;
+    int cfd, sfd, progress;
+    uint32_t rto, rto_max = 0, srtt_max = 0;
+    ssize_t rv;
+    size_t i, n;
+
+    if(tcp_pair(TCP_BULK_PORT, &cfd, &sfd) < 0)
+        return -1;
+
+    start = netsim_now;
+    ls = netsim_if_get_stats();
+    cpu = clock();
+
+    while(rcvd < bulk_size) {
+        progress = 0;
+
+        if(sent < bulk_size) {
+            n = bulk_size - sent < sizeof(buf) ? bulk_size - sent : sizeof(buf);
+
+            for(i = 0; i < n; ++i)
+                buf[i] = pattern(sent + i);
+
+            if((rv = ns_sendto(cfd, buf, n, 0, NULL, 0)) > 0) {
+                sent += rv;
+                progress = 1;
+            }
+            else if(rv < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+                perror("send");
+                return -1;
+            }
+        }
+
+        if((rv = ns_recvfrom(sfd, buf, sizeof(buf), 0, NULL, NULL)) > 0) {
+            for(i = 0; i < (size_t)rv; ++i) {
+                if(buf[i] != pattern(rcvd + i)) {
+                    fprintf(stderr, "bad data at offset %zu\n", rcvd + i);
+                    return -1;
+                }
+            }
+
+            rcvd += rv;
+            progress = 1;
+        }
+        else if(rv == 0) {
+            fprintf(stderr, "connection closed after %zu bytes\n", rcvd);
+            return -1;
+        }
+        else if(errno != EWOULDBLOCK && errno != EAGAIN) {
+            perror("recv");
+            return -1;
+        }
+
+        /* Keep track of the sender's RTT estimate and of the RTO it gives
+           (leaving out any backing off), which lost segments and
+           retransmissions mustn't throw off. */
+        if(get_info(cfd, &info) == 0) {
+            rto = info.tcpi_rto >> (info.tcpi_backoff < 31 ?
+                                    info.tcpi_backoff : 31);
+            rto_max = rto > rto_max ? rto : rto_max;
+            srtt_max = info.tcpi_rtt > srtt_max ? info.tcpi_rtt : srtt_max;
+        }
+
+        if(!progress && wait_event(deadline) < 0)
+            return -1;
+    }
+
+    cpu = clock() - cpu;
+    secs = (netsim_now - start) / 1000000.0;
+    get_info(cfd, &info);
+    n = netsim_if_get_stats().frames - ls.frames;
+
+    printf("tcp bulk:  %zu bytes in %.3f s (%.2f Mbit/s), %.3f s cpu\n",
+           rcvd, secs, secs > 0 ? rcvd * 8 / secs / 1000000.0 : 0.0,
+           (double)cpu / CLOCKS_PER_SEC);
+    printf("           %zu frames, %u segments retransmitted "
+           "(%u fast, %u timeouts)\n", n, info.tcpi_total_retrans,
+           info.tcpi_fast_retrans, info.tcpi_timeouts);
+    printf("           srtt max %.1f ms, rto max %.1f ms\n",
+           srtt_max / 1000.0, rto_max / 1000.0);
+
+    if(max_rto && rto_max > max_rto * 1000) {
+        fprintf(stderr, "rto went above %u ms\n", max_rto);
+        return -1;
+    }
+
+    ns_close(cfd);
+    ns_close(sfd);
+    netsim_run(1000000);
+
+    return 0;
+}
+
+static void report_rr(const char *name, uint64_t total, uint64_t max, int ok,
+                      int lost) {
+    printf("%s  %d round trips, avg %.1f us, max %llu us", name, ok,
+           ok ? (double)total / ok : 0.0, (unsigned long long)max);
+
+    if(lost)
+        printf(", %d lost", lost);
+
+    printf("\n");
+}
+
+static int test_udp_rr(void) {
+    struct sockaddr_in sin, from;
+    socklen_t flen;
+    uint8 req[64], rsp[64];
+    uint64_t t, total = 0, max = 0;
+    int cfd, sfd, i, ok = 0, lost = 0;
+    ssize_t rv;
+
+    if((sfd = ns_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0 ||
+       (cfd = ns_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = INADDR_ANY;
+    sin.sin_port = htons(UDP_PORT);
+
+    if(ns_bind(sfd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        perror("bind");
+        return -1;
+    }
+
+    sin.sin_port = htons(UDP_CLIENT_PORT);
+
+    if(ns_bind(cfd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        perror("bind");
+        return -1;
+    }
+
+    peer_addr(&sin, UDP_PORT);
+
+    for(i = 0; i < iterations; ++i) {
+        memset(req, i, sizeof(req));
+        t = netsim_now;
+
+        if(ns_sendto(cfd, req, sizeof(req), 0, (struct sockaddr *)&sin,
+                     sizeof(sin)) < 0) {
+            perror("sendto");
+            return -1;
+        }
+
+        /* Wait for the request to make it across and answer it, then wait
+           for the answer. Give up on it after a second. */
+        for(;;) {
+            flen = sizeof(from);
+            rv = ns_recvfrom(sfd, rsp, sizeof(rsp), 0,
+                             (struct sockaddr *)&from, &flen);
+
+            if(rv > 0)
+                ns_sendto(sfd, rsp, rv, 0, (struct sockaddr *)&from, flen);
+
+            if(ns_recvfrom(cfd, rsp, sizeof(rsp), 0, NULL, NULL) > 0 &&
+               rsp[0] == (uint8)i)
+                break;
+
+            if(!netsim_step(t + 1000000)) {
+                ++lost;
+                break;
+            }
+        }
+
+        if(netsim_now - t < 1000000) {
+            t = netsim_now - t;
+            total += t;
+            max = t > max ? t : max;
+            ++ok;
+        }
+    }
+
+    report_rr("udp rr:   ", total, max, ok, lost);
+
+    ns_close(cfd);
+    ns_close(sfd);
+    return ok ? 0 : -1;
+}
+
+/* Send bursts of datagrams with sendmmsg(), each in two pieces, and take them
+   all at once on the other end with recvmmsg(). */
+static int test_udp_batch(void) {
+    static uint8 data[UDP_BATCH][UDP_BATCH_SIZE];
+    static uint8 rbuf[UDP_BATCH][UDP_BATCH_SIZE + 4];
+    struct mmsghdr msgs[UDP_BATCH], rmsgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH][2], riov[UDP_BATCH];
+    uint32_t seq[UDP_BATCH], next = 0, got;
+    struct sockaddr_in sin;
+    uint64_t t;
+    clock_t cpu;
+    int cfd, sfd, i, j, rv, calls = 0, rcvd = 0, lost = 0;
+
+    if((sfd = ns_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0 ||
+       (cfd = ns_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = INADDR_ANY;
+    sin.sin_port = htons(UDP_BATCH_PORT);
+
+    if(ns_bind(sfd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        perror("bind");
+        return -1;
+    }
+
+    peer_addr(&sin, UDP_BATCH_PORT);
+    memset(msgs, 0, sizeof(msgs));
+    memset(rmsgs, 0, sizeof(rmsgs));
+
+    for(i = 0; i < UDP_BATCH; ++i) {
+        iov[i][0].iov_base = &seq[i];
+        iov[i][0].iov_len = sizeof(seq[i]);
+        iov[i][1].iov_base = data[i];
+        iov[i][1].iov_len = UDP_BATCH_SIZE;
+        msgs[i].msg_hdr.msg_name = &sin;
+        msgs[i].msg_hdr.msg_namelen = sizeof(sin);
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+
+        riov[i].iov_base = rbuf[i];
+        riov[i].iov_len = sizeof(rbuf[i]);
+        rmsgs[i].msg_hdr.msg_iov = &riov[i];
+        rmsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    cpu = clock();
+
+    for(i = 0; i < iterations; ++i) {
+        for(j = 0; j < UDP_BATCH; ++j) {
+            seq[j] = next + j;
+            memset(data[j], (uint8)seq[j], UDP_BATCH_SIZE);
+        }
+
+        next += UDP_BATCH;
+
+        if((rv = ns_sendmmsg(cfd, msgs, UDP_BATCH, 0)) != UDP_BATCH) {
+            perror("sendmmsg");
+            return -1;
+        }
+
+        /* Let the whole burst come in, then take what made it. */
+        t = netsim_now;
+
+        while(netsim_if_next_frame() != UINT64_MAX &&
+              netsim_step(t + 1000000))
+            ;
+
+        got = 0;
+
+        while((rv = ns_recvmmsg(sfd, rmsgs, UDP_BATCH, 0)) > 0) {
+            ++calls;
+
+            for(j = 0; j < rv; ++j) {
+                memcpy(&seq[0], rbuf[j], sizeof(seq[0]));
+
+                if(rmsgs[j].msg_len != UDP_BATCH_SIZE + 4 ||
+                   seq[0] < next - UDP_BATCH || seq[0] >= next ||
+                   rbuf[j][4] != (uint8)seq[0] ||
+                   rbuf[j][UDP_BATCH_SIZE + 3] != (uint8)seq[0]) {
+                    fprintf(stderr, "bad datagram in batch %d\n", i);
+                    return -1;
+                }
+            }
+
+            got += rv;
+        }
+
+        if(rv < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+            perror("recvmmsg");
+            return -1;
+        }
+
+        rcvd += got;
+        lost += UDP_BATCH - got;
+    }
+
+    cpu = clock() - cpu;
+
+    printf("udp batch: %d datagrams in %d calls, %.3f s cpu", rcvd, calls,
+           (double)cpu / CLOCKS_PER_SEC);
+
+    if(lost)
+        printf(", %d lost", lost);
+
+    printf("\n");
+
+    ns_close(cfd);
+    ns_close(sfd);
+    return rcvd ? 0 : -1;
+}
+
+static int test_tcp_rr(void) {
+    uint8 req[64], rsp[64];
+    uint64_t t, total = 0, max = 0, deadline = netsim_now + TIME_LIMIT;
+    int cfd, sfd, i;
+    size_t got, echoed;
+    ssize_t rv;
+
+    if(tcp_pair(TCP_RR_PORT, &cfd, &sfd) < 0)
+        return -1;
+
+    for(i = 0; i < iterations; ++i) {
+        memset(req, i, sizeof(req));
+        t = netsim_now;
+
+        if(ns_sendto(cfd, req, sizeof(req), 0, NULL, 0) != sizeof(req)) {
+            perror("send");
+            return -1;
+        }
+
+        got = echoed = 0;
+
+        while(got < sizeof(rsp)) {
+            if(echoed < sizeof(req) &&
+               (rv = ns_recvfrom(sfd, rsp, sizeof(rsp) - echoed, 0,
+                                 NULL, NULL)) > 0) {
+                ns_sendto(sfd, rsp, rv, 0, NULL, 0);
+                echoed += rv;
+                continue;
+            }
+
+            if((rv = ns_recvfrom(cfd, rsp + got, sizeof(rsp) - got, 0,
+                                 NULL, NULL)) > 0) {
+                got += rv;
+                continue;
+            }
+
+            if(wait_event(deadline) < 0)
+                return -1;
+        }
+
+        if(memcmp(req, rsp, sizeof(req))) {
+            fprintf(stderr, "bad response to request %d\n", i);
+            return -1;
+        }
+
+        t = netsim_now - t;
+        total += t;
+        max = t > max ? t : max;
+    }
+
+    report_rr("tcp rr:   ", total, max, iterations, 0);
+
+    ns_close(cfd);
+    ns_close(sfd);
+    netsim_run(1000000);
+
+    return 0;
+}
+
+static int replay(const char *fn) {
+    int count = netsim_pcap_replay(fn);
+    net_ipv4_stats_t s4;
+    net_udp_stats_t su;
+
+    if(count < 0)
+        return -1;
+
+    netsim_run(1000000);
+    s4 = net_ipv4_get_stats();
+    su = net_udp_get_stats();
+
+    printf("replayed %d frames from %s\n", count, fn);
+    printf("ipv4: %u received, %u sent, %u dropped\n", s4.pkt_recv,
+           s4.pkt_sent, s4.pkt_recv_bad_size + s4.pkt_recv_bad_chksum +
+           s4.pkt_recv_bad_proto);
+    printf("udp:  %u received, %u sent, %u dropped\n", su.pkt_recv,
+           su.pkt_sent, su.pkt_recv_bad_size + su.pkt_recv_bad_chksum +
+           su.pkt_recv_no_sock + su.pkt_recv_no_space);
+
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -d ms     one-way delay of the link (default 0.1)\n"
+            "  -l pct    frames lost, in percent (default 0)\n"
+            "  -r mbit   rate of the link in Mbit/s, 0 for unlimited "
+            "(default 10)\n"
+            "  -s seed   seed for picking the frames to lose\n"
+            "  -n bytes  size of the bulk transfer (default 4 MiB)\n"
+            "  -i count  round trips to time (default 100)\n"
+            "  -b bytes  socket buffer sizes\n"
+            "  -m ms     fail if the bulk sender's RTO goes above this\n"
+            "  -w file   write the frames sent to a pcap file\n"
+            "  -p file   feed a pcap file into the stack instead\n"
+            "  -v        print debug output from the stack\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *pcap_out = NULL, *pcap_in = NULL;
+    int c, rv = 0;
+
+    while((c = getopt(argc, argv, "d:l:r:s:n:i:b:m:w:p:v")) != -1) {
+        switch(c) {
+            case 'd':
+                netsim_link.delay = (uint64_t)(atof(optarg) * 1000);
+                break;
+            case 'l':
+                netsim_link.loss = (uint32_t)(atof(optarg) * 10000);
+                break;
+            case 'r':
+                netsim_link.rate = (uint64_t)(atof(optarg) * 1000000);
+                break;
+            case 's':
+                netsim_link.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                bulk_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 'b':
+                buf_size = atoi(optarg);
+                break;
+            case 'm':
+                max_rto = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                pcap_out = optarg;
+                break;
+            case 'p':
+                pcap_in = optarg;
+                break;
+            case 'v':
+                netsim_dbglog_level = DBG_KDEBUG;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if(netsim_if_init() < 0) {
+        fprintf(stderr, "can't bring up the network\n");
+        return 1;
+    }
+
+    if(pcap_out && netsim_pcap_open(pcap_out) < 0)
+        return 1;
+
+    if(pcap_in) {
+        rv = replay(pcap_in);
+    }
+    else {
+        printf("link: %.3f ms delay, %.4f%% loss, ", netsim_link.delay / 1000.0,
+               netsim_link.loss / 10000.0);
+
+        if(netsim_link.rate)
+            printf("%.2f Mbit/s\n", netsim_link.rate / 1000000.0);
+        else
+            printf("unlimited rate\n");
+
+        if(test_tcp_bulk() < 0 || test_udp_rr() < 0 ||
+           test_udp_batch() < 0 || test_tcp_rr() < 0)
+            rv = -1;
+    }
+
+    netsim_pcap_close();
+
+    if(rv < 0) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+/* KallistiOS ##version##
+
+   utils/netsim/netsim.h
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+#ifndef __NETSIM_H
+#define __NETSIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/socket.h>
+#include <kos/net.h>
+
+/* Everything runs on one thread, in simulated time. Sockets must be used in
+   non-blocking mode, anything that would actually block the calling thread
+   is reported as a bug in the test. */
+
+/* Current simulated time, in microseconds. */
+extern uint64_t netsim_now;
+
+/* Run the simulation until the next event (a frame arriving or a network
+   timer going off), but no further than the given time. Returns 1 if an event
+   was handled, or 0 if the time limit was reached first. */
+int netsim_step(uint64_t limit);
+
+/* Run the simulation for the given number of microseconds. */
+void netsim_run(uint64_t us);
+
+/* Time of the next event, or UINT64_MAX if there is none. */
+uint64_t netsim_next_timer(void);
+void netsim_run_timers(void);
+
+/* The simulated network device, connected to itself by one link. Whatever it
+   sends comes back in after the configured delay, unless it gets lost. */
+typedef struct netsim_link {
+    uint64_t delay;         /* One-way delay, in microseconds */
+    uint32_t loss;          /* Frames lost, per million */
+    uint64_t rate;          /* Bits per second, 0 for unlimited */
+    uint32_t seed;          /* Seed for picking the frames to lose */
+} netsim_link_t;
+
+typedef struct netsim_link_stats {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t lost;
+} netsim_link_stats_t;
+
+extern netsim_link_t netsim_link;
+extern netif_t netsim_if;
+
+/* Our own address, and the address of the other end, which is also us. */
+extern const uint8 netsim_ip[4];
+extern const uint8 netsim_peer_ip[4];
+
+int netsim_if_init(void);
+uint64_t netsim_if_next_frame(void);
+void netsim_if_deliver(void);
+netsim_link_stats_t netsim_if_get_stats(void);
+
+/* Write every frame sent to a pcap file. */
+int netsim_pcap_open(const char *fn);
+void netsim_pcap_close(void);
+
+/* Feed the frames from a pcap file into the stack, in simulated time. */
+int netsim_pcap_replay(const char *fn);
+
+/* Sockets, in place of fs_socket. File descriptors here have nothing to do
+   with those of the host. */
+int ns_socket(int domain, int type, int protocol);
+int ns_close(int fd);
+int ns_bind(int fd, const struct sockaddr *addr, socklen_t len);
+int ns_listen(int fd, int backlog);
+int ns_accept(int fd, struct sockaddr *addr, socklen_t *len);
+int ns_connect(int fd, const struct sockaddr *addr, socklen_t len);
+ssize_t ns_sendto(int fd, const void *buf, size_t len, int flags,
+                  const struct sockaddr *addr, socklen_t alen);
+ssize_t ns_recvfrom(int fd, void *buf, size_t len, int flags,
+                    struct sockaddr *addr, socklen_t *alen);
+int ns_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags);
+int ns_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags);
+int ns_setsockopt(int fd, int level, int name, const void *val,
+                  socklen_t len);
+int ns_getsockopt(int fd, int level, int name, void *val, socklen_t *len);
+short ns_poll(int fd, short events);
+
+#endif /* __NETSIM_H */
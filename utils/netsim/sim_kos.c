@@ -0,0 +1,648 @@
+/* KallistiOS ##version##
+
+   utils/netsim/sim_kos.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* The parts of the kernel that the network stack needs, for a single thread
+   running in simulated time: locks that only check that they're used right,
+   the network thread's timers, and the socket layer of fs_socket. Anything
+   that would have to wait for another thread is a bug in the test. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <kos/mutex.h>
+#include <kos/rwsem.h>
+#include <kos/cond.h>
+#include <kos/genwait.h>
+#include <kos/thread.h>
+#include <kos/fs.h>
+#include <kos/fs_socket.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+
+#include "net_thd.h"
+#include "net_dhcp.h"
+#include "netsim.h"
+
+#define MAX_SOCKETS     256
+
+uint64_t netsim_now = 0;
+int netsim_dbglog_level = DBG_WARNING;
+
+kthread_t *thd_current = NULL;
+struct _reent *_impure_ptr = NULL;
+
+static void stuck(const char *what) {
+    fprintf(stderr, "netsim: %s would block\n", what);
+    abort();
+}
+
+/* Debug output */
+void dbglog(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if(level > netsim_dbglog_level)
+        return;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+/* Time */
+uint64_t timer_ms_gettime64(void) {
+    return netsim_now / 1000;
+}
+
+uint64_t timer_us_gettime64(void) {
+    return netsim_now;
+}
+
+uint64_t timer_ns_gettime64(void) {
+    return netsim_now * 1000;
+}
+
+/* Interrupts never happen. */
+irq_mask_t irq_disable(void) {
+    return 0;
+}
+
+void irq_restore(irq_mask_t v) {
+    (void)v;
+}
+
+int irq_inside_int(void) {
+    return 0;
+}
+
+/* Threads */
+void thd_pass(void) {
+}
+
+/* Mutexes */
+int mutex_init(mutex_t *m, int mtype) {
+    memset(m, 0, sizeof(mutex_t));
+    m->type = mtype;
+    return 0;
+}
+
+int mutex_destroy(mutex_t *m) {
+    if(m->count) {
+        fprintf(stderr, "netsim: destroying a locked mutex\n");
+        abort();
+    }
+
+    return 0;
+}
+
+int mutex_trylock(mutex_t *m) {
+    if(m->count && m->type != MUTEX_TYPE_RECURSIVE) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    ++m->count;
+    return 0;
+}
+
+int mutex_lock(mutex_t *m) {
+    if(mutex_trylock(m))
+        stuck("mutex_lock()");
+
+    return 0;
+}
+
+int mutex_lock_irqsafe(mutex_t *m) {
+    return mutex_lock(m);
+}
+
+int mutex_unlock(mutex_t *m) {
+    if(!m->count) {
+        fprintf(stderr, "netsim: unlocking an unlocked mutex\n");
+        abort();
+    }
+
+    --m->count;
+    return 0;
+}
+
+/* Reader/writer semaphores */
+int rwsem_read_trylock(rw_semaphore_t *s) {
+    if(s->write_lock) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    ++s->read_count;
+    return 0;
+}
+
+int rwsem_read_lock(rw_semaphore_t *s) {
+    if(rwsem_read_trylock(s))
+        stuck("rwsem_read_lock()");
+
+    return 0;
+}
+
+int rwsem_read_lock_irqsafe(rw_semaphore_t *s) {
+    return rwsem_read_lock(s);
+}
+
+int rwsem_read_unlock(rw_semaphore_t *s) {
+    if(!s->read_count) {
+        fprintf(stderr, "netsim: unlocking an unlocked rwsem\n");
+        abort();
+    }
+
+    --s->read_count;
+    return 0;
+}
+
+int rwsem_write_trylock(rw_semaphore_t *s) {
+    if(s->write_lock || s->read_count) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    /* Anything will do, as long as it isn't NULL. */
+    s->write_lock = (kthread_t *)s;
+    return 0;
+}
+
+int rwsem_write_lock(rw_semaphore_t *s) {
+    if(rwsem_write_trylock(s))
+        stuck("rwsem_write_lock()");
+
+    return 0;
+}
+
+int rwsem_write_lock_irqsafe(rw_semaphore_t *s) {
+    return rwsem_write_lock(s);
+}
+
+int rwsem_write_unlock(rw_semaphore_t *s) {
+    if(!s->write_lock) {
+        fprintf(stderr, "netsim: unlocking an unlocked rwsem\n");
+        abort();
+    }
+
+    s->write_lock = NULL;
+    return 0;
+}
+
+/* Condition variables and genwait: signals go nowhere, waiting is a bug. */
+int cond_init(condvar_t *cv) {
+    memset(cv, 0, sizeof(condvar_t));
+    return 0;
+}
+
+int cond_destroy(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int cond_wait(condvar_t *cv, mutex_t *m) {
+    (void)cv;
+    (void)m;
+    stuck("cond_wait()");
+    return -1;
+}
+
+int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
+    (void)timeout;
+    return cond_wait(cv, m);
+}
+
+int cond_signal(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int cond_broadcast(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int genwait_wait(void *obj, const char *mesg, int timeout,
+                 void (*callback)(void *)) {
+    (void)obj;
+    (void)timeout;
+    (void)callback;
+    stuck(mesg);
+    return -1;
+}
+
+void genwait_wake_all(void *obj) {
+    (void)obj;
+}
+
+void genwait_wake_one(void *obj) {
+    (void)obj;
+}
+
+/* Polling isn't used, sockets are checked with ns_poll(). */
+void __poll_event_trigger(int fd, short event) {
+    (void)fd;
+    (void)event;
+}
+
+/* Network timers, in place of net_thd.c. They run from netsim_step(), which
+   stands in for the network thread. */
+static struct net_timer_queue timers = TAILQ_HEAD_INITIALIZER(timers);
+
+struct thd_cb {
+    net_timer_t timer;
+    void (*cb)(void *);
+    void *data;
+    uint64 period;
+    int id;
+    struct thd_cb *next;
+};
+
+static struct thd_cb *cbs = NULL;
+static int cb_id = 0;
+
+void net_timer_init(net_timer_t *t, void (*cb)(void *), void *data) {
+    t->cb = cb;
+    t->data = data;
+    t->queued = 0;
+    t->expires = 0;
+}
+
+void net_timer_cancel(net_timer_t *t) {
+    if(t->queued) {
+        TAILQ_REMOVE(&timers, t, entry);
+        t->queued = 0;
+    }
+}
+
+void net_timer_set(net_timer_t *t, uint64 expires) {
+    net_timer_t *i;
+
+    net_timer_cancel(t);
+    t->expires = expires;
+
+    TAILQ_FOREACH_REVERSE(i, &timers, net_timer_queue, entry) {
+        if(i->expires <= expires)
+            break;
+    }
+
+    if(i)
+        TAILQ_INSERT_AFTER(&timers, i, t, entry);
+    else
+        TAILQ_INSERT_HEAD(&timers, t, entry);
+
+    t->queued = 1;
+}
+
+void net_timer_set_earliest(net_timer_t *t, uint64 expires) {
+    if(!t->queued || expires < t->expires)
+        net_timer_set(t, expires);
+}
+
+int net_timer_pending(const net_timer_t *t) {
+    return t->queued;
+}
+
+uint64_t netsim_next_timer(void) {
+    net_timer_t *t = TAILQ_FIRST(&timers);
+
+    return t ? t->expires * 1000 : UINT64_MAX;
+}
+
+void netsim_run_timers(void) {
+    net_timer_t *t;
+
+    while((t = TAILQ_FIRST(&timers)) && t->expires * 1000 <= netsim_now) {
+        net_timer_cancel(t);
+        t->cb(t->data);
+    }
+}
+
+static void thd_cb_run(void *data) {
+    struct thd_cb *cb = (struct thd_cb *)data;
+
+    net_timer_set(&cb->timer, timer_ms_gettime64() + cb->period);
+    cb->cb(cb->data);
+}
+
+int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout) {
+    struct thd_cb *c;
+
+    if(!(c = (struct thd_cb *)malloc(sizeof(struct thd_cb))))
+        return -1;
+
+    c->cb = cb;
+    c->data = data;
+    c->period = timeout;
+    c->id = cb_id++;
+    c->next = cbs;
+    cbs = c;
+
+    net_timer_init(&c->timer, thd_cb_run, c);
+    net_timer_set(&c->timer, timer_ms_gettime64() + timeout);
+
+    return c->id;
+}
+
+int net_thd_del_callback(int cbid) {
+    struct thd_cb **i, *c;
+
+    for(i = &cbs; *i; i = &(*i)->next) {
+        if((*i)->id == cbid) {
+            c = *i;
+            *i = c->next;
+            net_timer_cancel(&c->timer);
+            free(c);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int net_thd_is_current(void) {
+    return 0;
+}
+
+void net_thd_kill(void) {
+}
+
+int net_thd_init(void) {
+    return 0;
+}
+
+void net_thd_shutdown(void) {
+}
+
+/* There's nobody to ask for an address. */
+int net_dhcp_init(void) {
+    return 0;
+}
+
+void net_dhcp_shutdown(void) {
+}
+
+int net_dhcp_request(uint32 required_address) {
+    (void)required_address;
+    errno = ENETUNREACH;
+    return -1;
+}
+
+/* The socket layer, in place of fs_socket.c. */
+static TAILQ_HEAD(, fs_socket_proto) protocols =
+    TAILQ_HEAD_INITIALIZER(protocols);
+static net_socket_t *sockets[MAX_SOCKETS];
+
+int fs_socket_init(void) {
+    return 0;
+}
+
+int fs_socket_shutdown(void) {
+    return 0;
+}
+
+int fs_socket_proto_add(fs_socket_proto_t *proto) {
+    TAILQ_INSERT_TAIL(&protocols, proto, entry);
+    return 0;
+}
+
+int fs_socket_proto_remove(fs_socket_proto_t *proto) {
+    TAILQ_REMOVE(&protocols, proto, entry);
+    return 0;
+}
+
+int fs_socket_input(netif_t *src, int domain, int protocol, const void *hdr,
+                    const uint8 *data, size_t size) {
+    fs_socket_proto_t *i;
+
+    TAILQ_FOREACH(i, &protocols, entry) {
+        if(i->protocol == protocol)
+            return i->input(src, domain, hdr, data, size);
+    }
+
+    return -2;
+}
+
+net_socket_t *fs_socket_open_sock(fs_socket_proto_t *proto) {
+    net_socket_t *sock;
+    int fd;
+
+    for(fd = 0; fd < MAX_SOCKETS; ++fd) {
+        if(!sockets[fd])
+            break;
+    }
+
+    if(fd == MAX_SOCKETS) {
+        errno = EMFILE;
+        return NULL;
+    }
+
+    if(!(sock = (net_socket_t *)calloc(1, sizeof(net_socket_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sock->fd = fd;
+    sock->protocol = proto;
+    sockets[fd] = sock;
+
+    return sock;
+}
+
+static net_socket_t *get_sock(int fd) {
+    if(fd < 0 || fd >= MAX_SOCKETS || !sockets[fd]) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    return sockets[fd];
+}
+
+int fs_close(file_t fd) {
+    net_socket_t *sock;
+
+    if(!(sock = get_sock(fd)))
+        return -1;
+
+    sockets[fd] = NULL;
+
+    if(sock->protocol)
+        sock->protocol->close(sock);
+
+    free(sock);
+    return 0;
+}
+
+/* Only net_tcp_shutdown() uses this, see the Makefile. */
+int netsim_close(int fd) {
+    return fs_close(fd);
+}
+
+static int sock_fcntl(net_socket_t *sock, int cmd, ...) {
+    va_list ap;
+    int rv;
+
+    va_start(ap, cmd);
+    rv = sock->protocol->fcntl(sock, cmd, ap);
+    va_end(ap);
+
+    return rv;
+}
+
+int ns_socket(int domain, int type, int protocol) {
+    fs_socket_proto_t *i;
+    net_socket_t *sock;
+
+    TAILQ_FOREACH(i, &protocols, entry) {
+        if(type == i->type && (protocol == i->protocol || protocol == 0))
+            break;
+    }
+
+    if(!i) {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+
+    if(!(sock = fs_socket_open_sock(i)))
+        return -1;
+
+    sock->protocol = NULL;
+
+    if(i->socket(sock, domain, type, protocol) == -1) {
+        fs_close(sock->fd);
+        return -1;
+    }
+
+    sock->protocol = i;
+
+    /* Nothing can wait for anything here. */
+    if(sock_fcntl(sock, F_SETFL, O_NONBLOCK) == -1) {
+        fs_close(sock->fd);
+        return -1;
+    }
+
+    return sock->fd;
+}
+
+int ns_close(int fd) {
+    return fs_close(fd);
+}
+
+int ns_bind(int fd, const struct sockaddr *addr, socklen_t len) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->bind(sock, addr, len) : -1;
+}
+
+int ns_listen(int fd, int backlog) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->listen(sock, backlog) : -1;
+}
+
+int ns_accept(int fd, struct sockaddr *addr, socklen_t *len) {
+    net_socket_t *sock = get_sock(fd);
+    int rv;
+
+    if(!sock || (rv = sock->protocol->accept(sock, addr, len)) < 0)
+        return -1;
+
+    if(sock_fcntl(sockets[rv], F_SETFL, O_NONBLOCK) == -1) {
+        fs_close(rv);
+        return -1;
+    }
+
+    return rv;
+}
+
+int ns_connect(int fd, const struct sockaddr *addr, socklen_t len) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->connect(sock, addr, len) : -1;
+}
+
+ssize_t ns_sendto(int fd, const void *buf, size_t len, int flags,
+                  const struct sockaddr *addr, socklen_t alen) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->sendto(sock, buf, len, flags, addr, alen) :
+           -1;
+}
+
+ssize_t ns_recvfrom(int fd, void *buf, size_t len, int flags,
+                    struct sockaddr *addr, socklen_t *alen) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->recvfrom(sock, buf, len, flags, addr, alen) :
+           -1;
+}
+
+int ns_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->recvmmsg(sock, msgs, vlen, flags, NULL) : -1;
+}
+
+int ns_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->sendmmsg(sock, msgs, vlen, flags) : -1;
+}
+
+int ns_setsockopt(int fd, int level, int name, const void *val,
+                  socklen_t len) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->setsockopt(sock, level, name, val, len) : -1;
+}
+
+int ns_getsockopt(int fd, int level, int name, void *val, socklen_t *len) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->getsockopt(sock, level, name, val, len) : -1;
+}
+
+short ns_poll(int fd, short events) {
+    net_socket_t *sock = get_sock(fd);
+
+    return sock ? sock->protocol->poll(sock, events) : POLLNVAL;
+}
+
+/* The simulation itself */
+int netsim_step(uint64_t limit) {
+    uint64_t frame = netsim_if_next_frame();
+    uint64_t timer = netsim_next_timer();
+    uint64_t next = frame < timer ? frame : timer;
+
+    if(next > limit) {
+        if(limit > netsim_now)
+            netsim_now = limit;
+
+        return 0;
+    }
+
+    if(next > netsim_now)
+        netsim_now = next;
+
+    if(frame <= timer)
+        netsim_if_deliver();
+    else
+        netsim_run_timers();
+
+    return 1;
+}
+
+void netsim_run(uint64_t us) {
+    uint64_t end = netsim_now + us;
+
+    while(netsim_step(end)) ;
+}
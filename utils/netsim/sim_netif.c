@@ -0,0 +1,362 @@
+/* KallistiOS ##version##
+
+   utils/netsim/sim_netif.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* The simulated network device, and the link it sends over. The link goes
+   straight back into the same device, so both ends of every connection are
+   run by the one stack. The other end has an address of its own, which the
+   link answers ARP requests for itself, but frames to it come back to us just
+   like any other. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include <kos/net.h>
+
+#include "netsim.h"
+
+typedef struct frame {
+    TAILQ_ENTRY(frame) list;
+    uint64_t arrival;
+    int len;
+    uint8 data[];
+} frame_t;
+
+static TAILQ_HEAD(frame_queue, frame) wire = TAILQ_HEAD_INITIALIZER(wire);
+
+/* By default, about what the broadband adapter gets on a LAN. */
+netsim_link_t netsim_link = { 100, 0, 10000000, 1 };
+static netsim_link_stats_t stats;
+static uint64_t link_free;
+static uint32_t rng;
+
+static FILE *pcap;
+
+/* Set while replaying a capture, what the stack sends back goes nowhere. */
+static int sink;
+
+const uint8 netsim_ip[4] = { 10, 0, 0, 1 };
+const uint8 netsim_peer_ip[4] = { 10, 0, 0, 2 };
+
+/* pcap file format */
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_SWAP     0xd4c3b2a1
+#define PCAP_MAGIC_NS       0xa1b23c4d
+#define PCAP_MAGIC_NS_SWAP  0x4d3cb2a1
+#define PCAP_LINKTYPE_ETH   1
+
+typedef struct pcap_hdr {
+    uint32_t magic;
+    uint16_t major, minor;
+    int32_t zone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_hdr_t;
+
+typedef struct pcap_rec {
+    uint32_t sec, usec;
+    uint32_t incl_len, orig_len;
+} pcap_rec_t;
+
+static void pcap_write(const uint8 *data, int len) {
+    pcap_rec_t rec;
+
+    rec.sec = (uint32_t)(netsim_now / 1000000);
+    rec.usec = (uint32_t)(netsim_now % 1000000);
+    rec.incl_len = rec.orig_len = len;
+
+    fwrite(&rec, sizeof(rec), 1, pcap);
+    fwrite(data, 1, len, pcap);
+}
+
+int netsim_pcap_open(const char *fn) {
+    pcap_hdr_t hdr = { PCAP_MAGIC, 2, 4, 0, 0, 65535, PCAP_LINKTYPE_ETH };
+
+    if(!(pcap = fopen(fn, "wb"))) {
+        perror(fn);
+        return -1;
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, pcap);
+    return 0;
+}
+
+void netsim_pcap_close(void) {
+    if(pcap) {
+        fclose(pcap);
+        pcap = NULL;
+    }
+}
+
+/* The link */
+static uint32_t rand_next(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* Put a frame on the wire, to come out at the given time. Frames mostly come
+   in order, so look for the spot from the back. */
+static void wire_put(const uint8 *data, int len, uint64_t arrival) {
+    frame_t *f = malloc(sizeof(frame_t) + len);
+    frame_t *prev;
+
+    if(!f) {
+        ++stats.lost;
+        return;
+    }
+
+    f->arrival = arrival;
+    f->len = len;
+    memcpy(f->data, data, len);
+
+    TAILQ_FOREACH_REVERSE(prev, &wire, frame_queue, list) {
+        if(prev->arrival <= arrival)
+            break;
+    }
+
+    if(prev)
+        TAILQ_INSERT_AFTER(&wire, prev, f, list);
+    else
+        TAILQ_INSERT_HEAD(&wire, f, list);
+}
+
+/* Answer an ARP request for the other end, with our own MAC address. */
+static int arp_answer(const uint8 *data, int len) {
+    uint8 reply[42];
+
+    if(len < 42 || data[12] != 0x08 || data[13] != 0x06 || data[21] != 1 ||
+       memcmp(data + 38, netsim_peer_ip, 4))
+        return 0;
+
+    memcpy(reply, data, 42);
+    memcpy(reply + 0, data + 6, 6);
+    memcpy(reply + 6, netsim_if.mac_addr, 6);
+    reply[21] = 2;
+    memcpy(reply + 22, netsim_if.mac_addr, 6);
+    memcpy(reply + 28, netsim_peer_ip, 4);
+    memcpy(reply + 32, data + 22, 10);
+
+    wire_put(reply, sizeof(reply), netsim_now + netsim_link.delay);
+    return 1;
+}
+
+static int sim_tx(netif_t *self, const uint8 *data, int len, int blocking) {
+    uint64_t start;
+
+    (void)self;
+    (void)blocking;
+
+    ++stats.frames;
+    stats.bytes += len;
+
+    if(pcap)
+        pcap_write(data, len);
+
+    if(sink || arp_answer(data, len))
+        return NETIF_TX_OK;
+
+    /* The frame takes up the link for as long as it takes to send, whether
+       it makes it or not. */
+    start = link_free > netsim_now ? link_free : netsim_now;
+
+    if(netsim_link.rate)
+        link_free = start + (uint64_t)len * 8 * 1000000 / netsim_link.rate;
+    else
+        link_free = start;
+
+    if(netsim_link.loss && rand_next() % 1000000 < netsim_link.loss) {
+        ++stats.lost;
+        return NETIF_TX_OK;
+    }
+
+    wire_put(data, len, link_free + netsim_link.delay);
+    return NETIF_TX_OK;
+}
+
+static int sim_tx_pbuf(netif_t *self, const net_pbuf_t *p, int blocking) {
+    size_t len = net_pbuf_chain_len(p);
+    uint8 buf[len];
+
+    net_pbuf_copy(p, buf, len);
+    return sim_tx(self, buf, (int)len, blocking);
+}
+
+static int sim_detect(netif_t *self) {
+    self->flags |= NETIF_DETECTED;
+    return 0;
+}
+
+static int sim_init(netif_t *self) {
+    self->flags |= NETIF_INITIALIZED;
+    return 0;
+}
+
+static int sim_shutdown(netif_t *self) {
+    self->flags &= ~(NETIF_DETECTED | NETIF_INITIALIZED);
+    return 0;
+}
+
+static int sim_start(netif_t *self) {
+    self->flags |= NETIF_RUNNING;
+    return 0;
+}
+
+static int sim_stop(netif_t *self) {
+    self->flags &= ~NETIF_RUNNING;
+    return 0;
+}
+
+static int sim_tx_commit(netif_t *self) {
+    (void)self;
+    return 0;
+}
+
+static int sim_rx_poll(netif_t *self) {
+    (void)self;
+    return 0;
+}
+
+static int sim_set_flags(netif_t *self, uint32 flags_and, uint32 flags_or) {
+    self->flags = (self->flags & flags_and) | flags_or;
+    return 0;
+}
+
+static int sim_set_mc(netif_t *self, const uint8 *list, int count) {
+    (void)self;
+    (void)list;
+    (void)count;
+    return 0;
+}
+
+netif_t netsim_if = {
+    .name = "sim",
+    .descr = "Simulated network device",
+    .flags = NETIF_NO_FLAGS,
+    .mac_addr = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .ip_addr = { 10, 0, 0, 1 },
+    .netmask = { 255, 255, 255, 0 },
+    .gateway = { 10, 0, 0, 254 },
+    .broadcast = { 10, 0, 0, 255 },
+    .mtu = 1500,
+    .mtu6 = 1500,
+    .hop_limit = 64,
+    .if_detect = sim_detect,
+    .if_init = sim_init,
+    .if_shutdown = sim_shutdown,
+    .if_start = sim_start,
+    .if_stop = sim_stop,
+    .if_tx = sim_tx,
+    .if_tx_commit = sim_tx_commit,
+    .if_rx_poll = sim_rx_poll,
+    .if_set_flags = sim_set_flags,
+    .if_set_mc = sim_set_mc,
+    .if_tx_pbuf = sim_tx_pbuf
+};
+
+int netsim_if_init(void) {
+    rng = netsim_link.seed ? netsim_link.seed : 1;
+
+    if(net_reg_device(&netsim_if) < 0)
+        return -1;
+
+    return net_init(0);
+}
+
+uint64_t netsim_if_next_frame(void) {
+    frame_t *f = TAILQ_FIRST(&wire);
+
+    return f ? f->arrival : UINT64_MAX;
+}
+
+void netsim_if_deliver(void) {
+    frame_t *f = TAILQ_FIRST(&wire);
+
+    if(!f)
+        return;
+
+    /* Take it off first, the stack will probably send something back. */
+    TAILQ_REMOVE(&wire, f, list);
+    net_input(&netsim_if, f->data, f->len);
+    free(f);
+}
+
+netsim_link_stats_t netsim_if_get_stats(void) {
+    return stats;
+}
+
+/* Replaying a capture */
+static uint32_t swap32(uint32_t v, int swap) {
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+int netsim_pcap_replay(const char *fn) {
+    FILE *fp;
+    pcap_hdr_t hdr;
+    pcap_rec_t rec;
+    uint8 *buf = NULL;
+    uint64_t start = netsim_now, ts, first = UINT64_MAX;
+    int swap, ns, count = 0;
+
+    if(!(fp = fopen(fn, "rb"))) {
+        perror(fn);
+        return -1;
+    }
+
+    if(fread(&hdr, sizeof(hdr), 1, fp) != 1)
+        goto bad;
+
+    swap = hdr.magic == PCAP_MAGIC_SWAP || hdr.magic == PCAP_MAGIC_NS_SWAP;
+    ns = hdr.magic == PCAP_MAGIC_NS || hdr.magic == PCAP_MAGIC_NS_SWAP;
+
+    if(!swap && !ns && hdr.magic != PCAP_MAGIC)
+        goto bad;
+
+    if(swap32(hdr.linktype, swap) != PCAP_LINKTYPE_ETH) {
+        fprintf(stderr, "%s: not an ethernet capture\n", fn);
+        fclose(fp);
+        return -1;
+    }
+
+    if(!(buf = malloc(65536)))
+        goto bad;
+
+    sink = 1;
+
+    while(fread(&rec, sizeof(rec), 1, fp) == 1) {
+        uint32_t len = swap32(rec.incl_len, swap);
+
+        if(len > 65536 || fread(buf, 1, len, fp) != len)
+            goto bad;
+
+        /* Keep the spacing of the capture, starting from now. */
+        ts = (uint64_t)swap32(rec.sec, swap) * 1000000 +
+             swap32(rec.usec, swap) / (ns ? 1000 : 1);
+
+        if(first == UINT64_MAX)
+            first = ts;
+
+        if(ts >= first && start + (ts - first) > netsim_now)
+            netsim_run(start + (ts - first) - netsim_now);
+
+        net_input(&netsim_if, buf, (int)len);
+        ++count;
+    }
+
+    free(buf);
+    fclose(fp);
+    return count;
+
+bad:
+    fprintf(stderr, "%s: not a valid capture file\n", fn);
+    free(buf);
+    fclose(fp);
+    return -1;
+}
@@ -0,0 +1,333 @@
+/* KallistiOS ##version##
+
+   utils/romdisk_bench/romdisk_bench.c
+   Copyright (C) 2024 The KOS Team and contributors
+
+*/
+
+/* Builds a romdisk image of a synthetic asset tree with genromfs, mounts it
+   with the real romdisk code, checks that every file and directory can be
+   found (in either case, and only as what it is), and then times stat() and
+   open()/close() on all of them. Built once with the path index and once
+   without, to compare the two.
+
+   Usage: romdisk_bench [-t] [-n files] [-r rounds] [-g genromfs]
+
+   With -t, only the tests are run. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <kos/fs.h>
+#include <kos/fs_romdisk.h>
+#include <kos/mutex.h>
+#include <kos/nmmgr.h>
+
+#define DIRS        30
+#define SUBDIRS     5
+
+/* The bits of the kernel that the romdisk code uses. There's one thread, so
+   the mutexes don't need to do anything. */
+static vfs_handler_t *vfsh;
+
+void dbglog(int level, const char *fmt, ...) {
+    (void)level;
+    (void)fmt;
+}
+
+int mutex_init(mutex_t *m, int mtype) {
+    (void)m;
+    (void)mtype;
+    return 0;
+}
+
+int mutex_destroy(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int mutex_lock(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int mutex_unlock(mutex_t *m) {
+    (void)m;
+    return 0;
+}
+
+int nmmgr_handler_add(nmmgr_handler_t *hnd) {
+    vfsh = (vfs_handler_t *)hnd;
+    return 0;
+}
+
+int nmmgr_handler_remove(nmmgr_handler_t *hnd) {
+    (void)hnd;
+    vfsh = NULL;
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static char tmpdir[] = "/tmp/romdisk_benchXXXXXX";
+static char **paths;
+static int nfiles;
+
+/* File i goes in one of DIRS * SUBDIRS directories, except for a few at the
+   top, and holds i % 64 bytes. */
+static void make_path(char *buf, size_t len, int i) {
+    if(i % 100 == 0)
+        snprintf(buf, len, "/top_%05d.bin", i);
+    else
+        snprintf(buf, len, "/dir%02d/sub%d/asset_%05d.bin", i % DIRS,
+                 (i / DIRS) % SUBDIRS, i);
+}
+
+static int make_tree(void) {
+    char path[256];
+    FILE *fp;
+    int i, j;
+
+    for(i = 0; i < DIRS; i++) {
+        snprintf(path, sizeof(path), "%s/tree/dir%02d", tmpdir, i);
+
+        if(mkdir(path, 0755) && errno != EEXIST)
+            return -1;
+
+        for(j = 0; j < SUBDIRS; j++) {
+            snprintf(path, sizeof(path), "%s/tree/dir%02d/sub%d", tmpdir, i, j);
+
+            if(mkdir(path, 0755))
+                return -1;
+        }
+    }
+
+    if(!(paths = (char **)calloc(nfiles, sizeof(char *))))
+        return -1;
+
+    for(i = 0; i < nfiles; i++) {
+        make_path(path, sizeof(path), i);
+        paths[i] = strdup(path);
+
+        snprintf(path, sizeof(path), "%s/tree%s", tmpdir, paths[i]);
+
+        if(!(fp = fopen(path, "wb")))
+            return -1;
+
+        for(j = 0; j < i % 64; j++)
+            fputc(j, fp);
+
+        fclose(fp);
+    }
+
+    return 0;
+}
+
+static uint8 *make_image(const char *genromfs) {
+    char cmd[512], path[256];
+    uint8 *img;
+    FILE *fp;
+    long len;
+
+    snprintf(path, sizeof(path), "%s/tree", tmpdir);
+
+    if(mkdir(path, 0755) || make_tree())
+        return NULL;
+
+    snprintf(cmd, sizeof(cmd), "%s -f %s/romdisk.img -d %s/tree -V bench",
+             genromfs, tmpdir, tmpdir);
+
+    if(system(cmd))
+        return NULL;
+
+    snprintf(path, sizeof(path), "%s/romdisk.img", tmpdir);
+
+    if(!(fp = fopen(path, "rb")))
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if(!(img = (uint8 *)malloc(len)) || fread(img, 1, len, fp) != (size_t)len) {
+        free(img);
+        img = NULL;
+    }
+
+    fclose(fp);
+    return img;
+}
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+        if(!(cond)) { \
+            printf("FAIL: " __VA_ARGS__); \
+            printf("\n"); \
+            ++failures; \
+        } \
+    } while(0)
+
+static void run_tests(void) {
+    char path[256], upper[256];
+    struct stat st;
+    void *h;
+    size_t i, len;
+    int j;
+
+    for(j = 0; j < nfiles; j++) {
+        CHECK(!vfsh->stat(vfsh, paths[j], &st, 0) && S_ISREG(st.st_mode) &&
+              st.st_size == j % 64, "stat %s", paths[j]);
+
+        h = vfsh->open(vfsh, paths[j], O_RDONLY);
+        CHECK(h && vfsh->total(h) == (size_t)(j % 64), "open %s", paths[j]);
+
+        if(h)
+            vfsh->close(h);
+
+        /* Lookups don't care about case. */
+        len = strlen(paths[j]);
+
+        for(i = 0; i <= len; i++)
+            upper[i] = toupper((unsigned char)paths[j][i]);
+
+        h = vfsh->open(vfsh, upper, O_RDONLY);
+        CHECK(h, "open %s", upper);
+
+        if(h)
+            vfsh->close(h);
+
+        /* Files aren't directories. */
+        CHECK(!vfsh->open(vfsh, paths[j], O_RDONLY | O_DIR),
+              "open %s as a directory", paths[j]);
+    }
+
+    for(j = 0; j < DIRS; j++) {
+        snprintf(path, sizeof(path), "/dir%02d", j);
+        CHECK(!vfsh->stat(vfsh, path, &st, 0) && S_ISDIR(st.st_mode),
+              "stat %s", path);
+        CHECK(!vfsh->open(vfsh, path, O_RDONLY), "open %s as a file", path);
+
+        snprintf(path, sizeof(path), "/dir%02d/sub%d/", j, SUBDIRS - 1);
+        h = vfsh->open(vfsh, path, O_RDONLY | O_DIR);
+        CHECK(h, "open %s", path);
+
+        if(h)
+            vfsh->close(h);
+    }
+
+    CHECK(vfsh->stat(vfsh, "/dir00/sub0/nope.bin", &st, 0) && errno == ENOENT,
+          "stat of a missing file");
+    CHECK(!vfsh->open(vfsh, "/nope/asset_00001.bin", O_RDONLY),
+          "open in a missing directory");
+    CHECK(!vfsh->open(vfsh, "/dir00/sub0/asset_0000", O_RDONLY),
+          "open of a prefix of a name");
+    CHECK(!vfsh->open(vfsh, "/dir01/sub0/asset_00000.bin", O_RDONLY),
+          "open of a file in the wrong directory");
+}
+
+static void run_bench(int rounds) {
+    struct stat st;
+    uint64_t begin, t_stat, t_open;
+    void *h;
+    int r, j;
+
+    begin = now_ns();
+
+    for(r = 0; r < rounds; r++)
+        for(j = 0; j < nfiles; j++)
+            vfsh->stat(vfsh, paths[j], &st, 0);
+
+    t_stat = now_ns() - begin;
+    begin = now_ns();
+
+    for(r = 0; r < rounds; r++) {
+        for(j = 0; j < nfiles; j++) {
+            if((h = vfsh->open(vfsh, paths[j], O_RDONLY)))
+                vfsh->close(h);
+        }
+    }
+
+    t_open = now_ns() - begin;
+
+    printf("%s: %d files, %.0f ns per stat(), %.0f ns per open()+close()\n",
+           FS_ROMDISK_INDEX_MAX ? "index " : "linear", nfiles,
+           (double)t_stat / rounds / nfiles, (double)t_open / rounds / nfiles);
+}
+
+int main(int argc, char *argv[]) {
+    const char *genromfs = "../genromfs/genromfs";
+    int opt, rounds = 20, tests_only = 0;
+    char cmd[64];
+    uint8 *img;
+
+    nfiles = 3000;
+
+    while((opt = getopt(argc, argv, "tn:r:g:")) != -1) {
+        switch(opt) {
+            case 't':
+                tests_only = 1;
+                break;
+            case 'n':
+                nfiles = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 'g':
+                genromfs = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t] [-n files] [-r rounds] "
+                        "[-g genromfs]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    img = make_image(genromfs);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", tmpdir);
+    system(cmd);
+
+    if(!img) {
+        fprintf(stderr, "Couldn't make the romdisk image\n");
+        return 1;
+    }
+
+    fs_romdisk_init();
+
+    if(fs_romdisk_mount("/rd", img, 1) || !vfsh) {
+        fprintf(stderr, "Couldn't mount the romdisk image\n");
+        return 1;
+    }
+
+    run_tests();
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    if(!tests_only)
+        run_bench(rounds);
+
+    fs_romdisk_unmount("/rd");
+    fs_romdisk_shutdown();
+
+    return 0;
+}